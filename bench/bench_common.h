@@ -0,0 +1,155 @@
+/**
+ * bench_common.h - 基准工具共用: 可复现的随机数、Zipf 采样、参数与 JSON 输出
+ *
+ * 同一 seed 在任何机器上生成相同的数据，便于在不同版本之间对比。
+ */
+
+#ifndef CONVERTSERVER_BENCH_COMMON_H
+#define CONVERTSERVER_BENCH_COMMON_H
+
+#include <stdint.h>
+#include <cmath>
+#include <cstdio>
+#include <chrono>
+#include <cstdlib>
+#include <string>
+
+// splitmix64: 快速、可复现，足以生成测试数据
+class BenchRng {
+private:
+    uint64_t state;
+
+public:
+    explicit BenchRng(uint64_t seed) : state(seed) {}
+
+    uint64_t next() {
+        uint64_t z = (state += 0x9E3779B97F4A7C15ull);
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+        return z ^ (z >> 31);
+    }
+
+    // [0, n)
+    uint64_t below(uint64_t n) { return n == 0 ? 0 : next() % n; }
+
+    // [0, 1)
+    double unit() { return (double)(next() >> 11) * (1.0 / 9007199254740992.0); }
+};
+
+// 秩 1..n 上指数为 s 的 Zipf 分布 (s = 0 为均匀分布)。
+// 拒绝-反演采样 (Hörmann & Derflinger)，不需要 O(n) 的累积表，n 可达 2^32
+class ZipfSampler {
+private:
+    uint64_t n;
+    double s;
+    double hIntegralX1;
+    double hIntegralN;
+    double threshold;
+
+    static double helper1(double x) { return std::fabs(x) > 1e-8 ? std::log1p(x) / x : 1 - x / 2; }
+    static double helper2(double x) { return std::fabs(x) > 1e-8 ? std::expm1(x) / x : 1 + x / 2; }
+
+    double h(double x) const { return std::exp(-s * std::log(x)); }
+
+    double hIntegral(double x) const {
+        double logX = std::log(x);
+        return helper2((1 - s) * logX) * logX;
+    }
+
+    double hIntegralInverse(double x) const {
+        double t = x * (1 - s);
+        if (t < -1) t = -1;
+        return std::exp(helper1(t) * x);
+    }
+
+public:
+    ZipfSampler(uint64_t n, double s) : n(n < 1 ? 1 : n), s(s) {
+        hIntegralX1 = hIntegral(1.5) - 1;
+        hIntegralN = hIntegral((double)this->n + 0.5);
+        threshold = 2 - hIntegralInverse(hIntegral(2.5) - h(2));
+    }
+
+    // 返回 0..n-1 (秩减 1)
+    uint64_t sample(BenchRng& rng) const {
+        if (s <= 0) return rng.below(n);
+        for (;;) {
+            double u = hIntegralN + rng.unit() * (hIntegralX1 - hIntegralN);
+            double x = hIntegralInverse(u);
+            uint64_t k = (uint64_t)(x + 0.5);
+            if (k < 1) k = 1;
+            if (k > n) k = n;
+            if ((double)k - x <= threshold || u >= hIntegral((double)k + 0.5) - h((double)k)) return k - 1;
+        }
+    }
+};
+
+// 把秩打散到 [0, n) 的 ID 上: 乘以与 n 互质的常数后取模，是一个双射，
+// 热门 ID 不会集中在表的开头
+class RankScatter {
+private:
+    uint64_t n;
+    uint64_t multiplier;
+
+    static uint64_t gcd(uint64_t a, uint64_t b) {
+        while (b != 0) {
+            uint64_t t = a % b;
+            a = b;
+            b = t;
+        }
+        return a;
+    }
+
+public:
+    explicit RankScatter(uint64_t n) : n(n < 1 ? 1 : n), multiplier(1) {
+        if (this->n > 2) {
+            multiplier = 0x9E3779B1ull % this->n;
+            while (multiplier < 2 || gcd(multiplier, this->n) != 1) multiplier = (multiplier + 1) % this->n;
+        }
+    }
+
+    uint64_t operator()(uint64_t rank) const { return (rank % n) * multiplier % n; }
+};
+
+static inline double benchSeconds(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// JSON 字符串转义 (只需处理引号、反斜杠与控制字符)
+static inline std::string jsonString(const std::string& text) {
+    std::string out = "\"";
+    for (char c : text) {
+        if (c == '"' || c == '\\') {
+            out += '\\';
+            out += c;
+        } else if ((unsigned char)c < 0x20) {
+            char escaped[8];
+            snprintf(escaped, sizeof(escaped), "\\u%04x", (unsigned char)c);
+            out += escaped;
+        } else {
+            out += c;
+        }
+    }
+    return out + "\"";
+}
+
+static inline std::string jsonNumber(double value) {
+    char text[32];
+    snprintf(text, sizeof(text), "%.6g", value);
+    return text;
+}
+
+// "min:max" 形式的区间
+static inline bool parseRange(const std::string& text, uint64_t& low, uint64_t& high) {
+    size_t colon = text.find(':');
+    char* end = NULL;
+    low = strtoull(text.c_str(), &end, 10);
+    if (colon == std::string::npos) {
+        high = low;
+        return *end == '\0';
+    }
+    if (end != text.c_str() + colon) return false;
+    high = strtoull(text.c_str() + colon + 1, &end, 10);
+    return *end == '\0' && low <= high;
+}
+
+#endif // CONVERTSERVER_BENCH_COMMON_H
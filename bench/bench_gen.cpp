@@ -0,0 +1,228 @@
+/**
+ * bench_gen - 生成基准测试用的合成 lookup 与 M8 文件
+ *
+ * 用法:
+ *   bench_gen lookup <out.lookup> --entries <n> [--name-length <min:max>] [--missing <rate>] [--seed <s>]
+ *   bench_gen m8 <out.m8> --rows <n> --targets <n> [--hits <per query>] [--skew <s>] [--seed <s>]
+ *
+ * lookup 每行 "ID\tName\tSetID"，名称形如 UniRef100_<base36 ID>_<填充>，长度在区间内均匀分布；
+ * --missing 按比例跳过 ID，用于测试 NOT_FOUND 与稀疏表。
+ * M8 每个 query 有 --hits 条比对，target ID 在 [0, targets) 上服从指数为 --skew 的 Zipf 分布
+ * (0 为均匀)，热门 ID 打散到整个 ID 空间。
+ * 完成后在 stdout 输出一行 JSON 摘要。
+ */
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <iostream>
+#include <string>
+#include <cstring>
+#include <cstdlib>
+#include <chrono>
+
+#include "../src/m8_reader.h"
+#include "../src/m8_format.h"
+#include "bench_common.h"
+
+static const size_t FLUSH_BYTES = 8 << 20;
+
+static bool flushBuffer(OutputBuffer& out, int fd, size_t& written) {
+    std::string error;
+    written += out.size();
+    if (!out.writeTo(fd, error)) {
+        std::cerr << "[ERROR] Cannot write output: " << error << std::endl;
+        return false;
+    }
+    out.clear();
+    return true;
+}
+
+static int generateLookup(const std::string& path, uint64_t entries, uint64_t minName, uint64_t maxName,
+                          double missing, uint64_t seed) {
+    int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        std::cerr << "[ERROR] Cannot open output file: " << path << " (" << strerror(errno) << ")" << std::endl;
+        return 1;
+    }
+    auto start = std::chrono::steady_clock::now();
+    BenchRng rng(seed);
+    OutputBuffer out;
+    size_t written = 0;
+    uint64_t lines = 0;
+    uint64_t nameBytes = 0;
+    static const char DIGITS[] = "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZ";
+    for (uint64_t id = 0; id < entries; id++) {
+        uint64_t r = rng.next();
+        if (missing > 0 && (double)(r >> 11) * (1.0 / 9007199254740992.0) < missing) continue;
+        uint64_t nameLen = minName + (maxName > minName ? rng.below(maxName - minName + 1) : 0);
+
+        char* p = out.reserve(2 * 20 + nameLen + 16);
+        p = m8::formatUInt(p, id);
+        *p++ = '\t';
+        // 名称: 前缀 + base36 ID (保证唯一) + 填充，截断或补足到 nameLen
+        char name[256];
+        size_t len = 0;
+        memcpy(name, "UniRef100_", 10);
+        len = 10;
+        char digits[16];
+        size_t n = 0;
+        uint64_t v = id;
+        do {
+            digits[n++] = DIGITS[v % 36];
+            v /= 36;
+        } while (v != 0);
+        while (n > 0) name[len++] = digits[--n];
+        name[len++] = '_';
+        for (; len < nameLen && len < sizeof(name); len++) name[len] = DIGITS[10 + (r >> (len % 48)) % 26];
+        if (nameLen < len) len = nameLen;
+        memcpy(p, name, len);
+        p += len;
+        *p++ = '\t';
+        p = m8::formatUInt(p, id);
+        *p++ = '\n';
+        out.commit(p);
+        lines++;
+        nameBytes += len;
+        if (out.size() >= FLUSH_BYTES && !flushBuffer(out, fd, written)) return 1;
+    }
+    if (!flushBuffer(out, fd, written)) return 1;
+    close(fd);
+
+    std::cout << "{\"tool\":\"bench_gen\",\"kind\":\"lookup\",\"path\":" << jsonString(path)
+              << ",\"entries\":" << lines << ",\"id_range\":" << entries << ",\"bytes\":" << written
+              << ",\"mean_name_length\":" << jsonNumber(lines ? (double)nameBytes / lines : 0)
+              << ",\"seed\":" << seed << ",\"seconds\":" << jsonNumber(benchSeconds(start)) << "}" << std::endl;
+    return 0;
+}
+
+static int generateM8(const std::string& path, uint64_t rows, uint64_t targets, uint64_t hits, double skew,
+                      uint64_t seed) {
+    int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        std::cerr << "[ERROR] Cannot open output file: " << path << " (" << strerror(errno) << ")" << std::endl;
+        return 1;
+    }
+    auto start = std::chrono::steady_clock::now();
+    BenchRng rng(seed);
+    ZipfSampler zipf(targets, skew);
+    RankScatter scatter(targets);
+    OutputBuffer out;
+    size_t written = 0;
+    for (uint64_t row = 0; row < rows; row++) {
+        uint64_t query = row / (hits == 0 ? 1 : hits);
+        uint32_t target = (uint32_t)scatter(zipf.sample(rng));
+        uint32_t alnlen = 50 + (uint32_t)rng.below(450);
+        uint32_t mismatch = (uint32_t)rng.below(alnlen / 2 + 1);
+        uint32_t gapopen = (uint32_t)rng.below(10);
+        uint32_t qstart = 1 + (uint32_t)rng.below(100);
+        uint32_t tstart = 1 + (uint32_t)rng.below(100);
+        double fident = (double)(alnlen - mismatch) / alnlen;
+        double evalue = std::pow(10.0, -(double)rng.below(180)) * (1 + rng.unit() * 8);
+        double bits = 20 + rng.unit() * 980;
+
+        char* p = out.reserve(24 + 10 * m8::MAX_NUMBER_TEXT);
+        *p++ = 'Q';
+        p = m8::formatUInt(p, query);
+        *p++ = '\t';
+        p = m8::formatUInt(p, target);
+        *p++ = '\t';
+        p = m8::formatFixed(p, fident, 3);
+        *p++ = '\t';
+        p = m8::formatUInt(p, alnlen);
+        *p++ = '\t';
+        p = m8::formatUInt(p, mismatch);
+        *p++ = '\t';
+        p = m8::formatUInt(p, gapopen);
+        *p++ = '\t';
+        p = m8::formatUInt(p, qstart);
+        *p++ = '\t';
+        p = m8::formatUInt(p, qstart + alnlen - 1);
+        *p++ = '\t';
+        p = m8::formatUInt(p, tstart);
+        *p++ = '\t';
+        p = m8::formatUInt(p, tstart + alnlen - 1);
+        *p++ = '\t';
+        p = m8::formatExp2(p, evalue);
+        *p++ = '\t';
+        p = m8::formatFixed(p, bits, 1);
+        *p++ = '\n';
+        out.commit(p);
+        if (out.size() >= FLUSH_BYTES && !flushBuffer(out, fd, written)) return 1;
+    }
+    if (!flushBuffer(out, fd, written)) return 1;
+    close(fd);
+
+    std::cout << "{\"tool\":\"bench_gen\",\"kind\":\"m8\",\"path\":" << jsonString(path)
+              << ",\"rows\":" << rows << ",\"targets\":" << targets << ",\"hits_per_query\":" << hits
+              << ",\"skew\":" << jsonNumber(skew) << ",\"bytes\":" << written << ",\"seed\":" << seed
+              << ",\"seconds\":" << jsonNumber(benchSeconds(start)) << "}" << std::endl;
+    return 0;
+}
+
+static void printUsage(const char* prog) {
+    std::cerr << "Usage: " << prog << " lookup <out.lookup> --entries <n> [options]" << std::endl;
+    std::cerr << "       " << prog << " m8 <out.m8> --rows <n> --targets <n> [options]" << std::endl;
+    std::cerr << std::endl;
+    std::cerr << "Options:" << std::endl;
+    std::cerr << "  --name-length <min:max>  Name length range, uniform (lookup, default: 20:40)" << std::endl;
+    std::cerr << "  --missing <rate>         Fraction of IDs left out of the lookup (default: 0)" << std::endl;
+    std::cerr << "  --hits <n>               Alignments per query (m8, default: 100)" << std::endl;
+    std::cerr << "  --skew <s>               Zipf exponent of target IDs, 0 = uniform (m8, default: 0)" << std::endl;
+    std::cerr << "  --seed <n>               Random seed (default: 1)" << std::endl;
+}
+
+int main(int argc, char* argv[]) {
+    if (argc < 3) {
+        printUsage(argv[0]);
+        return 1;
+    }
+    std::string kind = argv[1];
+    std::string path = argv[2];
+    uint64_t entries = 0, rows = 0, targets = 0, hits = 100, seed = 1;
+    uint64_t minName = 20, maxName = 40;
+    double missing = 0, skew = 0;
+    for (int i = 3; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--entries" && i + 1 < argc) {
+            entries = strtoull(argv[++i], NULL, 10);
+        } else if (arg == "--rows" && i + 1 < argc) {
+            rows = strtoull(argv[++i], NULL, 10);
+        } else if (arg == "--targets" && i + 1 < argc) {
+            targets = strtoull(argv[++i], NULL, 10);
+        } else if (arg == "--hits" && i + 1 < argc) {
+            hits = std::max<uint64_t>(1, strtoull(argv[++i], NULL, 10));
+        } else if (arg == "--seed" && i + 1 < argc) {
+            seed = strtoull(argv[++i], NULL, 10);
+        } else if (arg == "--missing" && i + 1 < argc) {
+            missing = atof(argv[++i]);
+        } else if (arg == "--skew" && i + 1 < argc) {
+            skew = atof(argv[++i]);
+        } else if (arg == "--name-length" && i + 1 < argc) {
+            if (!parseRange(argv[++i], minName, maxName) || maxName > 200) {
+                std::cerr << "[ERROR] Invalid --name-length (expected <min:max>, at most 200): " << argv[i] << std::endl;
+                return 1;
+            }
+        } else {
+            std::cerr << "[ERROR] Unknown option: " << arg << std::endl;
+            printUsage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (kind == "lookup") {
+        if (entries == 0 || entries > (1ull << 32)) {
+            std::cerr << "[ERROR] lookup needs --entries between 1 and 2^32" << std::endl;
+            return 1;
+        }
+        return generateLookup(path, entries, minName, maxName, missing, seed);
+    }
+    if (kind == "m8") {
+        if (rows == 0 || targets == 0 || targets > (1ull << 32)) {
+            std::cerr << "[ERROR] m8 needs --rows and --targets (at most 2^32)" << std::endl;
+            return 1;
+        }
+        return generateM8(path, rows, targets, hits, skew, seed);
+    }
+    printUsage(argv[0]);
+    return 1;
+}
@@ -0,0 +1,400 @@
+/**
+ * bench_load - convertserver 负载驱动: 多个并发客户端发送 GET / BATCH 请求并统计吞吐与延迟
+ *
+ * 用法:
+ *   bench_load <socket> [--mode get|batch|binary] [--clients <n>] [--duration <s> | --requests <n>]
+ *              [--batch-size <n>] [--pipeline <n>] [--id-range <n>] [--skew <s>] [--table <name>]
+ *   bench_load <socket> --mode wait [--timeout <s>]   等待服务端就绪 (PING)，报告等待时间
+ *   bench_load <socket> --mode stats                  取服务端 STATS 原文
+ *
+ * 每个客户端一个连接，每轮流水线发送 --pipeline 个请求后依次读取响应 (一轮的响应应小于
+ * 服务端的背压上限 64MB，否则双方都会阻塞在发送上)；
+ * 延迟为请求发出到对应响应读完的时间，记入与服务端相同的直方图 (metrics.h)。
+ * 结束后在 stdout 输出一行 JSON。<socket> 也可以是 host:port (convertserver --tcp)。
+ */
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <memory>
+#include <chrono>
+#include <cstring>
+#include <cstdlib>
+
+#include "../src/protocol.h"
+#include "../src/metrics.h"
+#include "bench_common.h"
+
+enum LoadMode { MODE_GET, MODE_BATCH, MODE_BINARY };
+
+struct DriverOptions {
+    std::string socketPath;
+    LoadMode mode;
+    int clients;
+    double duration;
+    uint64_t requests;   // 非 0 时按总请求数结束，否则按 duration
+    uint32_t batchSize;
+    int pipeline;
+    uint64_t idRange;
+    double skew;
+    std::string table;
+    uint64_t seed;
+
+    DriverOptions()
+        : mode(MODE_GET), clients(1), duration(10), requests(0), batchSize(1000), pipeline(1), idRange(1000000),
+          skew(0), seed(1) {}
+};
+
+// 按需从 socket 读取的缓冲
+class SocketReader {
+private:
+    int fd;
+    std::vector<char> buffer;
+    size_t begin;
+    size_t end;
+
+    bool fill() {
+        if (begin == end) {
+            begin = end = 0;
+        } else if (end == buffer.size()) {
+            memmove(buffer.data(), buffer.data() + begin, end - begin);
+            end -= begin;
+            begin = 0;
+        }
+        if (end == buffer.size()) buffer.resize(buffer.size() * 2);
+        ssize_t n;
+        do {
+            n = recv(fd, buffer.data() + end, buffer.size() - end, 0);
+        } while (n < 0 && errno == EINTR);
+        if (n <= 0) return false;
+        end += n;
+        return true;
+    }
+
+public:
+    explicit SocketReader(int fd) : fd(fd), buffer(1 << 20), begin(0), end(0) {}
+
+    // 读一行 (不含 \n)
+    bool readLine(std::string& line) {
+        size_t scanned = 0;  // 从 begin 起已查找过的字节 (fill 搬移数据时保持不变)
+        for (;;) {
+            const char* from = buffer.data() + begin + scanned;
+            const char* nl = (const char*)memchr(from, '\n', end - begin - scanned);
+            if (nl != NULL) {
+                line.assign(buffer.data() + begin, nl - (buffer.data() + begin));
+                begin = nl + 1 - buffer.data();
+                return true;
+            }
+            scanned = end - begin;
+            if (!fill()) return false;
+        }
+    }
+
+    bool readExact(char* out, size_t len) {
+        while (len > 0) {
+            if (begin == end && !fill()) return false;
+            size_t n = std::min(len, end - begin);
+            if (out != NULL) {
+                memcpy(out, buffer.data() + begin, n);
+                out += n;
+            }
+            begin += n;
+            len -= n;
+        }
+        return true;
+    }
+};
+
+// unix socket 路径或 host:port (convertserver --tcp)
+static int connectSocket(const std::string& address) {
+    std::string error;
+    return connectAddress(address, error);
+}
+
+// 发送一条文本命令并读取单行响应
+static bool command(int fd, SocketReader& reader, const std::string& request, std::string& response) {
+    return sendAll(fd, request.data(), request.size()) && reader.readLine(response);
+}
+
+struct ClientResult {
+    Histogram latency;
+    uint64_t requests;
+    uint64_t ids;
+    uint64_t notFound;
+    std::string error;
+
+    ClientResult() : requests(0), ids(0), notFound(0) {}
+};
+
+static void runClient(const DriverOptions& options, int index, std::atomic<uint64_t>& issued,
+                      std::chrono::steady_clock::time_point deadline, ClientResult& result) {
+    int fd = connectSocket(options.socketPath);
+    if (fd < 0) {
+        result.error = "cannot connect";
+        return;
+    }
+    SocketReader reader(fd);
+    std::string line;
+    if (!options.table.empty() && (!command(fd, reader, "USE " + options.table + "\n", line) ||
+                                   line.compare(0, 2, "OK") != 0)) {
+        result.error = "USE failed: " + line;
+        close(fd);
+        return;
+    }
+    if (options.mode == MODE_BINARY && (!command(fd, reader, BIN_HELLO, line) || line + "\n" != BIN_HELLO_OK)) {
+        result.error = "binary protocol not supported";
+        close(fd);
+        return;
+    }
+
+    BenchRng rng(options.seed * 1000003 + index);
+    ZipfSampler zipf(options.idRange, options.skew);
+    RankScatter scatter(options.idRange);
+    uint32_t perRequest = options.mode == MODE_GET ? 1 : options.batchSize;
+    std::string request;
+    std::vector<uint32_t> lengths;
+
+    for (;;) {
+        int burst = options.pipeline;
+        if (options.requests > 0) {
+            uint64_t taken = issued.fetch_add(burst);
+            if (taken >= options.requests) break;
+            burst = (int)std::min<uint64_t>(burst, options.requests - taken);
+        } else if (std::chrono::steady_clock::now() >= deadline) {
+            break;
+        }
+
+        request.clear();
+        for (int r = 0; r < burst; r++) {
+            if (options.mode == MODE_BINARY) {
+                size_t at = request.size();
+                request.resize(at + BIN_HEADER_SIZE + 4 * (size_t)perRequest);
+                request[at] = (char)BIN_MAGIC;
+                putU32(&request[at + 1], perRequest);
+                for (uint32_t k = 0; k < perRequest; k++) {
+                    putU32(&request[at + BIN_HEADER_SIZE + 4 * (size_t)k], (uint32_t)scatter(zipf.sample(rng)));
+                }
+            } else {
+                request += options.mode == MODE_GET ? "GET" : "BATCH";
+                for (uint32_t k = 0; k < perRequest; k++) {
+                    request += ' ';
+                    request += std::to_string(scatter(zipf.sample(rng)));
+                }
+                request += '\n';
+            }
+        }
+
+        uint64_t sent = metricsNanos();
+        if (!sendAll(fd, request.data(), request.size())) {
+            result.error = "send failed";
+            break;
+        }
+        for (int r = 0; r < burst; r++) {
+            if (options.mode == MODE_BINARY) {
+                char header[BIN_HEADER_SIZE];
+                if (!reader.readExact(header, BIN_HEADER_SIZE) || (unsigned char)header[0] != BIN_MAGIC) {
+                    result.error = "bad binary response";
+                    break;
+                }
+                uint32_t count = getU32(header + 1);
+                lengths.resize(count);
+                if (!reader.readExact((char*)lengths.data(), 4 * (size_t)count)) {
+                    result.error = "short binary response";
+                    break;
+                }
+                size_t blob = 0;
+                for (uint32_t len : lengths) {
+                    if (len == BIN_NOT_FOUND) {
+                        result.notFound++;
+                    } else {
+                        blob += len;
+                    }
+                }
+                if (!reader.readExact(NULL, blob)) {
+                    result.error = "short binary response";
+                    break;
+                }
+            } else {
+                if (!reader.readLine(line) || line.compare(0, 6, "ERROR:") == 0) {
+                    result.error = "bad response: " + line;
+                    break;
+                }
+                for (size_t pos = 0; pos <= line.size();) {
+                    size_t tab = line.find('\t', pos);
+                    if (tab == std::string::npos) tab = line.size();
+                    if (line.compare(pos, tab - pos, "NOT_FOUND") == 0) result.notFound++;
+                    pos = tab + 1;
+                }
+            }
+            result.latency.record(metricsNanos() - sent);
+            result.requests++;
+            result.ids += perRequest;
+        }
+        if (!result.error.empty()) break;
+    }
+    close(fd);
+}
+
+// 等待服务端回复 PING
+static int waitReady(const std::string& socketPath, double timeout) {
+    auto start = std::chrono::steady_clock::now();
+    for (;;) {
+        int fd = connectSocket(socketPath);
+        if (fd >= 0) {
+            SocketReader reader(fd);
+            std::string line;
+            bool ready = command(fd, reader, "PING\n", line) && line == "PONG";
+            close(fd);
+            if (ready) break;
+        }
+        if (benchSeconds(start) > timeout) {
+            std::cerr << "[ERROR] convertserver at " << socketPath << " not ready after " << timeout << "s" << std::endl;
+            return 1;
+        }
+        usleep(20000);
+    }
+    std::cout << "{\"tool\":\"bench_load\",\"mode\":\"wait\",\"seconds\":" << jsonNumber(benchSeconds(start)) << "}"
+              << std::endl;
+    return 0;
+}
+
+static int fetchStats(const std::string& socketPath) {
+    int fd = connectSocket(socketPath);
+    if (fd < 0) {
+        std::cerr << "[ERROR] Cannot connect to convertserver at " << socketPath << std::endl;
+        return 1;
+    }
+    SocketReader reader(fd);
+    std::string line;
+    bool ok = command(fd, reader, "STATS\n", line) && line.compare(0, 6, "STATS ") == 0;
+    close(fd);
+    if (!ok) {
+        std::cerr << "[ERROR] STATS failed: " << line << std::endl;
+        return 1;
+    }
+    std::cout << "{\"tool\":\"bench_load\",\"mode\":\"stats\",\"stats\":" << jsonString(line) << "}" << std::endl;
+    return 0;
+}
+
+static void printUsage(const char* prog) {
+    std::cerr << "Usage: " << prog << " <socket|host:port> [options]" << std::endl;
+    std::cerr << std::endl;
+    std::cerr << "Options:" << std::endl;
+    std::cerr << "  --mode <m>          get, batch (text), binary, wait or stats (default: get)" << std::endl;
+    std::cerr << "  --clients <n>       Concurrent connections (default: 1)" << std::endl;
+    std::cerr << "  --duration <s>      Run time in seconds (default: 10)" << std::endl;
+    std::cerr << "  --requests <n>      Stop after n requests in total instead of after --duration" << std::endl;
+    std::cerr << "  --batch-size <n>    IDs per BATCH request (default: 1000)" << std::endl;
+    std::cerr << "  --pipeline <n>      Requests sent before reading responses (default: 1)" << std::endl;
+    std::cerr << "  --id-range <n>      IDs are drawn from [0, n) (default: 1000000)" << std::endl;
+    std::cerr << "  --skew <s>          Zipf exponent of the IDs, 0 = uniform (default: 0)" << std::endl;
+    std::cerr << "  --table <name>      USE this table first" << std::endl;
+    std::cerr << "  --timeout <s>       Wait mode: give up after s seconds (default: 600)" << std::endl;
+    std::cerr << "  --seed <n>          Random seed (default: 1)" << std::endl;
+}
+
+int main(int argc, char* argv[]) {
+    if (argc < 2 || argv[1][0] == '-') {
+        printUsage(argv[0]);
+        return 1;
+    }
+    DriverOptions options;
+    options.socketPath = argv[1];
+    std::string mode = "get";
+    double timeout = 600;
+    for (int i = 2; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--mode" && i + 1 < argc) {
+            mode = argv[++i];
+        } else if (arg == "--clients" && i + 1 < argc) {
+            options.clients = std::max(1, atoi(argv[++i]));
+        } else if (arg == "--duration" && i + 1 < argc) {
+            options.duration = atof(argv[++i]);
+        } else if (arg == "--requests" && i + 1 < argc) {
+            options.requests = strtoull(argv[++i], NULL, 10);
+        } else if (arg == "--batch-size" && i + 1 < argc) {
+            options.batchSize = (uint32_t)std::max(1, atoi(argv[++i]));
+        } else if (arg == "--pipeline" && i + 1 < argc) {
+            options.pipeline = std::max(1, atoi(argv[++i]));
+        } else if (arg == "--id-range" && i + 1 < argc) {
+            options.idRange = std::max<uint64_t>(1, strtoull(argv[++i], NULL, 10));
+        } else if (arg == "--skew" && i + 1 < argc) {
+            options.skew = atof(argv[++i]);
+        } else if (arg == "--table" && i + 1 < argc) {
+            options.table = argv[++i];
+        } else if (arg == "--timeout" && i + 1 < argc) {
+            timeout = atof(argv[++i]);
+        } else if (arg == "--seed" && i + 1 < argc) {
+            options.seed = strtoull(argv[++i], NULL, 10);
+        } else {
+            std::cerr << "[ERROR] Unknown option: " << arg << std::endl;
+            printUsage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (mode == "wait") return waitReady(options.socketPath, timeout);
+    if (mode == "stats") return fetchStats(options.socketPath);
+    if (mode == "get") {
+        options.mode = MODE_GET;
+    } else if (mode == "batch") {
+        options.mode = MODE_BATCH;
+    } else if (mode == "binary") {
+        options.mode = MODE_BINARY;
+    } else {
+        std::cerr << "[ERROR] Unknown mode: " << mode << std::endl;
+        return 1;
+    }
+    if (options.mode == MODE_BINARY && options.batchSize > BIN_MAX_COUNT) {
+        std::cerr << "[ERROR] --batch-size exceeds the binary frame limit " << BIN_MAX_COUNT << std::endl;
+        return 1;
+    }
+
+    std::vector<std::unique_ptr<ClientResult> > results;
+    std::vector<std::thread> clients;
+    std::atomic<uint64_t> issued(0);
+    auto start = std::chrono::steady_clock::now();
+    auto deadline = start + std::chrono::microseconds((long long)(options.duration * 1e6));
+    for (int c = 0; c < options.clients; c++) {
+        results.push_back(std::unique_ptr<ClientResult>(new ClientResult()));
+        clients.push_back(std::thread(runClient, std::cref(options), c, std::ref(issued), deadline,
+                                      std::ref(*results.back())));
+    }
+    for (auto& client : clients) {
+        client.join();
+    }
+    double seconds = benchSeconds(start);
+
+    uint64_t requests = 0, ids = 0, notFound = 0, maxNanos = 0;
+    std::vector<uint64_t> merged(Histogram::BUCKETS);
+    for (const auto& result : results) {
+        if (!result->error.empty()) {
+            std::cerr << "[ERROR] Client failed: " << result->error << std::endl;
+            return 1;
+        }
+        requests += result->requests;
+        ids += result->ids;
+        notFound += result->notFound;
+        maxNanos = std::max(maxNanos, result->latency.mergeInto(merged));
+    }
+    auto percentileMicros = [&](double q) {
+        return jsonNumber(std::min(maxNanos, histogramPercentile(merged, requests, q)) / 1000.0);
+    };
+
+    std::cout << "{\"tool\":\"bench_load\",\"mode\":" << jsonString(mode) << ",\"clients\":" << options.clients
+              << ",\"batch_size\":" << (options.mode == MODE_GET ? 1 : options.batchSize)
+              << ",\"pipeline\":" << options.pipeline << ",\"id_range\":" << options.idRange
+              << ",\"skew\":" << jsonNumber(options.skew) << ",\"requests\":" << requests << ",\"ids\":" << ids
+              << ",\"not_found\":" << notFound << ",\"seconds\":" << jsonNumber(seconds)
+              << ",\"requests_per_sec\":" << jsonNumber(requests / seconds)
+              << ",\"ids_per_sec\":" << jsonNumber(ids / seconds)
+              << ",\"latency_us\":{\"p50\":" << percentileMicros(0.50) << ",\"p90\":" << percentileMicros(0.90)
+              << ",\"p99\":" << percentileMicros(0.99) << ",\"p999\":" << percentileMicros(0.999)
+              << ",\"max\":" << jsonNumber(maxNanos / 1000.0) << "}}" << std::endl;
+    return 0;
+}
@@ -0,0 +1,162 @@
+/**
+ * bench_lookup - 查询表批量查询内核的微基准
+ *
+ * 用法:
+ *   bench_lookup <snapshot> [--batches <n,n,...>] [--ids <n>] [--table dense|compressed|all] [--seed <s>]
+ *
+ * 把快照复制到匿名内存 (compressed 由其编码)，对每个批次大小生成均匀随机的 ID，
+ * 比较三种查询方式的每 ID 耗时，名称都拷贝到输出缓冲 (与服务端写响应相同):
+ *   scalar   逐个 find (文本 BATCH 的方式)
+ *   batch    findBatch (分组预取偏移项)，读取结果时用 prefetchName 预取名称
+ *   grouped  findBatchGrouped (先按 ID 高位分组，结果按请求顺序写回)，读取方式同 batch
+ * 每个批次大小至少查询 --ids 个 ID (默认 4000000)。每个 (表, 批次大小) 在 stdout 输出一行 JSON。
+ */
+
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <cstdlib>
+#include <thread>
+
+#include "../src/name_table.h"
+#include "bench_common.h"
+
+enum LookupMethod { METHOD_SCALAR, METHOD_BATCH, METHOD_GROUPED };
+
+// 查询 ids 中的每个批次并把名称拷贝到 out，返回每 ID 纳秒数；checksum 防止拷贝被优化掉
+static double measure(const NameTable& table, LookupMethod method, const std::vector<uint32_t>& ids, size_t batch,
+                      uint64_t& checksum) {
+    NameScratch scratch;
+    std::vector<NameRef> refs(batch);
+    std::string out;
+    out.reserve(batch * 48);
+    auto start = std::chrono::steady_clock::now();
+    for (size_t begin = 0; begin + batch <= ids.size(); begin += batch) {
+        const uint32_t* part = ids.data() + begin;
+        scratch.clear();
+        out.clear();
+        if (method == METHOD_SCALAR) {
+            for (size_t i = 0; i < batch; i++) {
+                NameRef ref;
+                if (table.find(part[i], ref, scratch)) out.append(ref.data, ref.len);
+                out += '\t';
+            }
+        } else {
+            if (method == METHOD_BATCH) {
+                table.findBatch(part, batch, refs.data(), scratch);
+            } else {
+                findBatchGrouped(table, part, batch, refs.data(), scratch);
+            }
+            for (size_t i = 0; i < batch; i++) {
+                prefetchName(refs.data(), i, batch);
+                if (refs[i].data != NULL) out.append(refs[i].data, refs[i].len);
+                out += '\t';
+            }
+        }
+        checksum += out.size();
+    }
+    return benchSeconds(start) * 1e9 / (double)(ids.size() / batch * batch);
+}
+
+static void runTable(const NameTable& table, const std::string& kind, uint64_t slots,
+                     const std::vector<size_t>& batches, uint64_t minIds, uint64_t seed) {
+    uint64_t checksum = 0;
+    for (size_t batch : batches) {
+        // 每种方式查询相同的 ID 序列
+        size_t total = (size_t)std::max<uint64_t>(batch, (minIds + batch - 1) / batch * batch);
+        std::vector<uint32_t> ids(total);
+        BenchRng rng(seed + batch);
+        for (size_t i = 0; i < total; i++) ids[i] = (uint32_t)rng.below(slots);
+
+        measure(table, METHOD_BATCH, ids, batch, checksum);  // 预热
+        double scalar = measure(table, METHOD_SCALAR, ids, batch, checksum);
+        double batched = measure(table, METHOD_BATCH, ids, batch, checksum);
+        double grouped = measure(table, METHOD_GROUPED, ids, batch, checksum);
+        std::cout << "{\"tool\":\"bench_lookup\",\"table\":" << jsonString(kind) << ",\"entries\":" << table.size()
+                  << ",\"batch\":" << batch << ",\"ids\":" << total << ",\"scalar_ns\":" << jsonNumber(scalar)
+                  << ",\"batch_ns\":" << jsonNumber(batched) << ",\"grouped_ns\":" << jsonNumber(grouped)
+                  << ",\"batch_speedup\":" << jsonNumber(scalar / batched)
+                  << ",\"grouped_speedup\":" << jsonNumber(scalar / grouped)
+                  << ",\"checksum\":" << checksum << "}" << std::endl;
+    }
+}
+
+static void printUsage(const char* prog) {
+    std::cerr << "Usage: " << prog << " <snapshot> [options]" << std::endl;
+    std::cerr << std::endl;
+    std::cerr << "Options:" << std::endl;
+    std::cerr << "  --batches <n,n,...>   Batch sizes (default: 10000,100000,1000000)" << std::endl;
+    std::cerr << "  --ids <n>             IDs looked up per batch size and method (default: 4000000)" << std::endl;
+    std::cerr << "  --table <kind>        dense, compressed or all (default: all)" << std::endl;
+    std::cerr << "  --seed <n>            Random seed (default: 1)" << std::endl;
+}
+
+int main(int argc, char* argv[]) {
+    if (argc < 2) {
+        printUsage(argv[0]);
+        return 1;
+    }
+    std::string path = argv[1];
+    std::vector<size_t> batches;
+    std::string batchList = "10000,100000,1000000";
+    std::string kind = "all";
+    uint64_t minIds = 4000000, seed = 1;
+    for (int i = 2; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--batches" && i + 1 < argc) {
+            batchList = argv[++i];
+        } else if (arg == "--ids" && i + 1 < argc) {
+            minIds = strtoull(argv[++i], NULL, 10);
+        } else if (arg == "--table" && i + 1 < argc) {
+            kind = argv[++i];
+        } else if (arg == "--seed" && i + 1 < argc) {
+            seed = strtoull(argv[++i], NULL, 10);
+        } else {
+            std::cerr << "[ERROR] Unknown option: " << arg << std::endl;
+            printUsage(argv[0]);
+            return 1;
+        }
+    }
+    for (size_t pos = 0; pos < batchList.size();) {
+        size_t comma = batchList.find(',', pos);
+        if (comma == std::string::npos) comma = batchList.size();
+        size_t batch = strtoull(batchList.substr(pos, comma - pos).c_str(), NULL, 10);
+        if (batch > 0) batches.push_back(batch);
+        pos = comma + 1;
+    }
+    if (batches.empty() || (kind != "dense" && kind != "compressed" && kind != "all")) {
+        printUsage(argv[0]);
+        return 1;
+    }
+
+    DenseNameTable snapshot;
+    std::string error;
+    if (!snapshot.openSnapshot(path, false, error)) {
+        std::cerr << "[ERROR] Cannot open snapshot " << path << ": " << error << std::endl;
+        return 1;
+    }
+    int threads = (int)std::max(1u, std::thread::hardware_concurrency());
+    uint64_t slots = snapshot.slotCount();
+
+    if (kind != "compressed") {
+        // 复制到匿名内存，测量不受页缓存缺页影响
+        std::unique_ptr<NameTable> dense;
+        if (!snapshot.replicate(MemoryPlacement(), threads, dense, error)) {
+            std::cerr << "[ERROR] Cannot copy snapshot: " << error << std::endl;
+            return 1;
+        }
+        runTable(*dense, "dense", slots, batches, minIds, seed);
+    }
+    if (kind != "dense") {
+        CompressedNameTable compressed;
+        if (!compressed.build(slots, [&](uint32_t id, NameRef& out) { return snapshot.find(id, out); }, threads,
+                              error)) {
+            std::cerr << "[ERROR] Cannot build compressed table: " << error << std::endl;
+            return 1;
+        }
+        runTable(compressed, "compressed", slots, batches, minIds, seed);
+    }
+    return 0;
+}
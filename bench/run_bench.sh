@@ -0,0 +1,158 @@
+#!/bin/bash
+# run_bench.sh - convertserver / convertalis-fast 基准测试
+#
+# 生成 (或复用) 合成数据，依次测量:
+#   1. 服务端加载时间: 文本 lookup、构建快照、从快照启动；
+#      批量查询内核的每 ID 耗时 (bench_lookup，dense 与 compressed，批次 10k / 100k / 1M 个随机 ID)
+#   2. 查询吞吐与延迟: bench_load 的 GET / 文本 BATCH / 二进制 BATCH，各并发数
+#   3. convertalis-fast 各阶段耗时 (--timing-json)，各线程数；服务端流式转换 (--server-convert) 的总耗时
+#   4. 结束时服务端的 STATS
+#   5. (BENCH_SHARDS > 0 时) 快照按 hash 分成 N 片，由 N 个本机服务端经 TCP 回环提供，
+#      convertalis-fast --shard-map 的各阶段耗时
+# 每项结果为一行 JSON: {"bench":<项目>,"label":<标签>,"entries":<n>,"rows":<n>,"result":<工具输出>}，
+# 追加到结果文件。
+#
+# 用法: bench/run_bench.sh   (在仓库根目录，先 make all bench)
+#
+# 参数通过环境变量设置:
+#   BENCH_ENTRIES   lookup 条目数 (默认 10000000)
+#   BENCH_ROWS      M8 行数 (默认 10000000)
+#   BENCH_SKEW      target ID 的 Zipf 指数 (默认 1.0)
+#   BENCH_CLIENTS   负载驱动的并发连接数列表 (默认 "1 4 16")
+#   BENCH_THREADS   convertalis-fast 线程数列表 (默认 "1 4")
+#   BENCH_DURATION  每项负载的持续秒数 (默认 10)
+#   BENCH_WORKERS   服务端工作线程数 (默认全部核心)
+#   BENCH_SHARDS    分片测量的服务端个数 (默认 0，不测量)
+#   BENCH_PORT      分片服务端的起始 TCP 端口 (默认 17600)
+#   BENCH_DIR       数据与临时文件目录 (默认 /tmp/convertserver-bench)
+#   BENCH_OUT       结果文件 (默认 bench_results.jsonl)
+#   BENCH_LABEL     写入每条结果的标签 (默认当前 git 提交)
+
+set -euo pipefail
+
+ENTRIES=${BENCH_ENTRIES:-10000000}
+ROWS=${BENCH_ROWS:-10000000}
+SKEW=${BENCH_SKEW:-1.0}
+CLIENTS=${BENCH_CLIENTS:-"1 4 16"}
+THREADS=${BENCH_THREADS:-"1 4"}
+DURATION=${BENCH_DURATION:-10}
+WORKERS=${BENCH_WORKERS:-$(nproc)}
+SHARDS=${BENCH_SHARDS:-0}
+PORT=${BENCH_PORT:-17600}
+DIR=${BENCH_DIR:-/tmp/convertserver-bench}
+OUT=${BENCH_OUT:-bench_results.jsonl}
+LABEL=${BENCH_LABEL:-$(git rev-parse --short HEAD 2>/dev/null || echo unknown)}
+
+for tool in ./convertserver ./convertalis-fast ./bench_gen ./bench_load ./bench_lookup; do
+    if [ ! -x "$tool" ]; then
+        echo "[ERROR] $tool not found, run 'make all bench' first" >&2
+        exit 1
+    fi
+done
+
+mkdir -p "$DIR"
+LOOKUP="$DIR/lookup_${ENTRIES}.lookup"
+SNAPSHOT="$DIR/lookup_${ENTRIES}.snapshot"
+M8="$DIR/m8_${ROWS}_${ENTRIES}_${SKEW}.m8"
+SOCKET="$DIR/bench.sock"
+SERVER_PID=""
+SHARD_PIDS=()
+
+stop_server() {
+    if [ -n "$SERVER_PID" ]; then
+        kill "$SERVER_PID" 2>/dev/null || true
+        wait "$SERVER_PID" 2>/dev/null || true
+        SERVER_PID=""
+    fi
+}
+
+stop_shards() {
+    for pid in "${SHARD_PIDS[@]}"; do
+        kill "$pid" 2>/dev/null || true
+        wait "$pid" 2>/dev/null || true
+    done
+    SHARD_PIDS=()
+}
+trap 'stop_server; stop_shards' EXIT
+
+# 追加一条结果: emit <项目> <工具输出的 JSON>
+emit() {
+    printf '{"bench":"%s","label":"%s","entries":%s,"rows":%s,"result":%s}\n' \
+        "$1" "$LABEL" "$ENTRIES" "$ROWS" "$2" | tee -a "$OUT"
+}
+
+# 启动服务端并等待就绪，记录从启动到可服务的时间
+start_server() {
+    local name=$1
+    shift
+    ./convertserver "$@" "$SOCKET" --workers "$WORKERS" >/dev/null 2>"$DIR/server.log" &
+    SERVER_PID=$!
+    emit "$name" "$(./bench_load "$SOCKET" --mode wait --timeout 3600)"
+}
+
+# 1. 数据
+if [ ! -f "$LOOKUP" ]; then
+    emit generate_lookup "$(./bench_gen lookup "$LOOKUP" --entries "$ENTRIES")"
+fi
+if [ ! -f "$M8" ]; then
+    emit generate_m8 "$(./bench_gen m8 "$M8" --rows "$ROWS" --targets "$ENTRIES" --skew "$SKEW")"
+fi
+
+# 2. 加载: 文本 lookup，快照构建，快照启动 (之后的测量使用快照启动的服务端)
+start_server load_text "$LOOKUP"
+stop_server
+start=$(date +%s%N)
+./convertserver --build-snapshot "$LOOKUP" "$SNAPSHOT" >/dev/null 2>"$DIR/snapshot.log"
+emit build_snapshot "$(awk -v a="$start" -v b="$(date +%s%N)" 'BEGIN { printf "{\"seconds\":%.3f}", (b - a) / 1e9 }')"
+./bench_lookup "$SNAPSHOT" > "$DIR/lookup_kernel.jsonl"
+while read -r line; do
+    emit lookup_kernel "$line"
+done < "$DIR/lookup_kernel.jsonl"
+start_server load_snapshot "$SNAPSHOT"
+
+# 3. 查询吞吐与延迟
+for clients in $CLIENTS; do
+    emit load_get "$(./bench_load "$SOCKET" --mode get --clients "$clients" --pipeline 16 \
+        --duration "$DURATION" --id-range "$ENTRIES" --skew "$SKEW")"
+    emit load_batch "$(./bench_load "$SOCKET" --mode batch --clients "$clients" --batch-size 1000 \
+        --duration "$DURATION" --id-range "$ENTRIES" --skew "$SKEW")"
+    emit load_binary "$(./bench_load "$SOCKET" --mode binary --clients "$clients" --batch-size 100000 \
+        --duration "$DURATION" --id-range "$ENTRIES" --skew "$SKEW")"
+done
+
+# 4. 客户端转换
+for threads in $THREADS; do
+    ./convertalis-fast "$M8" "$DIR/out.m8" --socket-path "$SOCKET" --threads "$threads" \
+        --timing-json "$DIR/timing.json" 2>"$DIR/client.log"
+    emit convert "$(cat "$DIR/timing.json")"
+done
+./convertalis-fast "$M8" "$DIR/out.m8" --socket-path "$SOCKET" --server-convert \
+    --timing-json "$DIR/timing.json" 2>"$DIR/client.log"
+emit convert_server "$(cat "$DIR/timing.json")"
+rm -f "$DIR/out.m8"
+
+emit server_stats "$(./bench_load "$SOCKET" --mode stats)"
+stop_server
+
+# 5. 分片: 每个服务端从同一快照取出 hash:k/N 一片，经 TCP 回环查询
+if [ "$SHARDS" -gt 0 ]; then
+    SHARD_MAP="$DIR/shards.map"
+    : >"$SHARD_MAP"
+    for ((k = 0; k < SHARDS; k++)); do
+        ./convertserver "$SNAPSHOT" "$DIR/shard$k.sock" --shard "hash:$k/$SHARDS" --tcp "127.0.0.1:$((PORT + k))" \
+            --workers "$WORKERS" >/dev/null 2>"$DIR/shard$k.log" &
+        SHARD_PIDS+=($!)
+        echo "127.0.0.1:$((PORT + k)) hash:$k/$SHARDS" >>"$SHARD_MAP"
+    done
+    for ((k = 0; k < SHARDS; k++)); do
+        emit load_shard "$(./bench_load "127.0.0.1:$((PORT + k))" --mode wait --timeout 3600)"
+    done
+    for threads in $THREADS; do
+        ./convertalis-fast "$M8" "$DIR/out.m8" --shard-map "$SHARD_MAP" --threads "$threads" \
+            --timing-json "$DIR/timing.json" 2>"$DIR/client.log"
+        emit convert_sharded "$(cat "$DIR/timing.json")"
+    done
+    rm -f "$DIR/out.m8"
+    stop_shards
+fi
+echo "[INFO] Results appended to $OUT" >&2
@@ -3,7 +3,21 @@
  *
  * 用法: ./convertalis-fast <result.m8> <output.m8> --socket-path <path>
  *
- * 从 convertserver 获取 target 名称，避免加载大型 lookup 文件
+ * 从 convertserver 获取 target 名称，避免加载大型 lookup 文件。
+ * --format-output 选择 MMseqs2 兼容的输出列；theader / tseq / tlen / tcov / taxid
+ * 由服务端的目标库 (convertserver --target-db) 以列请求批量提供。
+ *
+ * 输入也可以是 MMseqs2 比对结果库 (存在 <input>.index 时): 直接 mmap 数据文件，
+ * 按 query key 分块并行解析，query 名称取自 --query-db 的 <queryDB>.lookup
+ *
+ * --socket-path 也可以是 host:port (convertserver --tcp)；--shard-map 给出多个分片服务端
+ * (见 shard.h)，每个批次按分片拆开并行查询，结果按原顺序合并
+ *
+ * --lookup 给出二进制 lookup 快照时不连接 convertserver，名称直接从映射的快照解析 (见 name_resolver.h)；
+ * --fallback-lookup 则只在 convertserver 不可用时改用该快照。两者都只能提供 target 名称
+ *
+ * --server-convert 把输入原样流式发给服务端 (CONVERT)，由服务端换上名称并流式返回转换后的行，
+ * 客户端不解析、不去重也不逐批查询；--server-convert-files 只发送路径，由服务端直接读写文件
  */
 
 #include <sys/socket.h>
@@ -19,121 +33,358 @@
 #include <unordered_map>
 #include <cstring>
 #include <cstdlib>
+#include <cstdio>
 #include <chrono>
 #include <thread>
-#include <sstream>
-#include <iomanip>
+#include <memory>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <climits>
+#include <functional>
+#include <algorithm>
+
+#include "protocol.h"
+#include "name_table.h"
+#include "m8_reader.h"
+#include "m8_format.h"
+#include "mmseqs_db.h"
+#include "shard.h"
+#include "name_resolver.h"
 
 // 连接到 convertserver 的客户端
 class ConvertClient {
 private:
     int sock;
-    std::string socketPath;
+    std::string address;  // unix socket 路径或 host:port
+    bool binary;  // 是否已协商二进制协议
+    uint32_t columns;  // 每个 ID 取的 TargetColumn 位；只有 COLUMN_NAME 时使用普通 BATCH
+    std::string pending;  // 文本协议下已接收、尚未消费的数据
     char buffer[1048576];  // 1MB buffer
 
+    // 读取一行文本响应 (不含换行符)，多个流水线响应可能在同一次 recv 中到达
+    bool readLine(std::string& line) {
+        size_t nl;
+        while ((nl = pending.find('\n')) == std::string::npos) {
+            ssize_t bytesRead = recv(sock, buffer, sizeof(buffer), 0);
+            if (bytesRead < 0 && errno == EINTR) continue;
+            if (bytesRead <= 0) return false;
+            pending.append(buffer, bytesRead);
+        }
+        line.assign(pending, 0, nl);
+        pending.erase(0, nl + 1);
+        return true;
+    }
+
+    // CONVERT 的响应: 行帧依次写入 outFd，直到长度为 0 的结束帧与汇总行
+    bool receiveConverted(int outFd, uint64_t& rows, uint64_t& notFound, std::string& error) {
+        char header[BIN_CONVERT_HEADER_SIZE];
+        while (true) {
+            if (!recvAll(sock, header, 1)) {
+                error = "connection closed";
+                return false;
+            }
+            if ((unsigned char)header[0] != BIN_CONVERT_MAGIC) {
+                // 错误响应为一行文本
+                pending.assign(1, header[0]);
+                if (!readLine(error)) error = "connection closed";
+                return false;
+            }
+            if (!recvAll(sock, header + 1, BIN_CONVERT_HEADER_SIZE - 1)) {
+                error = "connection closed";
+                return false;
+            }
+            size_t len = getU32(header + 1);
+            if (len == 0) break;
+            while (len > 0) {
+                size_t n = std::min(len, sizeof(buffer));
+                if (!recvAll(sock, buffer, n)) {
+                    error = "connection closed";
+                    return false;
+                }
+                for (size_t done = 0; done < n;) {
+                    ssize_t written = ::write(outFd, buffer + done, n - done);
+                    if (written < 0 && errno == EINTR) continue;
+                    if (written <= 0) {
+                        error = std::string("cannot write output: ") + strerror(errno);
+                        return false;
+                    }
+                    done += written;
+                }
+                len -= n;
+            }
+        }
+        std::string response;
+        if (!readLine(response)) {
+            error = "connection closed";
+            return false;
+        }
+        return parseConverted(response, rows, notFound, error);
+    }
+
+    // "OK CONVERTED <rows> <notFound>"
+    static bool parseConverted(const std::string& response, uint64_t& rows, uint64_t& notFound, std::string& error) {
+        unsigned long long r = 0, missing = 0;
+        if (sscanf(response.c_str(), "OK CONVERTED %llu %llu", &r, &missing) != 2) {
+            error = response;
+            return false;
+        }
+        rows = r;
+        notFound = missing;
+        return true;
+    }
+
 public:
-    ConvertClient(const std::string& path) : sock(-1), socketPath(path) {}
+    // 发送一个批量请求 (不等待响应)。发送与接收可以在两个线程中同时进行
+    bool sendBatch(const uint32_t* ids, size_t count) {
+        if (binary && columns != COLUMN_NAME) {
+            // 列请求: 帧头 + 列位 + 打包的 ID
+            std::string request(BIN_COLUMNS_HEADER_SIZE, (char)BIN_COLUMNS_MAGIC);
+            putU32(&request[1], (uint32_t)count);
+            putU32(&request[5], columns);
+            request.append((const char*)ids, 4 * count);
+            return sendAll(sock, request.data(), request.size());
+        }
+        if (binary) {
+            // 二进制 BATCH: 帧头 + 打包的 ID
+            std::string request(BIN_HEADER_SIZE, (char)BIN_MAGIC);
+            putU32(&request[1], (uint32_t)count);
+            request.append((const char*)ids, 4 * count);
+            return sendAll(sock, request.data(), request.size());
+        }
 
-    bool connect() {
-        sock = socket(AF_UNIX, SOCK_STREAM, 0);
-        if (sock < 0) {
+        std::string request = "BATCH";
+        for (size_t i = 0; i < count; i++) {
+            request += " " + std::to_string(ids[i]);
+        }
+        request += "\n";
+        return sendAll(sock, request.data(), request.size());
+    }
+
+    // 读取一个批量请求的响应，写入 results[0..count × valuesPerId())
+    bool readBatch(size_t ids, std::string* results) {
+        size_t count = ids * valuesPerId();
+        if (binary) {
+            // 二进制响应: 读取长度表 → 按长度切分名称
+            char header[BIN_HEADER_SIZE];
+            std::vector<char> lengths(4 * count);
+            if (!recvAll(sock, header, sizeof(header)) ||
+                (unsigned char)header[0] != BIN_MAGIC || getU32(header + 1) != count ||
+                !recvAll(sock, lengths.data(), lengths.size())) {
+                return false;
+            }
+
+            size_t nameBytes = 0;
+            for (size_t i = 0; i < count; i++) {
+                uint32_t len = getU32(&lengths[4 * i]);
+                if (len != BIN_NOT_FOUND) nameBytes += len;
+            }
+            std::vector<char> names(nameBytes);
+            if (!recvAll(sock, names.data(), nameBytes)) {
+                return false;
+            }
+
+            size_t offset = 0;
+            for (size_t i = 0; i < count; i++) {
+                uint32_t len = getU32(&lengths[4 * i]);
+                if (len == BIN_NOT_FOUND) {
+                    results[i] = "NOT_FOUND";
+                } else {
+                    results[i].assign(names.data() + offset, len);
+                    offset += len;
+                }
+            }
+            return true;
+        }
+
+        // 文本响应: 一行，\t 分隔
+        std::string response;
+        if (!readLine(response)) {
             return false;
         }
+        size_t start = 0;
+        for (size_t i = 0; i < count; i++) {
+            size_t tab = response.find('\t', start);
+            if (tab == std::string::npos) tab = response.size();
+            results[i].assign(response, start, tab - start);
+            start = tab + 1;
+        }
+        return true;
+    }
 
-        struct sockaddr_un addr;
-        memset(&addr, 0, sizeof(addr));
-        addr.sun_family = AF_UNIX;
-        strncpy(addr.sun_path, socketPath.c_str(), sizeof(addr.sun_path) - 1);
+    ConvertClient(const std::string& addr) : sock(-1), address(addr), binary(false), columns(COLUMN_NAME) {}
 
-        if (::connect(sock, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
-            ::close(sock);
-            sock = -1;
+    bool connect() {
+        std::string error;
+        sock = connectAddress(address, error);
+        return sock >= 0;
+    }
+
+    // 协商二进制协议，旧版本服务端不支持时继续使用文本协议
+    bool negotiateBinary() {
+        if (!sendAll(sock, BIN_HELLO, strlen(BIN_HELLO))) return false;
+
+        std::string response;
+        if (!readLine(response)) return false;
+        binary = (response + "\n" == BIN_HELLO_OK);
+        return binary;
+    }
+
+    bool isBinary() const { return binary; }
+
+    // 之后的批量请求每个 ID 取 columns 中的各列 (需要二进制协议)，结果按 ID 依次排列
+    void selectColumns(uint32_t selected) { columns = selected; }
+
+    size_t valuesPerId() const { return (size_t)columnCount(columns); }
+
+    // 查询服务端当前表可提供的列 (COLUMNS)；旧版本服务端只提供名称
+    bool availableColumns(uint32_t& available, std::string& error) {
+        std::string response;
+        if (!sendAll(sock, "COLUMNS\n", 8) || !readLine(response)) {
+            error = "connection closed";
             return false;
         }
+        available = COLUMN_NAME;
+        if (response.compare(0, 7, "COLUMNS") != 0) return true;
+        size_t start = 8;
+        while (start < response.size()) {
+            size_t space = response.find(' ', start);
+            if (space == std::string::npos) space = response.size();
+            std::string name = response.substr(start, space - start);
+            for (int c = 0; (1u << c) <= COLUMN_ALL; c++) {
+                if (name == TARGET_COLUMN_NAMES[c]) available |= 1u << c;
+            }
+            start = space + 1;
+        }
+        return true;
+    }
 
+    // 选择服务端托管的命名表，之后本连接上的查询 (包括二进制 BATCH) 都使用该表
+    bool useTable(const std::string& name, std::string& error) {
+        std::string request = "USE " + name + "\n";
+        std::string response;
+        if (!sendAll(sock, request.data(), request.size()) || !readLine(response)) {
+            error = "connection closed";
+            return false;
+        }
+        if (response.compare(0, 3, "OK ") != 0) {
+            error = response;
+            return false;
+        }
         return true;
     }
 
-    // 查询单个 ID
-    std::string getName(uint32_t id) {
-        std::string request = "GET " + std::to_string(id) + "\n";
-        send(sock, request.c_str(), request.size(), 0);
+    int fd() const { return sock; }
 
-        ssize_t bytesRead = recv(sock, buffer, sizeof(buffer) - 1, 0);
-        if (bytesRead <= 0) {
-            return "ERROR";
+    // 共享内存握手: 向服务端索取其只读表的文件路径并直接映射，
+    // 之后的名称查询都是本进程内的内存读取，socket 只用于握手与存活检测
+    bool attachShared(NameResolver& table, std::string& error) {
+        std::string request = "SHM\n";
+        std::string response;
+        if (!sendAll(sock, request.data(), request.size()) || !readLine(response)) {
+            error = "connection closed";
+            return false;
+        }
+        if (response.compare(0, 4, "SHM ") != 0) {
+            error = response;
+            return false;
         }
+        size_t space = response.find(' ', 4);
+        std::string path = response.substr(4, space == std::string::npos ? std::string::npos : space - 4);
+        return table.open(path, false, error);
+    }
 
-        buffer[bytesRead] = '\0';
-        std::string response(buffer);
+    // 服务端流式转换 (CONVERT): 发送线程把 data 作为 M8 数据发出，本线程同时接收转换后的行帧并写入 outFd。
+    // 收发并行，服务端输出的背压不会与发送互相等待
+    bool convertStream(const char* data, size_t size, bool passthrough, int outFd, uint64_t& rows,
+                       uint64_t& notFound, std::string& error) {
+        std::string request = "CONVERT " + std::to_string(size) + (passthrough ? " passthrough" : "") + "\n";
+        bool sent = false;
+        std::thread sender([&] {
+            const size_t SLICE = 1 << 20;
+            sent = sendAll(sock, request.data(), request.size());
+            for (size_t pos = 0; sent && pos < size; pos += SLICE) {
+                sent = sendAll(sock, data + pos, std::min(SLICE, size - pos));
+            }
+        });
+        bool ok = receiveConverted(outFd, rows, notFound, error);
+        if (!ok) shutdown(sock, SHUT_RDWR);  // 服务端不再读取时解除发送线程的阻塞
+        sender.join();
+        return ok;
+    }
 
-        // 移除换行符
-        if (!response.empty() && response.back() == '\n') {
-            response.pop_back();
+    // 服务端文件转换 (CONVERTFILE): 路径须为服务端可访问的绝对路径
+    bool convertFile(const std::string& input, const std::string& output, bool passthrough, uint64_t& rows,
+                     uint64_t& notFound, std::string& error) {
+        std::string request = "CONVERTFILE " + input + " " + output + (passthrough ? " passthrough" : "") + "\n";
+        std::string response;
+        if (!sendAll(sock, request.data(), request.size()) || !readLine(response)) {
+            error = "connection closed";
+            return false;
         }
+        return parseConverted(response, rows, notFound, error);
+    }
+
+    // 存活检测
+    bool ping() {
+        std::string response;
+        return sendAll(sock, "PING\n", 5) && readLine(response) && response == "PONG";
+    }
 
+    // 查询单个 ID
+    std::string getName(uint32_t id) {
+        std::string request = "GET " + std::to_string(id) + "\n";
+        std::string response;
+        if (!sendAll(sock, request.data(), request.size()) || !readLine(response)) {
+            return "ERROR";
+        }
         return response;
     }
 
     // 批量查询
     std::vector<std::string> getNames(const std::vector<uint32_t>& ids) {
-        std::vector<std::string> results;
-        results.reserve(ids.size());
-
+        std::vector<std::string> results(ids.size());
         if (ids.empty()) return results;
 
-        // 构建批量请求
-        std::string request = "BATCH";
-        for (uint32_t id : ids) {
-            request += " " + std::to_string(id);
+        if (!sendBatch(ids.data(), ids.size()) || !readBatch(ids.size(), results.data())) {
+            results.assign(ids.size(), "ERROR");
         }
-        request += "\n";
+        return results;
+    }
 
-        // 确保完整发送
-        size_t totalSent = 0;
-        while (totalSent < request.size()) {
-            ssize_t sent = send(sock, request.c_str() + totalSent, request.size() - totalSent, 0);
-            if (sent <= 0) {
-                for (size_t i = 0; i < ids.size(); i++) {
-                    results.push_back("ERROR");
-                }
-                return results;
-            }
-            totalSent += sent;
-        }
+    // 流水线批量查询: 发送线程连续写出所有批次，当前线程按顺序读取响应，
+    // 不必每批等待一次往返。progress(已完成数) 在每批响应读完后调用。
+    std::vector<std::string> getNamesPipelined(const std::vector<uint32_t>& ids, size_t batchSize,
+                                               const std::function<void(size_t)>& progress) {
+        std::vector<std::string> results(ids.size());
+        if (ids.empty()) return results;
+        batchSize = std::max<size_t>(1, batchSize);
 
-        // 循环接收直到收到完整响应（以换行符结尾）
-        std::string response;
-        while (true) {
-            ssize_t bytesRead = recv(sock, buffer, sizeof(buffer) - 1, 0);
-            if (bytesRead <= 0) {
-                for (size_t i = 0; i < ids.size(); i++) {
-                    results.push_back("ERROR");
+        std::thread sender([&]() {
+            for (size_t i = 0; i < ids.size(); i += batchSize) {
+                size_t count = std::min(batchSize, ids.size() - i);
+                if (!sendBatch(ids.data() + i, count)) {
+                    // 发送失败: 关闭连接以唤醒等待响应的读取方
+                    shutdown(sock, SHUT_RDWR);
+                    break;
                 }
-                return results;
             }
-            buffer[bytesRead] = '\0';
-            response += buffer;
+        });
 
-            // 检查是否接收完整
-            if (!response.empty() && response.back() == '\n') {
+        size_t done = 0;
+        for (size_t i = 0; i < ids.size(); i += batchSize) {
+            size_t count = std::min(batchSize, ids.size() - i);
+            if (!readBatch(count, results.data() + i)) {
+                // 连接出错: 剩余条目全部标记为 ERROR，关闭读方向以唤醒发送线程
+                for (size_t j = i; j < ids.size(); j++) results[j] = "ERROR";
+                shutdown(sock, SHUT_RDWR);
                 break;
             }
+            done += count;
+            if (progress) progress(done);
         }
-
-        // 解析响应（\t 分隔）
-        size_t pos = 0;
-        size_t start = 0;
-        while (pos < response.size()) {
-            if (response[pos] == '\t' || response[pos] == '\n') {
-                results.push_back(response.substr(start, pos - start));
-                start = pos + 1;
-            }
-            pos++;
-        }
-        if (start < response.size()) {
-            results.push_back(response.substr(start));
-        }
+        sender.join();
 
         return results;
     }
@@ -150,100 +401,667 @@ public:
     }
 };
 
-// 安全解析函数
-double safeStod(const std::string& s, double defaultVal = 0.0) {
-    try {
-        return std::stod(s);
-    } catch (...) {
-        return defaultVal;
+// 名称查询连接池: 每个分片 n 条连接 (不分片时只有一个分片)。批次按分片拆成子批次，
+// 子批次轮流分配到所在分片的各连接，各分片并行查询；每条连接一个发送线程、一个接收线程，
+// 请求连续流水线发送，响应按发送顺序读取，批次的结果全部到齐 (按原顺序放回) 即回调 done
+class FetchPool {
+public:
+    struct Batch {
+        const uint32_t* ids;
+        size_t count;
+        std::string* results;   // count × 每个 ID 的列数
+        std::function<void()> done;  // 在接收线程中调用
+    };
+
+private:
+    struct Lane {
+        std::unique_ptr<ConvertClient> client;
+        std::mutex mutex;
+        std::condition_variable wake;
+        std::deque<Batch> toSend;
+        std::deque<Batch> inFlight;
+        bool failed;
+        bool closing;
+        std::thread sender;
+        std::thread receiver;
+
+        Lane() : failed(false), closing(false) {}
+    };
+
+    // 按分片拆开的批次: 各子批次读完后在接收线程中把结果放回原批次的位置，最后完成的一个回调 done
+    struct Split {
+        Batch parent;
+        std::vector<std::vector<uint32_t> > ids;       // 按分片
+        std::vector<std::vector<size_t> > positions;   // 子批次中各 ID 在原批次中的下标
+        std::vector<std::vector<std::string> > results;
+        std::atomic<size_t> pending;
+    };
+
+    std::vector<std::unique_ptr<Lane> > lanes;  // 分片 s 的连接为 lanes[s * lanesPerShard, (s + 1) * lanesPerShard)
+    size_t lanesPerShard;
+    size_t valuesPerId;
+    ShardMap shards;
+    std::atomic<size_t> nextLane;
+
+    void enqueue(size_t shard, const Batch& batch) {
+        Lane* lane = lanes[shard * lanesPerShard + nextLane++ % lanesPerShard].get();
+        {
+            std::lock_guard<std::mutex> lock(lane->mutex);
+            lane->toSend.push_back(batch);
+        }
+        lane->wake.notify_all();
+    }
+
+    static void sendLoop(Lane* lane) {
+        for (;;) {
+            Batch batch;
+            bool failed;
+            {
+                std::unique_lock<std::mutex> lock(lane->mutex);
+                lane->wake.wait(lock, [&]() { return lane->closing || !lane->toSend.empty(); });
+                if (lane->toSend.empty()) return;
+                batch = lane->toSend.front();
+                lane->toSend.pop_front();
+                lane->inFlight.push_back(batch);
+                failed = lane->failed;
+            }
+            lane->wake.notify_all();
+            if (!failed && !lane->client->sendBatch(batch.ids, batch.count)) {
+                // 发送失败: 关闭连接以唤醒等待响应的接收线程
+                shutdown(lane->client->fd(), SHUT_RDWR);
+            }
+        }
+    }
+
+    static void receiveLoop(Lane* lane) {
+        for (;;) {
+            Batch batch;
+            bool failed;
+            {
+                std::unique_lock<std::mutex> lock(lane->mutex);
+                lane->wake.wait(lock, [&]() {
+                    return !lane->inFlight.empty() || (lane->closing && lane->toSend.empty());
+                });
+                if (lane->inFlight.empty()) return;
+                batch = lane->inFlight.front();
+                failed = lane->failed;
+            }
+            if (failed || !lane->client->readBatch(batch.count, batch.results)) {
+                // 连接出错: 该批次及之后分配到此连接的批次全部标记为 ERROR
+                size_t values = batch.count * lane->client->valuesPerId();
+                for (size_t i = 0; i < values; i++) batch.results[i] = "ERROR";
+                if (!failed) {
+                    std::cerr << "[ERROR] Lost connection to convertserver, remaining names on it marked ERROR" << std::endl;
+                    shutdown(lane->client->fd(), SHUT_RDWR);
+                }
+                std::lock_guard<std::mutex> lock(lane->mutex);
+                lane->failed = true;
+            }
+            {
+                std::lock_guard<std::mutex> lock(lane->mutex);
+                lane->inFlight.pop_front();
+            }
+            batch.done();
+        }
     }
+
+public:
+    FetchPool() : lanesPerShard(1), valuesPerId(1), nextLane(0) {}
+
+    ~FetchPool() { close(); }
+
+    // 向 map 中的每个分片建立 n 条连接 (协商二进制协议，除非 textProtocol；tableName 非空时选择该表)，
+    // 每个 ID 取 columns 中的各列
+    bool open(const ShardMap& map, int n, bool textProtocol, const std::string& tableName, uint32_t columns) {
+        shards = map;
+        lanesPerShard = n;
+        valuesPerId = (size_t)columnCount(columns);
+        for (size_t s = 0; s < shards.size(); s++) {
+            const std::string& address = shards[s].address;
+            for (int i = 0; i < n; i++) {
+                std::unique_ptr<Lane> lane(new Lane());
+                lane->client.reset(new ConvertClient(address));
+                if (!lane->client->connect()) {
+                    std::cerr << "[ERROR] Cannot open connection " << i << " to convertserver at " << address << std::endl;
+                    return false;
+                }
+                if (!textProtocol) lane->client->negotiateBinary();
+                std::string error;
+                if (!tableName.empty() && !lane->client->useTable(tableName, error)) {
+                    std::cerr << "[ERROR] Cannot use table " << tableName << " at " << address << ": " << error << std::endl;
+                    return false;
+                }
+                lane->client->selectColumns(columns);
+                lanes.push_back(std::move(lane));
+            }
+        }
+        for (auto& lane : lanes) {
+            lane->sender = std::thread(sendLoop, lane.get());
+            lane->receiver = std::thread(receiveLoop, lane.get());
+        }
+        return true;
+    }
+
+    // 提交一个批次，立即返回。不属于任何分片的 ID 直接记为 NOT_FOUND
+    void submit(const Batch& batch) {
+        if (shards.size() == 1 && !shards[0].spec.partial()) {
+            enqueue(0, batch);
+            return;
+        }
+        std::shared_ptr<Split> split(new Split());
+        split->ids.resize(shards.size());
+        split->positions.resize(shards.size());
+        size_t routed = 0;
+        for (size_t i = 0; i < batch.count; i++) {
+            int shard = shards.shardOf(batch.ids[i]);
+            if (shard < 0) {
+                for (size_t k = 0; k < valuesPerId; k++) batch.results[i * valuesPerId + k] = "NOT_FOUND";
+                continue;
+            }
+            split->ids[shard].push_back(batch.ids[i]);
+            split->positions[shard].push_back(i);
+            routed++;
+        }
+        std::vector<size_t> targets;
+        for (size_t s = 0; s < shards.size(); s++) {
+            if (!split->ids[s].empty()) targets.push_back(s);
+        }
+        if (targets.empty()) {
+            batch.done();
+            return;
+        }
+        if (targets.size() == 1 && routed == batch.count) {
+            // 整批落在一个分片: 原样提交，无需拆分与合并
+            enqueue(targets[0], batch);
+            return;
+        }
+        split->parent = batch;
+        split->results.resize(shards.size());
+        split->pending = targets.size();
+        size_t values = valuesPerId;
+        for (size_t s : targets) {
+            split->results[s].resize(split->ids[s].size() * values);
+            Batch part;
+            part.ids = split->ids[s].data();
+            part.count = split->ids[s].size();
+            part.results = split->results[s].data();
+            part.done = [split, s, values]() {
+                const std::vector<size_t>& positions = split->positions[s];
+                std::vector<std::string>& results = split->results[s];
+                for (size_t j = 0; j < positions.size(); j++) {
+                    for (size_t k = 0; k < values; k++) {
+                        split->parent.results[positions[j] * values + k].swap(results[j * values + k]);
+                    }
+                }
+                if (--split->pending == 0) split->parent.done();
+            };
+            enqueue(s, part);
+        }
+    }
+
+    // 等待已提交的批次全部完成后关闭连接
+    void close() {
+        for (auto& lane : lanes) {
+            {
+                std::lock_guard<std::mutex> lock(lane->mutex);
+                lane->closing = true;
+            }
+            lane->wake.notify_all();
+        }
+        for (auto& lane : lanes) {
+            if (lane->sender.joinable()) lane->sender.join();
+            if (lane->receiver.joinable()) lane->receiver.join();
+            lane->client->close();
+        }
+        lanes.clear();
+    }
+};
+
+// 输入中的一个行对齐块，依次经过: 解析 → 等待名称 → 格式化 → 主线程按原顺序写出。
+// 解析后提交名称查询即可继续解析下一块，名称到齐的块先格式化，与仍在途的查询重叠。
+// M8 输入时 [begin, end) 为字节区间，结果库输入时为索引槽位区间。
+struct Chunk {
+    size_t begin;
+    size_t end;
+    size_t rows;
+    std::string queryNames;  // 结果库输入: 块内各 query 的名称拼接，行的 lineOffset 指向这里
+
+    // 解析结果与块内去重后的 target ID，格式化后释放
+    AlignmentColumns columns;
+    std::vector<uint32_t> ids;
+    std::vector<uint32_t> rowSlot;
+    std::vector<std::string> values;  // 每个 ID 的各列 (默认只有名称)，ids[k] 的值从 k × 列数开始
+    size_t pendingBatches;
+
+    OutputBuffer* output;  // 从缓冲池借出，写出后归还
+    bool done;
+
+    Chunk(size_t b, size_t e) : begin(b), end(e), rows(0), pendingBatches(0), output(NULL), done(false) {}
+};
+
+// 单个阶段的累计线程时间与时间跨度 (相对开始时刻的微秒)，用于观察各阶段的重叠
+struct PhaseStat {
+    std::atomic<long long> busy;
+    std::atomic<long long> first;
+    std::atomic<long long> last;
+
+    PhaseStat() : busy(0), first(LLONG_MAX), last(0) {}
+
+    void record(long long startMicros, long long endMicros) {
+        busy += endMicros - startMicros;
+        long long seen = first.load();
+        while (startMicros < seen && !first.compare_exchange_weak(seen, startMicros)) {}
+        seen = last.load();
+        while (endMicros > seen && !last.compare_exchange_weak(seen, endMicros)) {}
+    }
+
+    std::string describe() const {
+        if (first.load() == LLONG_MAX) return "-";
+        return std::to_string(first.load() / 1000) + "-" + std::to_string(last.load() / 1000) + "ms";
+    }
+
+    // --timing-json 中的一项 (微秒，未执行的阶段 first/last 为 -1)
+    std::string json() const {
+        bool ran = first.load() != LLONG_MAX;
+        return "{\"busy_us\":" + std::to_string(busy.load()) +
+               ",\"first_us\":" + std::to_string(ran ? first.load() : -1) +
+               ",\"last_us\":" + std::to_string(ran ? last.load() : -1) + "}";
+    }
+};
+
+struct PhaseTimes {
+    std::chrono::steady_clock::time_point origin;
+    PhaseStat parse;
+    PhaseStat fetch;   // 批次提交 → 响应读完
+    PhaseStat format;
+    PhaseStat write;
+
+    explicit PhaseTimes(std::chrono::steady_clock::time_point start) : origin(start) {}
+
+    long long now() const {
+        return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - origin).count();
+    }
+};
+
+// 输出列需要服务端提供的 TargetColumn 位 (来自输入的列为 0)
+static constexpr uint32_t targetColumnOf(OutputColumn column) {
+    return column == OUT_TARGET ? (uint32_t)COLUMN_NAME
+         : column == OUT_THEADER ? (uint32_t)COLUMN_HEADER
+         : column == OUT_TSEQ ? (uint32_t)COLUMN_SEQUENCE
+         : column == OUT_TLEN || column == OUT_TCOV ? (uint32_t)COLUMN_LENGTH
+         : column == OUT_TAXID ? (uint32_t)COLUMN_TAXID : 0u;
+}
+
+// 不需要任何 target 列时仍按名称查询，保持请求形式不变
+static constexpr uint32_t fetchedColumns(uint32_t used) {
+    return used == 0 ? (uint32_t)COLUMN_NAME : used;
+}
+
+static constexpr int bitCount(uint32_t v) {
+    return v == 0 ? 0 : 1 + bitCount(v & (v - 1));
+}
+
+struct OutputLayout;
+
+// 格式化一个块的所有行到 chunk.output，启动时按列列表选定
+typedef void (*RowFormatter)(const char* data, Chunk& chunk, const OutputLayout& layout);
+
+// 输出格式与选定的行写出器
+struct OutputLayout {
+    std::vector<OutputColumn> columns;
+    uint32_t targetColumns;  // 需要向服务端请求的 TargetColumn 位
+    bool passthrough;        // 仅默认 12 列
+    RowFormatter formatRows;
+    const char* writer;      // 行写出器名称，用于日志
+
+    OutputLayout() : targetColumns(COLUMN_NAME), passthrough(false), formatRows(NULL), writer("") {}
+
+    bool parse(const std::string& spec, std::string& error) {
+        if (!parseOutputFormat(spec, columns, error)) return false;
+        uint32_t used = 0;
+        for (OutputColumn column : columns) used |= targetColumnOf(column);
+        targetColumns = fetchedColumns(used);
+        return true;
+    }
+
+    size_t valuesPerId() const { return (size_t)columnCount(targetColumns); }
+
+    // column 在每个 ID 的值中的位置，未请求时为 -1
+    int valueIndex(uint32_t column) const {
+        return (targetColumns & column) ? columnCount(targetColumns & (column - 1)) : -1;
+    }
+};
+
+// 按约 chunkBytes 切分 [0, size)，切分点后移到下一个换行符之后
+static std::vector<std::unique_ptr<Chunk> > splitIntoChunks(const char* data, size_t size, size_t chunkBytes) {
+    std::vector<std::unique_ptr<Chunk> > chunks;
+    size_t begin = 0;
+    while (begin < size) {
+        size_t end = std::min(size, begin + chunkBytes);
+        if (end < size) {
+            const char* nl = (const char*)memchr(data + end, '\n', size - end);
+            end = nl ? (size_t)(nl - data) + 1 : size;
+        }
+        chunks.push_back(std::unique_ptr<Chunk>(new Chunk(begin, end)));
+        begin = end;
+    }
+    return chunks;
+}
+
+// 按约 chunkBytes 把结果库的槽位切分成块 (每块至少一个 query 条目)
+static std::vector<std::unique_ptr<Chunk> > splitResultDB(const MmseqsDB& db, size_t chunkBytes) {
+    std::vector<std::unique_ptr<Chunk> > chunks;
+    size_t begin = 0;
+    size_t bytes = 0;
+    for (size_t i = 0; i < db.slotCount(); i++) {
+        bytes += db.slotBytes(i);
+        if (bytes >= chunkBytes) {
+            chunks.push_back(std::unique_ptr<Chunk>(new Chunk(begin, i + 1)));
+            begin = i + 1;
+            bytes = 0;
+        }
+    }
+    if (begin < db.slotCount()) chunks.push_back(std::unique_ptr<Chunk>(new Chunk(begin, db.slotCount())));
+    return chunks;
+}
+
+// 对块内 target ID 去重；localTable 非空时直接从本进程映射的表填入名称
+static void collectTargets(Chunk& chunk, size_t valuesPerId, const NameResolver* localTable) {
+    const AlignmentColumns& rows = chunk.columns;
+    chunk.rows = rows.size();
+
+    // 块内去重: 每行记录其 ID 在 ids 中的下标
+    std::unordered_map<uint32_t, uint32_t> slotOf;
+    chunk.rowSlot.resize(rows.size());
+    for (size_t i = 0; i < rows.size(); i++) {
+        auto inserted = slotOf.emplace(rows.targetId[i], (uint32_t)chunk.ids.size());
+        if (inserted.second) chunk.ids.push_back(rows.targetId[i]);
+        chunk.rowSlot[i] = inserted.first->second;
+    }
+    chunk.values.resize(chunk.ids.size() * valuesPerId);
+
+    if (localTable != NULL) {
+        localTable->resolve(chunk.ids.data(), chunk.ids.size(), chunk.values.data());
+    }
+}
+
+// 解析 M8 输入中的一个块
+static void parseChunk(const char* data, Chunk& chunk, size_t valuesPerId, const NameResolver* localTable) {
+    chunk.columns.reserve((chunk.end - chunk.begin) / 96 + 1);
+    parseM8(data, chunk.begin, chunk.end, chunk.columns);
+    collectTargets(chunk, valuesPerId, localTable);
 }
 
-int safeStoi(const std::string& s, int defaultVal = 0) {
-    try {
-        return std::stoi(s);
-    } catch (...) {
-        return defaultVal;
+// 解析结果库中的一个块: 按 key 顺序处理各 query 条目，query 名称取自 queryNames (缺失时为 key)
+static void parseResultChunk(const MmseqsDB& db, const LookupNames* queryNames, Chunk& chunk, size_t valuesPerId,
+                             const NameResolver* localTable) {
+    for (size_t slot = chunk.begin; slot < chunk.end; slot++) {
+        uint32_t key;
+        const char* text;
+        size_t len;
+        if (!db.slot(slot, key, text, len)) continue;
+
+        uint64_t nameOffset = chunk.queryNames.size();
+        const char* name;
+        size_t nameLen;
+        if (queryNames != NULL && queryNames->find(key, name, nameLen)) {
+            chunk.queryNames.append(name, nameLen);
+        } else {
+            char keyText[16];
+            chunk.queryNames.append(keyText, m8::formatUInt(keyText, key) - keyText);
+        }
+        parseResultEntry(text, len, nameOffset, (uint32_t)(chunk.queryNames.size() - nameOffset), chunk.columns);
     }
+    collectTargets(chunk, valuesPerId, localTable);
 }
 
-uint32_t safeStoul(const std::string& s, uint32_t defaultVal = 0) {
-    try {
-        return std::stoul(s);
-    } catch (...) {
-        return defaultVal;
+// 服务端返回的一列值: NOT_FOUND 视为缺失 (ERROR 原样输出，表示查询失败)
+static void fieldText(const std::string& value, const char*& text, size_t& len) {
+    if (value == "NOT_FOUND") {
+        text = NULL;
+        len = 0;
+    } else {
+        text = value.data();
+        len = value.size();
     }
 }
 
-// 解析 M8 格式的一行
-struct AlignmentResult {
-    std::string query;
-    uint32_t targetId;
-    double fident;
-    int alnlen;
-    int mismatch;
-    int gapopen;
-    int qstart;
-    int qend;
-    int tstart;
-    int tend;
-    double evalue;
-    double bits;
-
-    static AlignmentResult parse(const std::string& line) {
-        AlignmentResult r;
-        r.targetId = 0;
-        r.fident = 0;
-        r.alnlen = 0;
-        r.mismatch = 0;
-        r.gapopen = 0;
-        r.qstart = 0;
-        r.qend = 0;
-        r.tstart = 0;
-        r.tend = 0;
-        r.evalue = 0;
-        r.bits = 0;
-
-        std::istringstream iss(line);
-        std::string field;
-
-        if (!std::getline(iss, r.query, '\t')) return r;
-        if (!std::getline(iss, field, '\t')) return r;
-        r.targetId = safeStoul(field);
-        if (!std::getline(iss, field, '\t')) return r;
-        r.fident = safeStod(field);
-        if (!std::getline(iss, field, '\t')) return r;
-        r.alnlen = safeStoi(field);
-        if (!std::getline(iss, field, '\t')) return r;
-        r.mismatch = safeStoi(field);
-        if (!std::getline(iss, field, '\t')) return r;
-        r.gapopen = safeStoi(field);
-        if (!std::getline(iss, field, '\t')) return r;
-        r.qstart = safeStoi(field);
-        if (!std::getline(iss, field, '\t')) return r;
-        r.qend = safeStoi(field);
-        if (!std::getline(iss, field, '\t')) return r;
-        r.tstart = safeStoi(field);
-        if (!std::getline(iss, field, '\t')) return r;
-        r.tend = safeStoi(field);
-        if (!std::getline(iss, field, '\t')) return r;
-        r.evalue = safeStod(field);
-        if (!std::getline(iss, field, '\t')) return r;
-        r.bits = safeStod(field);
-
-        return r;
+// target 名称，NOT_FOUND 时输出数字 ID
+static void targetName(const std::string& name, uint32_t targetId, char* idText, TargetFields& target) {
+    if (name.empty() || name == "NOT_FOUND") {
+        target.name = idText;
+        target.nameLen = m8::formatUInt(idText, targetId) - idText;
+    } else {
+        target.name = name.data();
+        target.nameLen = name.size();
     }
+}
+
+// 默认 12 列: 手写的 appendAlignmentRow，支持 --passthrough
+static void formatRowsM8(const char* data, Chunk& chunk, const OutputLayout& layout) {
+    const AlignmentColumns& rows = chunk.columns;
+    OutputBuffer& out = *chunk.output;
+    for (size_t i = 0; i < rows.size(); i++) {
+        uint32_t targetId = rows.targetId[i];
+
+        // 获取 target 名称，NOT_FOUND 时输出数字 ID
+        const std::string& name = chunk.values[chunk.rowSlot[i]];
+        if (name.empty() || name == "NOT_FOUND") {
+            char idText[16];
+            char* idEnd = m8::formatUInt(idText, targetId);
+            appendAlignmentRow(out, data, rows, i, idText, idEnd - idText, layout.passthrough);
+        } else {
+            appendAlignmentRow(out, data, rows, i, name.data(), name.size(), layout.passthrough);
+        }
+    }
+}
+
+// 编译期列列表需要的 TargetColumn 位
+template <OutputColumn... Columns>
+struct TargetColumnsOf {
+    static const uint32_t value = 0;
+};
+
+template <OutputColumn C, OutputColumn... Rest>
+struct TargetColumnsOf<C, Rest...> {
+    static const uint32_t value = targetColumnOf(C) | TargetColumnsOf<Rest...>::value;
 };
 
+// 常用列组合的特化写出器: 需要哪些 target 值与它们在每个 ID 的值中的位置都在编译期确定
+template <OutputColumn... Columns>
+static void formatRowsAs(const char* data, Chunk& chunk, const OutputLayout&) {
+    static const uint32_t used = TargetColumnsOf<Columns...>::value;
+    static const uint32_t fetched = fetchedColumns(used);
+    static const size_t perId = bitCount(fetched);
+    const AlignmentColumns& rows = chunk.columns;
+    OutputBuffer& out = *chunk.output;
+    for (size_t i = 0; i < rows.size(); i++) {
+        const std::string* values = &chunk.values[chunk.rowSlot[i] * perId];
+        TargetFields target;
+        char idText[16];
+        if (used & COLUMN_NAME) {
+            targetName(values[bitCount(fetched & (COLUMN_NAME - 1))], rows.targetId[i], idText, target);
+        }
+        if (used & COLUMN_HEADER) {
+            fieldText(values[bitCount(fetched & (COLUMN_HEADER - 1))], target.header, target.headerLen);
+        }
+        if (used & COLUMN_SEQUENCE) {
+            fieldText(values[bitCount(fetched & (COLUMN_SEQUENCE - 1))], target.sequence, target.sequenceLen);
+        }
+        if (used & COLUMN_LENGTH) {
+            fieldText(values[bitCount(fetched & (COLUMN_LENGTH - 1))], target.length, target.lengthLen);
+        }
+        if (used & COLUMN_TAXID) {
+            fieldText(values[bitCount(fetched & (COLUMN_TAXID - 1))], target.taxid, target.taxidLen);
+        }
+        RowWriter<Columns...>::append(out, data, rows, i, target);
+    }
+}
+
+// 任意列列表: 逐行组装 TargetFields，逐列解释
+static void formatRowsGeneric(const char* data, Chunk& chunk, const OutputLayout& layout) {
+    const AlignmentColumns& rows = chunk.columns;
+    OutputBuffer& out = *chunk.output;
+    for (size_t i = 0; i < rows.size(); i++) {
+        const std::string* values = &chunk.values[chunk.rowSlot[i] * layout.valuesPerId()];
+        TargetFields target;
+        char idText[16];
+        int index;
+        if ((index = layout.valueIndex(COLUMN_NAME)) >= 0) targetName(values[index], rows.targetId[i], idText, target);
+        if ((index = layout.valueIndex(COLUMN_HEADER)) >= 0) fieldText(values[index], target.header, target.headerLen);
+        if ((index = layout.valueIndex(COLUMN_SEQUENCE)) >= 0) fieldText(values[index], target.sequence, target.sequenceLen);
+        if ((index = layout.valueIndex(COLUMN_LENGTH)) >= 0) fieldText(values[index], target.length, target.lengthLen);
+        if ((index = layout.valueIndex(COLUMN_TAXID)) >= 0) fieldText(values[index], target.taxid, target.taxidLen);
+        appendFormattedRow(out, data, rows, i, layout.columns, target);
+    }
+}
+
+// 编译期特化的常用列组合，其余列表走 formatRowsGeneric
+struct SpecializedFormat {
+    const char* spec;
+    RowFormatter formatRows;
+};
+
+static const SpecializedFormat SPECIALIZED_FORMATS[] = {
+    {"query,target", formatRowsAs<OUT_QUERY, OUT_TARGET>},
+    {"query,target,evalue,bits", formatRowsAs<OUT_QUERY, OUT_TARGET, OUT_EVALUE, OUT_BITS>},
+    {"query,target,theader,evalue,bits", formatRowsAs<OUT_QUERY, OUT_TARGET, OUT_THEADER, OUT_EVALUE, OUT_BITS>},
+    {"query,theader,fident,alnlen,mismatch,gapopen,qstart,qend,tstart,tend,evalue,bits",
+     formatRowsAs<OUT_QUERY, OUT_THEADER, OUT_FIDENT, OUT_ALNLEN, OUT_MISMATCH, OUT_GAPOPEN, OUT_QSTART, OUT_QEND,
+                  OUT_TSTART, OUT_TEND, OUT_EVALUE, OUT_BITS>},
+    {"query,target,fident,alnlen,mismatch,gapopen,qstart,qend,tstart,tend,evalue,bits,theader",
+     formatRowsAs<OUT_QUERY, OUT_TARGET, OUT_FIDENT, OUT_ALNLEN, OUT_MISMATCH, OUT_GAPOPEN, OUT_QSTART, OUT_QEND,
+                  OUT_TSTART, OUT_TEND, OUT_EVALUE, OUT_BITS, OUT_THEADER>},
+};
+
+// 启动时为列列表选定行写出器: 默认 12 列 → 手写循环，常用组合 → 特化模板，其余 → 逐列解释
+static void selectRowWriter(OutputLayout& layout) {
+    std::vector<OutputColumn> candidate;
+    std::string error;
+    if (parseOutputFormat(DEFAULT_FORMAT_OUTPUT, candidate, error) && candidate == layout.columns) {
+        layout.formatRows = formatRowsM8;
+        layout.writer = "default M8";
+        return;
+    }
+    for (const SpecializedFormat& format : SPECIALIZED_FORMATS) {
+        if (parseOutputFormat(format.spec, candidate, error) && candidate == layout.columns) {
+            layout.formatRows = format.formatRows;
+            layout.writer = "specialized";
+            return;
+        }
+    }
+    layout.formatRows = formatRowsGeneric;
+    layout.writer = "generic";
+}
+
+// 格式化一个名称已齐的块到 chunk.output，之后释放中间数据
+static void formatChunk(const char* data, Chunk& chunk, const OutputLayout& layout) {
+    layout.formatRows(data, chunk, layout);
+
+    chunk.columns = AlignmentColumns();
+    std::string().swap(chunk.queryNames);
+    std::vector<uint32_t>().swap(chunk.ids);
+    std::vector<uint32_t>().swap(chunk.rowSlot);
+    std::vector<std::string>().swap(chunk.values);
+}
+
+// --server-convert: 转换在服务端完成，客户端只传输数据 (或文件路径) 并写出结果
+static int convertOnServer(ConvertClient& client, const std::string& inputFile, const std::string& outputFile,
+                           bool passthrough, bool files, const std::string& timingFile,
+                           std::chrono::steady_clock::time_point startTotal) {
+    uint64_t rows = 0, notFound = 0, inputBytes = 0;
+    std::string error;
+    bool ok;
+    if (files) {
+        // 服务端的工作目录与客户端不同，路径一律转为绝对路径
+        char* resolved = realpath(inputFile.c_str(), NULL);
+        std::string input = resolved ? resolved : inputFile;
+        free(resolved);
+        std::string output = outputFile;
+        if (output.empty() || output[0] != '/') {
+            char* cwd = getcwd(NULL, 0);
+            output = std::string(cwd ? cwd : ".") + "/" + output;
+            free(cwd);
+        }
+        if (input.find(' ') != std::string::npos || output.find(' ') != std::string::npos) {
+            std::cerr << "[ERROR] --server-convert-files does not support paths containing spaces" << std::endl;
+            return 1;
+        }
+        struct stat st;
+        if (stat(input.c_str(), &st) == 0) inputBytes = st.st_size;
+        std::cerr << "[INFO] Converting " << input << " on the server into " << output << std::endl;
+        ok = client.convertFile(input, output, passthrough, rows, notFound, error);
+    } else {
+        MappedFile input;
+        if (!input.open(inputFile, error)) {
+            std::cerr << "[ERROR] Cannot open input file: " << inputFile << " (" << error << ")" << std::endl;
+            return 1;
+        }
+        int outFd = open(outputFile.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (outFd < 0) {
+            std::cerr << "[ERROR] Cannot open output file: " << outputFile << " (" << strerror(errno) << ")" << std::endl;
+            return 1;
+        }
+        inputBytes = input.size();
+        std::cerr << "[INFO] Streaming " << inputBytes << " bytes to convertserver for conversion..." << std::endl;
+        ok = client.convertStream(input.data(), input.size(), passthrough, outFd, rows, notFound, error);
+        if (close(outFd) != 0 && ok) {
+            ok = false;
+            error = std::string("cannot write output: ") + strerror(errno);
+        }
+    }
+    client.close();
+    if (!ok) {
+        std::cerr << "[ERROR] Server-side conversion failed: " << error << std::endl;
+        return 1;
+    }
+
+    auto totalTime = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now() - startTotal).count();
+    std::cerr << "[INFO] Converted " << rows << " alignments on the server (" << notFound
+              << " target IDs not found)" << std::endl;
+    std::cerr << "[INFO] Total time: " << totalTime << "ms" << std::endl;
+    if (!timingFile.empty()) {
+        std::ofstream timing(timingFile.c_str());
+        timing << "{\"input_bytes\":" << inputBytes << ",\"rows\":" << rows << ",\"not_found\":" << notFound
+               << ",\"writer\":\"" << (files ? "server file" : "server stream") << "\",\"total_ms\":" << totalTime
+               << "}" << std::endl;
+        if (!timing) {
+            std::cerr << "[WARN] Cannot write timing file: " << timingFile << std::endl;
+        }
+    }
+    std::cerr << "[INFO] Output written to: " << outputFile << std::endl;
+    return 0;
+}
+
 void printUsage(const char* prog) {
     std::cerr << "Usage: " << prog << " <result.m8> <output.m8> --socket-path <path>" << std::endl;
+    std::cerr << "       " << prog << " <alnDB> <output.m8> --socket-path <path> [--query-db <queryDB>]" << std::endl;
+    std::cerr << "       " << prog << " <result.m8> <output.m8> --lookup <snapshot>" << std::endl;
     std::cerr << std::endl;
     std::cerr << "Options:" << std::endl;
-    std::cerr << "  --socket-path <path>  Path to convertserver socket (default: /tmp/convertserver.sock)" << std::endl;
-    std::cerr << "  --threads <n>         Number of threads (default: 1)" << std::endl;
-    std::cerr << "  --batch-size <n>      Batch size for queries (default: 1000)" << std::endl;
+    std::cerr << "  --socket-path <path>  Path to convertserver socket, or host:port for TCP (default: /tmp/convertserver.sock)" << std::endl;
+    std::cerr << "  --shard-map <file>    Query sharded servers: one \"<socket|host:port> <range:b-e|hash:k/n>\" per line" << std::endl;
+    std::cerr << "  --table <name>        Named table hosted by the server (default: the server's default table)" << std::endl;
+    std::cerr << "  --threads <n>         Worker threads for parse and format (default: 1)" << std::endl;
+    std::cerr << "  --connections <n>     Connections (per shard) used to fetch names, each with pipelined batches (default: 4)" << std::endl;
+    std::cerr << "  --batch-size <n>      IDs per pipelined batch request (default: 100000)" << std::endl;
+    std::cerr << "  --text-protocol       Use the text BATCH protocol instead of the binary one" << std::endl;
+    std::cerr << "  --shm                 Map the server's table via shared memory and read names directly" << std::endl;
+    std::cerr << "  --lookup <snapshot>   Resolve names from a lookup snapshot (convertserver --build-snapshot), no server" << std::endl;
+    std::cerr << "  --fallback-lookup <snapshot>" << std::endl;
+    std::cerr << "                        Resolve names from this snapshot when convertserver cannot be reached" << std::endl;
+    std::cerr << "  --server-convert      Stream the M8 input to convertserver and receive converted rows (default columns)" << std::endl;
+    std::cerr << "  --server-convert-files" << std::endl;
+    std::cerr << "                        Let convertserver (--convert-files) read the input and write the output itself" << std::endl;
+    std::cerr << "  --passthrough         Copy numeric fields that are already in output form instead of reformatting" << std::endl;
+    std::cerr << "  --query-db <queryDB>  Query DB whose .lookup names the queries of an MMseqs2 result DB input" << std::endl;
+    std::cerr << "  --format-output <cols>" << std::endl;
+    std::cerr << "                        Comma-separated MMseqs2 output columns (default: " << DEFAULT_FORMAT_OUTPUT << ")" << std::endl;
+    std::cerr << "                        theader, tseq, tlen, tcov and taxid need convertserver --target-db" << std::endl;
+    std::cerr << "  --timing-json <file>  Write phase timings as one JSON object (for benchmarks)" << std::endl;
     std::cerr << std::endl;
-    std::cerr << "Input format: queryId\\ttargetId\\t..." << std::endl;
+    std::cerr << "Input format: queryId\\ttargetId\\t..., or an MMseqs2 alignment result DB (<alnDB> + <alnDB>.index)" << std::endl;
     std::cerr << "Output format: queryName\\ttargetName\\t..." << std::endl;
 }
 
@@ -257,140 +1075,451 @@ int main(int argc, char* argv[]) {
     std::string outputFile = argv[2];
     std::string socketPath = "/tmp/convertserver.sock";
     int threads = 1;
-    int batchSize = 1000;
+    int connections = 4;
+    int batchSize = 100000;
+    bool textProtocol = false;
+    bool useShared = false;
+    bool passthrough = false;
+    std::string tableName;
+    std::string formatOutput = DEFAULT_FORMAT_OUTPUT;
+    std::string queryDB;
+    std::string timingFile;
+    std::string shardMapFile;
+    std::string lookupFile;
+    std::string fallbackFile;
+    bool serverConvert = false;
+    bool serverFiles = false;
 
     // 解析参数
     for (int i = 3; i < argc; i++) {
         std::string arg = argv[i];
         if (arg == "--socket-path" && i + 1 < argc) {
             socketPath = argv[++i];
+        } else if (arg == "--shard-map" && i + 1 < argc) {
+            shardMapFile = argv[++i];
         } else if (arg == "--threads" && i + 1 < argc) {
             threads = std::stoi(argv[++i]);
+        } else if (arg == "--connections" && i + 1 < argc) {
+            connections = std::stoi(argv[++i]);
         } else if (arg == "--batch-size" && i + 1 < argc) {
             batchSize = std::stoi(argv[++i]);
+        } else if (arg == "--text-protocol") {
+            textProtocol = true;
+        } else if (arg == "--shm") {
+            useShared = true;
+        } else if (arg == "--lookup" && i + 1 < argc) {
+            lookupFile = argv[++i];
+        } else if (arg == "--fallback-lookup" && i + 1 < argc) {
+            fallbackFile = argv[++i];
+        } else if (arg == "--server-convert") {
+            serverConvert = true;
+        } else if (arg == "--server-convert-files") {
+            serverConvert = true;
+            serverFiles = true;
+        } else if (arg == "--table" && i + 1 < argc) {
+            tableName = argv[++i];
+        } else if (arg == "--passthrough") {
+            passthrough = true;
+        } else if (arg == "--query-db" && i + 1 < argc) {
+            queryDB = argv[++i];
+        } else if (arg == "--format-output" && i + 1 < argc) {
+            formatOutput = argv[++i];
+        } else if (arg == "--timing-json" && i + 1 < argc) {
+            timingFile = argv[++i];
         } else if (arg == "--help" || arg == "-h") {
             printUsage(argv[0]);
             return 0;
         }
     }
 
-    auto startTotal = std::chrono::steady_clock::now();
-
-    // 连接到 convertserver
-    ConvertClient client(socketPath);
-    if (!client.connect()) {
-        std::cerr << "[ERROR] Cannot connect to convertserver at " << socketPath << std::endl;
-        std::cerr << "[INFO] Start convertserver first: ./convertserver <lookup_file> " << socketPath << std::endl;
+    OutputLayout layout;
+    std::string formatError;
+    if (!layout.parse(formatOutput, formatError)) {
+        std::cerr << "[ERROR] Invalid --format-output: " << formatError << std::endl;
         return 1;
     }
+    bool extraColumns = layout.targetColumns != COLUMN_NAME;
+    selectRowWriter(layout);
 
-    std::cerr << "[INFO] Connected to convertserver at " << socketPath << std::endl;
+    auto startTotal = std::chrono::steady_clock::now();
 
-    // 打开输入文件
-    std::ifstream inFile(inputFile);
-    if (!inFile) {
-        std::cerr << "[ERROR] Cannot open input file: " << inputFile << std::endl;
-        return 1;
+    // 本进程内解析名称的表: --lookup / --fallback-lookup 的快照，或 --shm 映射的服务端表
+    NameResolver localTable;
+    bool local = false;
+    bool shared = false;
+    // 分片快照只含部分 ID，不能代替完整的服务端
+    auto openLocal = [&](const std::string& path, std::string& error) {
+        if (!localTable.open(path, false, error)) return false;
+        if (localTable.shard().partial()) {
+            error = "snapshot holds only shard " + localTable.shard().describe();
+            return false;
+        }
+        local = true;
+        return true;
+    };
+    // convertserver 不可用时改从 --fallback-lookup 的快照解析名称
+    auto fallBack = [&](const std::string& reason) {
+        if (fallbackFile.empty()) return false;
+        if (extraColumns) {
+            std::cerr << "[ERROR] " << reason << "; --fallback-lookup only provides target names, not --format-output "
+                      << formatOutput << std::endl;
+            return false;
+        }
+        std::string error;
+        if (!openLocal(fallbackFile, error)) {
+            std::cerr << "[ERROR] " << reason << "; cannot open fallback snapshot " << fallbackFile << ": " << error
+                      << std::endl;
+            return false;
+        }
+        std::cerr << "[WARN] " << reason << ", resolving names from snapshot " << localTable.path() << " ("
+                  << localTable.size() << " entries)" << std::endl;
+        return true;
+    };
+
+    // 分片表: 未给出时只有 --socket-path 一个服务端
+    ShardMap shardMap;
+    if (!lookupFile.empty()) {
+        // 无服务端模式: 只映射快照，不连接 convertserver
+        if (extraColumns) {
+            std::cerr << "[ERROR] --lookup only provides target names; --format-output " << formatOutput
+                      << " needs convertserver --target-db" << std::endl;
+            return 1;
+        }
+        std::string error;
+        if (!openLocal(lookupFile, error)) {
+            std::cerr << "[ERROR] Cannot open lookup snapshot " << lookupFile << ": " << error << std::endl;
+            return 1;
+        }
+        if (!tableName.empty() || !shardMapFile.empty() || useShared) {
+            std::cerr << "[WARN] --table, --shard-map and --shm are ignored with --lookup" << std::endl;
+        }
+        std::cerr << "[INFO] Resolving names from snapshot " << localTable.path() << " (" << localTable.size()
+                  << " entries), no convertserver needed" << std::endl;
+    } else if (shardMapFile.empty()) {
+        shardMap.single(socketPath);
+    } else {
+        std::string error;
+        if (!shardMap.load(shardMapFile, error)) {
+            std::cerr << "[ERROR] Invalid --shard-map: " << error << std::endl;
+            return 1;
+        }
+        std::cerr << "[INFO] Routing lookups to " << shardMap.size() << " shard(s) from " << shardMapFile << std::endl;
+        if (!shardMap.gaps().empty()) {
+            std::cerr << "[WARN] IDs in " << shardMap.gaps() << " belong to no shard and are reported as NOT_FOUND"
+                      << std::endl;
+        }
+        if (useShared) {
+            std::cerr << "[WARN] Shared tables are not available for sharded servers, using socket lookups" << std::endl;
+            useShared = false;
+        }
+        socketPath = shardMap[0].address;
     }
 
-    // 打开输出文件
-    std::ofstream outFile(outputFile);
-    if (!outFile) {
-        std::cerr << "[ERROR] Cannot open output file: " << outputFile << std::endl;
+    // 连接到 convertserver (分片时为第一个分片，用于握手)
+    ConvertClient client(socketPath);
+    if (!local && !client.connect() && !fallBack("Cannot connect to convertserver at " + socketPath)) {
+        if (fallbackFile.empty()) {
+            std::cerr << "[ERROR] Cannot connect to convertserver at " << socketPath << std::endl;
+            std::cerr << "[INFO] Start convertserver first (./convertserver <lookup_file> " << socketPath
+                      << "), or pass --lookup <snapshot>" << std::endl;
+        }
         return 1;
     }
 
-    // 第一遍：收集所有 target ID
-    std::cerr << "[INFO] Scanning input file..." << std::endl;
-    std::unordered_map<uint32_t, std::string> idToName;
-    std::vector<std::string> lines;
-    std::string line;
-
-    while (std::getline(inFile, line)) {
-        if (line.empty() || line[0] == '#') continue;
-        lines.push_back(line);
+    if (!local) {
+        std::cerr << "[INFO] Connected to convertserver at " << socketPath << std::endl;
+        if (!tableName.empty()) {
+            std::string error;
+            if (!client.useTable(tableName, error)) {
+                std::cerr << "[ERROR] Cannot use table " << tableName << ": " << error << std::endl;
+                return 1;
+            }
+            std::cerr << "[INFO] Using table " << tableName << std::endl;
+        }
+        if (extraColumns) {
+            // 表头/序列等列只能经二进制列请求获取
+            uint32_t available = 0;
+            std::string error;
+            if (textProtocol || !client.negotiateBinary()) {
+                std::cerr << "[ERROR] --format-output " << formatOutput << " needs the binary protocol" << std::endl;
+                return 1;
+            }
+            if (!client.availableColumns(available, error)) {
+                std::cerr << "[ERROR] Cannot query server columns: " << error << std::endl;
+                return 1;
+            }
+            // 各分片都须能提供请求的列
+            for (size_t s = 1; s < shardMap.size(); s++) {
+                ConvertClient other(shardMap[s].address);
+                uint32_t columns = 0;
+                if (!other.connect() || (!tableName.empty() && !other.useTable(tableName, error)) ||
+                    !other.availableColumns(columns, error)) {
+                    std::cerr << "[ERROR] Cannot query columns of shard " << shardMap[s].address << std::endl;
+                    return 1;
+                }
+                available &= columns;
+            }
+            for (int c = 0; (1u << c) <= COLUMN_ALL; c++) {
+                if ((layout.targetColumns & (1u << c)) && !(available & (1u << c))) {
+                    std::cerr << "[ERROR] convertserver cannot provide target " << TARGET_COLUMN_NAMES[c]
+                              << " (start it with --target-db <targetDB>)" << std::endl;
+                    return 1;
+                }
+            }
+            if (useShared) {
+                std::cerr << "[WARN] Shared table only holds names, fetching target columns over the socket" << std::endl;
+                useShared = false;
+            }
+        }
+        if (layout.formatRows != formatRowsM8) {
+            std::cerr << "[INFO] Output columns: " << formatOutput << " (" << layout.writer << " row writer)" << std::endl;
+        }
+        if (useShared) {
+            std::string error;
+            shared = client.attachShared(localTable, error);
+            local = shared;
+            if (shared) {
+                std::cerr << "[INFO] Attached shared table " << localTable.path()
+                          << " (" << localTable.size() << " entries)" << std::endl;
+            } else {
+                std::cerr << "[WARN] Shared table unavailable (" << error << "), using socket lookups" << std::endl;
+            }
+        }
+        if (!local && !textProtocol && (client.isBinary() || client.negotiateBinary())) {
+            std::cerr << "[INFO] Using binary batch protocol" << std::endl;
+        }
+    }
+    // 映射输入: 存在 <input>.index 时为 MMseqs2 比对结果库，否则为 M8 文本
+    threads = std::max(1, threads);
+    bool resultInput = mmseqs::fileExists(inputFile + ".index");
 
-        AlignmentResult r = AlignmentResult::parse(line);
-        if (idToName.find(r.targetId) == idToName.end()) {
-            idToName[r.targetId] = "";  // 占位
+    if (serverConvert && local) {
+        std::cerr << "[WARN] --server-convert needs convertserver, converting in this process" << std::endl;
+    } else if (serverConvert) {
+        // 服务端只输出默认 12 列，且需要完整的表
+        if (layout.formatRows != formatRowsM8 || resultInput || shardMap.size() > 1 || shardMap[0].spec.partial()) {
+            std::cerr << "[ERROR] --server-convert supports M8 input with the default columns on an unsharded server"
+                      << std::endl;
+            return 1;
         }
+        return convertOnServer(client, inputFile, outputFile, passthrough, serverFiles, timingFile, startTotal);
+    }
+    MappedFile input;
+    MmseqsDB resultDB;
+    LookupNames queryNames;
+    std::string inputError;
+    if (resultInput) {
+        if (!resultDB.open(inputFile, threads, inputError, true)) {
+            std::cerr << "[ERROR] Cannot open result database: " << inputError << std::endl;
+            return 1;
+        }
+        std::cerr << "[INFO] Reading MMseqs2 result database " << inputFile << " (" << resultDB.size() << " queries)" << std::endl;
+        if (queryDB.empty()) {
+            std::cerr << "[WARN] No --query-db given, queries are written as their keys" << std::endl;
+        } else if (!queryNames.open(queryDB + ".lookup", threads, inputError)) {
+            std::cerr << "[ERROR] Cannot open query lookup: " << inputError << std::endl;
+            return 1;
+        }
+        // 结果库中没有原样可拷贝的数值文本
+        passthrough = false;
+    } else if (!input.open(inputFile, inputError)) {
+        std::cerr << "[ERROR] Cannot open input file: " << inputFile << " (" << inputError << ")" << std::endl;
+        return 1;
     }
-    inFile.close();
 
-    std::cerr << "[INFO] Found " << lines.size() << " alignments, " << idToName.size() << " unique target IDs" << std::endl;
+    layout.passthrough = passthrough;
 
-    // 批量获取名称
-    std::cerr << "[INFO] Fetching target names from convertserver..." << std::endl;
-    auto startFetch = std::chrono::steady_clock::now();
+    // 打开输出文件
+    int outFd = open(outputFile.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (outFd < 0) {
+        std::cerr << "[ERROR] Cannot open output file: " << outputFile << " (" << strerror(errno) << ")" << std::endl;
+        return 1;
+    }
 
-    std::vector<uint32_t> idsToFetch;
-    idsToFetch.reserve(idToName.size());
-    for (auto& pair : idToName) {
-        idsToFetch.push_back(pair.first);
+    // 名称查询连接池 (在本进程内解析名称时无需连接)
+    connections = std::max(1, connections);
+    batchSize = std::max(1, batchSize);
+    FetchPool pool;
+    if (!local && !pool.open(shardMap, connections, textProtocol, tableName, layout.targetColumns) &&
+        !fallBack("Cannot open connections to convertserver")) {
+        return 1;
     }
 
-    // 分批查询
-    size_t fetched = 0;
-    for (size_t i = 0; i < idsToFetch.size(); i += batchSize) {
-        size_t end = std::min(i + batchSize, idsToFetch.size());
-        std::vector<uint32_t> batch(idsToFetch.begin() + i, idsToFetch.begin() + end);
+    // 按行切分输入: 至少每线程 4 块，使解析、查询、格式化、写出能在块之间重叠；单块不超过 CHUNK_BYTES
+    const size_t CHUNK_BYTES = 8 << 20;
+    size_t inputBytes = resultInput ? resultDB.dataBytes() : input.size();
+    size_t perChunk = (inputBytes + 4 * threads - 1) / (4 * threads);
+    size_t chunkBytes = std::max<size_t>(1, std::min(CHUNK_BYTES, perChunk));
+    std::vector<std::unique_ptr<Chunk> > chunks = resultInput ? splitResultDB(resultDB, chunkBytes)
+                                                              : splitIntoChunks(input.data(), input.size(), chunkBytes);
+    std::cerr << "[INFO] Converting " << inputBytes << " bytes in " << chunks.size() << " chunks with "
+              << threads << " threads, " << (local ? 0 : connections * shardMap.size()) << " connections..." << std::endl;
 
-        std::vector<std::string> names = client.getNames(batch);
-        for (size_t j = 0; j < batch.size() && j < names.size(); j++) {
-            idToName[batch[j]] = names[j];
-        }
+    // 工作线程优先格式化名称已齐的块，否则按顺序领取新块解析并提交查询；
+    // 已领取但未写出的块最多 window 个，限制内存占用
+    std::mutex mutex;
+    std::condition_variable workReady;
+    std::condition_variable chunkDone;
+    std::deque<size_t> readyToFormat;
+    size_t nextChunk = 0;
+    size_t formatClaimed = 0;
+    size_t written = 0;
+    size_t window = 4 * (size_t)threads + 4;
+    PhaseTimes times(startTotal);
 
-        fetched += batch.size();
-        if (fetched % 100000 == 0 || fetched == idsToFetch.size()) {
-            std::cerr << "[INFO] Fetched " << fetched << "/" << idsToFetch.size() << " names..." << std::endl;
-        }
+    // 输出缓冲区循环使用: 同时存在的块不超过 window 个
+    std::vector<std::unique_ptr<OutputBuffer> > bufferStore;
+    std::vector<OutputBuffer*> freeBuffers;
+    for (size_t i = 0; i < std::min(window, chunks.size()); i++) {
+        bufferStore.push_back(std::unique_ptr<OutputBuffer>(new OutputBuffer()));
+        freeBuffers.push_back(bufferStore.back().get());
     }
 
-    auto endFetch = std::chrono::steady_clock::now();
-    auto fetchTime = std::chrono::duration_cast<std::chrono::milliseconds>(endFetch - startFetch).count();
-    std::cerr << "[INFO] Fetch completed in " << fetchTime << "ms" << std::endl;
+    // 块的名称全部到齐 (调用方持有 mutex)
+    auto markReady = [&](size_t index) {
+        readyToFormat.push_back(index);
+        workReady.notify_all();
+    };
 
-    client.close();
-
-    // 第二遍：输出结果
-    std::cerr << "[INFO] Writing output..." << std::endl;
-    auto startWrite = std::chrono::steady_clock::now();
+    std::vector<std::thread> workers;
+    for (int t = 0; t < threads; t++) {
+        workers.push_back(std::thread([&]() {
+            for (;;) {
+                size_t index;
+                bool format;
+                {
+                    std::unique_lock<std::mutex> lock(mutex);
+                    workReady.wait(lock, [&]() {
+                        return !readyToFormat.empty() || formatClaimed == chunks.size() ||
+                               (nextChunk < chunks.size() && nextChunk < written + window);
+                    });
+                    if (!readyToFormat.empty()) {
+                        index = readyToFormat.front();
+                        readyToFormat.pop_front();
+                        chunks[index]->output = freeBuffers.back();
+                        freeBuffers.pop_back();
+                        formatClaimed++;
+                        format = true;
+                    } else if (formatClaimed == chunks.size()) {
+                        workReady.notify_all();
+                        return;
+                    } else {
+                        index = nextChunk++;
+                        format = false;
+                    }
+                }
+                Chunk& chunk = *chunks[index];
 
-    for (const std::string& line : lines) {
-        AlignmentResult r = AlignmentResult::parse(line);
+                if (format) {
+                    long long start = times.now();
+                    formatChunk(resultInput ? chunk.queryNames.data() : input.data(), chunk, layout);
+                    times.format.record(start, times.now());
+                    {
+                        std::lock_guard<std::mutex> lock(mutex);
+                        chunk.done = true;
+                    }
+                    chunkDone.notify_all();
+                    continue;
+                }
 
-        // 获取 target 名称
-        std::string targetName = idToName[r.targetId];
-        if (targetName.empty() || targetName == "NOT_FOUND") {
-            targetName = std::to_string(r.targetId);
-        }
+                long long start = times.now();
+                if (resultInput) {
+                    parseResultChunk(resultDB, queryDB.empty() ? NULL : &queryNames, chunk, layout.valuesPerId(),
+                                     local ? &localTable : NULL);
+                } else {
+                    parseChunk(input.data(), chunk, layout.valuesPerId(), local ? &localTable : NULL);
+                }
+                times.parse.record(start, times.now());
 
-        // 输出格式化结果
-        outFile << r.query << "\t"
-                << targetName << "\t"
-                << std::fixed << std::setprecision(3) << r.fident << "\t"
-                << r.alnlen << "\t"
-                << r.mismatch << "\t"
-                << r.gapopen << "\t"
-                << r.qstart << "\t"
-                << r.qend << "\t"
-                << r.tstart << "\t"
-                << r.tend << "\t"
-                << std::scientific << std::setprecision(2) << r.evalue << "\t"
-                << std::fixed << std::setprecision(1) << r.bits
-                << "\n";
+                size_t batches = local ? 0 : (chunk.ids.size() + batchSize - 1) / batchSize;
+                if (batches == 0) {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    markReady(index);
+                    continue;
+                }
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    chunk.pendingBatches = batches;
+                }
+                for (size_t b = 0; b < batches; b++) {
+                    size_t offset = b * batchSize;
+                    long long submitted = times.now();
+                    FetchPool::Batch batch;
+                    batch.ids = chunk.ids.data() + offset;
+                    batch.count = std::min<size_t>(batchSize, chunk.ids.size() - offset);
+                    batch.results = chunk.values.data() + offset * layout.valuesPerId();
+                    batch.done = [&, index, submitted]() {
+                        times.fetch.record(submitted, times.now());
+                        std::lock_guard<std::mutex> lock(mutex);
+                        if (--chunks[index]->pendingBatches == 0) markReady(index);
+                    };
+                    pool.submit(batch);
+                }
+            }
+        }));
     }
 
-    outFile.close();
+    // 主线程按原顺序写出
+    size_t totalRows = 0;
+    bool writeFailed = false;
+    for (size_t i = 0; i < chunks.size(); i++) {
+        Chunk& chunk = *chunks[i];
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            chunkDone.wait(lock, [&]() { return chunk.done; });
+        }
+        long long start = times.now();
+        std::string writeError;
+        if (!writeFailed && !chunk.output->writeTo(outFd, writeError)) {
+            std::cerr << "[ERROR] Cannot write output file: " << outputFile << " (" << writeError << ")" << std::endl;
+            writeFailed = true;
+        }
+        totalRows += chunk.rows;
+        times.write.record(start, times.now());
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            chunk.output->clear();
+            freeBuffers.push_back(chunk.output);
+            chunk.output = NULL;
+            written = i + 1;
+        }
+        workReady.notify_all();
+    }
+    for (auto& worker : workers) {
+        worker.join();
+    }
+    pool.close();
+    if (close(outFd) != 0 && !writeFailed) {
+        std::cerr << "[ERROR] Cannot write output file: " << outputFile << " (" << strerror(errno) << ")" << std::endl;
+        writeFailed = true;
+    }
 
-    auto endWrite = std::chrono::steady_clock::now();
-    auto writeTime = std::chrono::duration_cast<std::chrono::milliseconds>(endWrite - startWrite).count();
+    if (shared && !client.ping()) {
+        std::cerr << "[WARN] convertserver did not answer PING after shared lookups" << std::endl;
+    }
+    client.close();
 
     auto endTotal = std::chrono::steady_clock::now();
     auto totalTime = std::chrono::duration_cast<std::chrono::milliseconds>(endTotal - startTotal).count();
 
-    std::cerr << "[INFO] Write completed in " << writeTime << "ms" << std::endl;
+    std::cerr << "[INFO] Converted " << totalRows << " alignments" << std::endl;
+    std::cerr << "[INFO] Thread time: parse " << times.parse.busy / 1000 << "ms, format "
+              << times.format.busy / 1000 << "ms, write " << times.write.busy / 1000 << "ms" << std::endl;
+    std::cerr << "[INFO] Phase spans: parse " << times.parse.describe() << ", fetch " << times.fetch.describe()
+              << ", format " << times.format.describe() << ", write " << times.write.describe() << std::endl;
     std::cerr << "[INFO] Total time: " << totalTime << "ms" << std::endl;
+    if (!timingFile.empty()) {
+        std::ofstream timing(timingFile.c_str());
+        timing << "{\"input_bytes\":" << inputBytes << ",\"rows\":" << totalRows << ",\"chunks\":" << chunks.size()
+               << ",\"threads\":" << threads << ",\"connections\":" << (local ? 0 : connections * shardMap.size())
+               << ",\"writer\":\"" << layout.writer << "\",\"total_ms\":" << totalTime
+               << ",\"parse\":" << times.parse.json() << ",\"fetch\":" << times.fetch.json()
+               << ",\"format\":" << times.format.json() << ",\"write\":" << times.write.json() << "}" << std::endl;
+        if (!timing) {
+            std::cerr << "[WARN] Cannot write timing file: " << timingFile << std::endl;
+        }
+    }
+    if (writeFailed) return 1;
     std::cerr << "[INFO] Output written to: " << outputFile << std::endl;
 
     return 0;
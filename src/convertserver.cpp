@@ -1,16 +1,45 @@
 /**
  * convertserver - 快速 ID→名称 查询服务
  *
- * 用法: ./convertserver <lookup_file> [socket_path]
+ * 用法: ./convertserver <lookup_file|snapshot> [socket_path] [--table auto|dense|hash|compressed]
+ *       ./convertserver --build-snapshot <lookup_file> <snapshot>
  *
  * 示例:
  *   ./convertserver /path/to/db.lookup /tmp/convertserver.sock
+ *   ./convertserver /path/to/db.lookup /tmp/convertserver.sock --table dense
+ *   ./convertserver --build-snapshot /path/to/db.lookup /path/to/db.lookup.bin
+ *   ./convertserver /path/to/db.lookup.bin /tmp/convertserver.sock
+ *   ./convertserver /path/to/uniref.lookup.bin /tmp/convertserver.sock --db bfd=/path/to/bfd.lookup.bin
+ *
+ * 一个进程可托管多个命名表 (位置参数为 default 表)，请求以 @name 选择表:
+ *   BATCH @bfd 1 2 3 / GET @bfd 1 / STAT @bfd / USE bfd
+ * 管理命令: LOAD <name> <path> (后台加载) / UNLOAD <name> / TABLES
+ *
+ * 热更新: RELOAD [@name] [path] 或 SIGHUP (重新加载所有表)。新表在后台构建，旧表继续服务，
+ * 构建完成后原子替换；旧表在进行中的请求结束后释放。STAT 报告 GENERATION 与 VERSION
+ *
+ * 目标库: --target-db [<name>=]<targetDB> 映射 MMseqs2 的 targetDB_h / targetDB / targetDB_mapping，
+ * 以二进制列请求 (见 protocol.h) 批量提供表头、序列、长度与 taxid; COLUMNS 报告可用列，HEADER / SEQ 供调试
+ *
+ * 反向查询: --name-index 为各表构建 名称→ID 索引 (见 name_index.h)，提供 NAMEID / NAMEIDS 与二进制名称帧
+ *
+ * 内存放置: --huge-pages / --mlock / --numa interleave|replicate (见 memory_placement.h)，STAT 报告实际放置
+ *
+ * 分片: --shard range:<begin>-<end> | hash:<k>/<n> 只加载该分片的条目 (见 shard.h)，多个实例合起来服务一个大表；
+ * --tcp [host:]port 在 unix socket 之外同时监听 TCP，供其他主机上的客户端 (convertalis-fast --shard-map) 访问；
+ * 表管理与读写文件的命令 (LOAD / RELOAD / UNLOAD / CONVERTFILE) 只接受 unix socket 上的请求，除非指定 --tcp-admin
+ *
+ * 服务端转换: CONVERT [@table] <bytes> 之后的 M8 行边收边换上 target 名称并流式返回 (见 protocol.h)；
+ * CONVERTFILE 由服务端直接读写文件 (需 --convert-files)。输出与 convertalis-fast 默认 12 列一致
  */
 
 #include <sys/socket.h>
 #include <sys/un.h>
+#include <netinet/in.h>
+#include <netdb.h>
 #include <sys/mman.h>
 #include <sys/stat.h>
+#include <dirent.h>
 #include <fcntl.h>
 #include <unistd.h>
 #include <signal.h>
@@ -24,9 +53,54 @@
 #include <atomic>
 #include <cstring>
 #include <chrono>
+#include <memory>
+#include <mutex>
+#include <algorithm>
+#include <map>
+#include <climits>
+#include <cctype>
+
+#include "name_table.h"
+#include "name_index.h"
+#include "protocol.h"
+#include "reactor.h"
+#include "metrics.h"
+#include "mmseqs_db.h"
+#include "memory_placement.h"
+#include "shard.h"
+#include "name_resolver.h"
+#include "m8_reader.h"
+#include "m8_format.h"
+
+// 查询表后端选择
+enum TableMode {
+    TABLE_AUTO,   // 根据 ID 密度自动选择
+    TABLE_DENSE,  // 按 ID 下标的 offsets 数组 + 名称 blob
+    TABLE_HASH,   // unordered_map (稀疏 ID)
+    TABLE_COMPRESSED  // 按块前缀压缩，内存最小
+};
+
+// 加载选项
+struct LoadOptions {
+    TableMode mode;
+    int loadThreads;        // 解析文本 lookup 的线程数
+    bool verifySnapshot;    // 映射快照时校验全部数据
+    bool shared;            // 从文本构建的稠密表放入共享内存段，供同主机客户端直接映射
+    bool nameIndex;         // 加载时构建名称→ID 反向索引 (快照旁已有索引文件时直接映射)
+    MemoryPlacement placement;  // 常驻表的大页、mlock 与 NUMA 策略
+    ShardSpec shard;            // 只加载该分片的 ID (--shard)，表中按局部 ID 存放
+
+    LoadOptions()
+        : mode(TABLE_AUTO), loadThreads(std::max(1u, std::thread::hardware_concurrency())),
+          verifySnapshot(false), shared(false), nameIndex(false) {}
+};
+
+// 主副本的放置: replicate 时绑定在第一个节点上，其他节点的副本由 placeTable 复制
+static MemoryPlacement primaryPlacement(const LoadOptions& options) {
+    return options.placement.numa == NUMA_REPLICATE ? options.placement.onNode(numaNodes()[0]) : options.placement;
+}
 
 // 全局变量
-static std::unordered_map<uint32_t, std::string> idToName;
 static std::atomic<bool> running(true);
 
 // 信号处理
@@ -35,9 +109,136 @@ void signalHandler(int signum) {
     running = false;
 }
 
-// 加载 lookup 文件到内存
-bool loadLookupFile(const std::string& lookupFile) {
-    std::cerr << "[INFO] Loading lookup file: " << lookupFile << std::endl;
+// 解析 lookup 的一行: ID\tName\tSetID
+static inline bool parseLookupLine(const char* line, size_t lineLen,
+                                   uint32_t& id, const char*& name, uint32_t& nameLen) {
+    // 找第一个 tab
+    size_t tab1 = 0;
+    while (tab1 < lineLen && line[tab1] != '\t') tab1++;
+
+    // 找第二个 tab
+    size_t tab2 = tab1 + 1;
+    while (tab2 < lineLen && line[tab2] != '\t') tab2++;
+
+    if (tab1 >= lineLen || tab2 >= lineLen) return false;
+
+    // 解析 ID
+    id = 0;
+    for (size_t i = 0; i < tab1; i++) {
+        if (line[i] >= '0' && line[i] <= '9') {
+            id = id * 10 + (line[i] - '0');
+        }
+    }
+
+    // 解析 Name
+    name = line + tab1 + 1;
+    nameLen = (uint32_t)(tab2 - tab1 - 1);
+    return true;
+}
+
+// 遍历 lookup 中属于分片 shard 的每个有效行，回调 fn(局部 ID, name, nameLen)，返回这些行的个数
+template <typename Fn>
+static size_t forEachLookupLine(const char* data, size_t size, const ShardSpec& shard, Fn fn) {
+    size_t count = 0;
+    size_t lineStart = 0;
+    while (lineStart < size) {
+        const char* nl = (const char*)memchr(data + lineStart, '\n', size - lineStart);
+        size_t lineEnd = nl ? (size_t)(nl - data) : size;
+        uint32_t id;
+        const char* name;
+        uint32_t nameLen;
+        if (lineEnd > lineStart && parseLookupLine(data + lineStart, lineEnd - lineStart, id, name, nameLen) &&
+            shard.contains(id)) {
+            fn(shard.toLocal(id), name, nameLen);
+            count++;
+        }
+        lineStart = lineEnd + 1;
+    }
+    return count;
+}
+
+// 多线程加载进度，每跨过 1000 万条打印一次
+class LoadProgress {
+private:
+    std::atomic<size_t> loaded;
+    std::mutex mutex;
+
+public:
+    static const size_t STEP = 65536;
+
+    LoadProgress() : loaded(0) {}
+
+    void add(size_t n) {
+        size_t total = loaded.fetch_add(n) + n;
+        if (total / 10000000 != (total - n) / 10000000) {
+            std::lock_guard<std::mutex> lock(mutex);
+            std::cerr << "[INFO] Loaded " << (total / 1000000) << "M entries..." << std::endl;
+        }
+    }
+};
+
+// 哈希模式下线程解析出的暂存条目，name 指向 mmap 中的原始数据
+struct PendingEntry {
+    uint32_t id;
+    uint32_t nameLen;
+    const char* name;
+};
+
+// 压缩比 = 相同内容以稠密表存放所需字节数 / 实际占用；用于日志与 STAT
+static double compressionRatio(const NameTable& table) {
+    size_t memory = table.memoryBytes();
+    return memory == 0 ? 1.0 : (double)table.rawBytes() / memory;
+}
+
+static void logCompression(const NameTable& table) {
+    if (table.rawBytes() == table.memoryBytes()) return;
+    std::cerr << "[INFO] Compression ratio: " << compressionRatio(table) << "x (dense layout: "
+              << (table.rawBytes() / 1024.0 / 1024.0 / 1024.0) << " GB)" << std::endl;
+}
+
+static const char SHARED_SEGMENT_DIR[] = "/dev/shm";
+static const char SHARED_SEGMENT_PREFIX[] = "convertserver-";
+
+// 共享内存段路径，按进程与表名区分
+static std::string sharedSegmentPath(const std::string& tableName) {
+    return std::string(SHARED_SEGMENT_DIR) + "/" + SHARED_SEGMENT_PREFIX + std::to_string(getpid()) + "-" +
+           tableName + ".lookup";
+}
+
+// 删除已退出的服务端留下的共享内存段: 段只在正常释放表时删除，被杀死或崩溃的进程会留下与表同样大小的 tmpfs 文件。
+// 进程仍存在 (或无法判断) 的段保留；已映射这些段的客户端不受删除影响
+static void removeStaleSegments() {
+    DIR* dir = opendir(SHARED_SEGMENT_DIR);
+    if (dir == NULL) return;
+    size_t prefixLen = strlen(SHARED_SEGMENT_PREFIX);
+    while (struct dirent* entry = readdir(dir)) {
+        std::string name = entry->d_name;
+        if (name.compare(0, prefixLen, SHARED_SEGMENT_PREFIX) != 0 || name.size() < 7 ||
+            name.compare(name.size() - 7, 7, ".lookup") != 0) {
+            continue;
+        }
+        char* end = NULL;
+        long pid = strtol(name.c_str() + prefixLen, &end, 10);
+        if (end == name.c_str() + prefixLen || *end != '-' || pid <= 0 || pid == getpid()) continue;
+        if (kill((pid_t)pid, 0) == 0 || errno != ESRCH) continue;
+        std::string path = std::string(SHARED_SEGMENT_DIR) + "/" + name;
+        if (unlink(path.c_str()) == 0) {
+            std::cerr << "[INFO] Removed stale shared segment " << path << std::endl;
+        }
+    }
+    closedir(dir);
+}
+
+// 加载 lookup 文件到内存，文件在换行处切分后由 loadThreads 个线程并行解析。
+// tableName 用于命名共享内存段 (--shm)。指定了 --shard 时只保留分片内的条目，按局部 ID 存放
+bool loadLookupFile(const std::string& lookupFile, const LoadOptions& options,
+                    const std::string& tableName, std::unique_ptr<NameTable>& table) {
+    TableMode mode = options.mode;
+    int loadThreads = options.loadThreads;
+    const ShardSpec& shard = options.shard;
+    bool shared = options.shared && !shard.partial();
+    std::cerr << "[INFO] Loading lookup file: " << lookupFile
+              << (shard.partial() ? " (shard " + shard.describe() + ")" : std::string()) << std::endl;
     auto start = std::chrono::steady_clock::now();
 
     int fd = open(lookupFile.c_str(), O_RDONLY);
@@ -53,67 +254,225 @@ bool loadLookupFile(const std::string& lookupFile) {
 
     std::cerr << "[INFO] File size: " << (fileSize / 1024.0 / 1024.0 / 1024.0) << " GB" << std::endl;
 
-    // mmap 文件
-    void* mapped = mmap(NULL, fileSize, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+    if (fileSize == 0) {
+        close(fd);
+        table.reset(new HashNameTable());
+        std::cerr << "[INFO] Loaded 0 entries" << std::endl;
+        return true;
+    }
+
+    // mmap 文件: 单线程时预读整个文件；多线程时由各线程并行缺页，仅提示内核预读
+    int flags = MAP_PRIVATE | (loadThreads <= 1 ? MAP_POPULATE : 0);
+    void* mapped = mmap(NULL, fileSize, PROT_READ, flags, fd, 0);
     if (mapped == MAP_FAILED) {
         std::cerr << "[ERROR] mmap failed: " << strerror(errno) << std::endl;
         close(fd);
         return false;
     }
+    if (loadThreads > 1) {
+        madvise(mapped, fileSize, MADV_WILLNEED);
+    }
 
-    // 预分配
-    size_t estimatedEntries = fileSize / 40;
-    idToName.reserve(estimatedEntries);
-
-    char* data = (char*)mapped;
+    const char* data = (const char*)mapped;
     size_t size = fileSize;
+    std::vector<size_t> bounds = splitAtLines(data, size, loadThreads);
+    int chunks = (int)bounds.size() - 1;
 
-    // 解析每行
-    size_t pos = 0;
-    size_t lineStart = 0;
-    size_t count = 0;
-    size_t lastReport = 0;
-
-    while (pos < size) {
-        if (data[pos] == '\n') {
-            size_t lineLen = pos - lineStart;
-            if (lineLen > 0) {
-                char* line = data + lineStart;
-
-                // 找第一个 tab
-                size_t tab1 = 0;
-                while (tab1 < lineLen && line[tab1] != '\t') tab1++;
-
-                // 找第二个 tab
-                size_t tab2 = tab1 + 1;
-                while (tab2 < lineLen && line[tab2] != '\t') tab2++;
-
-                if (tab1 < lineLen && tab2 < lineLen) {
-                    // 解析 ID
-                    uint32_t id = 0;
-                    for (size_t i = 0; i < tab1; i++) {
-                        if (line[i] >= '0' && line[i] <= '9') {
-                            id = id * 10 + (line[i] - '0');
-                        }
-                    }
+    std::cerr << "[INFO] Parsing with " << chunks << " thread(s)" << std::endl;
 
-                    // 解析 Name
-                    size_t nameLen = tab2 - tab1 - 1;
-                    std::string name(line + tab1 + 1, nameLen);
+    // 第一遍: 各段统计条目数、最大 ID 与名称总字节数，合并后决定后端
+    std::vector<uint32_t> chunkMaxId(chunks, 0);
+    std::vector<uint64_t> chunkNameBytes(chunks, 0);
+    std::vector<size_t> chunkLines(chunks, 0);
+    runBlocks(chunks, [&](int c) {
+        uint32_t maxId = 0;
+        uint64_t nameBytes = 0;
+        chunkLines[c] = forEachLookupLine(data + bounds[c], bounds[c + 1] - bounds[c], shard,
+            [&](uint32_t id, const char*, uint32_t nameLen) {
+                if (id > maxId) maxId = id;
+                nameBytes += nameLen;
+            });
+        chunkMaxId[c] = maxId;
+        chunkNameBytes[c] = nameBytes;
+    });
 
-                    idToName[id] = std::move(name);
-                    count++;
-                }
-            }
-            lineStart = pos + 1;
+    uint32_t maxId = 0;
+    uint64_t nameBytes = 0;
+    size_t lines = 0;
+    for (int c = 0; c < chunks; c++) {
+        maxId = std::max(maxId, chunkMaxId[c]);
+        nameBytes += chunkNameBytes[c];
+        lines += chunkLines[c];
+    }
+    uint64_t slots = lines > 0 ? (uint64_t)maxId + 1 : 0;
+
+    if (mode == TABLE_AUTO) {
+        // offsets 每个 slot 8 字节，哈希节点每条目 ~60 字节；slot 数不超过条目数 4 倍时稠密表更省
+        mode = (slots <= (uint64_t)lines * 4 + 1024) ? TABLE_DENSE : TABLE_HASH;
+    }
 
-            // 进度报告
-            if (count - lastReport > 10000000) {
-                std::cerr << "[INFO] Loaded " << (count / 1000000) << "M entries..." << std::endl;
-                lastReport = count;
+    LoadProgress progress;
+
+    if (options.shared && shard.partial()) {
+        std::cerr << "[WARN] Shared memory mode serves whole tables, ignoring --shm for shard " << shard.describe()
+                  << std::endl;
+    } else if (options.shared && mode != TABLE_DENSE) {
+        std::cerr << "[WARN] Shared memory mode requires the dense table, ignoring --shm" << std::endl;
+    }
+
+    if (mode == TABLE_DENSE) {
+        // 各线程直接写入按 ID 下标的表，不同 ID 落在不同 slot，无需合并。
+        // lookup 中的 ID 通常唯一；发现重复 ID 时按文件顺序串行重新记录长度并拷贝名称，
+        // 与单线程加载一样以最后一次为准，也避免两个线程同时写同一个 slot
+        DenseNameTable* dense = new DenseNameTable();
+        table.reset(dense);
+        std::string error;
+        if (!dense->allocate(slots, nameBytes, error, shared ? sharedSegmentPath(tableName) : std::string(),
+                             primaryPlacement(options))) {
+            std::cerr << "[ERROR] Cannot allocate dense table: " << error << std::endl;
+            munmap(mapped, fileSize);
+            close(fd);
+            return false;
+        }
+        std::atomic<bool> duplicates(false);
+        runBlocks(chunks, [&](int c) {
+            bool seen = false;
+            forEachLookupLine(data + bounds[c], bounds[c + 1] - bounds[c], shard,
+                [&](uint32_t id, const char*, uint32_t nameLen) {
+                    seen |= dense->claimLength(id, nameLen);
+                });
+            if (seen) duplicates = true;
+        });
+        int nameThreads = chunks;
+        if (duplicates && chunks > 1) {
+            std::cerr << "[WARN] Duplicate IDs in lookup file, resolving them in file order" << std::endl;
+            for (int c = 0; c < chunks; c++) {
+                forEachLookupLine(data + bounds[c], bounds[c + 1] - bounds[c], shard,
+                    [&](uint32_t id, const char*, uint32_t nameLen) {
+                        dense->setLength(id, nameLen);
+                    });
             }
+            nameThreads = 1;
         }
-        pos++;
+        dense->finalizeLayout(chunks);
+        runBlocks(nameThreads, [&](int t) {
+            for (int c = t; c < chunks; c += nameThreads) {
+                size_t pending = 0;
+                forEachLookupLine(data + bounds[c], bounds[c + 1] - bounds[c], shard,
+                    [&](uint32_t id, const char* name, uint32_t nameLen) {
+                        dense->setName(id, name, nameLen);
+                        if (++pending == LoadProgress::STEP) {
+                            progress.add(pending);
+                            pending = 0;
+                        }
+                    });
+                progress.add(pending);
+            }
+        });
+        if (shard.partial()) dense->setShard(shard.kind, shard.first, shard.second);
+        dense->seal();
+        if (shared) {
+            std::cerr << "[INFO] Table shared at " << dense->sharedPath() << std::endl;
+        }
+    } else if (mode == TABLE_COMPRESSED) {
+        // 先记录每个 ID 的名称在文件中的位置 (低 40 位为偏移 + 1，高 24 位为长度，0 表示不存在)，
+        // 再按块并行编码；名称直接从映射的文件读取，构建期间额外占用每 slot 8 字节
+        if ((uint64_t)fileSize >= (1ull << 40)) {
+            std::cerr << "[ERROR] Lookup file too large for the compressed table" << std::endl;
+            munmap(mapped, fileSize);
+            close(fd);
+            return false;
+        }
+        // 位置原子写入；发现重复 ID 时按文件顺序串行重新记录，以最后一次为准
+        std::vector<uint64_t> locations(slots, 0);
+        std::atomic<bool> tooLong(false);
+        std::atomic<bool> duplicates(false);
+        runBlocks(chunks, [&](int c) {
+            size_t pending = 0;
+            bool seen = false;
+            forEachLookupLine(data + bounds[c], bounds[c + 1] - bounds[c], shard,
+                [&](uint32_t id, const char* name, uint32_t nameLen) {
+                    if (nameLen >= (1u << 24)) {
+                        tooLong = true;
+                    } else if (nameLen > 0) {  // 与稠密表一致，空名称视为不存在
+                        uint64_t location = (uint64_t)(name - data + 1) | ((uint64_t)nameLen << 40);
+                        seen |= __atomic_exchange_n(&locations[id], location, __ATOMIC_RELAXED) != 0;
+                    }
+                    if (++pending == LoadProgress::STEP) {
+                        progress.add(pending);
+                        pending = 0;
+                    }
+                });
+            progress.add(pending);
+            if (seen) duplicates = true;
+        });
+        if (duplicates && chunks > 1) {
+            std::cerr << "[WARN] Duplicate IDs in lookup file, resolving them in file order" << std::endl;
+            for (int c = 0; c < chunks; c++) {
+                forEachLookupLine(data + bounds[c], bounds[c + 1] - bounds[c], shard,
+                    [&](uint32_t id, const char* name, uint32_t nameLen) {
+                        if (nameLen > 0 && nameLen < (1u << 24)) {
+                            locations[id] = (uint64_t)(name - data + 1) | ((uint64_t)nameLen << 40);
+                        }
+                    });
+            }
+        }
+        if (tooLong) {
+            std::cerr << "[WARN] Names longer than 16 MB are not supported by the compressed table, skipped" << std::endl;
+        }
+        CompressedNameTable* compressed = new CompressedNameTable();
+        table.reset(compressed);
+        std::string error;
+        bool ok = compressed->build(slots, [&](uint32_t id, NameRef& out) {
+            uint64_t location = locations[id];
+            if (location == 0) return false;
+            out.data = data + (location & ((1ull << 40) - 1)) - 1;
+            out.len = (uint32_t)(location >> 40);
+            return true;
+        }, chunks, error, primaryPlacement(options));
+        if (!ok) {
+            std::cerr << "[ERROR] Cannot allocate compressed table: " << error << std::endl;
+            munmap(mapped, fileSize);
+            close(fd);
+            return false;
+        }
+    } else {
+        // 各线程按 id % shards 把条目分区暂存，再由每个线程独立构建一个分片；
+        // 分片内按段顺序插入，重复 ID 仍以文件中最后一次为准
+        int shards = chunks;
+        HashNameTable* hash = new HashNameTable(shards);
+        table.reset(hash);
+        std::vector<std::vector<std::vector<PendingEntry> > > parts(
+            chunks, std::vector<std::vector<PendingEntry> >(shards));
+        runBlocks(chunks, [&](int c) {
+            for (int s = 0; s < shards; s++) {
+                parts[c][s].reserve(chunkLines[c] / shards + 1);
+            }
+            forEachLookupLine(data + bounds[c], bounds[c + 1] - bounds[c], shard,
+                [&](uint32_t id, const char* name, uint32_t nameLen) {
+                    PendingEntry entry = {id, nameLen, name};
+                    parts[c][hash->shardOf(id)].push_back(entry);
+                });
+        });
+        runBlocks(shards, [&](int s) {
+            size_t shardLines = 0;
+            for (int c = 0; c < chunks; c++) {
+                shardLines += parts[c][s].size();
+            }
+            hash->reserveShard(s, shardLines);
+            size_t pending = 0;
+            for (int c = 0; c < chunks; c++) {
+                for (const PendingEntry& entry : parts[c][s]) {
+                    hash->insertIntoShard(s, entry.id, entry.name, entry.nameLen);
+                    if (++pending == LoadProgress::STEP) {
+                        progress.add(pending);
+                        pending = 0;
+                    }
+                }
+                std::vector<PendingEntry>().swap(parts[c][s]);
+            }
+            progress.add(pending);
+        });
     }
 
     munmap(mapped, fileSize);
@@ -122,98 +481,1856 @@ bool loadLookupFile(const std::string& lookupFile) {
     auto end = std::chrono::steady_clock::now();
     auto duration = std::chrono::duration_cast<std::chrono::seconds>(end - start).count();
 
-    std::cerr << "[INFO] Loaded " << count << " entries in " << duration << "s" << std::endl;
-    std::cerr << "[INFO] Estimated memory: ~" << (count * 50 / 1024.0 / 1024.0 / 1024.0) << " GB" << std::endl;
+    std::cerr << "[INFO] Loaded " << table->size() << " entries in " << duration << "s"
+              << " (table: " << table->kind() << ")" << std::endl;
+    std::cerr << "[INFO] Estimated memory: ~" << (table->memoryBytes() / 1024.0 / 1024.0 / 1024.0) << " GB" << std::endl;
+    logCompression(*table);
 
     return true;
 }
 
-// 处理客户端请求
-void handleClient(int clientSocket) {
-    char buffer[65536];
+// 快照的反向索引文件 (--build-snapshot --name-index 写出)
+static std::string nameIndexPath(const std::string& snapshotFile) {
+    return snapshotFile + ".nameidx";
+}
 
-    while (running) {
-        ssize_t bytesRead = recv(clientSocket, buffer, sizeof(buffer) - 1, 0);
-        if (bytesRead <= 0) break;
+// 为表构建名称→ID 反向索引；checksum 为对应快照的数据校验和 (写出索引文件时用于匹配快照)
+static bool buildNameIndex(const NameTable& table, int threads, uint64_t checksum, std::unique_ptr<NameIndex>& index) {
+    std::cerr << "[INFO] Building name index for " << table.size() << " entries" << std::endl;
+    auto start = std::chrono::steady_clock::now();
+    index.reset(new NameIndex());
+    std::string error;
+    if (!index->build(table, threads, checksum, error)) {
+        std::cerr << "[ERROR] Cannot build name index: " << error << std::endl;
+        index.reset();
+        return false;
+    }
+    auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now() - start).count();
+    std::cerr << "[INFO] Name index built in " << duration << "ms: " << (index->memoryBytes() / 1024.0 / 1024.0)
+              << " MB (" << index->bytesPerEntry() << " bytes/entry)" << std::endl;
+    return true;
+}
 
-        buffer[bytesRead] = '\0';
-        std::string request(buffer);
-        std::string response;
+// 抽样页在各节点上的比例，形如 "0=50.0%,1=50.0%"；没有已分配的页时为 "-"
+static std::string formatNodes(const PlacementStatus& status) {
+    std::string text;
+    for (size_t node = 0; node < status.nodePages.size(); node++) {
+        if (status.nodePages[node] == 0) continue;
+        char item[32];
+        snprintf(item, sizeof(item), "%s%zu=%.1f%%", text.empty() ? "" : ",", node,
+                 100.0 * status.nodePages[node] / status.sampledPages);
+        text += item;
+    }
+    return text.empty() ? "-" : text;
+}
 
-        if (request.substr(0, 4) == "GET ") {
-            // 单个查询
-            try {
-                uint32_t id = std::stoul(request.substr(4));
-                auto it = idToName.find(id);
-                if (it != idToName.end()) {
-                    response = it->second + "\n";
-                } else {
-                    response = "NOT_FOUND\n";
+// 报告一份表实际达到的放置 (请求未能完全生效时给出原因)
+static void logPlacement(const NameTable& table, const std::string& label) {
+    const LookupImage* image = table.residentImage();
+    if (image == NULL) return;
+    if (!image->placementWarning().empty()) {
+        std::cerr << "[WARN] " << label << ": " << image->placementWarning() << std::endl;
+    }
+    PlacementStatus status = image->measure();
+    std::cerr << "[INFO] Placement of " << label << ": huge pages " << HUGE_PAGE_MODE_NAMES[image->placement().hugePages]
+              << " (" << (status.hugePageBytes / 1024.0 / 1024.0) << " MB backed), locked "
+              << (status.lockedBytes / 1024.0 / 1024.0) << " MB, NUMA " << NUMA_MODE_NAMES[image->placement().numa]
+              << " (nodes " << formatNodes(status) << ")" << std::endl;
+}
+
+// 加载后的放置: --mlock 锁定表内存；--numa replicate 为其余每个 NUMA 节点复制一份绑定在该节点上的副本。
+// 副本由优先在该节点分配内存的线程构建，堆上的部分 (压缩表的块偏移) 也落在本地。
+// replicas 按节点号下标，主表所在节点的项为空
+static void placeTable(NameTable& table, const LoadOptions& options, const std::string& name,
+                       std::vector<std::shared_ptr<const NameTable> >& replicas) {
+    const MemoryPlacement& placement = options.placement;
+    if (table.residentImage() == NULL) {
+        if (placement.needsPrivateMemory() || placement.lock) {
+            std::cerr << "[WARN] Memory placement options apply to dense and compressed tables, "
+                      << table.kind() << " table " << name << " left as is" << std::endl;
+        }
+        return;
+    }
+    std::string error;
+    if (placement.lock && !table.lockMemory(error)) {
+        std::cerr << "[WARN] Cannot lock table " << name << ": " << error << std::endl;
+    }
+    logPlacement(table, name);
+
+    const std::vector<int>& nodes = numaNodes();
+    if (placement.numa != NUMA_REPLICATE) return;
+    if (nodes.size() <= 1) {
+        std::cerr << "[INFO] Single NUMA node, table " << name << " is not replicated" << std::endl;
+        return;
+    }
+    replicas.assign(nodes.back() + 1, std::shared_ptr<const NameTable>());
+    for (size_t k = 1; k < nodes.size(); k++) {
+        int node = nodes[k];
+        auto start = std::chrono::steady_clock::now();
+        std::unique_ptr<NameTable> copy;
+        bool ok = false;
+        std::thread([&] {
+            preferNode(node);
+            ok = table.replicate(placement.onNode(node), options.loadThreads, copy, error);
+        }).join();
+        if (!ok) {
+            std::cerr << "[WARN] Cannot replicate table " << name << " on node " << node << ": " << error << std::endl;
+            continue;
+        }
+        if (placement.lock && !copy->lockMemory(error)) {
+            std::cerr << "[WARN] Cannot lock replica of " << name << " on node " << node << ": " << error << std::endl;
+        }
+        auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::steady_clock::now() - start).count();
+        std::cerr << "[INFO] Replicated table " << name << " on node " << node << " in " << duration << "ms" << std::endl;
+        logPlacement(*copy, name + " (node " + std::to_string(node) + ")");
+        replicas[node].reset(copy.release());
+    }
+}
+
+// 从完整的稠密表中取出一个分片，按局部 ID 存入按放置分配的新稠密表 (只读取分片内的 slot)
+static bool extractShard(const DenseNameTable& full, const ShardSpec& shard, const LoadOptions& options,
+                         std::unique_ptr<NameTable>& table, std::string& error) {
+    uint64_t slots = shard.localSlots(full.slotCount());
+    int parts = (int)std::max<uint64_t>(1, std::min<uint64_t>(options.loadThreads, slots / 65536));
+    std::vector<uint64_t> partBytes(parts, 0);
+    runBlocks(parts, [&](int p) {
+        NameRef name;
+        for (uint64_t local = slots * p / parts; local < slots * (p + 1) / parts; local++) {
+            if (full.find(shard.toGlobal((uint32_t)local), name)) partBytes[p] += name.len;
+        }
+    });
+    uint64_t nameBytes = 0;
+    for (uint64_t bytes : partBytes) nameBytes += bytes;
+
+    DenseNameTable* dense = new DenseNameTable();
+    std::unique_ptr<NameTable> owned(dense);
+    if (!dense->allocate(slots, nameBytes, error, std::string(), primaryPlacement(options))) return false;
+    runBlocks(parts, [&](int p) {
+        NameRef name;
+        for (uint64_t local = slots * p / parts; local < slots * (p + 1) / parts; local++) {
+            if (full.find(shard.toGlobal((uint32_t)local), name)) dense->setLength((uint32_t)local, name.len);
+        }
+    });
+    dense->finalizeLayout(parts);
+    runBlocks(parts, [&](int p) {
+        NameRef name;
+        for (uint64_t local = slots * p / parts; local < slots * (p + 1) / parts; local++) {
+            if (full.find(shard.toGlobal((uint32_t)local), name)) dense->setName((uint32_t)local, name.data, name.len);
+        }
+    });
+    dense->setShard(shard.kind, shard.first, shard.second);
+    dense->seal();
+    table.swap(owned);
+    return true;
+}
+
+// 直接映射二进制快照，无需解析。快照旁有匹配的反向索引文件时一并映射到 index。
+// shard 返回表中 ID 所属的分片: 分片快照为其记录的分片；完整快照加 --shard 时取出该分片
+bool loadSnapshotFile(const std::string& snapshotFile, const LoadOptions& options, std::unique_ptr<NameTable>& table,
+                      std::unique_ptr<NameIndex>& index, ShardSpec& shard) {
+    bool verifyData = options.verifySnapshot;
+    std::cerr << "[INFO] Mapping lookup snapshot: " << snapshotFile << std::endl;
+    auto start = std::chrono::steady_clock::now();
+
+    DenseNameTable* dense = new DenseNameTable();
+    table.reset(dense);
+    std::string error;
+    if (!dense->openSnapshot(snapshotFile, verifyData, error)) {
+        std::cerr << "[ERROR] Cannot open snapshot " << snapshotFile << ": " << error << std::endl;
+        return false;
+    }
+
+    auto end = std::chrono::steady_clock::now();
+    auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count();
+
+    std::cerr << "[INFO] Mapped " << table->size() << " entries in " << duration << "ms"
+              << (verifyData ? " (checksum verified)" : "") << std::endl;
+    std::cerr << "[INFO] Snapshot size: " << (table->memoryBytes() / 1024.0 / 1024.0 / 1024.0)
+              << " GB (shared page cache)" << std::endl;
+
+    ShardSpec stored = snapshotShard(*dense);
+    if (stored.partial()) {
+        std::cerr << "[INFO] Snapshot holds shard " << stored.describe() << std::endl;
+    }
+    if (stored.partial() && options.shard.partial() && stored != options.shard) {
+        std::cerr << "[ERROR] Snapshot " << snapshotFile << " holds shard " << stored.describe() << ", not "
+                  << options.shard.describe() << std::endl;
+        return false;
+    }
+    bool extract = options.shard.partial() && !stored.partial();
+    shard = stored.partial() ? stored : options.shard;
+
+    std::string indexFile = nameIndexPath(snapshotFile);
+    if (extract) {
+        // 快照旁的反向索引对应完整表，取出分片后不再适用
+        if (options.nameIndex) {
+            std::cerr << "[INFO] Name index of the full snapshot is not used for shard " << shard.describe() << std::endl;
+        }
+    } else if (access(indexFile.c_str(), F_OK) == 0) {
+        index.reset(new NameIndex());
+        if (index->openFile(indexFile, dense->size(), dense->dataChecksum(), error)) {
+            std::cerr << "[INFO] Mapped name index " << indexFile << " (" << index->bytesPerEntry()
+                      << " bytes/entry)" << std::endl;
+        } else {
+            std::cerr << "[WARN] Ignoring name index " << indexFile << ": " << error << std::endl;
+            index.reset();
+        }
+    }
+
+    if (options.mode == TABLE_COMPRESSED) {
+        // 从映射的快照编码压缩表，完成后解除映射，之后只占用压缩后的内存
+        start = std::chrono::steady_clock::now();
+        CompressedNameTable* compressed = new CompressedNameTable();
+        std::unique_ptr<NameTable> built(compressed);
+        ShardSpec part = extract ? shard : ShardSpec();
+        bool ok = compressed->build(part.localSlots(dense->slotCount()), [&](uint32_t id, NameRef& out) {
+            return dense->find(part.toGlobal(id), out);
+        }, options.loadThreads, error, primaryPlacement(options));
+        if (!ok) {
+            std::cerr << "[ERROR] Cannot allocate compressed table: " << error << std::endl;
+            return false;
+        }
+        table.swap(built);
+        duration = std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::steady_clock::now() - start).count();
+        std::cerr << "[INFO] Compressed " << table->size() << " entries in " << duration << "ms, memory: ~"
+                  << (table->memoryBytes() / 1024.0 / 1024.0 / 1024.0) << " GB" << std::endl;
+        logCompression(*table);
+    } else if (extract) {
+        start = std::chrono::steady_clock::now();
+        std::unique_ptr<NameTable> part;
+        if (!extractShard(*dense, shard, options, part, error)) {
+            std::cerr << "[ERROR] Cannot allocate shard " << shard.describe() << ": " << error << std::endl;
+            return false;
+        }
+        table.swap(part);
+        duration = std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::steady_clock::now() - start).count();
+        std::cerr << "[INFO] Extracted shard " << shard.describe() << ": " << table->size() << " entries in "
+                  << duration << "ms, memory: ~" << (table->memoryBytes() / 1024.0 / 1024.0 / 1024.0) << " GB"
+                  << std::endl;
+    } else if (options.placement.needsPrivateMemory()) {
+        // 映射的快照文件无法改变页大小与节点: 复制到按放置分配的匿名内存，之后不再经共享内存提供给客户端
+        start = std::chrono::steady_clock::now();
+        std::unique_ptr<NameTable> copy;
+        if (!table->replicate(primaryPlacement(options), options.loadThreads, copy, error)) {
+            std::cerr << "[ERROR] Cannot copy snapshot into placed memory: " << error << std::endl;
+            return false;
+        }
+        table.swap(copy);
+        duration = std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::steady_clock::now() - start).count();
+        std::cerr << "[INFO] Copied snapshot into private memory for placement in " << duration << "ms" << std::endl;
+    }
+    return true;
+}
+
+// --build-snapshot: 解析文本 lookup 并写出二进制快照 (指定 --shard 时只含该分片，分片记录在快照中)
+int buildSnapshot(const std::string& lookupFile, const std::string& outFile, LoadOptions options) {
+    options.mode = TABLE_DENSE;
+    options.shared = false;
+    options.placement = MemoryPlacement();
+    std::unique_ptr<NameTable> table;
+    if (!loadLookupFile(lookupFile, options, "snapshot", table)) {
+        return 1;
+    }
+
+    DenseNameTable* dense = static_cast<DenseNameTable*>(table.get());
+    if (dense->slotCount() > (uint64_t)dense->size() * 4 + 1024) {
+        std::cerr << "[WARN] Lookup IDs are sparse, snapshot offsets dominate its size" << std::endl;
+    }
+
+    std::cerr << "[INFO] Writing snapshot: " << outFile << std::endl;
+    auto start = std::chrono::steady_clock::now();
+    std::string error;
+    if (!dense->writeSnapshot(outFile, error)) {
+        std::cerr << "[ERROR] Cannot write snapshot: " << error << std::endl;
+        return 1;
+    }
+    auto end = std::chrono::steady_clock::now();
+    auto duration = std::chrono::duration_cast<std::chrono::seconds>(end - start).count();
+
+    std::cerr << "[INFO] Snapshot written in " << duration << "s ("
+              << (dense->memoryBytes() / 1024.0 / 1024.0 / 1024.0) << " GB)" << std::endl;
+
+    // 旧的索引文件与新快照不匹配，总是先删除。分片快照的索引按全局 ID 构建
+    std::string indexFile = nameIndexPath(outFile);
+    unlink(indexFile.c_str());
+    if (options.nameIndex) {
+        uint64_t checksum = dense->dataChecksum();
+        if (options.shard.partial()) table.reset(new ShardedNameTable(std::move(table), options.shard));
+        std::unique_ptr<NameIndex> index;
+        if (!buildNameIndex(*table, options.loadThreads, checksum, index)) return 1;
+        if (!index->writeFile(indexFile, error)) {
+            std::cerr << "[ERROR] Cannot write name index: " << error << std::endl;
+            return 1;
+        }
+        std::cerr << "[INFO] Name index written: " << indexFile << std::endl;
+    }
+    return 0;
+}
+
+// ---- 多表托管 ----
+
+static const char* const DEFAULT_TABLE = "default";
+
+// 目标库的表头、序列与 taxid (--target-db)。数据文件 mmap，常驻内存的只有偏移索引
+struct TargetData {
+    MmseqsDB headers;           // <targetDB>_h
+    MmseqsDB sequences;         // <targetDB>
+    TaxonomyMapping taxonomy;   // <targetDB>_mapping
+    uint32_t columns;           // 可提供的 TargetColumn 位 (COLUMN_NAME 由 lookup 提供)
+
+    TargetData() : columns(0) {}
+
+    size_t memoryBytes() const {
+        return headers.memoryBytes() + sequences.memoryBytes() + taxonomy.memoryBytes();
+    }
+};
+
+// 一个已加载的命名表。多个名称加载同一文件 (realpath、大小、修改时间与加载方式都相同) 时
+// 共享同一个 NameTable，只占一份内存。
+// 重新加载会生成新的 HostedTable (generation + 1) 替换旧的；旧对象在最后一个持有它的请求结束时析构
+struct HostedTable {
+    std::string name;
+    std::string path;
+    std::string sourceKey;
+    std::string version;   // 源文件修改时间 (秒)
+    uint64_t generation;
+    std::shared_ptr<const NameTable> table;
+    std::vector<std::shared_ptr<const NameTable> > replicas;  // --numa replicate: 按节点号下标，空项使用 table
+    std::shared_ptr<const NameIndex> nameIndex;  // 名称→ID 反向索引，未启用时为空
+    ShardSpec shard;           // 表中条目所属的分片 (--shard 或分片快照)
+    std::string targetPath;    // --target-db，空表示只有名称
+    std::string targetKey;
+    std::shared_ptr<const TargetData> target;
+
+    HostedTable() : generation(0) {}
+
+    uint32_t columns() const { return COLUMN_NAME | (target ? target->columns : 0); }
+
+    // 当前工作线程所在 NUMA 节点上的副本，没有副本时为主表
+    const NameTable& local() const {
+        if (!replicas.empty()) {
+            size_t node = (size_t)currentNumaNode();
+            if (node < replicas.size() && replicas[node]) return *replicas[node];
+        }
+        return *table;
+    }
+
+    ~HostedTable() {
+        std::cerr << "[INFO] Released table " << name << " generation " << generation << std::endl;
+    }
+};
+
+// 名称 → 表。请求在查找时复制 shared_ptr (RCU 式读取)，UNLOAD / 重新加载只替换表项，
+// 旧表在最后一个进行中的请求结束时释放
+class TableRegistry {
+private:
+    mutable std::mutex mutex;
+    std::map<std::string, std::shared_ptr<const HostedTable> > tables;
+    std::map<std::string, std::string> loading;   // 名称 → 路径
+    std::map<std::string, std::string> reloading; // 名称 → 新路径 (旧表继续服务)
+    std::map<std::string, std::string> failures;  // 名称 → 最近一次加载失败原因
+    std::mutex taskMutex;
+    std::vector<std::thread> tasks;               // LOAD / RELOAD 的后台线程，退出前全部 join
+    std::vector<std::thread::id> finishedTasks;   // 已结束、尚未回收的线程
+
+    // 回收已结束的线程 (持有 taskMutex 时调用)
+    void reapTasks() {
+        for (std::thread::id id : finishedTasks) {
+            for (size_t i = 0; i < tasks.size(); i++) {
+                if (tasks[i].get_id() != id) continue;
+                tasks[i].join();
+                tasks.erase(tasks.begin() + i);
+                break;
+            }
+        }
+        finishedTasks.clear();
+    }
+
+public:
+    // 在后台线程中执行一次加载或重新加载
+    template <typename Fn>
+    void runTask(Fn fn) {
+        std::lock_guard<std::mutex> lock(taskMutex);
+        reapTasks();
+        tasks.push_back(std::thread([this, fn]() {
+            fn();
+            std::lock_guard<std::mutex> lock(taskMutex);
+            finishedTasks.push_back(std::this_thread::get_id());
+        }));
+    }
+
+    // 停止服务后调用: 等待进行中的加载与重新加载结束 (之后不再有线程访问表与全局配置)
+    void waitTasks() {
+        std::vector<std::thread> pending;
+        {
+            std::lock_guard<std::mutex> lock(taskMutex);
+            reapTasks();
+            pending.swap(tasks);
+        }
+        if (!pending.empty()) {
+            std::cerr << "[INFO] Waiting for " << pending.size() << " table load(s) to finish" << std::endl;
+        }
+        for (auto& task : pending) task.join();
+    }
+
+    // 查找可用的表；失败时 error 为响应行
+    std::shared_ptr<const HostedTable> find(const std::string& name, std::string& error) const {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = tables.find(name);
+        if (it != tables.end()) return it->second;
+        if (loading.count(name)) {
+            error = "ERROR:Table " + name + " is loading\n";
+        } else {
+            error = "ERROR:Unknown table " + name + "\n";
+        }
+        return std::shared_ptr<const HostedTable>();
+    }
+
+    // 查找同源的已加载表 (共用其查询表与反向索引)，用于共享内存
+    std::shared_ptr<const HostedTable> findSource(const std::string& sourceKey) const {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (const auto& pair : tables) {
+            if (pair.second->sourceKey == sourceKey) return pair.second;
+        }
+        return std::shared_ptr<const HostedTable>();
+    }
+
+    // 查找同源的已加载目标库
+    std::shared_ptr<const TargetData> findTarget(const std::string& targetKey) const {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (const auto& pair : tables) {
+            if (pair.second->target && pair.second->targetKey == targetKey) return pair.second->target;
+        }
+        return std::shared_ptr<const TargetData>();
+    }
+
+    // 登记一个加载任务；名称已存在或正在加载时返回 false
+    bool beginLoad(const std::string& name, const std::string& path, std::string& error) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (tables.count(name) || loading.count(name)) {
+            error = "ERROR:Table " + name + " already exists\n";
+            return false;
+        }
+        loading[name] = path;
+        failures.erase(name);
+        return true;
+    }
+
+    // 加载结束: hosted 为空表示失败
+    void finishLoad(const std::string& name, const std::shared_ptr<const HostedTable>& hosted,
+                    const std::string& error) {
+        std::lock_guard<std::mutex> lock(mutex);
+        loading.erase(name);
+        if (hosted) {
+            tables[name] = hosted;
+        } else {
+            failures[name] = error;
+        }
+    }
+
+    bool unload(const std::string& name) {
+        std::lock_guard<std::mutex> lock(mutex);
+        return tables.erase(name) > 0;
+    }
+
+    // 登记一次重新加载；path 为空时沿用当前路径。current 为当前服务中的表
+    bool beginReload(const std::string& name, std::string& path, std::shared_ptr<const HostedTable>& current,
+                     std::string& error) {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = tables.find(name);
+        if (it == tables.end()) {
+            error = "ERROR:Unknown table " + name + "\n";
+            return false;
+        }
+        if (reloading.count(name)) {
+            error = "ERROR:Table " + name + " is reloading\n";
+            return false;
+        }
+        current = it->second;
+        if (path.empty()) path = current->path;
+        reloading[name] = path;
+        return true;
+    }
+
+    // 重新加载结束: replacement 非空时原子替换 (期间被 UNLOAD 的表不再恢复)
+    void finishReload(const std::string& name, const std::shared_ptr<const HostedTable>& replacement) {
+        std::shared_ptr<const HostedTable> retired;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            reloading.erase(name);
+            auto it = tables.find(name);
+            if (replacement && it != tables.end()) {
+                retired = it->second;
+                it->second = replacement;
+            }
+        }
+        // retired 在锁外释放: 若没有进行中的请求，旧表在此析构
+    }
+
+    std::vector<std::string> names() const {
+        std::lock_guard<std::mutex> lock(mutex);
+        std::vector<std::string> result;
+        for (const auto& pair : tables) result.push_back(pair.first);
+        return result;
+    }
+
+    // TABLES 响应: 各表一项，\t 分隔
+    std::string describe() const {
+        std::lock_guard<std::mutex> lock(mutex);
+        std::string response = "TABLES " + std::to_string(tables.size() + loading.size() + failures.size());
+        for (const auto& pair : tables) {
+            const HostedTable& hosted = *pair.second;
+            size_t sharing = 0;
+            for (const auto& other : tables) {
+                if (other.second->table == hosted.table) sharing++;
+            }
+            response += "\t" + hosted.name + (reloading.count(hosted.name) ? " RELOADING" : " READY") +
+                        " ENTRIES:" + std::to_string(hosted.table->size()) +
+                        " TABLE:" + hosted.table->kind() +
+                        " MEMORY:" + std::to_string(hosted.table->memoryBytes()) +
+                        " SHARED:" + std::to_string(sharing) +
+                        " GENERATION:" + std::to_string(hosted.generation) + " PATH:" + hosted.path;
+            if (hosted.target) response += " TARGET:" + hosted.targetPath;
+        }
+        for (const auto& pair : loading) {
+            response += "\t" + pair.first + " LOADING PATH:" + pair.second;
+        }
+        for (const auto& pair : failures) {
+            response += "\t" + pair.first + " FAILED " + pair.second;
+        }
+        return response + "\n";
+    }
+};
+
+static TableRegistry registry;
+static LoadOptions serverLoadOptions;
+static bool allowFileConvert = false;  // --convert-files: 允许 CONVERTFILE 读写服务端路径
+static bool allowRemoteAdmin = false;  // --tcp-admin: TCP 连接也可以执行表管理与 CONVERTFILE
+
+// 打开任意路径为表、卸载表或读写文件的命令，默认只接受 unix socket 上的请求
+static bool isAdminCommand(const std::string& command) {
+    return command == "LOAD" || command == "RELOAD" || command == "UNLOAD" || command == "CONVERTFILE";
+}
+
+// 表名用于请求与共享内存段路径，只允许字母、数字与 _ - .
+static bool isValidTableName(const std::string& name) {
+    if (name.empty() || name.size() > 64) return false;
+    for (char c : name) {
+        if (!isalnum((unsigned char)c) && c != '_' && c != '-' && c != '.') return false;
+    }
+    return true;
+}
+
+// 判断两次加载是否同源: realpath + 大小 + 修改时间 + 分片；文本 lookup 还取决于后端与共享内存选项。
+// version 为源文件修改时间，STAT 中报告
+static bool tableSourceKey(const std::string& path, const LoadOptions& options, std::string& key,
+                           std::string& version, std::string& error) {
+    char resolved[PATH_MAX];
+    struct stat st;
+    if (realpath(path.c_str(), resolved) == NULL || stat(resolved, &st) != 0) {
+        error = path + ": " + strerror(errno);
+        return false;
+    }
+    version = std::to_string((long long)st.st_mtim.tv_sec);
+    key = std::string(resolved) + "|" + std::to_string((long long)st.st_size) + "|" +
+          std::to_string((long long)st.st_mtim.tv_sec) + "." + std::to_string((long long)st.st_mtim.tv_nsec);
+    if (!isLookupImageFile(resolved)) {
+        key += "|" + std::to_string((int)options.mode) + (options.shared ? "|shm" : "") +
+               (options.nameIndex ? "|nameidx" : "");
+    } else if (options.mode == TABLE_COMPRESSED) {
+        key += "|compressed";
+    }
+    if (options.shard.partial()) key += "|" + options.shard.describe();
+    return true;
+}
+
+// 目标库由多个文件组成，逐个取 realpath + 大小 + 修改时间；不存在的可选文件记为 "-"
+static bool targetSourceKey(const std::string& targetPath, std::string& key, std::string& error) {
+    const char* suffixes[] = {"_h", "_h.index", "", ".index", "_mapping"};
+    key.clear();
+    for (const char* suffix : suffixes) {
+        std::string path = targetPath + suffix;
+        char resolved[PATH_MAX];
+        struct stat st;
+        if (realpath(path.c_str(), resolved) == NULL || stat(resolved, &st) != 0) {
+            key += "-|";
+            continue;
+        }
+        key += std::string(resolved) + ":" + std::to_string((long long)st.st_size) + ":" +
+               std::to_string((long long)st.st_mtim.tv_sec) + "." + std::to_string((long long)st.st_mtim.tv_nsec) + "|";
+    }
+    if (key == "-|-|-|-|-|") {
+        error = targetPath + ": no MMseqs2 header or sequence database found";
+        return false;
+    }
+    return true;
+}
+
+// 映射目标库: <targetDB>_h (表头)、<targetDB> (序列，提供序列与长度)、<targetDB>_mapping (taxid)，
+// 存在哪些就提供哪些列
+static bool openTargetData(const std::string& targetPath, int threads, std::shared_ptr<const TargetData>& target,
+                           std::string& error) {
+    std::cerr << "[INFO] Loading target database: " << targetPath << std::endl;
+    auto start = std::chrono::steady_clock::now();
+    std::shared_ptr<TargetData> data(new TargetData());
+    if (mmseqs::fileExists(targetPath + "_h.index")) {
+        if (!data->headers.open(targetPath + "_h", threads, error)) return false;
+        data->columns |= COLUMN_HEADER;
+    }
+    if (mmseqs::fileExists(targetPath + ".index")) {
+        if (!data->sequences.open(targetPath, threads, error)) return false;
+        data->columns |= COLUMN_SEQUENCE | COLUMN_LENGTH;
+    }
+    if (mmseqs::fileExists(targetPath + "_mapping")) {
+        if (!data->taxonomy.open(targetPath + "_mapping", threads, error)) return false;
+        data->columns |= COLUMN_TAXID;
+    }
+    if (data->columns == 0) {
+        error = targetPath + ": no MMseqs2 header or sequence database found";
+        return false;
+    }
+
+    auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+    std::cerr << "[INFO] Target database loaded in " << duration << "ms: " << data->headers.size() << " headers, "
+              << data->sequences.size() << " sequences, index memory "
+              << (data->memoryBytes() / 1024.0 / 1024.0) << " MB" << std::endl;
+    target = data;
+    return true;
+}
+
+// 打开一个命名表的第 generation 代: 已有同源表时直接共享，否则映射快照或解析文本
+static bool openTable(const std::string& name, const std::string& path, const std::string& targetPath,
+                      const LoadOptions& options, uint64_t generation, std::shared_ptr<const HostedTable>& hosted,
+                      std::string& error) {
+    std::string sourceKey, version, targetKey;
+    if (!tableSourceKey(path, options, sourceKey, version, error)) return false;
+    if (!targetPath.empty() && !targetSourceKey(targetPath, targetKey, error)) return false;
+
+    std::shared_ptr<const NameTable> table;
+    std::vector<std::shared_ptr<const NameTable> > replicas;
+    std::shared_ptr<const NameIndex> nameIndex;
+    ShardSpec shard = options.shard;
+    std::shared_ptr<const HostedTable> source = registry.findSource(sourceKey);
+    if (source) {
+        std::cerr << "[INFO] Table " << name << " shares the already loaded " << path << std::endl;
+        table = source->table;
+        replicas = source->replicas;
+        nameIndex = source->nameIndex;
+        shard = source->shard;
+    } else {
+        std::unique_ptr<NameTable> loaded;
+        std::unique_ptr<NameIndex> index;
+        bool ok = isLookupImageFile(path) ? loadSnapshotFile(path, options, loaded, index, shard)
+                                          : loadLookupFile(path, options, name + "." + std::to_string(generation), loaded);
+        if (!ok) {
+            error = "Cannot load " + path;
+            return false;
+        }
+        // 分片表以全局 ID 对外提供查询 (反向索引随之返回全局 ID)
+        if (shard.partial()) loaded.reset(new ShardedNameTable(std::move(loaded), shard));
+        if (!index && options.nameIndex && !buildNameIndex(*loaded, options.loadThreads, 0, index)) {
+            error = "Cannot build name index for " + path;
+            return false;
+        }
+        placeTable(*loaded, options, name, replicas);
+        table.reset(loaded.release());
+        nameIndex.reset(index.release());
+    }
+
+    std::shared_ptr<const TargetData> target;
+    if (!targetPath.empty()) {
+        target = registry.findTarget(targetKey);
+        if (target) {
+            std::cerr << "[INFO] Table " << name << " shares the already loaded target database " << targetPath << std::endl;
+        } else if (!openTargetData(targetPath, options.loadThreads, target, error)) {
+            return false;
+        }
+    }
+
+    std::shared_ptr<HostedTable> created(new HostedTable());
+    created->name = name;
+    created->path = path;
+    created->sourceKey = sourceKey;
+    created->version = version;
+    created->generation = generation;
+    created->table = table;
+    created->replicas = replicas;
+    created->nameIndex = nameIndex;
+    created->shard = shard;
+    created->targetPath = targetPath;
+    created->targetKey = targetKey;
+    created->target = target;
+    hosted = created;
+    return true;
+}
+
+// 启动时同步加载一个表，targetPath 非空时同时映射目标库
+static bool loadInitialTable(const std::string& name, const std::string& path, const std::string& targetPath) {
+    std::string error;
+    std::shared_ptr<const HostedTable> hosted;
+    if (!registry.beginLoad(name, path, error) ||
+        !openTable(name, path, targetPath, serverLoadOptions, 1, hosted, error)) {
+        std::cerr << "[ERROR] Cannot load table " << name << ": " << error << std::endl;
+        return false;
+    }
+    registry.finishLoad(name, hosted, error);
+    return true;
+}
+
+static const size_t BATCH_PENDING = 256;          // 文本 BATCH 每攒够这么多 ID 整组查询一次
+static const uint64_t BATCH_INVALID_ID = ~0ull;
+
+// 进行中的 CONVERTFILE: 事件循环每轮转换一片 (见 stepConvertFile)
+struct FileConversion {
+    MappedFile input;
+    int fd;
+    std::string outputPath;
+    bool passthrough;
+    size_t pos;        // 下一片的起点
+    uint64_t rows;
+    uint64_t notFound;
+    uint64_t nanos;    // 已累计的转换耗时，不含等待其他连接的时间
+    std::shared_ptr<const HostedTable> table;
+
+    FileConversion() : fd(-1), passthrough(false), pos(0), rows(0), notFound(0), nanos(0) {}
+    ~FileConversion() {
+        if (fd >= 0) close(fd);
+    }
+};
+
+// 每个连接的流式解析状态
+struct ProtocolState : public ConnectionContext {
+    std::string tableName;  // USE 选择的默认表
+    bool remote;            // 连接经 TCP 接入，不接受管理命令 (除非 --tcp-admin)
+    bool inBatch;           // 正在解析一条文本 BATCH，"BATCH " 前缀已消费
+    bool batchFailed;       // 当前 BATCH 的表不可用，已输出错误，跳过到行尾
+    bool batchSkipping;     // 超长的参数已记为一项 ERROR，跳过其余部分直到下一个分隔符
+    size_t batchItems;      // 当前 BATCH 已输出的条目数
+    size_t batchNotFound;   // 当前 BATCH 中没有名称 (或无法解析) 的条目数
+    uint64_t batchNanos;    // 当前 BATCH 已累计的处理耗时，不含等待后续数据的时间
+    std::shared_ptr<const HostedTable> batchTable;  // 当前 BATCH 使用的表 (未确定时为空)
+    uint64_t batchPending[BATCH_PENDING];  // 已解析、尚未输出的 ID (BATCH_INVALID_ID 为无法解析的参数)
+    size_t batchPendingCount;
+    bool inConvert;              // 正在接收 CONVERT 的 M8 数据
+    bool convertFailed;          // CONVERT 的表不可用，已输出错误，数据读取后丢弃
+    bool convertPassthrough;     // 规范形式的数值字段直接拷贝
+    uint64_t convertRemaining;   // CONVERT 尚未处理的数据字节数
+    uint64_t convertRows;
+    uint64_t convertNotFound;
+    uint64_t convertNanos;       // 当前 CONVERT 已累计的处理耗时，不含等待数据的时间
+    std::shared_ptr<const HostedTable> convertTable;
+    std::unique_ptr<FileConversion> fileConvert;  // 进行中的 CONVERTFILE，完成前不处理后续请求
+
+    ProtocolState()
+        : tableName(DEFAULT_TABLE), remote(false), inBatch(false), batchFailed(false), batchSkipping(false), batchItems(0), batchNotFound(0),
+          batchNanos(0), batchPendingCount(0), inConvert(false), convertFailed(false), convertPassthrough(false), convertRemaining(0),
+          convertRows(0), convertNotFound(0), convertNanos(0) {}
+};
+
+// 当前工作线程的名称解码缓冲 (压缩表使用)。请求在一个线程内处理完，开始时清空即可复用
+static NameScratch& threadScratch() {
+    static thread_local NameScratch scratch;
+    scratch.clear();
+    return scratch;
+}
+
+// 取出请求参数开头的 "@name"，没有时使用连接的默认表
+static std::string takeTableName(std::string& args, const ProtocolState& state) {
+    if (args.empty() || args[0] != '@') return state.tableName;
+    size_t space = args.find(' ');
+    std::string name = args.substr(1, space == std::string::npos ? std::string::npos : space - 1);
+    args = space == std::string::npos ? std::string() : args.substr(space + 1);
+    return name;
+}
+
+// 后台加载一个表，完成后出现在 TABLES 中并可被请求使用
+static std::string startLoad(const std::string& name, const std::string& path) {
+    std::string error;
+    if (!isValidTableName(name)) return "ERROR:Invalid table name\n";
+    if (!registry.beginLoad(name, path, error)) return error;
+    registry.runTask([name, path]() {
+        std::string error;
+        std::shared_ptr<const HostedTable> hosted;
+        if (!openTable(name, path, std::string(), serverLoadOptions, 1, hosted, error)) {
+            std::cerr << "[ERROR] Cannot load table " << name << ": " << error << std::endl;
+        } else {
+            std::cerr << "[INFO] Table " << name << " ready" << std::endl;
+        }
+        registry.finishLoad(name, hosted, error);
+    });
+    return "OK LOADING " + name + "\n";
+}
+
+// 后台重新加载一个表 (及其目标库): 新表构建期间旧表继续服务，完成后原子替换；源文件未变化时不做任何事。
+// 只用一半的加载线程，减少对服务线程的干扰
+static std::string startReload(const std::string& name, std::string path) {
+    std::string error;
+    std::shared_ptr<const HostedTable> current;
+    if (!registry.beginReload(name, path, current, error)) return error;
+    registry.runTask([name, path, current]() {
+        LoadOptions options = serverLoadOptions;
+        options.loadThreads = std::max(1, options.loadThreads / 2);
+        std::string key, version, targetKey, error;
+        std::shared_ptr<const HostedTable> replacement;
+        if (!tableSourceKey(path, options, key, version, error) ||
+            (!current->targetPath.empty() && !targetSourceKey(current->targetPath, targetKey, error))) {
+            std::cerr << "[ERROR] Cannot reload table " << name << ": " << error << std::endl;
+        } else if (key == current->sourceKey && targetKey == current->targetKey) {
+            std::cerr << "[INFO] Table " << name << " is unchanged, keeping generation "
+                      << current->generation << std::endl;
+        } else if (!openTable(name, path, current->targetPath, options, current->generation + 1, replacement, error)) {
+            std::cerr << "[ERROR] Cannot reload table " << name << ", still serving generation "
+                      << current->generation << ": " << error << std::endl;
+        } else {
+            std::cerr << "[INFO] Table " << name << " reloaded, now serving generation "
+                      << replacement->generation << std::endl;
+        }
+        registry.finishReload(name, replacement);
+    });
+    return "OK RELOADING " + name + "\n";
+}
+
+// SIGHUP: 按当前路径重新加载所有表 (只有源文件变化的表会被替换)
+static void reloadAllTables() {
+    for (const std::string& name : registry.names()) {
+        std::string response = startReload(name, std::string());
+        if (response.compare(0, 3, "OK ") != 0) {
+            std::cerr << "[WARN] " << response.substr(0, response.size() - 1) << std::endl;
+        }
+    }
+}
+
+// 取一个 ID 的一列 (TargetColumn 中的一位)。长度与 taxid 格式化为十进制写入 text (至少 16 字节)，
+// 压缩表的名称解码到 scratch
+static bool findColumn(const HostedTable& hosted, uint32_t column, uint32_t id, char* text, NameRef& out,
+                       NameScratch& scratch) {
+    const TargetData* target = hosted.target.get();
+    const char* data;
+    size_t len;
+    uint32_t number;
+    switch (column) {
+    case COLUMN_NAME:
+        return hosted.local().find(id, out, scratch);
+    case COLUMN_HEADER:
+    case COLUMN_SEQUENCE:
+        if (target == NULL || !(column == COLUMN_HEADER ? target->headers : target->sequences).find(id, data, len)) {
+            return false;
+        }
+        out.data = data;
+        out.len = (uint32_t)len;
+        return true;
+    case COLUMN_LENGTH:
+        if (target == NULL || !target->sequences.entryLength(id, number)) return false;
+        break;
+    case COLUMN_TAXID:
+        if (target == NULL) return false;
+        number = target->taxonomy.find(id);
+        break;
+    default:
+        return false;
+    }
+    out.len = (uint32_t)snprintf(text, 16, "%u", number);
+    out.data = text;
+    return true;
+}
+
+// HEADER / SEQ 文本命令: 单个 ID 的一列
+static std::string getColumn(const std::string& args, uint32_t column, ProtocolState& state) {
+    std::string rest = args;
+    std::string response;
+    std::shared_ptr<const HostedTable> hosted = registry.find(takeTableName(rest, state), response);
+    if (!hosted) return response;
+    if (!(hosted->columns() & column)) return "ERROR:Column not available\n";
+    try {
+        uint32_t id = std::stoul(rest);
+        char text[16];
+        NameRef ref;
+        if (!findColumn(*hosted, column, id, text, ref, threadScratch())) return "NOT_FOUND\n";
+        response.assign(ref.data, ref.len);
+        return response + "\n";
+    } catch (...) {
+        return "ERROR\n";
+    }
+}
+
+// NAMEID / NAMEIDS 文本命令: 单个名称 (可含空格) 或以空格分隔的多个名称
+static std::string lookupNameIds(const std::string& args, bool batch, ProtocolState& state) {
+    std::string rest = args;
+    std::string response;
+    std::shared_ptr<const HostedTable> hosted = registry.find(takeTableName(rest, state), response);
+    if (!hosted) return response;
+    if (!hosted->nameIndex) return "ERROR:Name index not available\n";
+    if (rest.empty()) return "ERROR\n";
+    size_t pos = 0;
+    while (pos < rest.size()) {
+        size_t end = batch ? rest.find(' ', pos) : std::string::npos;
+        if (end == std::string::npos) end = rest.size();
+        if (end > pos) {
+            uint32_t id;
+            if (!response.empty()) response += '\t';
+            if (hosted->nameIndex->find(rest.data() + pos, end - pos, hosted->local(), threadScratch(), id)) {
+                response += std::to_string(id);
+            } else {
+                response += "NOT_FOUND";
+            }
+        }
+        pos = end + 1;
+    }
+    return response + "\n";
+}
+
+static const size_t CONVERT_SLICE = 1 << 20;  // CONVERTFILE 每步处理的输入字节数 (约数毫秒)
+
+// 以空格分隔的参数，末尾可选的 "passthrough" 取出到 passthrough
+static std::vector<std::string> splitConvertArgs(const std::string& args, bool& passthrough) {
+    std::vector<std::string> words;
+    size_t pos = 0;
+    while (pos < args.size()) {
+        size_t end = args.find(' ', pos);
+        if (end == std::string::npos) end = args.size();
+        if (end > pos) words.push_back(args.substr(pos, end - pos));
+        pos = end + 1;
+    }
+    passthrough = !words.empty() && words.back() == "passthrough";
+    if (passthrough) words.pop_back();
+    return words;
+}
+
+// 把 data[from, to) 中 M8 行的 target ID 换成名称 (不存在的 ID 保留数字) 并按默认 12 列格式化到 out，
+// 与 convertalis-fast 的输出逐字节一致。返回行数，notFound 累加不存在的 ID 数
+static size_t convertRows(const NameTable& table, const char* data, size_t from, size_t to, bool passthrough,
+                          OutputBuffer& out, uint64_t& notFound) {
+    AlignmentColumns rows;
+    rows.reserve((to - from) / 96 + 1);
+    parseM8(data, from, to, rows);
+    std::vector<NameRef> refs(rows.size());
+    notFound += table.findBatch(rows.targetId.data(), rows.size(), refs.data(), threadScratch());
+    for (size_t i = 0; i < rows.size(); i++) {
+        prefetchName(refs.data(), i, rows.size());
+        if (refs[i].data != NULL) {
+            appendAlignmentRow(out, data, rows, i, refs[i].data, refs[i].len, passthrough);
+        } else {
+            char idText[16];
+            char* idEnd = m8::formatUInt(idText, rows.targetId[i]);
+            appendAlignmentRow(out, data, rows, i, idText, idEnd - idText, passthrough);
+        }
+    }
+    return rows.size();
+}
+
+// CONVERT [@table] <bytes> [passthrough]: 之后的 bytes 字节由 processInput 边收边转换。
+// 表不可用时返回错误，数据仍须读取并丢弃
+static std::string startConvert(std::string args, ProtocolState& state) {
+    std::string name = takeTableName(args, state);
+    bool passthrough;
+    std::vector<std::string> words = splitConvertArgs(args, passthrough);
+    char* end = NULL;
+    uint64_t bytes = words.size() == 1 ? strtoull(words[0].c_str(), &end, 10) : 0;
+    if (words.size() != 1 || end == words[0].c_str() || *end != '\0') {
+        return "ERROR:Usage CONVERT [@table] <bytes> [passthrough]\n";
+    }
+    std::string response;
+    state.convertTable = registry.find(name, response);
+    state.inConvert = true;
+    state.convertFailed = !state.convertTable;
+    state.convertPassthrough = passthrough;
+    state.convertRemaining = bytes;
+    state.convertRows = 0;
+    state.convertNotFound = 0;
+    state.convertNanos = 0;
+    return response;
+}
+
+// 转换 CONVERT 数据中的一段完整行，作为一帧追加到 out
+static void appendConvertFrame(ProtocolState& state, const char* data, size_t from, size_t to, OutputQueue& out) {
+    static thread_local OutputBuffer rows;
+    rows.clear();
+    state.convertRows += convertRows(state.convertTable->local(), data, from, to, state.convertPassthrough, rows,
+                                     state.convertNotFound);
+    if (rows.empty()) return;
+    char* header = out.reserve(BIN_CONVERT_HEADER_SIZE);
+    header[0] = (char)BIN_CONVERT_MAGIC;
+    putU32(header + 1, (uint32_t)rows.size());
+    out.append(rows.data(), rows.size());
+}
+
+// CONVERT 的数据已全部处理: 输出结束帧与汇总行，记录指标
+static void finishConvert(ProtocolState& state, OutputQueue& out, ThreadMetrics& metrics) {
+    if (!state.convertFailed) {
+        char* header = out.reserve(BIN_CONVERT_HEADER_SIZE);
+        header[0] = (char)BIN_CONVERT_MAGIC;
+        putU32(header + 1, 0);
+        out.append("OK CONVERTED " + std::to_string(state.convertRows) + " " + std::to_string(state.convertNotFound) +
+                   "\n");
+    }
+    metrics.recordRequest(REQ_CONVERT, state.convertNanos, state.convertRows, state.convertNotFound,
+                          state.convertFailed);
+    state.inConvert = false;
+    state.convertTable.reset();
+}
+
+// CONVERTFILE [@table] <input> <output> [passthrough]: 服务端映射输入文件并打开输出，转换由 stepConvertFile
+// 在事件循环中逐片进行。参数或文件有误时返回错误响应，开始转换时返回空串 (响应在完成时输出)
+static std::string startConvertFile(std::string args, ProtocolState& state) {
+    if (!allowFileConvert) return "ERROR:CONVERTFILE is disabled (start convertserver with --convert-files)\n";
+    std::string response;
+    std::shared_ptr<const HostedTable> hosted = registry.find(takeTableName(args, state), response);
+    if (!hosted) return response;
+    bool passthrough;
+    std::vector<std::string> words = splitConvertArgs(args, passthrough);
+    if (words.size() != 2) return "ERROR:Usage CONVERTFILE [@table] <input> <output> [passthrough]\n";
+
+    std::unique_ptr<FileConversion> job(new FileConversion());
+    std::string error;
+    if (!job->input.open(words[0], error)) return "ERROR:Cannot open " + words[0] + ": " + error + "\n";
+    job->fd = open(words[1].c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (job->fd < 0) return "ERROR:Cannot open " + words[1] + ": " + strerror(errno) + "\n";
+    job->outputPath = words[1];
+    job->passthrough = passthrough;
+    job->table = hosted;
+    state.fileConvert.swap(job);
+    return std::string();
+}
+
+// 转换 CONVERTFILE 的下一片 (按行对齐的 CONVERT_SLICE 字节) 并写出，缓冲区大小与文件大小无关。
+// 全部完成或出错时输出响应、记录指标并返回 true
+static bool stepConvertFile(ProtocolState& state, OutputQueue& reply, ThreadMetrics& metrics) {
+    FileConversion& job = *state.fileConvert;
+    uint64_t start = metricsNanos();
+    static thread_local OutputBuffer out;
+    const char* data = job.input.data();
+    size_t size = job.input.size();
+    std::string error;
+    bool ok = true;
+    if (job.pos < size) {
+        size_t end = std::min(size, job.pos + CONVERT_SLICE);
+        if (end < size) {
+            const char* nl = (const char*)memchr(data + end, '\n', size - end);
+            end = nl ? (size_t)(nl - data) + 1 : size;
+        }
+        out.clear();
+        job.rows += convertRows(job.table->local(), data, job.pos, end, job.passthrough, out, job.notFound);
+        ok = out.writeTo(job.fd, error);
+        job.pos = end;
+    }
+    job.nanos += metricsNanos() - start;
+    if (ok && job.pos < size) return false;
+
+    if (close(job.fd) != 0 && ok) {
+        ok = false;
+        error = strerror(errno);
+    }
+    job.fd = -1;
+    if (ok) {
+        reply.append("OK CONVERTED " + std::to_string(job.rows) + " " + std::to_string(job.notFound) + "\n");
+    } else {
+        reply.append("ERROR:Cannot write " + job.outputPath + ": " + error + "\n");
+    }
+    metrics.recordRequest(REQ_CONVERT, job.nanos, job.rows, job.notFound, !ok);
+    state.fileConvert.reset();
+    return true;
+}
+
+// STAT 中的内存放置: 实际的大页方式与大页字节数、锁定字节数、NUMA 策略、抽样页的节点分布 (各副本合计)
+// 与副本数
+static std::string describePlacement(const HostedTable& hosted) {
+    std::vector<const NameTable*> copies(1, hosted.table.get());
+    for (const auto& replica : hosted.replicas) {
+        if (replica) copies.push_back(replica.get());
+    }
+    const LookupImage* image = hosted.table->residentImage();
+    PlacementStatus total;
+    for (const NameTable* copy : copies) {
+        if (copy->residentImage() == NULL) continue;
+        PlacementStatus status = copy->residentImage()->measure();
+        total.hugePageBytes += status.hugePageBytes;
+        total.lockedBytes += status.lockedBytes;
+        total.sampledPages += status.sampledPages;
+        if (status.nodePages.size() > total.nodePages.size()) total.nodePages.resize(status.nodePages.size(), 0);
+        for (size_t node = 0; node < status.nodePages.size(); node++) total.nodePages[node] += status.nodePages[node];
+    }
+    return std::string(" HUGE_PAGES:") + HUGE_PAGE_MODE_NAMES[image ? image->placement().hugePages : HUGE_PAGES_OFF] +
+           " HUGE_PAGE_BYTES:" + std::to_string(total.hugePageBytes) +
+           " LOCKED_BYTES:" + std::to_string(total.lockedBytes) +
+           " NUMA:" + NUMA_MODE_NAMES[image ? image->placement().numa : NUMA_DEFAULT] +
+           " NODES:" + formatNodes(total) +
+           " REPLICAS:" + std::to_string(copies.size());
+}
+
+// 处理一条文本命令 (BATCH 之外)，返回响应
+std::string handleTextRequest(const std::string& request, ProtocolState& state) {
+    std::string line = request;
+    while (!line.empty() && (line.back() == '\n' || line.back() == '\r')) line.pop_back();
+    size_t space = line.find(' ');
+    std::string command = line.substr(0, space);
+    std::string args = space == std::string::npos ? std::string() : line.substr(space + 1);
+    std::string response;
+
+    if (state.remote && !allowRemoteAdmin && isAdminCommand(command)) {
+        return "ERROR:" + command + " not allowed over TCP (start convertserver with --tcp-admin)\n";
+    }
+
+    if (command == "GET") {
+        // 单个查询: GET [@table] <id>
+        std::shared_ptr<const HostedTable> hosted = registry.find(takeTableName(args, state), response);
+        if (!hosted) return response;
+        try {
+            uint32_t id = std::stoul(args);
+            NameRef ref;
+            if (hosted->local().find(id, ref, threadScratch())) {
+                response.assign(ref.data, ref.len);
+                response += '\n';
+            } else {
+                response = "NOT_FOUND\n";
+            }
+        } catch (...) {
+            response = "ERROR\n";
+        }
+    } else if (command == "PING") {
+        response = "PONG\n";
+    } else if (command == "STAT") {
+        // STAT [@table]
+        std::shared_ptr<const HostedTable> hosted = registry.find(takeTableName(args, state), response);
+        if (!hosted) return response;
+        const NameTable& table = *hosted->table;
+        char ratio[32];
+        snprintf(ratio, sizeof(ratio), "%.2f", compressionRatio(table));
+        response = "ENTRIES:" + std::to_string(table.size()) +
+                   " TABLE:" + table.kind() +
+                   " MEMORY:" + std::to_string(table.memoryBytes()) +
+                   " COMPRESSION:" + std::string(ratio) +
+                   " NAME_INDEX:" + std::to_string(hosted->nameIndex ? hosted->nameIndex->memoryBytes() : 0) +
+                   " NAME:" + hosted->name +
+                   " GENERATION:" + std::to_string(hosted->generation) +
+                   " VERSION:" + hosted->version + " SHARD:" + hosted->shard.describe() +
+                   describePlacement(*hosted) + "\n";
+    } else if (command == "NAMEID") {
+        // NAMEID [@table] <name>: 名称 → ID (需要反向索引)
+        response = lookupNameIds(args, false, state);
+    } else if (command == "NAMEIDS") {
+        // NAMEIDS [@table] <name> <name> ...: 批量名称 → ID，以 \t 分隔
+        response = lookupNameIds(args, true, state);
+    } else if (command == "CONVERT") {
+        // CONVERT [@table] <bytes> [passthrough]: 随后的 M8 数据流式转换
+        response = startConvert(args, state);
+    } else if (command == "CONVERTFILE") {
+        // CONVERTFILE [@table] <input> <output> [passthrough]: 服务端读写文件
+        response = startConvertFile(args, state);
+    } else if (command == "HEADER") {
+        // HEADER [@table] <id>: 目标库中的表头
+        response = getColumn(args, COLUMN_HEADER, state);
+    } else if (command == "SEQ") {
+        // SEQ [@table] <id>: 目标库中的序列
+        response = getColumn(args, COLUMN_SEQUENCE, state);
+    } else if (command == "COLUMNS") {
+        // COLUMNS [@table]: 列请求可取的列
+        std::shared_ptr<const HostedTable> hosted = registry.find(takeTableName(args, state), response);
+        if (!hosted) return response;
+        response = "COLUMNS";
+        for (int c = 0; (1u << c) <= COLUMN_ALL; c++) {
+            if (hosted->columns() & (1u << c)) response += std::string(" ") + TARGET_COLUMN_NAMES[c];
+        }
+        response += "\n";
+    } else if (command == "SHM") {
+        // 共享内存握手: 返回可直接映射的表文件路径 (共享内存段或快照文件)
+        std::shared_ptr<const HostedTable> hosted = registry.find(takeTableName(args, state), response);
+        if (!hosted) return response;
+        const DenseNameTable* dense = dynamic_cast<const DenseNameTable*>(hosted->table.get());
+        if (dense != NULL && !dense->sharedPath().empty()) {
+            response = "SHM " + dense->sharedPath() + " " + std::to_string(dense->memoryBytes()) + "\n";
+        } else {
+            response = "ERROR:Shared table not available\n";
+        }
+    } else if (command == "USE") {
+        // 之后不带 @table 的请求 (包括二进制 BATCH) 使用该表
+        std::shared_ptr<const HostedTable> hosted = registry.find(args, response);
+        if (!hosted) return response;
+        state.tableName = args;
+        response = "OK USE " + args + "\n";
+    } else if (command == "LOAD") {
+        // LOAD <name> <path>: 后台加载，旧请求不受影响
+        size_t sep = args.find(' ');
+        if (sep == std::string::npos || sep + 1 >= args.size()) return "ERROR:Usage LOAD <name> <path>\n";
+        response = startLoad(args.substr(0, sep), args.substr(sep + 1));
+    } else if (command == "RELOAD") {
+        // RELOAD [@table] [path]: 后台构建新表，完成后原子替换，不中断服务
+        std::string name = takeTableName(args, state);
+        response = startReload(name, args);
+    } else if (command == "UNLOAD") {
+        response = registry.unload(args) ? "OK UNLOADED " + args + "\n" : "ERROR:Unknown table " + args + "\n";
+    } else if (command == "TABLES") {
+        response = registry.describe();
+    } else if (command == "STATS") {
+        // 运行指标: 连接、收发字节与各类请求的计数、耗时分位数与批量大小
+        response = ServerMetrics::instance().describe();
+    } else if (line + "\n" == BIN_HELLO) {
+        // 协商二进制协议
+        response = BIN_HELLO_OK;
+    } else {
+        response = "ERROR:Unknown command\n";
+    }
+
+    return response;
+}
+
+// 处理一帧二进制 BATCH: ids 为 count 个小端 uint32，响应为长度表 + 拼接的名称。返回不存在的 ID 数
+size_t handleBinaryBatch(const NameTable& table, const char* ids, uint32_t count, OutputQueue& out) {
+    std::vector<uint32_t> idList(count);
+    for (uint32_t i = 0; i < count; i++) {
+        idList[i] = getU32(ids + 4 * (size_t)i);
+    }
+    std::vector<NameRef> refs(count);
+    size_t notFound = table.findBatch(idList.data(), count, refs.data(), threadScratch());
+
+    char* header = out.reserve(BIN_HEADER_SIZE);
+    header[0] = (char)BIN_MAGIC;
+    putU32(header + 1, count);
+    for (uint32_t i = 0; i < count; i++) {
+        putU32(out.reserve(4), refs[i].data == NULL ? BIN_NOT_FOUND : refs[i].len);
+    }
+    for (uint32_t i = 0; i < count; i++) {
+        prefetchName(refs.data(), i, count);
+        if (refs[i].data != NULL) {
+            out.append(refs[i].data, refs[i].len);
+        }
+    }
+    return notFound;
+}
+
+// 处理一帧二进制列请求: 每个 ID 依次输出 columns 中的各列，响应格式同 BATCH。
+// 请求的列不可用时输出错误并返回 false；notFound 为缺失的值数
+bool handleColumnBatch(const HostedTable& hosted, const char* ids, uint32_t count, uint32_t columns,
+                       OutputQueue& out, size_t& notFound) {
+    notFound = 0;
+    if ((columns & ~hosted.columns()) != 0 || columns == 0) {
+        out.append("ERROR:Column not available\n");
+        return false;
+    }
+    std::vector<uint32_t> selected;
+    for (int c = 0; (1u << c) <= COLUMN_ALL; c++) {
+        if (columns & (1u << c)) selected.push_back(1u << c);
+    }
+    size_t total = (size_t)count * selected.size();
+    std::vector<NameRef> refs(total);
+    std::vector<char> numbers((columns & (COLUMN_LENGTH | COLUMN_TAXID)) ? 16 * total : 0);
+    std::vector<uint32_t> idList(count);
+    for (uint32_t i = 0; i < count; i++) {
+        idList[i] = getU32(ids + 4 * (size_t)i);
+    }
+    // 名称列整批查询 (压缩表可连续解码同一块)
+    NameScratch& scratch = threadScratch();
+    std::vector<NameRef> names;
+    if (columns & COLUMN_NAME) {
+        names.resize(count);
+        notFound += hosted.local().findBatch(idList.data(), count, names.data(), scratch);
+    }
+    for (uint32_t i = 0; i < count; i++) {
+        uint32_t id = idList[i];
+        for (size_t c = 0; c < selected.size(); c++) {
+            size_t k = (size_t)i * selected.size() + c;
+            char* text = numbers.empty() ? NULL : &numbers[16 * k];
+            if (selected[c] == COLUMN_NAME) {
+                refs[k] = names[i];
+            } else if (!findColumn(hosted, selected[c], id, text, refs[k], scratch)) {
+                refs[k].data = NULL;
+                refs[k].len = 0;
+                notFound++;
+            }
+        }
+    }
+
+    char* header = out.reserve(BIN_HEADER_SIZE);
+    header[0] = (char)BIN_MAGIC;
+    putU32(header + 1, (uint32_t)total);
+    for (size_t k = 0; k < total; k++) {
+        putU32(out.reserve(4), refs[k].data == NULL ? BIN_NOT_FOUND : refs[k].len);
+    }
+    for (size_t k = 0; k < total; k++) {
+        if (refs[k].data != NULL) {
+            out.append(refs[k].data, refs[k].len);
+        }
+    }
+    return true;
+}
+
+// 处理一帧二进制名称查询: lens 为 count 个小端 uint32，names 为拼接的名称 (bytes 字节)。
+// 表没有反向索引或长度与 bytes 不符时输出错误并返回 false；notFound 为不在表中的名称数
+bool handleNameBatch(const HostedTable& hosted, const char* lens, uint32_t count, const char* names, uint32_t bytes,
+                     OutputQueue& out, size_t& notFound) {
+    notFound = 0;
+    if (!hosted.nameIndex) {
+        out.append("ERROR:Name index not available\n");
+        return false;
+    }
+    uint64_t total = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        total += getU32(lens + 4 * (size_t)i);
+    }
+    if (total != bytes) {
+        out.append("ERROR:Name lengths do not match frame size\n");
+        return false;
+    }
+    char* header = out.reserve(BIN_HEADER_SIZE);
+    header[0] = (char)BIN_NAMEID_MAGIC;
+    putU32(header + 1, count);
+    const char* name = names;
+    NameScratch& scratch = threadScratch();
+    for (uint32_t i = 0; i < count; i++) {
+        uint32_t len = getU32(lens + 4 * (size_t)i);
+        uint32_t id;
+        if (!hosted.nameIndex->find(name, len, hosted.local(), scratch, id)) {
+            id = BIN_NOT_FOUND;
+            notFound++;
+        }
+        putU32(out.reserve(4), id);
+        name += len;
+        scratch.clear();
+    }
+    return true;
+}
+
+// 文本 BATCH 中 ID 之间的分隔符。\r 也视为分隔符，CRLF 结尾的行与其他文本命令一样处理
+static inline bool isBatchSeparator(char c) {
+    return c == ' ' || c == '\t' || c == '\r';
+}
+
+// 解析文本 BATCH 中的一个 ID，无法解析时为 BATCH_INVALID_ID
+static uint64_t parseBatchId(const char* token, size_t len) {
+    uint64_t id = 0;
+    bool valid = len > 0 && len <= 10;
+    for (size_t i = 0; valid && i < len; i++) {
+        if (token[i] < '0' || token[i] > '9') valid = false;
+        id = id * 10 + (token[i] - '0');
+    }
+    return valid && id <= 0xFFFFFFFFull ? id : BATCH_INVALID_ID;
+}
+
+// 输出文本 BATCH 中暂存的 ID: 名称 / NOT_FOUND / ERROR，条目间以 \t 分隔。
+// 合法的 ID 整组经 findBatch 查询，读取结果时预取名称，与二进制 BATCH 使用同一个查询内核
+static void flushBatchItems(ProtocolState& state, OutputQueue& out) {
+    uint32_t ids[BATCH_PENDING];
+    NameRef refs[BATCH_PENDING];
+    size_t count = 0;
+    for (size_t i = 0; i < state.batchPendingCount; i++) {
+        if (state.batchPending[i] != BATCH_INVALID_ID) ids[count++] = (uint32_t)state.batchPending[i];
+    }
+    state.batchTable->local().findBatch(ids, count, refs, threadScratch());
+    size_t k = 0;
+    for (size_t i = 0; i < state.batchPendingCount; i++) {
+        if (state.batchItems++ > 0) {
+            out.append('\t');
+        }
+        if (state.batchPending[i] == BATCH_INVALID_ID) {
+            out.append("ERROR", 5);
+            state.batchNotFound++;
+            continue;
+        }
+        prefetchName(refs, k, count);
+        const NameRef& ref = refs[k++];
+        if (ref.data != NULL) {
+            out.append(ref.data, ref.len);
+        } else {
+            out.append("NOT_FOUND", 9);
+            state.batchNotFound++;
+        }
+    }
+    state.batchPendingCount = 0;
+}
+
+// 记录一条文本命令 (BATCH 之外) 的指标: GET / HEADER / SEQ 各含一个 ID，其余计为控制命令
+static void recordTextRequest(const std::string& request, const std::string& response, uint64_t nanos) {
+    RequestKind kind = REQ_CONTROL;
+    if (request.compare(0, 4, "GET ") == 0) {
+        kind = REQ_GET;
+    } else if (request.compare(0, 7, "HEADER ") == 0 || request.compare(0, 4, "SEQ ") == 0) {
+        kind = REQ_FIELD;
+    } else if (request.compare(0, 7, "NAMEID ") == 0 || request.compare(0, 8, "NAMEIDS ") == 0) {
+        kind = REQ_NAMEID;
+    } else if (request.compare(0, 12, "CONVERTFILE ") == 0) {
+        kind = REQ_CONVERT;
+    }
+    bool error = response.compare(0, 5, "ERROR") == 0;
+    uint64_t ids = kind == REQ_CONTROL ? 0 : 1;
+    uint64_t notFound = response == "NOT_FOUND\n" ? 1 : 0;
+    if (kind == REQ_CONVERT) {
+        // 这里只有未能开始的 CONVERTFILE，完成的由 stepConvertFile 记录
+        ids = 0;
+    }
+    if (kind == REQ_NAMEID && !error) {
+        // NAMEIDS 的响应每个名称一项
+        ids = std::count(response.begin(), response.end(), '\t') + 1;
+        notFound = 0;
+        for (size_t at = response.find("NOT_FOUND"); at != std::string::npos; at = response.find("NOT_FOUND", at + 9)) {
+            notFound++;
+        }
+    }
+    ServerMetrics::local().recordRequest(kind, nanos, ids, notFound, error);
+}
+
+static const size_t MAX_TEXT_LINE = 1 << 20;   // BATCH 之外的文本命令最大长度
+static const size_t MAX_BATCH_TOKEN = 64;      // BATCH 中单个 ID 或 @table 的最大长度
+
+// 增量解析连接上已收到的数据:
+//   - 二进制帧 (BATCH 与列请求) 按长度收齐后处理，使用连接的默认表 (USE)
+//   - 文本 BATCH [@table] 边收边处理，已收到的完整 ID 每 BATCH_PENDING 个整组查询，
+//     本次调用结束前输出，不需要等待整行
+//   - CONVERT 之后的 M8 数据每收到完整的行即转换输出，不完整的行留到下次
+//   - CONVERTFILE 每次调用转换一片，未完成时设置 conn.resume，由事件循环下一轮继续
+//   - 其他文本命令以换行结尾
+// 多个请求可以连续发送 (流水线)，响应按请求顺序写出。
+// 每个请求的处理耗时记入 ServerMetrics: 上一个请求的结束时刻即下一个的开始，每个请求只读一次时钟
+void processInput(Connection& conn) {
+    ProtocolState* state = static_cast<ProtocolState*>(conn.context.get());
+    if (state == NULL) {
+        state = new ProtocolState();
+        state->remote = conn.remote;
+        conn.context.reset(state);
+    }
+
+    const std::string& in = conn.in;
+    ThreadMetrics& metrics = ServerMetrics::local();
+    if (state->fileConvert && !stepConvertFile(*state, conn.out, metrics)) {
+        // CONVERTFILE 未完成: 下一轮事件循环继续，之后的请求等待
+        conn.resume = true;
+        return;
+    }
+    uint64_t lastTick = metricsNanos();
+    uint64_t batchResumed = lastTick;  // 文本 BATCH 在本次调用中开始或继续处理的时刻
+    size_t pos = 0;
+    while (pos < in.size()) {
+        if (state->inConvert) {
+            // 数据的最后一行可以没有换行符
+            size_t take = (size_t)std::min<uint64_t>(in.size() - pos, state->convertRemaining);
+            if (take < state->convertRemaining) {
+                const char* last = (const char*)memrchr(in.data() + pos, '\n', take);
+                if (last == NULL) {
+                    if (take > MAX_TEXT_LINE) {
+                        conn.out.append("ERROR:Line too long\n");
+                        conn.in.clear();
+                        conn.peerClosed = true;
+                        return;
+                    }
+                    break;
                 }
-            } catch (...) {
-                response = "ERROR\n";
+                take = (size_t)(last - (in.data() + pos)) + 1;
             }
-        } else if (request.substr(0, 6) == "BATCH ") {
-            // 批量查询
-            size_t pos = 6;
-            while (pos < request.size()) {
-                while (pos < request.size() && request[pos] == ' ') pos++;
-                if (pos >= request.size() || request[pos] == '\n') break;
-
-                size_t start = pos;
-                while (pos < request.size() && request[pos] != ' ' && request[pos] != '\n') pos++;
-
-                try {
-                    uint32_t id = std::stoul(request.substr(start, pos - start));
-                    auto it = idToName.find(id);
-                    if (it != idToName.end()) {
-                        response += it->second + "\t";
-                    } else {
-                        response += "NOT_FOUND\t";
+            if (!state->convertFailed) appendConvertFrame(*state, in.data(), pos, pos + take, conn.out);
+            pos += take;
+            state->convertRemaining -= take;
+            uint64_t now = metricsNanos();
+            state->convertNanos += now - lastTick;
+            lastTick = now;
+            if (state->convertRemaining == 0) finishConvert(*state, conn.out, metrics);
+        } else if (state->inBatch) {
+            char c = in[pos];
+            if (c == '\n') {
+                if (state->batchPendingCount > 0) flushBatchItems(*state, conn.out);
+                if (!state->batchFailed) conn.out.append('\n');
+                uint64_t now = metricsNanos();
+                metrics.recordRequest(REQ_BATCH, state->batchNanos + (now - batchResumed),
+                                      state->batchItems, state->batchNotFound, state->batchFailed);
+                lastTick = now;
+                state->inBatch = false;
+                state->batchSkipping = false;
+                state->batchTable.reset();
+                pos++;
+            } else if (state->batchSkipping) {
+                // 超长参数的其余部分，可能跨越多次读取
+                while (pos < in.size() && !isBatchSeparator(in[pos]) && in[pos] != '\n') pos++;
+                if (pos < in.size()) state->batchSkipping = false;
+            } else if (state->batchFailed || isBatchSeparator(c)) {
+                pos++;
+            } else if (!state->batchTable) {
+                // 第一个参数: 可选的 @table。超长的表名不存在，不论分几次收到都只输出一个错误
+                std::string name = state->tableName;
+                if (c == '@') {
+                    size_t end = pos;
+                    while (end < in.size() && !isBatchSeparator(in[end]) && in[end] != '\n') end++;
+                    if (end - pos > MAX_BATCH_TOKEN) {
+                        conn.out.append("ERROR:Invalid table name\n");
+                        state->batchFailed = true;
+                        pos = end;
+                        continue;
                     }
-                } catch (...) {
-                    response += "ERROR\t";
+                    if (end == in.size()) break;  // 表名未收全
+                    name.assign(in, pos + 1, end - pos - 1);
+                    pos = end;
+                }
+                std::string error;
+                state->batchTable = registry.find(name, error);
+                if (!state->batchTable) {
+                    conn.out.append(error);
+                    state->batchFailed = true;
+                }
+            } else {
+                size_t end = pos;
+                while (end < in.size() && !isBatchSeparator(in[end]) && in[end] != '\n') end++;
+                if (end - pos > MAX_BATCH_TOKEN) {
+                    // 超长的参数记为一项 ERROR；未收全时跳过其余部分，不会在下次读取时成为新的条目
+                    state->batchPending[state->batchPendingCount++] = BATCH_INVALID_ID;
+                    state->batchSkipping = end == in.size();
+                } else if (end == in.size()) {
+                    break;  // ID 未收全
+                } else {
+                    state->batchPending[state->batchPendingCount++] = parseBatchId(in.data() + pos, end - pos);
                 }
+                if (state->batchPendingCount == BATCH_PENDING) flushBatchItems(*state, conn.out);
+                pos = end;
+            }
+        } else if ((unsigned char)in[pos] == BIN_MAGIC) {
+            if (in.size() - pos < BIN_HEADER_SIZE) break;
+            uint32_t count = getU32(in.data() + pos + 1);
+            if (count > BIN_MAX_COUNT) {
+                // 非法帧，无法继续定位后续请求
+                conn.in.clear();
+                conn.peerClosed = true;
+                return;
             }
-            if (!response.empty()) {
-                response.back() = '\n';
+            size_t frameSize = BIN_HEADER_SIZE + 4 * (size_t)count;
+            if (in.size() - pos < frameSize) break;
+
+            std::string error;
+            size_t notFound = 0;
+            std::shared_ptr<const HostedTable> hosted = registry.find(state->tableName, error);
+            if (hosted) {
+                notFound = handleBinaryBatch(hosted->local(), in.data() + pos + BIN_HEADER_SIZE, count, conn.out);
+            } else {
+                conn.out.append(error);
+            }
+            uint64_t now = metricsNanos();
+            metrics.recordRequest(REQ_BIN_BATCH, now - lastTick, count, notFound, !hosted);
+            lastTick = now;
+            pos += frameSize;
+        } else if ((unsigned char)in[pos] == BIN_COLUMNS_MAGIC) {
+            if (in.size() - pos < BIN_COLUMNS_HEADER_SIZE) break;
+            uint32_t count = getU32(in.data() + pos + 1);
+            uint32_t columns = getU32(in.data() + pos + 5);
+            if (count > BIN_MAX_COUNT) {
+                conn.in.clear();
+                conn.peerClosed = true;
+                return;
+            }
+            size_t frameSize = BIN_COLUMNS_HEADER_SIZE + 4 * (size_t)count;
+            if (in.size() - pos < frameSize) break;
+
+            std::string error;
+            size_t notFound = 0;
+            std::shared_ptr<const HostedTable> hosted = registry.find(state->tableName, error);
+            bool ok = false;
+            if (hosted) {
+                ok = handleColumnBatch(*hosted, in.data() + pos + BIN_COLUMNS_HEADER_SIZE, count, columns, conn.out,
+                                       notFound);
+            } else {
+                conn.out.append(error);
+            }
+            uint64_t now = metricsNanos();
+            metrics.recordRequest(REQ_BIN_COLUMNS, now - lastTick, count, notFound, !ok);
+            lastTick = now;
+            pos += frameSize;
+        } else if ((unsigned char)in[pos] == BIN_NAMEID_MAGIC) {
+            if (in.size() - pos < BIN_NAMEID_HEADER_SIZE) break;
+            uint32_t count = getU32(in.data() + pos + 1);
+            uint32_t bytes = getU32(in.data() + pos + 5);
+            if (count > BIN_MAX_COUNT || bytes > BIN_MAX_NAME_BYTES) {
+                conn.in.clear();
+                conn.peerClosed = true;
+                return;
+            }
+            size_t frameSize = BIN_NAMEID_HEADER_SIZE + 4 * (size_t)count + bytes;
+            if (in.size() - pos < frameSize) break;
+
+            std::string error;
+            size_t notFound = 0;
+            std::shared_ptr<const HostedTable> hosted = registry.find(state->tableName, error);
+            bool ok = false;
+            if (hosted) {
+                const char* lens = in.data() + pos + BIN_NAMEID_HEADER_SIZE;
+                ok = handleNameBatch(*hosted, lens, count, lens + 4 * (size_t)count, bytes, conn.out, notFound);
             } else {
-                response = "\n";  // 空响应
+                conn.out.append(error);
             }
-        } else if (request.substr(0, 4) == "PING") {
-            response = "PONG\n";
-        } else if (request.substr(0, 4) == "STAT") {
-            response = "ENTRIES:" + std::to_string(idToName.size()) + "\n";
+            uint64_t now = metricsNanos();
+            metrics.recordRequest(REQ_BIN_NAMEID, now - lastTick, count, notFound, !ok);
+            lastTick = now;
+            pos += frameSize;
+        } else if (in.compare(pos, 6, "BATCH ") == 0) {
+            state->inBatch = true;
+            state->batchFailed = false;
+            state->batchSkipping = false;
+            state->batchItems = 0;
+            state->batchNotFound = 0;
+            state->batchNanos = 0;
+            batchResumed = lastTick;
+            pos += 6;
         } else {
-            response = "ERROR:Unknown command\n";
+            size_t nl = in.find('\n', pos);
+            if (nl == std::string::npos) {
+                if (in.size() - pos > MAX_TEXT_LINE) {
+                    conn.out.append("ERROR:Request too long\n");
+                    conn.in.clear();
+                    conn.peerClosed = true;
+                    return;
+                }
+                break;
+            }
+            std::string request = in.substr(pos, nl + 1 - pos);
+            std::string response = handleTextRequest(request, *state);
+            conn.out.append(response);
+            uint64_t now = metricsNanos();
+            if (state->inConvert) {
+                // CONVERT 的指标在其数据处理完后记录
+                state->convertNanos = now - lastTick;
+                if (state->convertRemaining == 0) finishConvert(*state, conn.out, metrics);
+            } else if (state->fileConvert) {
+                // CONVERTFILE 由事件循环逐片转换，完成前不处理后续请求
+                state->fileConvert->nanos = now - lastTick;
+                conn.resume = true;
+                pos = nl + 1;
+                break;
+            } else {
+                recordTextRequest(request, response, now - lastTick);
+            }
+            lastTick = now;
+            pos = nl + 1;
         }
+    }
+    if (state->inBatch) {
+        // 已收到的 ID 在本次调用内输出，不等待后续数据
+        if (state->batchPendingCount > 0) flushBatchItems(*state, conn.out);
+        state->batchNanos += metricsNanos() - batchResumed;
+    }
+    conn.in.erase(0, pos);
+}
 
-        send(clientSocket, response.c_str(), response.size(), 0);
+// 在 TCP 地址 [host:]port 上监听: 只给端口时只监听本机回环，":port" 或 "0.0.0.0:port" 监听所有网卡。
+// 失败时返回 -1
+static int listenTcp(const std::string& address, int backlog, std::string& error) {
+    std::string host = "127.0.0.1";
+    std::string port = address;
+    size_t colon = address.rfind(':');
+    if (colon != std::string::npos) {
+        host = address.substr(0, colon);
+        port = address.substr(colon + 1);
     }
+    if (host.size() >= 2 && host[0] == '[' && host[host.size() - 1] == ']') host = host.substr(1, host.size() - 2);
 
-    close(clientSocket);
+    struct addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_PASSIVE;
+    struct addrinfo* result = NULL;
+    int rc = getaddrinfo(host.empty() ? NULL : host.c_str(), port.c_str(), &hints, &result);
+    if (rc != 0) {
+        error = address + ": " + gai_strerror(rc);
+        return -1;
+    }
+    int fd = -1;
+    for (struct addrinfo* ai = result; ai != NULL; ai = ai->ai_next) {
+        fd = socket(ai->ai_family, ai->ai_socktype | SOCK_CLOEXEC, ai->ai_protocol);
+        if (fd < 0) continue;
+        int one = 1;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        if (bind(fd, ai->ai_addr, ai->ai_addrlen) == 0 && listen(fd, backlog) == 0) break;
+        error = address + ": " + strerror(errno);
+        close(fd);
+        fd = -1;
+    }
+    freeaddrinfo(result);
+    return fd;
+}
+
+void printUsage(const char* prog) {
+    std::cerr << "Usage: " << prog << " <lookup_file|snapshot> [socket_path] [options]" << std::endl;
+    std::cerr << "       " << prog << " --build-snapshot <lookup_file> <snapshot>" << std::endl;
+    std::cerr << std::endl;
+    std::cerr << "Options:" << std::endl;
+    std::cerr << "  --table <mode>        Table backend: auto, dense, hash (text lookups) or compressed (default: auto)" << std::endl;
+    std::cerr << "  --load-threads <n>    Threads for parsing text lookups (default: all cores)" << std::endl;
+    std::cerr << "  --verify-snapshot     Verify the full data checksum when mapping a snapshot" << std::endl;
+    std::cerr << "  --shm                 Build the dense table in /dev/shm so local clients can map it" << std::endl;
+    std::cerr << "  --workers <n>         Worker threads serving connections (default: all cores)" << std::endl;
+    std::cerr << "  --no-pin              Do not pin worker threads to CPU cores" << std::endl;
+    std::cerr << "  --backlog <n>         Listen backlog (default: 4096, capped by net.core.somaxconn)" << std::endl;
+    std::cerr << "  --db <name>=<path>    Also host the lookup file or snapshot as table <name> (repeatable)" << std::endl;
+    std::cerr << "  --target-db [<name>=]<targetDB>" << std::endl;
+    std::cerr << "                        Serve headers, sequences, lengths and taxids of an MMseqs2 target DB" << std::endl;
+    std::cerr << "                        (targetDB_h, targetDB, targetDB_mapping) for the default or named table" << std::endl;
+    std::cerr << "  --name-index          Build a name->ID index for NAMEID queries (with --build-snapshot:" << std::endl;
+    std::cerr << "                        also write <snapshot>.nameidx, which is mapped at startup)" << std::endl;
+    std::cerr << "  --huge-pages <mode>   Back tables with huge pages: off, thp (transparent) or explicit" << std::endl;
+    std::cerr << "                        (hugetlb pool, falls back to thp) (default: off)" << std::endl;
+    std::cerr << "  --mlock               Lock tables in memory so they are never swapped out" << std::endl;
+    std::cerr << "  --numa <policy>       default, interleave (pages spread over all nodes) or replicate" << std::endl;
+    std::cerr << "                        (one copy per node, workers read their local copy) (default: default)" << std::endl;
+    std::cerr << "  --shard <shard>       Load only the IDs of one shard: range:<begin>-<end> or hash:<k>/<n>" << std::endl;
+    std::cerr << "                        (id % n == k); applies to every table and to --build-snapshot" << std::endl;
+    std::cerr << "  --tcp [host:]<port>   Also listen on TCP (port only: loopback; :<port>: all interfaces)" << std::endl;
+    std::cerr << "  --tcp-admin           Accept LOAD/RELOAD/UNLOAD/CONVERTFILE over TCP (default: unix socket only)" << std::endl;
+    std::cerr << "  --convert-files       Allow CONVERTFILE requests to read and write files on this host" << std::endl;
+    std::cerr << "  --build-snapshot <lookup_file> <snapshot>" << std::endl;
+    std::cerr << "                        Parse a text lookup and write a binary snapshot, then exit" << std::endl;
 }
 
 int main(int argc, char* argv[]) {
-    if (argc < 2) {
-        std::cerr << "Usage: " << argv[0] << " <lookup_file> [socket_path]" << std::endl;
+    // 解析参数: 位置参数 <lookup_file> [socket_path]，其余为选项
+    std::vector<std::string> positional;
+    LoadOptions loadOptions;
+    int workers = std::max(1u, std::thread::hardware_concurrency());
+    int backlog = 4096;
+    bool pinWorkers = true;
+    std::string tcpAddress;
+    std::string snapshotInput, snapshotOutput;
+    std::vector<std::pair<std::string, std::string> > extraTables;
+    std::map<std::string, std::string> targetDBs;  // 表名 → 目标库
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--build-snapshot" && i + 2 < argc) {
+            snapshotInput = argv[++i];
+            snapshotOutput = argv[++i];
+        } else if (arg == "--load-threads" && i + 1 < argc) {
+            loadOptions.loadThreads = std::max(1, std::stoi(argv[++i]));
+        } else if (arg == "--workers" && i + 1 < argc) {
+            workers = std::max(1, std::stoi(argv[++i]));
+        } else if (arg == "--backlog" && i + 1 < argc) {
+            backlog = std::max(1, std::stoi(argv[++i]));
+        } else if (arg == "--db" && i + 1 < argc) {
+            std::string value = argv[++i];
+            size_t eq = value.find('=');
+            if (eq == std::string::npos || !isValidTableName(value.substr(0, eq)) ||
+                value.substr(0, eq) == DEFAULT_TABLE) {
+                std::cerr << "[ERROR] Invalid --db (expected <name>=<lookup_file|snapshot>): " << value << std::endl;
+                return 1;
+            }
+            extraTables.push_back(std::make_pair(value.substr(0, eq), value.substr(eq + 1)));
+        } else if (arg == "--target-db" && i + 1 < argc) {
+            // [<name>=]<targetDB>: 前缀不是合法表名 (例如路径中含 '=') 时整体视为 default 表的路径
+            std::string value = argv[++i];
+            size_t eq = value.find('=');
+            if (eq != std::string::npos && isValidTableName(value.substr(0, eq))) {
+                targetDBs[value.substr(0, eq)] = value.substr(eq + 1);
+            } else {
+                targetDBs[DEFAULT_TABLE] = value;
+            }
+        } else if (arg == "--no-pin") {
+            pinWorkers = false;
+        } else if (arg == "--verify-snapshot") {
+            loadOptions.verifySnapshot = true;
+        } else if (arg == "--shm") {
+            loadOptions.shared = true;
+        } else if (arg == "--name-index") {
+            loadOptions.nameIndex = true;
+        } else if (arg == "--shard" && i + 1 < argc) {
+            std::string error;
+            if (!loadOptions.shard.parse(argv[++i], error)) {
+                std::cerr << "[ERROR] Invalid --shard: " << error << std::endl;
+                return 1;
+            }
+        } else if (arg == "--tcp" && i + 1 < argc) {
+            tcpAddress = argv[++i];
+        } else if (arg == "--tcp-admin") {
+            allowRemoteAdmin = true;
+        } else if (arg == "--convert-files") {
+            allowFileConvert = true;
+        } else if (arg == "--mlock") {
+            loadOptions.placement.lock = true;
+        } else if (arg == "--huge-pages" && i + 1 < argc) {
+            std::string value = argv[++i];
+            if (value == "off") {
+                loadOptions.placement.hugePages = HUGE_PAGES_OFF;
+            } else if (value == "thp") {
+                loadOptions.placement.hugePages = HUGE_PAGES_TRANSPARENT;
+            } else if (value == "explicit") {
+                loadOptions.placement.hugePages = HUGE_PAGES_EXPLICIT;
+            } else {
+                std::cerr << "[ERROR] Unknown huge page mode: " << value << std::endl;
+                return 1;
+            }
+        } else if (arg == "--numa" && i + 1 < argc) {
+            std::string value = argv[++i];
+            if (value == "default") {
+                loadOptions.placement.numa = NUMA_DEFAULT;
+            } else if (value == "interleave") {
+                loadOptions.placement.numa = NUMA_INTERLEAVE;
+            } else if (value == "replicate") {
+                loadOptions.placement.numa = NUMA_REPLICATE;
+            } else {
+                std::cerr << "[ERROR] Unknown NUMA policy: " << value << std::endl;
+                return 1;
+            }
+        } else if (arg == "--table" && i + 1 < argc) {
+            std::string value = argv[++i];
+            if (value == "auto") {
+                loadOptions.mode = TABLE_AUTO;
+            } else if (value == "dense") {
+                loadOptions.mode = TABLE_DENSE;
+            } else if (value == "hash") {
+                loadOptions.mode = TABLE_HASH;
+            } else if (value == "compressed") {
+                loadOptions.mode = TABLE_COMPRESSED;
+            } else {
+                std::cerr << "[ERROR] Unknown table mode: " << value << std::endl;
+                return 1;
+            }
+        } else if (arg == "--help" || arg == "-h") {
+            printUsage(argv[0]);
+            return 0;
+        } else {
+            positional.push_back(arg);
+        }
+    }
+
+    if (!snapshotInput.empty()) {
+        return buildSnapshot(snapshotInput, snapshotOutput, loadOptions);
+    }
+    if (loadOptions.placement.numa == NUMA_REPLICATE && !pinWorkers) {
+        std::cerr << "[ERROR] --numa replicate needs pinned workers, remove --no-pin" << std::endl;
+        return 1;
+    }
+
+    if (positional.empty()) {
+        printUsage(argv[0]);
         return 1;
     }
 
-    std::string lookupFile = argv[1];
+    std::string lookupFile = positional[0];
     std::string socketPath = lookupFile + ".sock";
-    if (argc > 2) {
-        socketPath = argv[2];
+    if (positional.size() > 1) {
+        socketPath = positional[1];
     }
 
-    // 信号处理
+    // 信号处理; SIGHUP 在所有线程中屏蔽，由专用线程同步等待
     signal(SIGINT, signalHandler);
     signal(SIGTERM, signalHandler);
+    sigset_t hupMask;
+    sigemptyset(&hupMask);
+    sigaddset(&hupMask, SIGHUP);
+    pthread_sigmask(SIG_BLOCK, &hupMask, NULL);
 
-    // 加载 lookup
-    if (!loadLookupFile(lookupFile)) {
+    // 加载 lookup: 二进制快照直接映射，否则解析文本。位置参数为 default 表，--db 追加命名表
+    serverLoadOptions = loadOptions;
+    if (loadOptions.shared) removeStaleSegments();
+    for (const auto& target : targetDBs) {
+        bool known = target.first == DEFAULT_TABLE;
+        for (const auto& db : extraTables) known = known || db.first == target.first;
+        if (!known) {
+            std::cerr << "[ERROR] --target-db refers to unknown table " << target.first << std::endl;
+            return 1;
+        }
+    }
+    if (!loadInitialTable(DEFAULT_TABLE, lookupFile, targetDBs[DEFAULT_TABLE])) {
         return 1;
     }
+    for (const auto& db : extraTables) {
+        if (!loadInitialTable(db.first, db.second, targetDBs[db.first])) {
+            return 1;
+        }
+    }
 
     // 创建 socket
     int serverSocket = socket(AF_UNIX, SOCK_STREAM, 0);
@@ -238,48 +2355,57 @@ int main(int argc, char* argv[]) {
     }
 
     // 监听
-    if (listen(serverSocket, 10) < 0) {
+    if (listen(serverSocket, backlog) < 0) {
         std::cerr << "[ERROR] Cannot listen on socket" << std::endl;
         close(serverSocket);
         unlink(socketPath.c_str());
         return 1;
     }
+    std::vector<int> listeners(1, serverSocket);
+    if (!tcpAddress.empty()) {
+        std::string error;
+        int tcpSocket = listenTcp(tcpAddress, backlog, error);
+        if (tcpSocket < 0) {
+            std::cerr << "[ERROR] Cannot listen on TCP " << error << std::endl;
+            close(serverSocket);
+            unlink(socketPath.c_str());
+            return 1;
+        }
+        listeners.push_back(tcpSocket);
+    }
 
     std::cerr << "[INFO] convertserver started" << std::endl;
     std::cerr << "[INFO] Socket path: " << socketPath << std::endl;
+    if (!tcpAddress.empty()) std::cerr << "[INFO] TCP address: " << tcpAddress << std::endl;
+    if (loadOptions.shard.partial()) std::cerr << "[INFO] Serving shard " << loadOptions.shard.describe() << std::endl;
     std::cerr << "[INFO] Ready to accept connections" << std::endl;
     std::cout << socketPath << std::endl;
 
-    // 主循环
-    while (running) {
-        fd_set readfds;
-        FD_ZERO(&readfds);
-        FD_SET(serverSocket, &readfds);
-
-        struct timeval timeout;
-        timeout.tv_sec = 1;
-        timeout.tv_usec = 0;
+    std::cerr << "[INFO] Serving with " << workers << " worker thread(s)" << (pinWorkers ? " pinned to cores" : "") << std::endl;
 
-        int activity = select(serverSocket + 1, &readfds, NULL, NULL, &timeout);
-
-        if (activity < 0 && errno != EINTR) {
-            std::cerr << "[ERROR] Select error" << std::endl;
-            break;
+    // SIGHUP: 重新加载所有表 (旧表继续服务直至新表就绪)
+    std::thread reloadWatcher([&hupMask]() {
+        for (;;) {
+            int sig = 0;
+            sigwait(&hupMask, &sig);
+            if (!running) break;
+            std::cerr << "[INFO] Received SIGHUP, reloading tables" << std::endl;
+            reloadAllTables();
         }
+    });
 
-        if (activity > 0 && FD_ISSET(serverSocket, &readfds)) {
-            int clientSocket = accept(serverSocket, NULL, NULL);
-            if (clientSocket < 0) {
-                continue;
-            }
-
-            std::thread clientThread(handleClient, clientSocket);
-            clientThread.detach();
-        }
+    // 主循环: epoll 接受连接，固定工作线程池处理请求；退出前排空进行中的请求
+    Reactor reactor(workers, pinWorkers, processInput, loadOptions.placement.numa == NUMA_REPLICATE);
+    if (!reactor.run(listeners, running)) {
+        std::cerr << "[ERROR] Cannot start worker threads" << std::endl;
     }
+    running = false;
+    pthread_kill(reloadWatcher.native_handle(), SIGHUP);
+    reloadWatcher.join();
+    registry.waitTasks();
 
     // 清理
-    close(serverSocket);
+    for (int fd : listeners) close(fd);
     unlink(socketPath.c_str());
 
     std::cerr << "[INFO] convertserver stopped" << std::endl;
@@ -0,0 +1,412 @@
+/**
+ * lookup_image.h - 稠密查询表的二进制镜像格式
+ *
+ * 同一布局既是内存中的 DenseNameTable，也是磁盘上的快照文件，
+ * 服务端可以直接 mmap 快照使用，无需解析和拷贝。
+ *
+ * 布局 (小端):
+ *   [0, 4096)                         LookupImageHeader，其余填 0
+ *   [offsetsPos, +8 * (slots + 1))    uint64 offsets，按 ID 下标
+ *   [blobPos, +blobBytes)             名称拼接而成的 blob
+ *
+ * 校验:
+ *   headerChecksum 覆盖 header 中它之前的所有字段，打开时总是校验，同时检查文件长度覆盖
+ *   offsets 与 blob、首末偏移与 blobBytes 一致；
+ *   dataChecksum 覆盖 offsets 与 blob，需要读完整个文件，按需校验。
+ *   不校验数据时中间的偏移可能损坏，DenseNameTable::find 把越过 blob 的区间视为不存在。
+ *
+ * 分片 (见 shard.h): 只含部分 ID 的镜像按局部 ID 下标，version 为 2，
+ * 在 header 区的 LOOKUP_IMAGE_SHARD_POS 处记录 LookupImageShard。
+ * 旧版本读取方拒绝 version 2，不会把局部 ID 当作全局 ID 提供。
+ *
+ * 匿名内存可按 MemoryPlacement 分配 (大页、NUMA 策略)，见 memory_placement.h。
+ */
+
+#ifndef CONVERTSERVER_LOOKUP_IMAGE_H
+#define CONVERTSERVER_LOOKUP_IMAGE_H
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdint.h>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <stddef.h>
+
+#include "memory_placement.h"
+
+static const char LOOKUP_IMAGE_MAGIC[8] = {'C', 'S', 'L', 'O', 'O', 'K', 'U', 'P'};
+static const uint32_t LOOKUP_IMAGE_VERSION = 1;
+static const uint32_t LOOKUP_IMAGE_SHARD_VERSION = 2;
+static const size_t LOOKUP_IMAGE_HEADER_SIZE = 4096;
+static const char LOOKUP_IMAGE_SHARD_MAGIC[8] = {'C', 'S', 'S', 'H', 'A', 'R', 'D', '1'};
+static const size_t LOOKUP_IMAGE_SHARD_POS = 512;
+
+struct LookupImageHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t headerSize;
+    uint64_t slots;           // offsets 共 slots + 1 项，即 maxId + 1
+    uint64_t count;           // 有效条目数
+    uint64_t offsetsPos;
+    uint64_t blobPos;
+    uint64_t blobBytes;
+    uint64_t dataChecksum;
+    uint64_t headerChecksum;  // 必须是最后一个字段
+};
+
+// 分片镜像包含的 ID 集合，字段含义见 shard.h 中的 ShardSpec
+struct LookupImageShard {
+    char magic[8];
+    uint32_t kind;
+    uint32_t reserved;
+    uint64_t first;
+    uint64_t second;
+    uint64_t checksum;  // 必须是最后一个字段
+};
+
+// 按 8 字节字长计算的 64 位校验和，4 路独立累加以利用指令级并行
+inline uint64_t imageChecksum(const void* data, size_t len, uint64_t seed = 0) {
+    const uint64_t prime1 = 0x9E3779B185EBCA87ULL;
+    const uint64_t prime2 = 0xC2B2AE3D27D4EB4FULL;
+    const unsigned char* p = (const unsigned char*)data;
+    uint64_t lanes[4] = {seed + prime1, seed + prime2, seed, seed - prime1};
+
+    size_t i = 0;
+    for (; i + 32 <= len; i += 32) {
+        for (int k = 0; k < 4; k++) {
+            uint64_t w;
+            memcpy(&w, p + i + 8 * k, 8);
+            lanes[k] = (lanes[k] ^ (w * prime2)) * prime1;
+            lanes[k] = (lanes[k] << 31) | (lanes[k] >> 33);
+        }
+    }
+
+    uint64_t h = lanes[0] ^ (lanes[1] * prime1) ^ (lanes[2] * prime2) ^ lanes[3] ^ (uint64_t)len;
+    for (; i < len; i++) {
+        h = (h ^ p[i]) * prime1;
+    }
+    h ^= h >> 29;
+    h *= prime2;
+    h ^= h >> 32;
+    return h;
+}
+
+inline uint64_t imageHeaderChecksum(const LookupImageHeader& header) {
+    return imageChecksum(&header, offsetof(LookupImageHeader, headerChecksum));
+}
+
+inline uint64_t imageShardChecksum(const LookupImageShard& shard) {
+    return imageChecksum(&shard, offsetof(LookupImageShard, checksum));
+}
+
+// 计算布局，返回镜像总大小
+inline size_t imageLayout(uint64_t slots, uint64_t blobBytes, uint64_t& offsetsPos, uint64_t& blobPos) {
+    offsetsPos = LOOKUP_IMAGE_HEADER_SIZE;
+    blobPos = offsetsPos + (slots + 1) * sizeof(uint64_t);
+    return (size_t)(blobPos + blobBytes);
+}
+
+// 镜像所在的内存区域: 匿名内存 (从文本构建)、可供其他进程映射的共享内存文件，
+// 或只读映射的快照文件
+class LookupImage {
+private:
+    char* base;
+    size_t length;
+    size_t mappedLength;   // 实际映射的长度 (hugetlb 按大页取整)
+    std::string filePath;  // 映射的文件路径，匿名内存为空
+    bool ownsFile;         // 释放时删除文件 (本进程创建的共享内存段)
+    MemoryPlacement achieved;    // 实际生效的放置 (大页方式、NUMA 策略、是否锁定)
+    std::string placementNote;   // 请求的放置未能完全生效的原因
+
+    LookupImage(const LookupImage&);
+    LookupImage& operator=(const LookupImage&);
+
+    // 按请求设置大页建议与 NUMA 策略；在写入数据之前调用，页在首次缺页时按策略分配
+    void applyPlacement(const MemoryPlacement& placement) {
+        if (achieved.hugePages == HUGE_PAGES_TRANSPARENT && madvise(base, mappedLength, MADV_HUGEPAGE) != 0) {
+            placementNote = std::string("madvise(MADV_HUGEPAGE) failed: ") + strerror(errno);
+            achieved.hugePages = HUGE_PAGES_OFF;
+        }
+        std::string error;
+        if (placement.numa != NUMA_DEFAULT) {
+            int node = placement.numa == NUMA_REPLICATE ? placement.node : -1;
+            if (bindRegion(base, mappedLength, node, error)) {
+                achieved.numa = placement.numa;
+                achieved.node = node;
+            } else {
+                placementNote = error;
+            }
+        }
+    }
+
+public:
+    LookupImage() : base(NULL), length(0), mappedLength(0), ownsFile(false) {}
+
+    ~LookupImage() { release(); }
+
+    char* data() const { return base; }
+    size_t size() const { return length; }
+    const std::string& path() const { return filePath; }
+    const MemoryPlacement& placement() const { return achieved; }
+    const std::string& placementWarning() const { return placementNote; }
+
+    void release() {
+        if (base != NULL) {
+            munmap(base, mappedLength);
+            base = NULL;
+            length = 0;
+            mappedLength = 0;
+        }
+        if (ownsFile) {
+            unlink(filePath.c_str());
+            ownsFile = false;
+        }
+        filePath.clear();
+        achieved = MemoryPlacement();
+        placementNote.clear();
+    }
+
+    // 分配可写的匿名内存 (按需缺页，未触碰部分不占物理内存)。
+    // placement 选择大页与 NUMA 策略: explicit 大页池不足时退回透明大页，
+    // 透明大页的区域按大页对齐；未能生效的部分记入 placementWarning()
+    bool allocate(size_t size, std::string& error, const MemoryPlacement& placement = MemoryPlacement()) {
+        release();
+        int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+        HugePageMode mode = placement.hugePages;
+        if (mode == HUGE_PAGES_EXPLICIT) {
+            size_t rounded = roundUp(std::max<size_t>(size, 1), hugePageSize());
+            void* p = mmap(NULL, rounded, PROT_READ | PROT_WRITE, flags | MAP_HUGETLB, -1, 0);
+            if (p != MAP_FAILED) {
+                base = (char*)p;
+                length = size;
+                mappedLength = rounded;
+                achieved.hugePages = HUGE_PAGES_EXPLICIT;
+                applyPlacement(placement);
+                return true;
+            }
+            placementNote = std::string("hugetlb pool exhausted (") + strerror(errno) + "), using transparent huge pages";
+            mode = HUGE_PAGES_TRANSPARENT;
+        }
+        // 透明大页只作用于对齐的大页区间: 多映射一个大页，再去掉首尾未对齐的部分
+        size_t align = mode == HUGE_PAGES_TRANSPARENT ? hugePageSize() : 0;
+        size_t mapped = roundUp(size, (size_t)sysconf(_SC_PAGESIZE));
+        void* p = mmap(NULL, mapped + align, PROT_READ | PROT_WRITE, flags, -1, 0);
+        if (p == MAP_FAILED) {
+            error = std::string("mmap failed: ") + strerror(errno);
+            return false;
+        }
+        char* start = (char*)p;
+        if (align > 0) {
+            char* aligned = (char*)roundUp((uintptr_t)start, align);
+            size_t head = aligned - start;
+            if (head > 0) munmap(start, head);
+            if (align > head) munmap(aligned + mapped, align - head);
+            start = aligned;
+        }
+        base = start;
+        length = size;
+        mappedLength = mapped;
+        achieved.hugePages = mode;
+        applyPlacement(placement);
+        return true;
+    }
+
+    // 在 tmpfs (如 /dev/shm) 上创建共享内存段并可写映射，其他进程可按路径只读映射。
+    // 段随本对象释放而删除；已映射的进程不受影响。空间在映射前分配，tmpfs 不足时返回错误。
+    // tmpfs 上不能使用 hugetlb，explicit 大页退回透明大页 (取决于 shmem_enabled)
+    bool allocateShared(const std::string& path, size_t size, std::string& error,
+                        const MemoryPlacement& placement = MemoryPlacement()) {
+        release();
+        int fd = open(path.c_str(), O_RDWR | O_CREAT | O_EXCL, 0644);
+        if (fd < 0) {
+            error = "cannot create " + path + ": " + strerror(errno);
+            return false;
+        }
+        // 预先分配全部页: 只 ftruncate 时 tmpfs 空间不足要到写入映射时才以 SIGBUS 暴露
+        int rc = posix_fallocate(fd, 0, size);
+        if (rc != 0) {
+            error = "cannot allocate " + std::to_string(size) + " bytes in " + path + ": " + strerror(rc) +
+                    (rc == ENOSPC ? " (tmpfs too small, see 'df /dev/shm')" : "");
+            close(fd);
+            unlink(path.c_str());
+            return false;
+        }
+        void* p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        close(fd);
+        if (p == MAP_FAILED) {
+            error = std::string("mmap failed: ") + strerror(errno);
+            unlink(path.c_str());
+            return false;
+        }
+        base = (char*)p;
+        length = size;
+        mappedLength = size;
+        filePath = path;
+        ownsFile = true;
+        achieved.hugePages = placement.hugePages == HUGE_PAGES_OFF ? HUGE_PAGES_OFF : HUGE_PAGES_TRANSPARENT;
+        if (placement.hugePages == HUGE_PAGES_EXPLICIT) {
+            placementNote = "hugetlb is not available for shared segments, using transparent huge pages";
+        }
+        applyPlacement(placement);
+        return true;
+    }
+
+    // 只读映射快照文件并校验 header；MAP_SHARED 使多个进程共享 page cache
+    bool mapFile(const std::string& path, bool verifyData, std::string& error) {
+        if (!mapReadOnly(path, LOOKUP_IMAGE_HEADER_SIZE, error)) return false;
+        if (!validate(verifyData, error)) {
+            release();
+            return false;
+        }
+        return true;
+    }
+
+    // 只读映射整个文件，不检查内容 (其他格式的文件自行校验)；文件小于 minSize 时失败
+    bool mapReadOnly(const std::string& path, size_t minSize, std::string& error) {
+        release();
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            error = "cannot open " + path + ": " + strerror(errno);
+            return false;
+        }
+        struct stat st;
+        if (fstat(fd, &st) != 0 || (size_t)st.st_size < minSize || st.st_size == 0) {
+            close(fd);
+            error = "file too small: " + path;
+            return false;
+        }
+        void* p = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        close(fd);
+        if (p == MAP_FAILED) {
+            error = std::string("mmap failed: ") + strerror(errno);
+            return false;
+        }
+        base = (char*)p;
+        length = st.st_size;
+        mappedLength = st.st_size;
+        char* resolved = realpath(path.c_str(), NULL);
+        filePath = resolved ? resolved : path;
+        free(resolved);
+        return true;
+    }
+
+    // 对整个区域设置访问方式提示 (madvise)，失败时忽略
+    void advise(int advice) const {
+        if (base != NULL) madvise(base, mappedLength, advice);
+    }
+
+    // 锁定整个区域，使其不被换出 (映射的快照锁定其 page cache)
+    bool lock(std::string& error) {
+        if (base == NULL) return true;
+        if (mlock(base, mappedLength) != 0) {
+            error = std::string("mlock failed: ") + strerror(errno) +
+                    (errno == ENOMEM || errno == EPERM ? " (raise 'ulimit -l' or grant CAP_IPC_LOCK)" : "");
+            return false;
+        }
+        achieved.lock = true;
+        return true;
+    }
+
+    // 实际达到的放置，见 measurePlacement
+    PlacementStatus measure() const { return measurePlacement(base, mappedLength); }
+
+    bool validate(bool verifyData, std::string& error) const {
+        const LookupImageHeader* h = (const LookupImageHeader*)base;
+        if (memcmp(h->magic, LOOKUP_IMAGE_MAGIC, sizeof(LOOKUP_IMAGE_MAGIC)) != 0) {
+            error = "bad magic";
+            return false;
+        }
+        if (h->version != LOOKUP_IMAGE_VERSION && h->version != LOOKUP_IMAGE_SHARD_VERSION) {
+            error = "unsupported image version " + std::to_string(h->version);
+            return false;
+        }
+        if (h->headerChecksum != imageHeaderChecksum(*h)) {
+            error = "header checksum mismatch";
+            return false;
+        }
+        const LookupImageShard* shard = (const LookupImageShard*)(base + LOOKUP_IMAGE_SHARD_POS);
+        if (h->version == LOOKUP_IMAGE_SHARD_VERSION &&
+            (memcmp(shard->magic, LOOKUP_IMAGE_SHARD_MAGIC, sizeof(LOOKUP_IMAGE_SHARD_MAGIC)) != 0 ||
+             shard->checksum != imageShardChecksum(*shard))) {
+            error = "bad shard header";
+            return false;
+        }
+        // 先限制 slots 与 blobBytes，布局计算不会溢出
+        if (h->slots >= length / sizeof(uint64_t) || h->blobBytes > length) {
+            error = "truncated or inconsistent image";
+            return false;
+        }
+        uint64_t offsetsPos, blobPos;
+        size_t expected = imageLayout(h->slots, h->blobBytes, offsetsPos, blobPos);
+        if (h->headerSize != LOOKUP_IMAGE_HEADER_SIZE || h->offsetsPos != offsetsPos ||
+            h->blobPos != blobPos || expected > length) {
+            error = "truncated or inconsistent image";
+            return false;
+        }
+        const uint64_t* offsets = (const uint64_t*)(base + offsetsPos);
+        if (offsets[0] != 0 || offsets[h->slots] != h->blobBytes) {
+            error = "offsets do not match blob size";
+            return false;
+        }
+        if (verifyData && imageChecksum(base + offsetsPos, expected - offsetsPos) != h->dataChecksum) {
+            error = "data checksum mismatch";
+            return false;
+        }
+        return true;
+    }
+
+    // 写出前 size 字节到文件: 先写临时文件再 rename，避免留下半个快照
+    bool writeFile(const std::string& path, size_t size, std::string& error) const {
+        std::string tmpPath = path + ".tmp";
+        int fd = open(tmpPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0) {
+            error = "cannot create " + tmpPath + ": " + strerror(errno);
+            return false;
+        }
+        size_t written = 0;
+        while (written < size) {
+            size_t chunk = std::min(size - written, (size_t)1 << 30);
+            ssize_t n = ::write(fd, base + written, chunk);
+            if (n < 0) {
+                if (errno == EINTR) continue;
+                error = "write failed: " + std::string(strerror(errno));
+                close(fd);
+                unlink(tmpPath.c_str());
+                return false;
+            }
+            written += n;
+        }
+        // fsync 失败也要关闭描述符，报告先出现的错误
+        int flushError = fsync(fd) != 0 ? errno : 0;
+        if (close(fd) != 0 && flushError == 0) flushError = errno;
+        if (flushError != 0) {
+            error = "cannot flush " + tmpPath + ": " + strerror(flushError);
+            unlink(tmpPath.c_str());
+            return false;
+        }
+        if (rename(tmpPath.c_str(), path.c_str()) != 0) {
+            error = "cannot rename " + tmpPath + ": " + strerror(errno);
+            unlink(tmpPath.c_str());
+            return false;
+        }
+        return true;
+    }
+};
+
+// 判断文件是否为 lookup 镜像 (只读取 magic)
+inline bool isLookupImageFile(const std::string& path) {
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) return false;
+    char magic[sizeof(LOOKUP_IMAGE_MAGIC)];
+    ssize_t n = pread(fd, magic, sizeof(magic), 0);
+    close(fd);
+    return n == (ssize_t)sizeof(magic) && memcmp(magic, LOOKUP_IMAGE_MAGIC, sizeof(magic)) == 0;
+}
+
+#endif // CONVERTSERVER_LOOKUP_IMAGE_H
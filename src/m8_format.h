@@ -0,0 +1,544 @@
+/**
+ * m8_format.h - M8 输出格式化
+ *
+ * 取代逐字段切换 std::fixed / std::scientific / std::setprecision 的 iostream 输出:
+ * 数值直接写入可复用的大块缓冲区，写满后以大块 write() 输出。
+ *
+ * 输出与原 iostream 格式逐字节一致 (fident "%.3f"、evalue "%.2e"、bits "%.1f"、整数 "%d"):
+ *   - 定点/科学计数的快速路径只在结果不可能落在舍入边界附近时使用，
+ *     否则 (以及 inf/nan、超出快速路径范围的值) 回退到 snprintf
+ *   - 透传模式下，输入中已经是规范输出形式的数值字段直接拷贝原始字节，不再重新格式化
+ */
+
+#ifndef CONVERTSERVER_M8_FORMAT_H
+#define CONVERTSERVER_M8_FORMAT_H
+
+#include <unistd.h>
+#include <errno.h>
+#include <stdint.h>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "m8_reader.h"
+
+// 可复用的输出缓冲区: 先 reserve 再直接写指针，clear() 后保留容量
+class OutputBuffer {
+private:
+    std::vector<char> bytes;
+    size_t used;
+
+public:
+    OutputBuffer() : used(0) {}
+
+    // 保证至少还有 n 字节可写，返回写入位置
+    char* reserve(size_t n) {
+        if (used + n > bytes.size()) {
+            bytes.resize(std::max(used + n, bytes.size() * 2 + 4096));
+        }
+        return &bytes[used];
+    }
+
+    // 提交 reserve() 之后实际写入的字节 (end 为写入结束位置)
+    void commit(char* end) { used = end - &bytes[0]; }
+
+    void append(const char* data, size_t len) {
+        char* p = reserve(len);
+        memcpy(p, data, len);
+        used += len;
+    }
+
+    const char* data() const { return bytes.empty() ? NULL : &bytes[0]; }
+    size_t size() const { return used; }
+    bool empty() const { return used == 0; }
+    void clear() { used = 0; }
+
+    // 完整写出到 fd
+    bool writeTo(int fd, std::string& error) const {
+        size_t done = 0;
+        while (done < used) {
+            ssize_t n = ::write(fd, &bytes[done], used - done);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) {
+                error = strerror(errno);
+                return false;
+            }
+            done += n;
+        }
+        return true;
+    }
+};
+
+namespace m8 {
+
+// 单个数值字段的最大输出长度 (snprintf 回退时 "%.3f" 格式化 1e308 约 313 字节)
+static const size_t MAX_NUMBER_TEXT = 352;
+
+inline char* formatUInt(char* p, uint64_t v) {
+    char digits[20];
+    int n = 0;
+    do {
+        digits[n++] = (char)('0' + v % 10);
+        v /= 10;
+    } while (v != 0);
+    while (n > 0) *p++ = digits[--n];
+    return p;
+}
+
+inline char* formatInt(char* p, int32_t v) {
+    if (v < 0) {
+        *p++ = '-';
+        return formatUInt(p, (uint64_t)(-(int64_t)v));
+    }
+    return formatUInt(p, (uint64_t)v);
+}
+
+// 写入固定 width 位十进制数 (前补 0)
+inline char* formatDigits(char* p, uint64_t v, int width) {
+    for (int i = width - 1; i >= 0; i--) {
+        p[i] = (char)('0' + v % 10);
+        v /= 10;
+    }
+    return p + width;
+}
+
+inline char* formatFallback(char* p, const char* format, int precision, double v) {
+    int n = snprintf(p, MAX_NUMBER_TEXT, format, precision, v);
+    return p + n;
+}
+
+// 10^k (k ∈ [-300, 300])，由 strtod 得到正确舍入的值
+inline double powerOfTen(int k) {
+    struct Table {
+        double values[601];
+        Table() {
+            char text[16];
+            for (int i = -300; i <= 300; i++) {
+                snprintf(text, sizeof(text), "1e%d", i);
+                values[i + 300] = strtod(text, NULL);
+            }
+        }
+    };
+    static const Table table;
+    return table.values[k + 300];
+}
+
+// 等价于 printf("%.*f", precision, v)，precision ≤ 6
+inline char* formatFixed(char* p, double v, int precision) {
+    static const uint64_t scale[] = {1, 10, 100, 1000, 10000, 100000, 1000000};
+    double magnitude = std::fabs(v);
+    double scaled = magnitude * (double)scale[precision];
+    // scaled < 1e9 时乘法误差 < 1e-7，只要小数部分离 0.5 足够远，舍入结果与精确值一致
+    if (!(scaled < 1e9)) return formatFallback(p, "%.*f", precision, v);
+    double whole = std::floor(scaled);
+    double fraction = scaled - whole;
+    if (std::fabs(fraction - 0.5) < 1e-6) return formatFallback(p, "%.*f", precision, v);
+
+    uint64_t rounded = (uint64_t)whole + (fraction > 0.5 ? 1 : 0);
+    if (std::signbit(v)) *p++ = '-';
+    p = formatUInt(p, rounded / scale[precision]);
+    if (precision > 0) {
+        *p++ = '.';
+        p = formatDigits(p, rounded % scale[precision], precision);
+    }
+    return p;
+}
+
+// 等价于 printf("%.2e", v)
+inline char* formatExp2(char* p, double v) {
+    double magnitude = std::fabs(v);
+    if (magnitude == 0) {
+        if (std::signbit(v)) *p++ = '-';
+        memcpy(p, "0.00e+00", 8);
+        return p + 8;
+    }
+    if (!std::isfinite(magnitude)) return formatFallback(p, "%.*e", 2, v);
+
+    // 缩放到 [100, 1000)：两次正确舍入的乘法，相对误差 < 3e-16，绝对误差 < 3e-13
+    int exponent = (int)std::floor(std::log10(magnitude));
+    double scaled = 0;
+    for (int attempt = 0; attempt < 2; attempt++) {
+        int k = 2 - exponent;
+        if (k < -300 || k > 300) return formatFallback(p, "%.*e", 2, v);
+        scaled = magnitude * powerOfTen(k);
+        if (scaled >= 1000) {
+            exponent++;
+        } else if (scaled < 100) {
+            exponent--;
+        } else {
+            break;
+        }
+    }
+    if (!(scaled >= 100 && scaled < 1000) || scaled < 100 + 1e-9 || scaled > 1000 - 1e-9) {
+        return formatFallback(p, "%.*e", 2, v);
+    }
+    double whole = std::floor(scaled);
+    double fraction = scaled - whole;
+    if (std::fabs(fraction - 0.5) < 1e-9) return formatFallback(p, "%.*e", 2, v);
+
+    uint64_t rounded = (uint64_t)whole + (fraction > 0.5 ? 1 : 0);
+    if (rounded == 1000) {
+        rounded = 100;
+        exponent++;
+    }
+    if (std::signbit(v)) *p++ = '-';
+    *p++ = (char)('0' + rounded / 100);
+    *p++ = '.';
+    p = formatDigits(p, rounded % 100, 2);
+    *p++ = 'e';
+    *p++ = exponent < 0 ? '-' : '+';
+    int absExponent = exponent < 0 ? -exponent : exponent;
+    return absExponent >= 100 ? formatDigits(p, absExponent, 3) : formatDigits(p, absExponent, 2);
+}
+
+// ---- 透传: 判断原始字段是否已经是 iostream 会输出的规范形式 ----
+
+// 规范整数: 0 | -?[1-9][0-9]*，且在 int32 范围内 (value 为解析结果)
+inline bool isCanonicalInt(const char* p, const char* end, int32_t value) {
+    size_t len = end - p;
+    if (len == 1 && *p == '0') return true;
+    if (value == 0 || len == 0 || len > 11) return false;
+    if (*p == '-') p++;
+    if (p >= end || *p < '1' || *p > '9') return false;
+    for (; p < end; p++) {
+        if (!isDigit(*p)) return false;
+    }
+    return true;
+}
+
+// 规范定点数: -?(0|[1-9][0-9]*)\.[0-9]{precision}，总位数 ≤ 15 (保证十进制→double→十进制往返)
+inline bool isCanonicalFixed(const char* p, const char* end, int precision) {
+    if (p < end && *p == '-') p++;
+    const char* dot = (const char*)memchr(p, '.', end - p);
+    if (dot == NULL || dot == p || end - dot - 1 != precision || end - p - 1 > 15) return false;
+    if (*p == '0' && dot - p != 1) return false;
+    for (const char* q = p; q < end; q++) {
+        if (q != dot && !isDigit(*q)) return false;
+    }
+    return true;
+}
+
+// 规范 "%.2e": -?[1-9]\.[0-9][0-9]e[+-][0-9]{2,3} (指数两位，≥100 时三位)，或 -?0.00e+00。
+// 指数限制在 ±300 内，排除次正规数与溢出
+inline bool isCanonicalExp2(const char* p, const char* end) {
+    if (p < end && *p == '-') p++;
+    size_t len = end - p;
+    if (len != 8 && len != 9) return false;
+    if (!isDigit(p[0]) || p[1] != '.' || !isDigit(p[2]) || !isDigit(p[3]) || p[4] != 'e' ||
+        (p[5] != '+' && p[5] != '-')) {
+        return false;
+    }
+    for (size_t i = 6; i < len; i++) {
+        if (!isDigit(p[i])) return false;
+    }
+    if (p[0] == '0') return len == 8 && memcmp(p, "0.00e+00", 8) == 0;
+    if (len == 9) {
+        if (p[6] == '0') return false;
+        int exponent = (p[6] - '0') * 100 + (p[7] - '0') * 10 + (p[8] - '0');
+        if (exponent > 300) return false;
+    }
+    return true;
+}
+
+} // namespace m8
+
+// 写出一行: query \t target \t 10 个数值列 \n。
+// passthrough 为 true 时，规范形式的数值字段直接拷贝输入中的原始字节。
+inline void appendAlignmentRow(OutputBuffer& out, const char* input, const AlignmentColumns& rows, size_t i,
+                               const char* target, size_t targetLen, bool passthrough) {
+    const char* line = input + rows.lineOffset[i];
+    const char* lineEnd = line + rows.lineLen[i];
+    size_t queryLen = rows.queryLen[i];
+
+    char* p = out.reserve(queryLen + targetLen + 12 + 10 * m8::MAX_NUMBER_TEXT);
+    memcpy(p, line, queryLen);
+    p += queryLen;
+    *p++ = '\t';
+    memcpy(p, target, targetLen);
+    p += targetLen;
+
+    // 原始字段区间 (仅透传模式使用): 第 i 列为 [begin[i], end[i])
+    const char* begin[12];
+    const char* end[12];
+    if (passthrough) {
+        const char* f = line;
+        for (int c = 0; c < 12; c++) {
+            const char* tab = f < lineEnd ? (const char*)memchr(f, '\t', lineEnd - f) : NULL;
+            begin[c] = f;
+            end[c] = tab ? tab : lineEnd;
+            f = tab ? tab + 1 : lineEnd;
+        }
+    }
+
+    const int32_t ints[7] = {rows.alnlen[i], rows.mismatch[i], rows.gapopen[i], rows.qstart[i],
+                             rows.qend[i], rows.tstart[i], rows.tend[i]};
+
+    *p++ = '\t';
+    if (passthrough && m8::isCanonicalFixed(begin[2], end[2], 3)) {
+        memcpy(p, begin[2], end[2] - begin[2]);
+        p += end[2] - begin[2];
+    } else {
+        p = m8::formatFixed(p, rows.fident[i], 3);
+    }
+    for (int c = 0; c < 7; c++) {
+        *p++ = '\t';
+        if (passthrough && m8::isCanonicalInt(begin[3 + c], end[3 + c], ints[c])) {
+            memcpy(p, begin[3 + c], end[3 + c] - begin[3 + c]);
+            p += end[3 + c] - begin[3 + c];
+        } else {
+            p = m8::formatInt(p, ints[c]);
+        }
+    }
+    *p++ = '\t';
+    if (passthrough && m8::isCanonicalExp2(begin[10], end[10])) {
+        memcpy(p, begin[10], end[10] - begin[10]);
+        p += end[10] - begin[10];
+    } else {
+        p = m8::formatExp2(p, rows.evalue[i]);
+    }
+    *p++ = '\t';
+    if (passthrough && m8::isCanonicalFixed(begin[11], end[11], 1)) {
+        memcpy(p, begin[11], end[11] - begin[11]);
+        p += end[11] - begin[11];
+    } else {
+        p = m8::formatFixed(p, rows.bits[i], 1);
+    }
+    *p++ = '\n';
+    out.commit(p);
+}
+
+// ---- --format-output: MMseqs2 兼容的列列表 ----
+
+// 可输出的列。M8 输入提供对齐数值列，target 的表头、序列、长度与 taxid 由服务端的目标库提供
+enum OutputColumn {
+    OUT_QUERY, OUT_TARGET, OUT_FIDENT, OUT_PIDENT, OUT_NIDENT, OUT_ALNLEN, OUT_MISMATCH, OUT_GAPOPEN,
+    OUT_QSTART, OUT_QEND, OUT_TSTART, OUT_TEND, OUT_EVALUE, OUT_BITS,
+    OUT_THEADER, OUT_TSEQ, OUT_TLEN, OUT_TCOV, OUT_TAXID
+};
+
+static const char* const OUTPUT_COLUMN_NAMES[] = {
+    "query", "target", "fident", "pident", "nident", "alnlen", "mismatch", "gapopen",
+    "qstart", "qend", "tstart", "tend", "evalue", "bits",
+    "theader", "tseq", "tlen", "tcov", "taxid"
+};
+
+// MMseqs2 的默认列 (即固定的 12 列 M8)
+static const char* const DEFAULT_FORMAT_OUTPUT = "query,target,fident,alnlen,mismatch,gapopen,qstart,qend,tstart,tend,evalue,bits";
+
+// 解析逗号分隔的列名；MMseqs2 支持但 M8 输入无法提供的列 (qlen、qseq、cigar 等) 报错
+inline bool parseOutputFormat(const std::string& spec, std::vector<OutputColumn>& columns, std::string& error) {
+    columns.clear();
+    size_t start = 0;
+    while (start <= spec.size()) {
+        size_t comma = spec.find(',', start);
+        if (comma == std::string::npos) comma = spec.size();
+        std::string name = spec.substr(start, comma - start);
+        size_t count = sizeof(OUTPUT_COLUMN_NAMES) / sizeof(OUTPUT_COLUMN_NAMES[0]);
+        size_t c = 0;
+        while (c < count && name != OUTPUT_COLUMN_NAMES[c]) c++;
+        if (c == count) {
+            error = "unsupported output column '" + name + "'";
+            return false;
+        }
+        columns.push_back((OutputColumn)c);
+        start = comma + 1;
+    }
+    return true;
+}
+
+// 一行对应 target 的附加值 (服务端返回的文本)，不可用时为空
+struct TargetFields {
+    const char* name;
+    size_t nameLen;
+    const char* header;
+    size_t headerLen;
+    const char* sequence;
+    size_t sequenceLen;
+    const char* length;     // 十进制序列长度
+    size_t lengthLen;
+    const char* taxid;
+    size_t taxidLen;
+
+    TargetFields()
+        : name(NULL), nameLen(0), header(NULL), headerLen(0), sequence(NULL), sequenceLen(0),
+          length(NULL), lengthLen(0), taxid(NULL), taxidLen(0) {}
+};
+
+inline char* appendText(char* p, const char* text, size_t len) {
+    if (len > 0) memcpy(p, text, len);
+    return p + len;
+}
+
+// 一行的数据来源: query 名称、对齐数值列与 target 附加值
+struct RowSource {
+    const char* query;
+    size_t queryLen;
+    const AlignmentColumns& rows;
+    size_t i;
+    const TargetFields& target;
+};
+
+namespace m8 {
+
+// 单列的文本部分 (名称、表头、序列等) 长度，数值列为 0
+template <OutputColumn C>
+inline size_t columnTextBytes(const RowSource& row) {
+    switch (C) {
+    case OUT_QUERY: return row.queryLen;
+    case OUT_TARGET: return row.target.nameLen;
+    case OUT_THEADER: return row.target.headerLen;
+    case OUT_TSEQ: return row.target.sequenceLen;
+    case OUT_TLEN: return row.target.lengthLen;
+    case OUT_TAXID: return row.target.taxidLen;
+    default: return 0;
+    }
+}
+
+// 写出单列。C 为编译期常量，switch 在实例化时只剩一个分支。数值格式与默认 12 列相同:
+// fident / tcov "%.3f"，pident "%.1f"，evalue "%.2e"，bits "%.1f"；缺失的 tlen / taxid 输出 0
+template <OutputColumn C>
+inline char* writeColumn(char* p, const RowSource& row) {
+    const AlignmentColumns& rows = row.rows;
+    size_t i = row.i;
+    const TargetFields& target = row.target;
+    switch (C) {
+    case OUT_QUERY: return appendText(p, row.query, row.queryLen);
+    case OUT_TARGET: return appendText(p, target.name, target.nameLen);
+    case OUT_FIDENT: return formatFixed(p, rows.fident[i], 3);
+    case OUT_PIDENT: return formatFixed(p, rows.fident[i] * 100.0, 1);
+    case OUT_NIDENT: return formatInt(p, (int32_t)(rows.fident[i] * rows.alnlen[i] + 0.5));
+    case OUT_ALNLEN: return formatInt(p, rows.alnlen[i]);
+    case OUT_MISMATCH: return formatInt(p, rows.mismatch[i]);
+    case OUT_GAPOPEN: return formatInt(p, rows.gapopen[i]);
+    case OUT_QSTART: return formatInt(p, rows.qstart[i]);
+    case OUT_QEND: return formatInt(p, rows.qend[i]);
+    case OUT_TSTART: return formatInt(p, rows.tstart[i]);
+    case OUT_TEND: return formatInt(p, rows.tend[i]);
+    case OUT_EVALUE: return formatExp2(p, rows.evalue[i]);
+    case OUT_BITS: return formatFixed(p, rows.bits[i], 1);
+    case OUT_THEADER: return appendText(p, target.header, target.headerLen);
+    case OUT_TSEQ: return appendText(p, target.sequence, target.sequenceLen);
+    case OUT_TLEN:
+        if (target.lengthLen == 0) {
+            *p++ = '0';
+            return p;
+        }
+        return appendText(p, target.length, target.lengthLen);
+    case OUT_TCOV: {
+        // 与 MMseqs2 相同: (|tend - tstart| + 1) / tlen
+        int32_t tlen = parseInt(target.length, target.length + target.lengthLen);
+        int64_t span = std::abs((int64_t)rows.tend[i] - rows.tstart[i]) + 1;
+        return formatFixed(p, tlen > 0 ? (double)span / tlen : 0.0, 3);
+    }
+    case OUT_TAXID:
+        if (target.taxidLen == 0) {
+            *p++ = '0';
+            return p;
+        }
+        return appendText(p, target.taxid, target.taxidLen);
+    }
+    return p;
+}
+
+// 运行时列类型分派到对应的 writeColumn<C>，供任意列列表使用
+inline char* writeColumn(char* p, OutputColumn column, const RowSource& row) {
+    switch (column) {
+    case OUT_QUERY: return writeColumn<OUT_QUERY>(p, row);
+    case OUT_TARGET: return writeColumn<OUT_TARGET>(p, row);
+    case OUT_FIDENT: return writeColumn<OUT_FIDENT>(p, row);
+    case OUT_PIDENT: return writeColumn<OUT_PIDENT>(p, row);
+    case OUT_NIDENT: return writeColumn<OUT_NIDENT>(p, row);
+    case OUT_ALNLEN: return writeColumn<OUT_ALNLEN>(p, row);
+    case OUT_MISMATCH: return writeColumn<OUT_MISMATCH>(p, row);
+    case OUT_GAPOPEN: return writeColumn<OUT_GAPOPEN>(p, row);
+    case OUT_QSTART: return writeColumn<OUT_QSTART>(p, row);
+    case OUT_QEND: return writeColumn<OUT_QEND>(p, row);
+    case OUT_TSTART: return writeColumn<OUT_TSTART>(p, row);
+    case OUT_TEND: return writeColumn<OUT_TEND>(p, row);
+    case OUT_EVALUE: return writeColumn<OUT_EVALUE>(p, row);
+    case OUT_BITS: return writeColumn<OUT_BITS>(p, row);
+    case OUT_THEADER: return writeColumn<OUT_THEADER>(p, row);
+    case OUT_TSEQ: return writeColumn<OUT_TSEQ>(p, row);
+    case OUT_TLEN: return writeColumn<OUT_TLEN>(p, row);
+    case OUT_TCOV: return writeColumn<OUT_TCOV>(p, row);
+    case OUT_TAXID: return writeColumn<OUT_TAXID>(p, row);
+    }
+    return p;
+}
+
+inline size_t columnTextBytes(OutputColumn column, const RowSource& row) {
+    switch (column) {
+    case OUT_QUERY: return columnTextBytes<OUT_QUERY>(row);
+    case OUT_TARGET: return columnTextBytes<OUT_TARGET>(row);
+    case OUT_THEADER: return columnTextBytes<OUT_THEADER>(row);
+    case OUT_TSEQ: return columnTextBytes<OUT_TSEQ>(row);
+    case OUT_TLEN: return columnTextBytes<OUT_TLEN>(row);
+    case OUT_TAXID: return columnTextBytes<OUT_TAXID>(row);
+    default: return 0;
+    }
+}
+
+// 编译期列列表: 逐列展开为直线代码，没有按列的分支与循环
+template <OutputColumn... Columns>
+struct ColumnList;
+
+template <>
+struct ColumnList<> {
+    static size_t textBytes(const RowSource&) { return 0; }
+    static char* writeRest(char* p, const RowSource&) { return p; }
+};
+
+template <OutputColumn C, OutputColumn... Rest>
+struct ColumnList<C, Rest...> {
+    static size_t textBytes(const RowSource& row) {
+        return columnTextBytes<C>(row) + ColumnList<Rest...>::textBytes(row);
+    }
+
+    // 第一列之后的各列，每列前加 \t
+    static char* writeRest(char* p, const RowSource& row) {
+        *p++ = '\t';
+        p = writeColumn<C>(p, row);
+        return ColumnList<Rest...>::writeRest(p, row);
+    }
+
+    static char* write(char* p, const RowSource& row) {
+        p = writeColumn<C>(p, row);
+        return ColumnList<Rest...>::writeRest(p, row);
+    }
+};
+
+} // namespace m8
+
+// 编译期特化的行写出器: 列在编译期确定，供常用的列组合使用
+template <OutputColumn... Columns>
+struct RowWriter {
+    static void append(OutputBuffer& out, const char* input, const AlignmentColumns& rows, size_t i,
+                       const TargetFields& target) {
+        RowSource row = {input + rows.lineOffset[i], rows.queryLen[i], rows, i, target};
+        size_t bytes = m8::ColumnList<Columns...>::textBytes(row) + sizeof...(Columns) * (m8::MAX_NUMBER_TEXT + 1) + 1;
+        char* p = m8::ColumnList<Columns...>::write(out.reserve(bytes), row);
+        *p++ = '\n';
+        out.commit(p);
+    }
+};
+
+// 按任意列列表写出一行 (逐列解释)，输出与相同列的 RowWriter 一致
+inline void appendFormattedRow(OutputBuffer& out, const char* input, const AlignmentColumns& rows, size_t i,
+                               const std::vector<OutputColumn>& columns, const TargetFields& target) {
+    RowSource row = {input + rows.lineOffset[i], rows.queryLen[i], rows, i, target};
+    size_t textBytes = 0;
+    for (OutputColumn column : columns) textBytes += m8::columnTextBytes(column, row);
+
+    char* p = out.reserve(textBytes + columns.size() * (m8::MAX_NUMBER_TEXT + 1) + 1);
+    for (size_t c = 0; c < columns.size(); c++) {
+        if (c > 0) *p++ = '\t';
+        p = m8::writeColumn(p, columns[c], row);
+    }
+    *p++ = '\n';
+    out.commit(p);
+}
+
+#endif // CONVERTSERVER_M8_FORMAT_H
@@ -0,0 +1,407 @@
+/**
+ * m8_reader.h - 零分配的 M8 (BLAST tabular) 输入解析
+ *
+ * 也解析 MMseqs2 比对结果库的条目 (parseResultEntry)，两种输入得到相同的列式存储。
+ *
+ * 输入文件整体 mmap，字段在原地切分，不构造 std::string / istringstream；
+ * 每条记录只解析一次，写入列式存储 AlignmentColumns。
+ *
+ * 数值解析与原先的 safeStoi / safeStoul / safeStod (std::stoi / stoul / stod，
+ * 失败返回 0) 结果逐位一致:
+ *   - 整数按 strtol / strtoul 的语法手工解析，超出范围返回 0
+ *   - 浮点数走 Clinger 快速路径 (尾数 ≤ 2^53 且 |10 的指数| ≤ 22 时一次乘/除即为正确舍入)，
+ *     其余情况 (长尾数、极小 evalue、inf/nan 等) 回退到 strtod
+ */
+
+#ifndef CONVERTSERVER_M8_READER_H
+#define CONVERTSERVER_M8_READER_H
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdint.h>
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+// 只读映射的输入文件
+class MappedFile {
+private:
+    char* base;
+    size_t length;
+
+    MappedFile(const MappedFile&);
+    MappedFile& operator=(const MappedFile&);
+
+public:
+    MappedFile() : base(NULL), length(0) {}
+
+    ~MappedFile() { close(); }
+
+    bool open(const std::string& path, std::string& error) {
+        close();
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            error = strerror(errno);
+            return false;
+        }
+        struct stat st;
+        if (fstat(fd, &st) != 0) {
+            error = strerror(errno);
+            ::close(fd);
+            return false;
+        }
+        length = st.st_size;
+        if (length > 0) {
+            void* p = mmap(NULL, length, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (p == MAP_FAILED) {
+                error = strerror(errno);
+                ::close(fd);
+                length = 0;
+                return false;
+            }
+            base = (char*)p;
+            madvise(base, length, MADV_SEQUENTIAL);
+        }
+        ::close(fd);
+        return true;
+    }
+
+    void close() {
+        if (base != NULL) {
+            munmap(base, length);
+            base = NULL;
+        }
+        length = 0;
+    }
+
+    const char* data() const { return base; }
+    size_t size() const { return length; }
+};
+
+// 对齐记录的列式存储；query 名称不拷贝，以 (行偏移, 长度) 指向输入文件
+struct AlignmentColumns {
+    std::vector<uint64_t> lineOffset;   // 行首在输入文件中的偏移，query 名称从行首开始
+    std::vector<uint32_t> lineLen;      // 行长度 (不含换行符)
+    std::vector<uint32_t> queryLen;
+    std::vector<uint32_t> targetId;
+    std::vector<double> fident;
+    std::vector<int32_t> alnlen;
+    std::vector<int32_t> mismatch;
+    std::vector<int32_t> gapopen;
+    std::vector<int32_t> qstart;
+    std::vector<int32_t> qend;
+    std::vector<int32_t> tstart;
+    std::vector<int32_t> tend;
+    std::vector<double> evalue;
+    std::vector<double> bits;
+
+    size_t size() const { return targetId.size(); }
+
+    void reserve(size_t n) {
+        lineOffset.reserve(n);
+        lineLen.reserve(n);
+        queryLen.reserve(n);
+        targetId.reserve(n);
+        fident.reserve(n);
+        alnlen.reserve(n);
+        mismatch.reserve(n);
+        gapopen.reserve(n);
+        qstart.reserve(n);
+        qend.reserve(n);
+        tstart.reserve(n);
+        tend.reserve(n);
+        evalue.reserve(n);
+        bits.reserve(n);
+    }
+};
+
+namespace m8 {
+
+inline bool isSpace(char c) {
+    return c == ' ' || c == '\t' || c == '\n' || c == '\v' || c == '\f' || c == '\r';
+}
+
+inline bool isDigit(char c) {
+    return c >= '0' && c <= '9';
+}
+
+// 等价于 std::stoi，失败或越界返回 0
+inline int32_t parseInt(const char* p, const char* end) {
+    while (p < end && isSpace(*p)) p++;
+    bool negative = false;
+    if (p < end && (*p == '+' || *p == '-')) {
+        negative = (*p == '-');
+        p++;
+    }
+    if (p >= end || !isDigit(*p)) return 0;
+    int64_t value = 0;
+    int digits = 0;
+    for (; p < end && isDigit(*p); p++) {
+        if (value != 0 || *p != '0') digits++;
+        if (digits > 11) return 0;
+        value = value * 10 + (*p - '0');
+    }
+    if (negative) value = -value;
+    if (value < INT32_MIN || value > INT32_MAX) return 0;
+    return (int32_t)value;
+}
+
+// 等价于 (uint32_t)std::stoul，失败或越界返回 0；负数按 strtoul 的规则取反
+inline uint32_t parseUInt32(const char* p, const char* end) {
+    while (p < end && isSpace(*p)) p++;
+    bool negative = false;
+    if (p < end && (*p == '+' || *p == '-')) {
+        negative = (*p == '-');
+        p++;
+    }
+    if (p >= end || !isDigit(*p)) return 0;
+    uint64_t value = 0;
+    for (; p < end && isDigit(*p); p++) {
+        uint64_t digit = *p - '0';
+        if (value > (UINT64_MAX - digit) / 10) return 0;
+        value = value * 10 + digit;
+    }
+    return (uint32_t)(negative ? 0 - value : value);
+}
+
+// 等价于 std::stod，失败或越界 (ERANGE) 返回 0
+inline double parseDouble(const char* p, const char* end) {
+    static const double pow10[] = {
+        1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+        1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+    };
+
+    const char* start = p;
+    while (p < end && isSpace(*p)) p++;
+    bool negative = false;
+    if (p < end && (*p == '+' || *p == '-')) {
+        negative = (*p == '-');
+        p++;
+    }
+
+    // 快速路径: [digits][.digits][e[+-]digits]
+    uint64_t mantissa = 0;
+    int digits = 0;
+    int scale = 0;
+    bool any = false;
+    const char* q = p;
+    for (; q < end && isDigit(*q); q++) {
+        any = true;
+        if (mantissa != 0 || *q != '0') digits++;
+        mantissa = mantissa * 10 + (*q - '0');
+        if (digits > 18) break;
+    }
+    if (q < end && *q == '.' && digits <= 18) {
+        q++;
+        for (; q < end && isDigit(*q); q++) {
+            any = true;
+            if (mantissa != 0 || *q != '0') digits++;
+            mantissa = mantissa * 10 + (*q - '0');
+            scale--;
+            if (digits > 18) break;
+        }
+    }
+    bool fast = any && digits <= 18 && mantissa <= (1ULL << 53);
+    if (fast && q < end && (*q == 'e' || *q == 'E')) {
+        const char* e = q + 1;
+        bool expNegative = false;
+        if (e < end && (*e == '+' || *e == '-')) {
+            expNegative = (*e == '-');
+            e++;
+        }
+        if (e < end && isDigit(*e)) {
+            int exponent = 0;
+            for (; e < end && isDigit(*e); e++) {
+                if (exponent < 10000) exponent = exponent * 10 + (*e - '0');
+            }
+            scale += expNegative ? -exponent : exponent;
+            q = e;
+        }
+    }
+    // 0x / inf / nan 等形式由 strtod 处理
+    if (fast && q < end && (*q == 'x' || *q == 'X' || isDigit(*q) || *q == '.')) fast = false;
+    if (fast && scale >= -22 && scale <= 22) {
+        double value = (double)mantissa;
+        value = scale < 0 ? value / pow10[-scale] : value * pow10[scale];
+        return negative ? -value : value;
+    }
+    if (fast && mantissa == 0) {
+        return negative ? -0.0 : 0.0;
+    }
+
+    // 回退: 复制到以 0 结尾的缓冲区交给 strtod
+    char buffer[128];
+    size_t len = end - start;
+    std::string longField;
+    const char* text = buffer;
+    if (len < sizeof(buffer)) {
+        memcpy(buffer, start, len);
+        buffer[len] = '\0';
+    } else {
+        longField.assign(start, len);
+        text = longField.c_str();
+    }
+    char* parsedEnd;
+    errno = 0;
+    double value = strtod(text, &parsedEnd);
+    if (parsedEnd == text || errno == ERANGE) return 0;
+    return value;
+}
+
+} // namespace m8
+
+// 解析 data[from, to) 中的所有行并追加到 cols，返回解析的行数。
+// 空行与以 '#' 开头的行被跳过；缺失的字段按 0 处理。
+inline size_t parseM8(const char* data, size_t from, size_t to, AlignmentColumns& cols) {
+    size_t rows = 0;
+    size_t pos = from;
+    while (pos < to) {
+        const char* line = data + pos;
+        const char* nl = (const char*)memchr(line, '\n', to - pos);
+        const char* lineEnd = nl ? nl : data + to;
+        size_t next = (size_t)(lineEnd - data) + 1;
+
+        if (lineEnd == line || line[0] == '#') {
+            pos = next;
+            continue;
+        }
+
+        // 切分字段: 第 i 列为 [begin[i], end[i])，缺失的列为空 (解析为 0)
+        const char* begin[12];
+        const char* end[12];
+        const char* p = line;
+        for (int i = 0; i < 12; i++) {
+            const char* tab = p < lineEnd ? (const char*)memchr(p, '\t', lineEnd - p) : NULL;
+            begin[i] = p;
+            end[i] = tab ? tab : lineEnd;
+            p = tab ? tab + 1 : lineEnd;
+        }
+
+        cols.lineOffset.push_back(pos);
+        cols.lineLen.push_back((uint32_t)(lineEnd - line));
+        cols.queryLen.push_back((uint32_t)(end[0] - line));
+        cols.targetId.push_back(m8::parseUInt32(begin[1], end[1]));
+        cols.fident.push_back(m8::parseDouble(begin[2], end[2]));
+        cols.alnlen.push_back(m8::parseInt(begin[3], end[3]));
+        cols.mismatch.push_back(m8::parseInt(begin[4], end[4]));
+        cols.gapopen.push_back(m8::parseInt(begin[5], end[5]));
+        cols.qstart.push_back(m8::parseInt(begin[6], end[6]));
+        cols.qend.push_back(m8::parseInt(begin[7], end[7]));
+        cols.tstart.push_back(m8::parseInt(begin[8], end[8]));
+        cols.tend.push_back(m8::parseInt(begin[9], end[9]));
+        cols.evalue.push_back(m8::parseDouble(begin[10], end[10]));
+        cols.bits.push_back(m8::parseDouble(begin[11], end[11]));
+
+        rows++;
+        pos = next;
+    }
+    return rows;
+}
+
+// ---- MMseqs2 比对结果库 (align / search 的输出) ----
+//
+// 每个 query 一个条目，条目内每行一条比对:
+//   dbKey \t score \t seqId \t evalue \t qStart \t qEnd \t qLen \t dbStart \t dbEnd \t dbLen
+//   [\t qOrfStart \t qOrfEnd \t dbOrfStart \t dbOrfEnd] [\t backtrace]
+// 位置从 0 开始；backtrace 为 "12M1I3M" 形式的压缩序列或 "MMMIM" 形式的原始序列。
+
+// 由 backtrace 统计比对长度、gap 开启次数与 gap 位置数
+inline void scanBacktrace(const char* p, const char* end, int32_t& alnLen, int32_t& gapOpen, int32_t& gapLen) {
+    alnLen = 0;
+    gapOpen = 0;
+    gapLen = 0;
+    char previous = 0;
+    while (p < end) {
+        int32_t count = 0;
+        bool counted = false;
+        while (p < end && m8::isDigit(*p)) {
+            count = count * 10 + (*p - '0');
+            counted = true;
+            p++;
+        }
+        if (p >= end) break;
+        char op = *p++;
+        if (!counted) count = 1;
+        alnLen += count;
+        if (op == 'I' || op == 'D') {
+            gapLen += count;
+            if (op != previous) gapOpen++;
+        }
+        previous = op;
+    }
+}
+
+// 解析结果库中一个 query 的条目 text[0, len) 并追加到 cols。
+// query 名称已写在 names 的 [nameOffset, nameOffset + nameLen)，各行的 lineOffset / queryLen 指向它；
+// 没有原始 M8 字段，lineLen 为 0。返回解析的行数。
+// 列的换算与 MMseqs2 convertalis 相同: 位置加 1；比对长度取自 backtrace，没有时为
+// max(|qEnd - qStart|, |dbEnd - dbStart|) + 1；mismatch = 比对长度 - 相同残基数 (seqId × 比对长度) - gap 位置数
+inline size_t parseResultEntry(const char* text, size_t len, uint64_t nameOffset, uint32_t nameLen,
+                               AlignmentColumns& cols) {
+    size_t rows = 0;
+    const char* p = text;
+    const char* end = text + len;
+    while (p < end) {
+        const char* nl = (const char*)memchr(p, '\n', end - p);
+        const char* lineEnd = nl ? nl : end;
+        if (lineEnd == p) {
+            p = lineEnd + 1;
+            continue;
+        }
+
+        const char* begin[16];
+        const char* fieldEnd[16];
+        int fields = 0;
+        const char* f = p;
+        while (fields < 16) {
+            const char* tab = (const char*)memchr(f, '\t', lineEnd - f);
+            begin[fields] = f;
+            fieldEnd[fields] = tab ? tab : lineEnd;
+            fields++;
+            if (tab == NULL) break;
+            f = tab + 1;
+        }
+        p = lineEnd + 1;
+        if (fields < 10) continue;
+
+        int32_t qStart = m8::parseInt(begin[4], fieldEnd[4]);
+        int32_t qEnd = m8::parseInt(begin[5], fieldEnd[5]);
+        int32_t dbStart = m8::parseInt(begin[7], fieldEnd[7]);
+        int32_t dbEnd = m8::parseInt(begin[8], fieldEnd[8]);
+        double seqId = m8::parseDouble(begin[2], fieldEnd[2]);
+
+        // 可选的 4 个 ORF 位置之后 (或直接在第 11 列) 是 backtrace
+        int backtraceField = fields == 11 ? 10 : (fields == 15 ? 14 : -1);
+        int32_t alnLen, gapOpen = 0, gapLen = 0;
+        if (backtraceField >= 0 && fieldEnd[backtraceField] > begin[backtraceField]) {
+            scanBacktrace(begin[backtraceField], fieldEnd[backtraceField], alnLen, gapOpen, gapLen);
+        } else {
+            alnLen = std::max(std::abs(qEnd - qStart), std::abs(dbEnd - dbStart)) + 1;
+        }
+        int32_t identical = (int32_t)(seqId * alnLen + 0.5);
+
+        cols.lineOffset.push_back(nameOffset);
+        cols.lineLen.push_back(0);
+        cols.queryLen.push_back(nameLen);
+        cols.targetId.push_back(m8::parseUInt32(begin[0], fieldEnd[0]));
+        cols.fident.push_back(seqId);
+        cols.alnlen.push_back(alnLen);
+        cols.mismatch.push_back(std::max(0, alnLen - identical - gapLen));
+        cols.gapopen.push_back(gapOpen);
+        cols.qstart.push_back(qStart + 1);
+        cols.qend.push_back(qEnd + 1);
+        cols.tstart.push_back(dbStart + 1);
+        cols.tend.push_back(dbEnd + 1);
+        cols.evalue.push_back(m8::parseDouble(begin[3], fieldEnd[3]));
+        cols.bits.push_back(m8::parseDouble(begin[1], fieldEnd[1]));
+        rows++;
+    }
+    return rows;
+}
+
+#endif // CONVERTSERVER_M8_READER_H
@@ -0,0 +1,289 @@
+/**
+ * memory_placement.h - 常驻查询表的内存放置: 大页、mlock 与 NUMA 策略
+ *
+ * - 大页: transparent 对区域 madvise(MADV_HUGEPAGE)；explicit 以 MAP_HUGETLB 从大页池分配，
+ *   池不足时退回 transparent
+ * - mlock: 表构建完成后锁定，内存紧张时不被换出 (受 RLIMIT_MEMLOCK 限制，失败时只警告)
+ * - NUMA: interleave 把页交错分布到所有节点；replicate 每个节点一份副本，绑定在该节点上，
+ *   工作线程读取所在节点的副本
+ *
+ * NUMA 相关调用 (mbind、set_mempolicy、move_pages、getcpu) 直接走系统调用，不依赖 libnuma。
+ * 实际达到的放置 (大页字节数、锁定字节数、各节点分布) 由 /proc/self/smaps 与 move_pages 测得，
+ * 在 STAT 中报告。
+ */
+
+#ifndef CONVERTSERVER_MEMORY_PLACEMENT_H
+#define CONVERTSERVER_MEMORY_PLACEMENT_H
+
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdint.h>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#ifndef MAP_HUGETLB
+#define MAP_HUGETLB 0x40000
+#endif
+#ifndef MADV_HUGEPAGE
+#define MADV_HUGEPAGE 14
+#endif
+
+// <linux/mempolicy.h> 中的常量
+static const int PLACEMENT_MPOL_PREFERRED = 1;
+static const int PLACEMENT_MPOL_BIND = 2;
+static const int PLACEMENT_MPOL_INTERLEAVE = 3;
+static const unsigned PLACEMENT_MPOL_MF_MOVE = 1u << 1;
+static const int PLACEMENT_MAX_NODES = 1024;
+
+enum HugePageMode { HUGE_PAGES_OFF, HUGE_PAGES_TRANSPARENT, HUGE_PAGES_EXPLICIT };
+enum NumaMode { NUMA_DEFAULT, NUMA_INTERLEAVE, NUMA_REPLICATE };
+
+static const char* const HUGE_PAGE_MODE_NAMES[] = {"off", "thp", "explicit"};
+static const char* const NUMA_MODE_NAMES[] = {"default", "interleave", "replicate"};
+
+// 请求的放置方式。node >= 0 时绑定到该节点 (replicate 的各副本)
+struct MemoryPlacement {
+    HugePageMode hugePages;
+    bool lock;
+    NumaMode numa;
+    int node;
+
+    MemoryPlacement() : hugePages(HUGE_PAGES_OFF), lock(false), numa(NUMA_DEFAULT), node(-1) {}
+
+    // 是否需要放在本进程的匿名内存中 (映射的快照文件无法改变页大小与节点)
+    bool needsPrivateMemory() const { return hugePages != HUGE_PAGES_OFF || numa != NUMA_DEFAULT; }
+
+    MemoryPlacement onNode(int n) const {
+        MemoryPlacement copy = *this;
+        copy.node = n;
+        return copy;
+    }
+};
+
+// 解析 "0-3,8,10-11" 形式的列表 (sysfs 中的 cpulist / online)
+inline std::vector<int> parseCpuList(const std::string& text) {
+    std::vector<int> values;
+    size_t pos = 0;
+    while (pos < text.size()) {
+        char* end = NULL;
+        long low = strtol(text.c_str() + pos, &end, 10);
+        if (end == text.c_str() + pos) break;
+        long high = low;
+        pos = end - text.c_str();
+        if (pos < text.size() && text[pos] == '-') {
+            high = strtol(text.c_str() + pos + 1, &end, 10);
+            pos = end - text.c_str();
+        }
+        for (long v = low; v <= high && v < 65536; v++) values.push_back((int)v);
+        while (pos < text.size() && (text[pos] == ',' || text[pos] == '\n')) pos++;
+    }
+    return values;
+}
+
+inline std::string readSmallFile(const std::string& path) {
+    std::string text;
+    FILE* f = fopen(path.c_str(), "r");
+    if (f == NULL) return text;
+    char buffer[4096];
+    size_t n;
+    while ((n = fread(buffer, 1, sizeof(buffer), f)) > 0) text.append(buffer, n);
+    fclose(f);
+    return text;
+}
+
+// 在线的 NUMA 节点 (非 NUMA 系统为 {0})
+inline const std::vector<int>& numaNodes() {
+    static const std::vector<int> nodes = [] {
+        std::vector<int> list = parseCpuList(readSmallFile("/sys/devices/system/node/online"));
+        list.erase(std::remove_if(list.begin(), list.end(), [](int n) { return n >= PLACEMENT_MAX_NODES; }),
+                   list.end());
+        if (list.empty()) list.push_back(0);
+        return list;
+    }();
+    return nodes;
+}
+
+// CPU 所在的 NUMA 节点，未知时为 0
+inline int numaNodeOfCpu(int cpu) {
+    for (int node : numaNodes()) {
+        std::vector<int> cpus = parseCpuList(
+            readSmallFile("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist"));
+        if (std::find(cpus.begin(), cpus.end(), cpu) != cpus.end()) return node;
+    }
+    return 0;
+}
+
+// 当前线程所在的节点。工作线程绑定了 CPU，首次查询后缓存
+inline int currentNumaNode() {
+    static thread_local int cached = -1;
+    if (cached < 0) {
+        unsigned cpu = 0, node = 0;
+        cached = syscall(SYS_getcpu, &cpu, &node, NULL) == 0 ? (int)node : 0;
+    }
+    return cached;
+}
+
+// 重排 CPU 列表，使相邻的工作线程轮流落在不同节点上 (线程数少于 CPU 数时各节点都有工作线程)
+inline void spreadAcrossNodes(std::vector<int>& cpus) {
+    const std::vector<int>& nodes = numaNodes();
+    if (nodes.size() <= 1) return;
+    std::vector<std::vector<int> > byNode(nodes.size());
+    for (int cpu : cpus) {
+        int node = numaNodeOfCpu(cpu);
+        size_t k = std::find(nodes.begin(), nodes.end(), node) - nodes.begin();
+        byNode[k < nodes.size() ? k : 0].push_back(cpu);
+    }
+    cpus.clear();
+    for (size_t i = 0; ; i++) {
+        bool any = false;
+        for (const std::vector<int>& list : byNode) {
+            if (i < list.size()) {
+                cpus.push_back(list[i]);
+                any = true;
+            }
+        }
+        if (!any) break;
+    }
+}
+
+inline size_t hugePageSize() {
+    static const size_t size = [] {
+        std::string meminfo = readSmallFile("/proc/meminfo");
+        size_t pos = meminfo.find("Hugepagesize:");
+        size_t kb = pos == std::string::npos ? 0 : strtoull(meminfo.c_str() + pos + 13, NULL, 10);
+        return kb > 0 ? kb * 1024 : (size_t)2 << 20;
+    }();
+    return size;
+}
+
+inline size_t roundUp(size_t value, size_t unit) {
+    return (value + unit - 1) / unit * unit;
+}
+
+// 对 [addr, addr + len) 设置页分配策略: node >= 0 绑定到该节点，否则在所有节点间交错。
+// 已分配的页一并迁移
+inline bool bindRegion(void* addr, size_t len, int node, std::string& error) {
+    unsigned long mask[PLACEMENT_MAX_NODES / (8 * sizeof(unsigned long))] = {0};
+    const size_t bits = 8 * sizeof(unsigned long);
+    if (node >= 0) {
+        mask[node / bits] |= 1ul << (node % bits);
+    } else {
+        for (int n : numaNodes()) mask[n / bits] |= 1ul << (n % bits);
+    }
+    int mode = node >= 0 ? PLACEMENT_MPOL_BIND : PLACEMENT_MPOL_INTERLEAVE;
+    if (syscall(SYS_mbind, addr, len, mode, mask, (unsigned long)PLACEMENT_MAX_NODES, PLACEMENT_MPOL_MF_MOVE) != 0) {
+        error = std::string("mbind failed: ") + strerror(errno);
+        return false;
+    }
+    return true;
+}
+
+// 当前线程之后分配的内存优先放在 node 上 (构建副本时 std::vector 等堆内存也落在本地)
+inline bool preferNode(int node) {
+    const size_t bits = 8 * sizeof(unsigned long);
+    unsigned long mask[PLACEMENT_MAX_NODES / (8 * sizeof(unsigned long))] = {0};
+    mask[node / bits] |= 1ul << (node % bits);
+    return syscall(SYS_set_mempolicy, PLACEMENT_MPOL_PREFERRED, mask, (unsigned long)PLACEMENT_MAX_NODES) == 0;
+}
+
+// 实际达到的放置
+struct PlacementStatus {
+    size_t hugePageBytes;              // 由大页 (透明或 hugetlb) 支撑的字节数
+    size_t lockedBytes;                // 被 mlock 的字节数
+    std::vector<uint64_t> nodePages;   // 抽样页在各节点上的个数，下标为节点号
+    uint64_t sampledPages;             // 抽样中已分配的页数
+
+    PlacementStatus() : hugePageBytes(0), lockedBytes(0), sampledPages(0) {}
+};
+
+// [addr, addr + len) 中驻留内存的字节数 (mincore)
+inline size_t residentBytes(uintptr_t begin, uintptr_t end) {
+    size_t pageSize = (size_t)sysconf(_SC_PAGESIZE);
+    begin &= ~(uintptr_t)(pageSize - 1);
+    if (end <= begin) return 0;
+    std::vector<unsigned char> pages((end - begin + pageSize - 1) / pageSize);
+    if (mincore((void*)begin, end - begin, pages.data()) != 0) return 0;
+    size_t resident = 0;
+    for (unsigned char page : pages) resident += page & 1;
+    return resident * pageSize;
+}
+
+// 由 /proc/self/smaps 统计 [addr, addr + len) 中的大页与锁定字节数，再用 move_pages 抽样至多 samples 个页所在的节点。
+// smaps 按映射 (VMA) 汇总，表的映射可能与相邻映射合并: 部分重叠的映射中，锁定字节数取重叠部分的驻留字节
+// (锁定映射的驻留页都已锁定)，大页字节数按重叠比例折算且不超过重叠长度
+inline PlacementStatus measurePlacement(const void* addr, size_t len, size_t samples = 1024) {
+    PlacementStatus status;
+    if (addr == NULL || len == 0) return status;
+    uintptr_t begin = (uintptr_t)addr, end = begin + len;
+    FILE* f = fopen("/proc/self/smaps", "r");
+    if (f != NULL) {
+        char line[512];
+        unsigned long low = 0, high = 0;
+        size_t hugeKb = 0, lockedKb = 0;
+        bool inside = false;
+        // 把上一个映射的计数按其与表的重叠部分计入
+        auto addMapping = [&]() {
+            if (!inside) return;
+            uintptr_t from = std::max<uintptr_t>(low, begin), to = std::min<uintptr_t>(high, end);
+            size_t overlap = to - from, size = high - low;
+            if (overlap == size) {
+                status.hugePageBytes += hugeKb * 1024;
+                status.lockedBytes += lockedKb * 1024;
+                return;
+            }
+            status.hugePageBytes += std::min<size_t>(overlap, (size_t)((double)hugeKb * 1024 * overlap / size));
+            if (lockedKb > 0) status.lockedBytes += residentBytes(from, to);
+        };
+        while (fgets(line, sizeof(line), f) != NULL) {
+            unsigned long lineLow, lineHigh;
+            // 映射的首行形如 "7f00-7f80 rw-p ..."，其余行为 "Name: value kB"
+            if (sscanf(line, "%lx-%lx ", &lineLow, &lineHigh) == 2) {
+                addMapping();
+                low = lineLow;
+                high = lineHigh;
+                hugeKb = 0;
+                lockedKb = 0;
+                inside = low < end && high > begin;
+                continue;
+            }
+            if (!inside) continue;
+            unsigned long kb;
+            if (sscanf(line, "AnonHugePages: %lu kB", &kb) == 1 || sscanf(line, "ShmemPmdMapped: %lu kB", &kb) == 1 ||
+                sscanf(line, "FilePmdMapped: %lu kB", &kb) == 1 || sscanf(line, "Private_Hugetlb: %lu kB", &kb) == 1 ||
+                sscanf(line, "Shared_Hugetlb: %lu kB", &kb) == 1) {
+                hugeKb += kb;
+            } else if (sscanf(line, "Locked: %lu kB", &kb) == 1) {
+                lockedKb += kb;
+            }
+        }
+        addMapping();
+        fclose(f);
+    }
+
+    size_t pageSize = (size_t)sysconf(_SC_PAGESIZE);
+    size_t pages = (len + pageSize - 1) / pageSize;
+    size_t count = std::min(pages, samples);
+    std::vector<void*> addresses(count);
+    std::vector<int> nodes(count, -1);
+    for (size_t i = 0; i < count; i++) {
+        size_t page = count == pages ? i : (size_t)((double)i * pages / count);
+        addresses[i] = (void*)((begin & ~(uintptr_t)(pageSize - 1)) + page * pageSize);
+    }
+    if (count > 0 && syscall(SYS_move_pages, 0, (unsigned long)count, addresses.data(), NULL, nodes.data(), 0) == 0) {
+        for (int node : nodes) {
+            if (node < 0 || node >= PLACEMENT_MAX_NODES) continue;
+            if ((size_t)node >= status.nodePages.size()) status.nodePages.resize(node + 1, 0);
+            status.nodePages[node]++;
+            status.sampledPages++;
+        }
+    }
+    return status;
+}
+
+#endif // CONVERTSERVER_MEMORY_PLACEMENT_H
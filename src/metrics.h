@@ -0,0 +1,224 @@
+/**
+ * metrics.h - convertserver 运行指标: 按线程的计数器与 HDR 风格的直方图
+ *
+ * - 每个工作线程首次记录时分配自己的 ThreadMetrics 并登记，之后只有该线程写入:
+ *   计数器是 relaxed 原子变量的 load + store，不需要锁，也没有跨核的 lock 前缀指令
+ * - STATS 读取时把所有线程的计数器与直方图逐项相加；读到的值可能稍旧，但不会撕裂
+ * - Histogram 按二进制数量级分段，每段再线性分 16 格 (相对误差不超过 1/16)，
+ *   与 HdrHistogram 的布局相同，覆盖 0 到 2^64 的全部取值，记录为一次下标计算加一次自增
+ */
+
+#ifndef CONVERTSERVER_METRICS_H
+#define CONVERTSERVER_METRICS_H
+
+#include <stdint.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// 单写者计数: 只有所属线程修改，读者用 relaxed load 读取
+static inline void bumpCounter(std::atomic<uint64_t>& counter, uint64_t n = 1) {
+    counter.store(counter.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+}
+
+static inline uint64_t metricsNanos() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+class Histogram {
+public:
+    static const int SUB_BITS = 4;
+    static const int SUB_COUNT = 1 << SUB_BITS;
+    static const int BUCKETS = (64 - SUB_BITS + 1) * SUB_COUNT;
+
+    // 小于 16 的值各占一格；其余按最高位所在的数量级 + 其后 4 位定位
+    static int bucketOf(uint64_t value) {
+        if (value < (uint64_t)SUB_COUNT) return (int)value;
+        int exponent = 63 - __builtin_clzll(value);
+        int sub = (int)((value >> (exponent - SUB_BITS)) & (SUB_COUNT - 1));
+        return (exponent - SUB_BITS + 1) * SUB_COUNT + sub;
+    }
+
+    // 落入该格的最大值 (报告分位数时取上界，不会低估)
+    static uint64_t bucketHigh(int bucket) {
+        if (bucket < SUB_COUNT) return (uint64_t)bucket;
+        int exponent = bucket / SUB_COUNT + SUB_BITS - 1;
+        uint64_t sub = (uint64_t)(bucket % SUB_COUNT);
+        uint64_t low = (SUB_COUNT + sub) << (exponent - SUB_BITS);
+        return low + (((uint64_t)1 << (exponent - SUB_BITS)) - 1);
+    }
+
+    void record(uint64_t value) {
+        bumpCounter(counts[bucketOf(value)]);
+        if (value > max.load(std::memory_order_relaxed)) max.store(value, std::memory_order_relaxed);
+    }
+
+    // 累加到 merged (长度 BUCKETS)，返回最大值
+    uint64_t mergeInto(std::vector<uint64_t>& merged) const {
+        for (int i = 0; i < BUCKETS; i++) merged[i] += counts[i].load(std::memory_order_relaxed);
+        return max.load(std::memory_order_relaxed);
+    }
+
+    Histogram() : max(0) {
+        for (int i = 0; i < BUCKETS; i++) counts[i].store(0, std::memory_order_relaxed);
+    }
+
+private:
+    std::atomic<uint64_t> counts[BUCKETS];
+    std::atomic<uint64_t> max;
+};
+
+// 合并后的直方图第 q 分位数 (q 取 0..1)，total 为样本数
+static inline uint64_t histogramPercentile(const std::vector<uint64_t>& merged, uint64_t total, double q) {
+    if (total == 0) return 0;
+    uint64_t rank = (uint64_t)(q * (double)total + 0.5);
+    if (rank < 1) rank = 1;
+    if (rank > total) rank = total;
+    uint64_t seen = 0;
+    for (int i = 0; i < Histogram::BUCKETS; i++) {
+        seen += merged[i];
+        if (seen >= rank) return Histogram::bucketHigh(i);
+    }
+    return Histogram::bucketHigh(Histogram::BUCKETS - 1);
+}
+
+// 按请求类型分别统计
+enum RequestKind {
+    REQ_GET,          // 文本 GET
+    REQ_FIELD,        // 文本 HEADER / SEQ
+    REQ_BATCH,        // 文本 BATCH
+    REQ_BIN_BATCH,    // 二进制 BATCH 帧
+    REQ_BIN_COLUMNS,  // 二进制列请求帧
+    REQ_NAMEID,       // 文本 NAMEID / NAMEIDS (名称 → ID)
+    REQ_BIN_NAMEID,   // 二进制名称查询帧
+    REQ_CONVERT,      // CONVERT 流 / CONVERTFILE (ID 数为转换的行数)
+    REQ_CONTROL,      // 其余文本命令 (STAT、TABLES、LOAD 等)
+    REQ_KIND_COUNT
+};
+
+static const char* const REQUEST_KIND_NAMES[REQ_KIND_COUNT] = {
+    "GET", "FIELD", "BATCH", "BIN_BATCH", "BIN_COLUMNS", "NAMEID", "BIN_NAMEID", "CONVERT", "CONTROL"
+};
+
+struct RequestMetrics {
+    std::atomic<uint64_t> requests;
+    std::atomic<uint64_t> ids;        // 请求中的 ID 数
+    std::atomic<uint64_t> notFound;   // 不存在的 ID (列请求按值计)
+    std::atomic<uint64_t> errors;     // 以 ERROR 响应的请求
+    std::atomic<uint64_t> totalNanos;
+    Histogram latency;                // 处理耗时 (纳秒)
+    Histogram batchSize;              // 每个请求的 ID 数
+
+    RequestMetrics() : requests(0), ids(0), notFound(0), errors(0), totalNanos(0) {}
+};
+
+struct ThreadMetrics {
+    RequestMetrics requests[REQ_KIND_COUNT];
+    std::atomic<uint64_t> connectionsOpened;
+    std::atomic<uint64_t> connectionsClosed;
+    std::atomic<uint64_t> bytesIn;
+    std::atomic<uint64_t> bytesOut;
+
+    ThreadMetrics() : connectionsOpened(0), connectionsClosed(0), bytesIn(0), bytesOut(0) {}
+
+    void recordRequest(RequestKind kind, uint64_t nanos, uint64_t ids, uint64_t notFound, bool error) {
+        RequestMetrics& m = requests[kind];
+        bumpCounter(m.requests);
+        bumpCounter(m.ids, ids);
+        bumpCounter(m.notFound, notFound);
+        if (error) bumpCounter(m.errors);
+        bumpCounter(m.totalNanos, nanos);
+        m.latency.record(nanos);
+        m.batchSize.record(ids);
+    }
+};
+
+class ServerMetrics {
+private:
+    std::mutex mutex;
+    std::vector<std::unique_ptr<ThreadMetrics> > threads;  // 只增不减，线程退出后其计数仍保留
+    uint64_t startNanos;
+
+    ServerMetrics() : startNanos(metricsNanos()) {}
+
+    ThreadMetrics* attach() {
+        std::lock_guard<std::mutex> lock(mutex);
+        threads.push_back(std::unique_ptr<ThreadMetrics>(new ThreadMetrics()));
+        return threads.back().get();
+    }
+
+public:
+    static ServerMetrics& instance() {
+        static ServerMetrics metrics;
+        return metrics;
+    }
+
+    // 当前线程的计数器 (首次调用时登记)
+    static ThreadMetrics& local() {
+        static thread_local ThreadMetrics* current = NULL;
+        if (current == NULL) current = instance().attach();
+        return *current;
+    }
+
+    // STATS 响应: 全局一项，之后每种请求一项，\t 分隔；耗时单位为纳秒
+    std::string describe() {
+        std::lock_guard<std::mutex> lock(mutex);
+        uint64_t opened = 0, closed = 0, bytesIn = 0, bytesOut = 0;
+        for (const auto& t : threads) {
+            opened += t->connectionsOpened.load(std::memory_order_relaxed);
+            closed += t->connectionsClosed.load(std::memory_order_relaxed);
+            bytesIn += t->bytesIn.load(std::memory_order_relaxed);
+            bytesOut += t->bytesOut.load(std::memory_order_relaxed);
+        }
+        std::string response = "STATS UPTIME_MS:" + std::to_string((metricsNanos() - startNanos) / 1000000) +
+                               " CONNECTIONS:" + std::to_string(opened >= closed ? opened - closed : 0) +
+                               " ACCEPTED:" + std::to_string(opened) +
+                               " BYTES_IN:" + std::to_string(bytesIn) +
+                               " BYTES_OUT:" + std::to_string(bytesOut) +
+                               " THREADS:" + std::to_string(threads.size());
+
+        std::vector<uint64_t> latency(Histogram::BUCKETS);
+        std::vector<uint64_t> sizes(Histogram::BUCKETS);
+        for (int kind = 0; kind < REQ_KIND_COUNT; kind++) {
+            uint64_t requests = 0, ids = 0, notFound = 0, errors = 0, totalNanos = 0, maxNanos = 0, maxIds = 0;
+            std::fill(latency.begin(), latency.end(), 0);
+            std::fill(sizes.begin(), sizes.end(), 0);
+            for (const auto& t : threads) {
+                const RequestMetrics& m = t->requests[kind];
+                requests += m.requests.load(std::memory_order_relaxed);
+                ids += m.ids.load(std::memory_order_relaxed);
+                notFound += m.notFound.load(std::memory_order_relaxed);
+                errors += m.errors.load(std::memory_order_relaxed);
+                totalNanos += m.totalNanos.load(std::memory_order_relaxed);
+                maxNanos = std::max(maxNanos, m.latency.mergeInto(latency));
+                maxIds = std::max(maxIds, m.batchSize.mergeInto(sizes));
+            }
+            // 直方图与计数器分别读取，以直方图中的样本数计算分位数；格的上界不超过实际最大值
+            uint64_t samples = 0, sizeSamples = 0;
+            for (uint64_t c : latency) samples += c;
+            for (uint64_t c : sizes) sizeSamples += c;
+            response += std::string("\t") + REQUEST_KIND_NAMES[kind] +
+                        " REQUESTS:" + std::to_string(requests) +
+                        " IDS:" + std::to_string(ids) +
+                        " NOT_FOUND:" + std::to_string(notFound) +
+                        " ERRORS:" + std::to_string(errors) +
+                        " MEAN_NS:" + std::to_string(requests ? totalNanos / requests : 0) +
+                        " P50_NS:" + std::to_string(std::min(maxNanos, histogramPercentile(latency, samples, 0.50))) +
+                        " P90_NS:" + std::to_string(std::min(maxNanos, histogramPercentile(latency, samples, 0.90))) +
+                        " P99_NS:" + std::to_string(std::min(maxNanos, histogramPercentile(latency, samples, 0.99))) +
+                        " P999_NS:" + std::to_string(std::min(maxNanos, histogramPercentile(latency, samples, 0.999))) +
+                        " MAX_NS:" + std::to_string(maxNanos) +
+                        " IDS_P50:" + std::to_string(std::min(maxIds, histogramPercentile(sizes, sizeSamples, 0.50))) +
+                        " IDS_P99:" + std::to_string(std::min(maxIds, histogramPercentile(sizes, sizeSamples, 0.99))) +
+                        " IDS_MAX:" + std::to_string(maxIds);
+        }
+        return response + "\n";
+    }
+};
+
+#endif // CONVERTSERVER_METRICS_H
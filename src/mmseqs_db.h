@@ -0,0 +1,443 @@
+/**
+ * mmseqs_db.h - MMseqs2 数据库 (数据文件 + .index) 的只读访问
+ *
+ * MMseqs2 的数据库由两部分组成:
+ *   - 数据文件: 条目依次拼接，每个条目以 '\0' 结尾 (表头与序列条目在 '\0' 前还有 '\n')
+ *   - .index:   每行 "key\toffset\tlength"，length 包含结尾的 '\0'
+ *
+ * 数据文件整体 mmap，不拷贝；.index 解析为紧凑的偏移索引 OffsetIndex (每个条目 12 字节):
+ *   - key 基本连续时按 key 直接下标 (length 为 0 表示不存在)
+ *   - key 稀疏时按 key 排序，二分查找
+ *
+ * 同样的索引也用于 <db>.lookup 中的名称 (LookupNames)。
+ *
+ * 不支持压缩数据库 (createdb --compressed 1) 与未合并的多文件数据库 (db.0, db.1, ...)。
+ */
+
+#ifndef CONVERTSERVER_MMSEQS_DB_H
+#define CONVERTSERVER_MMSEQS_DB_H
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdint.h>
+#include <algorithm>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "parallel.h"
+
+namespace mmseqs {
+
+// 只读映射一个文件；空文件得到 NULL / 0
+inline bool mapFile(const std::string& path, int advice, const char*& data, size_t& size, std::string& error) {
+    data = NULL;
+    size = 0;
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        error = path + ": " + strerror(errno);
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        error = path + ": " + strerror(errno);
+        close(fd);
+        return false;
+    }
+    if (st.st_size > 0) {
+        void* p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (p == MAP_FAILED) {
+            error = path + ": " + strerror(errno);
+            close(fd);
+            return false;
+        }
+        madvise(p, st.st_size, advice);
+        data = (const char*)p;
+        size = st.st_size;
+    }
+    close(fd);
+    return true;
+}
+
+inline bool fileExists(const std::string& path) {
+    struct stat st;
+    return stat(path.c_str(), &st) == 0;
+}
+
+// 读取 <db>.dbtype (4 字节 int)；扩展类型位于高 16 位，其中第 0 位表示压缩
+inline bool isCompressed(const std::string& dbPath) {
+    int fd = open((dbPath + ".dbtype").c_str(), O_RDONLY);
+    if (fd < 0) return false;
+    int32_t dbtype = 0;
+    bool ok = read(fd, &dbtype, sizeof(dbtype)) == (ssize_t)sizeof(dbtype);
+    close(fd);
+    return ok && ((dbtype >> 16) & 1) != 0;
+}
+
+// 解析无符号十进制数，p 移到数字之后
+inline uint64_t parseNumber(const char*& p, const char* end) {
+    uint64_t value = 0;
+    while (p < end && *p >= '0' && *p <= '9') {
+        value = value * 10 + (*p - '0');
+        p++;
+    }
+    return value;
+}
+
+// 把按行组织的文本文件 (.index / _mapping) 切成 threads 段并行解析，
+// parseLine(line, lineEnd, out) 返回 false 的行被跳过。结果按文件顺序拼接
+template <typename Entry, typename ParseLine>
+inline std::vector<Entry> parseLinesParallel(const char* data, size_t size, int threads, ParseLine parseLine) {
+    int blocks = (int)std::max<size_t>(1, std::min<size_t>(std::max(1, threads), size / (1 << 20)));
+    std::vector<size_t> bounds = splitAtLines(data, size, blocks);
+    std::vector<std::vector<Entry> > parts(blocks);
+    runBlocks(blocks, [&](int b) {
+        const char* p = data + bounds[b];
+        const char* end = data + bounds[b + 1];
+        parts[b].reserve((end - p) / 16 + 1);
+        while (p < end) {
+            const char* nl = (const char*)memchr(p, '\n', end - p);
+            const char* lineEnd = nl ? nl : end;
+            Entry entry;
+            if (lineEnd > p && parseLine(p, lineEnd, entry)) parts[b].push_back(entry);
+            p = lineEnd + 1;
+        }
+    });
+
+    if (blocks == 1) return std::move(parts[0]);
+    size_t total = 0;
+    for (const auto& part : parts) total += part.size();
+    std::vector<Entry> entries;
+    entries.reserve(total);
+    for (auto& part : parts) {
+        entries.insert(entries.end(), part.begin(), part.end());
+        std::vector<Entry>().swap(part);
+    }
+    return entries;
+}
+
+// key 空间不超过条目数的 2 倍 (加少量余量) 时按 key 直接下标
+inline bool isDenseKeySpace(uint64_t maxKey, size_t count) {
+    return maxKey + 1 <= (uint64_t)count * 2 + 1024;
+}
+
+} // namespace mmseqs
+
+// key → 文件区间 [offset, offset + length) 的紧凑索引 (每个条目 12 字节)，构建后只读
+class OffsetIndex {
+public:
+    struct Entry {
+        uint32_t key;
+        uint32_t length;
+        uint64_t offset;
+    };
+
+private:
+    bool dense;
+    std::vector<uint32_t> keys;      // 稀疏时有序的 key
+    std::vector<uint64_t> offsets;   // 稠密时按 key 下标，稀疏时与 keys 对应
+    std::vector<uint32_t> lengths;   // 0 表示不存在
+    size_t count;
+
+public:
+    OffsetIndex() : dense(true), count(0) {}
+
+    // 由解析出的条目构建；重复的 key 以最后一次为准
+    void build(std::vector<Entry>& entries) {
+        clear();
+        uint64_t maxKey = 0;
+        for (const Entry& entry : entries) maxKey = std::max<uint64_t>(maxKey, entry.key);
+        count = entries.size();
+        dense = mmseqs::isDenseKeySpace(maxKey, entries.size());
+        if (dense) {
+            size_t slots = entries.empty() ? 0 : (size_t)maxKey + 1;
+            offsets.assign(slots, 0);
+            lengths.assign(slots, 0);
+            for (const Entry& entry : entries) {
+                offsets[entry.key] = entry.offset;
+                lengths[entry.key] = entry.length;
+            }
+        } else {
+            std::stable_sort(entries.begin(), entries.end(),
+                             [](const Entry& a, const Entry& b) { return a.key < b.key; });
+            keys.reserve(entries.size());
+            offsets.reserve(entries.size());
+            lengths.reserve(entries.size());
+            for (const Entry& entry : entries) {
+                if (!keys.empty() && keys.back() == entry.key) {
+                    offsets.back() = entry.offset;
+                    lengths.back() = entry.length;
+                    continue;
+                }
+                keys.push_back(entry.key);
+                offsets.push_back(entry.offset);
+                lengths.push_back(entry.length);
+            }
+        }
+        std::vector<Entry>().swap(entries);
+    }
+
+    void clear() {
+        dense = true;
+        std::vector<uint32_t>().swap(keys);
+        std::vector<uint64_t>().swap(offsets);
+        std::vector<uint32_t>().swap(lengths);
+        count = 0;
+    }
+
+    bool find(uint32_t key, uint64_t& offset, uint32_t& length) const {
+        size_t i;
+        if (dense) {
+            if (key >= lengths.size()) return false;
+            i = key;
+        } else {
+            auto it = std::lower_bound(keys.begin(), keys.end(), key);
+            if (it == keys.end() || *it != key) return false;
+            i = it - keys.begin();
+        }
+        offset = offsets[i];
+        length = lengths[i];
+        return length != 0;
+    }
+
+    // 按 key 升序遍历: 共 slotCount() 个槽位，第 i 个槽位的 key 为 slotKey(i)，长度 0 的槽位为空
+    size_t slotCount() const { return lengths.size(); }
+    uint32_t slotKey(size_t i) const { return dense ? (uint32_t)i : keys[i]; }
+    uint64_t slotOffset(size_t i) const { return offsets[i]; }
+    uint32_t slotLength(size_t i) const { return lengths[i]; }
+
+    size_t size() const { return count; }
+
+    size_t memoryBytes() const {
+        return keys.capacity() * sizeof(uint32_t) + offsets.capacity() * sizeof(uint64_t) +
+               lengths.capacity() * sizeof(uint32_t);
+    }
+};
+
+// 一个 MMseqs2 数据库: 数据文件 mmap + 紧凑偏移索引，打开后只读，可多线程并发查询
+class MmseqsDB {
+private:
+    const char* data;
+    size_t dataSize;
+    OffsetIndex index;
+
+    MmseqsDB(const MmseqsDB&);
+    MmseqsDB& operator=(const MmseqsDB&);
+
+    static bool parseIndexLine(const char* p, const char* end, OffsetIndex::Entry& entry) {
+        if (p >= end || *p < '0' || *p > '9') return false;
+        uint64_t key = mmseqs::parseNumber(p, end);
+        if (p >= end || *p != '\t') return false;
+        p++;
+        entry.offset = mmseqs::parseNumber(p, end);
+        if (p >= end || *p != '\t') return false;
+        p++;
+        uint64_t length = mmseqs::parseNumber(p, end);
+        if (key > 0xFFFFFFFFull || length > 0xFFFFFFFFull) return false;
+        entry.key = (uint32_t)key;
+        entry.length = (uint32_t)length;
+        return true;
+    }
+
+    // 去掉条目结尾的 "\n\0" / "\0"；越界的条目视为不存在
+    bool entryText(uint64_t offset, uint32_t length, const char*& text, size_t& len) const {
+        if (length == 0 || offset + length > dataSize) return false;
+        text = data + offset;
+        len = length;
+        while (len > 0 && (text[len - 1] == '\0' || text[len - 1] == '\n')) len--;
+        return true;
+    }
+
+public:
+    MmseqsDB() : data(NULL), dataSize(0) {}
+
+    ~MmseqsDB() { close(); }
+
+    // 打开 dbPath 与 dbPath.index；threads 个线程并行解析 .index。
+    // sequential 为 true 时按顺序遍历数据文件 (结果库)，否则按随机访问提示内核
+    bool open(const std::string& dbPath, int threads, std::string& error, bool sequential = false) {
+        close();
+        if (!mmseqs::fileExists(dbPath) && mmseqs::fileExists(dbPath + ".0")) {
+            error = dbPath + ": split databases are not supported, merge them with mmseqs mergedbs";
+            return false;
+        }
+        if (mmseqs::isCompressed(dbPath)) {
+            error = dbPath + ": compressed databases are not supported";
+            return false;
+        }
+        const char* indexText;
+        size_t indexSize;
+        if (!mmseqs::mapFile(dbPath + ".index", MADV_SEQUENTIAL, indexText, indexSize, error)) return false;
+        std::vector<OffsetIndex::Entry> entries =
+            mmseqs::parseLinesParallel<OffsetIndex::Entry>(indexText, indexSize, threads, parseIndexLine);
+        if (indexText != NULL) munmap((void*)indexText, indexSize);
+        index.build(entries);
+
+        if (!mmseqs::mapFile(dbPath, sequential ? MADV_SEQUENTIAL : MADV_RANDOM, data, dataSize, error)) {
+            close();
+            return false;
+        }
+        return true;
+    }
+
+    void close() {
+        if (data != NULL) {
+            munmap((void*)data, dataSize);
+            data = NULL;
+        }
+        dataSize = 0;
+        index.clear();
+    }
+
+    // 条目内容，不含结尾的 "\n\0" / "\0"
+    bool find(uint32_t key, const char*& text, size_t& len) const {
+        uint64_t offset;
+        uint32_t length;
+        return index.find(key, offset, length) && entryText(offset, length, text, len);
+    }
+
+    // 只读索引得到的条目长度 (去掉 "\n\0")，不访问数据文件；序列库中即序列长度
+    bool entryLength(uint32_t key, uint32_t& len) const {
+        uint64_t offset;
+        uint32_t length;
+        if (!index.find(key, offset, length) || offset + length > dataSize) return false;
+        len = length >= 2 ? length - 2 : 0;
+        return true;
+    }
+
+    // 按 key 升序遍历条目 (见 OffsetIndex)，空槽位返回 false
+    size_t slotCount() const { return index.slotCount(); }
+    uint32_t slotBytes(size_t i) const { return index.slotLength(i); }
+    bool slot(size_t i, uint32_t& key, const char*& text, size_t& len) const {
+        key = index.slotKey(i);
+        return entryText(index.slotOffset(i), index.slotLength(i), text, len);
+    }
+
+    size_t size() const { return index.size(); }
+
+    size_t dataBytes() const { return dataSize; }
+
+    // 索引的常驻内存 (数据文件由页缓存承载，不计入)
+    size_t memoryBytes() const { return index.memoryBytes(); }
+};
+
+// <db>.lookup: 每行 "key\tname\tfileNumber"。文件整体 mmap，只为名称建立偏移索引
+class LookupNames {
+private:
+    const char* data;
+    size_t dataSize;
+    OffsetIndex index;
+
+    LookupNames(const LookupNames&);
+    LookupNames& operator=(const LookupNames&);
+
+public:
+    LookupNames() : data(NULL), dataSize(0) {}
+
+    ~LookupNames() {
+        if (data != NULL) munmap((void*)data, dataSize);
+    }
+
+    bool open(const std::string& path, int threads, std::string& error) {
+        if (!mmseqs::mapFile(path, MADV_SEQUENTIAL, data, dataSize, error)) return false;
+        const char* base = data;
+        std::vector<OffsetIndex::Entry> entries = mmseqs::parseLinesParallel<OffsetIndex::Entry>(
+            data, dataSize, threads, [base](const char* p, const char* end, OffsetIndex::Entry& entry) {
+                if (p >= end || *p < '0' || *p > '9') return false;
+                uint64_t key = mmseqs::parseNumber(p, end);
+                if (p >= end || *p != '\t' || key > 0xFFFFFFFFull) return false;
+                p++;
+                const char* tab = (const char*)memchr(p, '\t', end - p);
+                const char* nameEnd = tab ? tab : end;
+                entry.key = (uint32_t)key;
+                entry.offset = (uint64_t)(p - base);
+                entry.length = (uint32_t)(nameEnd - p);
+                return true;
+            });
+        index.build(entries);
+        madvise((void*)data, dataSize, MADV_RANDOM);
+        return true;
+    }
+
+    bool find(uint32_t key, const char*& name, size_t& len) const {
+        uint64_t offset;
+        uint32_t length;
+        if (!index.find(key, offset, length)) return false;
+        name = data + offset;
+        len = length;
+        return true;
+    }
+
+    size_t size() const { return index.size(); }
+};
+
+// <db>_mapping: 每行 "key\ttaxid"，key 对应序列库的 key
+class TaxonomyMapping {
+private:
+    struct MappingEntry {
+        uint32_t key;
+        uint32_t taxid;
+    };
+
+    bool dense;
+    std::vector<uint32_t> keys;     // 稀疏时有序的 key
+    std::vector<uint32_t> taxids;   // 稠密时按 key 下标 (0 表示无注释)
+
+    static bool parseMappingLine(const char* p, const char* end, MappingEntry& entry) {
+        if (p >= end || *p < '0' || *p > '9') return false;
+        uint64_t key = mmseqs::parseNumber(p, end);
+        if (p >= end || *p != '\t') return false;
+        p++;
+        uint64_t taxid = mmseqs::parseNumber(p, end);
+        if (key > 0xFFFFFFFFull || taxid > 0xFFFFFFFFull) return false;
+        entry.key = (uint32_t)key;
+        entry.taxid = (uint32_t)taxid;
+        return true;
+    }
+
+public:
+    TaxonomyMapping() : dense(true) {}
+
+    bool open(const std::string& path, int threads, std::string& error) {
+        const char* text;
+        size_t size;
+        if (!mmseqs::mapFile(path, MADV_SEQUENTIAL, text, size, error)) return false;
+        std::vector<MappingEntry> entries =
+            mmseqs::parseLinesParallel<MappingEntry>(text, size, threads, parseMappingLine);
+        if (text != NULL) munmap((void*)text, size);
+
+        uint64_t maxKey = 0;
+        for (const MappingEntry& entry : entries) maxKey = std::max<uint64_t>(maxKey, entry.key);
+        dense = mmseqs::isDenseKeySpace(maxKey, entries.size());
+        keys.clear();
+        taxids.clear();
+        if (dense) {
+            taxids.assign(entries.empty() ? 0 : (size_t)maxKey + 1, 0);
+            for (const MappingEntry& entry : entries) taxids[entry.key] = entry.taxid;
+        } else {
+            std::sort(entries.begin(), entries.end(),
+                      [](const MappingEntry& a, const MappingEntry& b) { return a.key < b.key; });
+            for (const MappingEntry& entry : entries) {
+                keys.push_back(entry.key);
+                taxids.push_back(entry.taxid);
+            }
+        }
+        return true;
+    }
+
+    // 无注释的 key 返回 0 (与 MMseqs2 一致)
+    uint32_t find(uint32_t key) const {
+        if (dense) return key < taxids.size() ? taxids[key] : 0;
+        auto it = std::lower_bound(keys.begin(), keys.end(), key);
+        return it != keys.end() && *it == key ? taxids[it - keys.begin()] : 0;
+    }
+
+    size_t memoryBytes() const {
+        return (keys.capacity() + taxids.capacity()) * sizeof(uint32_t);
+    }
+};
+
+#endif // CONVERTSERVER_MMSEQS_DB_H
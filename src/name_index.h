@@ -0,0 +1,394 @@
+/**
+ * name_index.h - 名称→ID 反向索引
+ *
+ * 最小完美哈希 (BBHash 式的分层位图) 把表中每个名称映射到 [0, n) 中唯一的下标，
+ * 下标处存放 ID；查询时取出 ID 后再用正向表比对名称，不在表中的名称因此不会误报。
+ * 不存放名称本身，每条目约 4.5 字节: 位图约 3.3 bit + rank 目录 + 4 字节 ID。
+ *
+ *   - 第 l 层是 levelBits[l] 位的位图。每个尚未落位的键按 (名称哈希, l) 取一位，
+ *     恰好只有一个键取到的位置 1，该键落位；冲突的键进入下一层
+ *   - 落位键的下标为其位之前所有层中 1 的个数 (rank)，每 512 位记录一次累计值
+ *   - MAX_LEVELS 层后仍未落位的键 (包括名称重复或 64 位哈希相同的键) 按哈希排序存入 fallback
+ *
+ * 文件布局 (小端，与内存布局相同，可直接 mmap):
+ *   [0, 512)          NameIndexHeader
+ *   [bitsPos, ...)    uint64 位图，各层依次拼接，每层按 512 位对齐
+ *   [ranksPos, ...)   uint64 rank 目录，每 512 位一项
+ *   [idsPos, ...)     uint32 ID，按下标
+ *   [fallbackPos, ...) NameIndexFallback，按 (hash, id) 排序
+ */
+
+#ifndef CONVERTSERVER_NAME_INDEX_H
+#define CONVERTSERVER_NAME_INDEX_H
+
+#include <stdint.h>
+#include <atomic>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+#include "lookup_image.h"
+#include "name_table.h"
+
+static const char NAME_INDEX_MAGIC[8] = {'C', 'S', 'N', 'A', 'M', 'E', 'I', 'X'};
+static const uint32_t NAME_INDEX_VERSION = 1;
+static const size_t NAME_INDEX_HEADER_SIZE = 512;
+static const int NAME_INDEX_MAX_LEVELS = 32;
+
+struct NameIndexHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t levels;
+    uint64_t keys;            // 表中的条目数
+    uint64_t tableChecksum;   // 对应快照的 dataChecksum，映射时据此确认索引与快照匹配
+    uint64_t bitsPos;
+    uint64_t ranksPos;
+    uint64_t idsPos;
+    uint64_t fallbackPos;
+    uint64_t fallbackCount;
+    uint64_t fileSize;
+    uint64_t levelStart[NAME_INDEX_MAX_LEVELS + 1];  // 各层在位图中的起始位，最后一项为总位数
+    uint64_t headerChecksum;  // 必须是最后一个字段
+};
+
+struct NameIndexFallback {
+    uint64_t hash;
+    uint32_t id;
+    uint32_t reserved;
+};
+
+// 名称的 64 位哈希: 按 8 字节字长混合，尾部补零，最后做一次 murmur3 finalizer
+static inline uint64_t nameMix(uint64_t h) {
+    h ^= h >> 33;
+    h *= 0xFF51AFD7ED558CCDULL;
+    h ^= h >> 33;
+    h *= 0xC4CEB9FE1A85EC53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+static inline uint64_t nameHash(const char* name, size_t len) {
+    uint64_t h = 0x9E3779B97F4A7C15ULL ^ (len * 0xC2B2AE3D27D4EB4FULL);
+    size_t i = 0;
+    for (; i + 8 <= len; i += 8) {
+        uint64_t w;
+        memcpy(&w, name + i, 8);
+        h = (h ^ nameMix(w)) * 0x9FB21C651E98DF25ULL;
+    }
+    if (i < len) {
+        uint64_t w = 0;
+        memcpy(&w, name + i, len - i);
+        h = (h ^ nameMix(w)) * 0x9FB21C651E98DF25ULL;
+    }
+    return nameMix(h);
+}
+
+class NameIndex {
+private:
+    static const uint64_t BLOCK_BITS = 512;   // rank 目录的间隔，也是每层的对齐单位
+
+    LookupImage image;
+    const NameIndexHeader* header;
+    const uint64_t* bits;
+    const uint64_t* ranks;
+    const uint32_t* ids;
+    const NameIndexFallback* fallback;
+
+    // 构建中的状态
+    struct Key {
+        uint64_t hash;
+        uint32_t id;
+    };
+    std::vector<uint64_t> buildBits;
+    std::vector<uint64_t> levelStart;
+
+    // 键在第 level 层的位 (相对该层起点)
+    static uint64_t levelPosition(uint64_t hash, int level, uint64_t levelBits) {
+        uint64_t h = nameMix(hash + (uint64_t)(level + 1) * 0x9E3779B97F4A7C15ULL);
+        return (uint64_t)(((unsigned __int128)h * levelBits) >> 64);
+    }
+
+    static bool testBit(const uint64_t* words, uint64_t pos) {
+        return (words[pos >> 6] >> (pos & 63)) & 1;
+    }
+
+    // 键落位的全局位置；前 levels 层都未落位时返回 UINT64_MAX
+    static uint64_t placement(const uint64_t* words, const uint64_t* starts, int levels, uint64_t hash) {
+        for (int l = 0; l < levels; l++) {
+            uint64_t pos = starts[l] + levelPosition(hash, l, starts[l + 1] - starts[l]);
+            if (testBit(words, pos)) return pos;
+        }
+        return UINT64_MAX;
+    }
+
+    uint64_t rank(uint64_t pos) const {
+        uint64_t block = pos / BLOCK_BITS;
+        uint64_t r = ranks[block];
+        for (uint64_t w = block * (BLOCK_BITS / 64); w < (pos >> 6); w++) {
+            r += __builtin_popcountll(bits[w]);
+        }
+        uint64_t mask = ((uint64_t)1 << (pos & 63)) - 1;
+        return r + __builtin_popcountll(bits[pos >> 6] & mask);
+    }
+
+    // 追加一层，大小为键数的 2 倍 (按 512 位对齐)。返回该层编号
+    int addLevel(uint64_t keys) {
+        uint64_t size = std::max<uint64_t>(BLOCK_BITS, (2 * keys + BLOCK_BITS - 1) / BLOCK_BITS * BLOCK_BITS);
+        uint64_t start = levelStart.back();
+        levelStart.push_back(start + size);
+        buildBits.resize((start + size) / 64, 0);
+        return (int)levelStart.size() - 2;
+    }
+
+    // 第 level 层放置一个键: 位已被占用时记为冲突
+    void markKey(int level, uint64_t hash, std::vector<uint64_t>& collisions) {
+        uint64_t start = levelStart[level];
+        uint64_t offset = levelPosition(hash, level, levelStart[level + 1] - start);
+        uint64_t mask = (uint64_t)1 << (offset & 63);
+        uint64_t old = __atomic_fetch_or(&buildBits[(start + offset) >> 6], mask, __ATOMIC_RELAXED);
+        if (old & mask) __atomic_fetch_or(&collisions[offset >> 6], mask, __ATOMIC_RELAXED);
+    }
+
+    // 清除冲突位，返回该层落位的键数
+    uint64_t finishLevel(int level, const std::vector<uint64_t>& collisions) {
+        uint64_t first = levelStart[level] / 64;
+        uint64_t placed = 0;
+        for (size_t w = 0; w < collisions.size(); w++) {
+            buildBits[first + w] &= ~collisions[w];
+            placed += __builtin_popcountll(buildBits[first + w]);
+        }
+        return placed;
+    }
+
+    bool validate(uint64_t keys, uint64_t tableChecksum, std::string& error) const {
+        if (memcmp(header->magic, NAME_INDEX_MAGIC, sizeof(NAME_INDEX_MAGIC)) != 0) {
+            error = "bad magic";
+            return false;
+        }
+        if (header->version != NAME_INDEX_VERSION) {
+            error = "unsupported index version " + std::to_string(header->version);
+            return false;
+        }
+        if (header->headerChecksum != imageChecksum(header, offsetof(NameIndexHeader, headerChecksum))) {
+            error = "header checksum mismatch";
+            return false;
+        }
+        if (header->fileSize != image.size() || header->levels > (uint32_t)NAME_INDEX_MAX_LEVELS) {
+            error = "truncated or inconsistent index";
+            return false;
+        }
+        if (header->keys != keys || header->tableChecksum != tableChecksum) {
+            error = "index does not belong to this snapshot";
+            return false;
+        }
+        if (!validLayout()) {
+            error = "invalid index layout";
+            return false;
+        }
+        return true;
+    }
+
+    // 校验和只覆盖 header: 各区段须依次排列且在文件内，否则损坏或布局不符的索引会使查询越界读取。
+    // 先与文件大小比较再做乘法，避免溢出
+    bool validLayout() const {
+        const NameIndexHeader* h = header;
+        uint64_t size = h->fileSize;
+        if (h->levelStart[0] != 0) return false;
+        for (uint32_t l = 0; l < h->levels; l++) {
+            uint64_t levelBits = h->levelStart[l + 1] - h->levelStart[l];
+            if (h->levelStart[l + 1] <= h->levelStart[l] || levelBits % BLOCK_BITS != 0) return false;
+        }
+        uint64_t totalBits = h->levelStart[h->levels];
+        if (totalBits / 8 > size || h->fallbackCount > h->keys || h->fallbackCount > size / sizeof(NameIndexFallback)) {
+            return false;
+        }
+        uint64_t rankCount = totalBits / BLOCK_BITS + 1;
+        uint64_t placed = h->keys - h->fallbackCount;
+        if (h->keys > size / sizeof(uint32_t)) return false;
+        return h->bitsPos >= NAME_INDEX_HEADER_SIZE && h->bitsPos % 8 == 0 && h->bitsPos <= h->ranksPos &&
+               h->ranksPos - h->bitsPos >= totalBits / 8 && h->ranksPos <= h->idsPos && h->ranksPos % 8 == 0 &&
+               h->idsPos - h->ranksPos >= rankCount * sizeof(uint64_t) && h->idsPos <= h->fallbackPos &&
+               h->fallbackPos - h->idsPos >= placed * sizeof(uint32_t) && h->fallbackPos % 8 == 0 &&
+               h->fallbackPos <= size &&
+               size - h->fallbackPos == h->fallbackCount * sizeof(NameIndexFallback);
+    }
+
+    void bind() {
+        header = (const NameIndexHeader*)image.data();
+        bits = (const uint64_t*)(image.data() + header->bitsPos);
+        ranks = (const uint64_t*)(image.data() + header->ranksPos);
+        ids = (const uint32_t*)(image.data() + header->idsPos);
+        fallback = (const NameIndexFallback*)(image.data() + header->fallbackPos);
+    }
+
+public:
+    NameIndex() : header(NULL), bits(NULL), ranks(NULL), ids(NULL), fallback(NULL) {}
+
+    // 由表中全部条目构建，threads 个线程并行遍历。
+    // 前几层键多，每层重新遍历表计算哈希，不暂存键；剩余键不超过 1/8 后暂存 (哈希, ID) 继续分层
+    bool build(const NameTable& table, int threads, uint64_t tableChecksum, std::string& error) {
+        int parts = std::max(1, threads);
+        uint64_t total = table.size();
+        buildBits.clear();
+        levelStart.assign(1, 0);
+
+        uint64_t remaining = total;
+        int level = 0;
+        while (level < NAME_INDEX_MAX_LEVELS && remaining > 0 && remaining * 8 > total) {
+            addLevel(remaining);
+            std::vector<uint64_t> collisions((levelStart[level + 1] - levelStart[level]) / 64, 0);
+            std::vector<uint64_t> participants(parts, 0);
+            runBlocks(parts, [&](int part) {
+                table.scan(part, parts, [&](uint32_t, const NameRef& name) {
+                    uint64_t hash = nameHash(name.data, name.len);
+                    if (placement(buildBits.data(), levelStart.data(), level, hash) != UINT64_MAX) return;
+                    markKey(level, hash, collisions);
+                    participants[part]++;
+                });
+            });
+            uint64_t reached = 0;
+            for (uint64_t n : participants) reached += n;
+            remaining = reached - finishLevel(level, collisions);
+            level++;
+        }
+
+        std::vector<std::vector<Key> > partKeys(parts);
+        runBlocks(parts, [&](int part) {
+            table.scan(part, parts, [&](uint32_t id, const NameRef& name) {
+                uint64_t hash = nameHash(name.data, name.len);
+                if (placement(buildBits.data(), levelStart.data(), level, hash) != UINT64_MAX) return;
+                Key key = {hash, id};
+                partKeys[part].push_back(key);
+            });
+        });
+        std::vector<Key> rest;
+        for (auto& keys : partKeys) {
+            rest.insert(rest.end(), keys.begin(), keys.end());
+            std::vector<Key>().swap(keys);
+        }
+        while (level < NAME_INDEX_MAX_LEVELS && !rest.empty()) {
+            addLevel(rest.size());
+            std::vector<uint64_t> collisions((levelStart[level + 1] - levelStart[level]) / 64, 0);
+            for (const Key& key : rest) markKey(level, key.hash, collisions);
+            finishLevel(level, collisions);
+            size_t kept = 0;
+            for (const Key& key : rest) {
+                if (placement(buildBits.data(), levelStart.data(), level + 1, key.hash) == UINT64_MAX) {
+                    rest[kept++] = key;
+                }
+            }
+            rest.resize(kept);
+            level++;
+        }
+        std::sort(rest.begin(), rest.end(), [](const Key& a, const Key& b) {
+            return a.hash != b.hash ? a.hash < b.hash : a.id < b.id;
+        });
+
+        // 布局: header + 位图 + rank 目录 + ID + fallback
+        uint64_t totalBits = levelStart.back();
+        uint64_t rankCount = totalBits / BLOCK_BITS + 1;
+        uint64_t placed = total - rest.size();
+        uint64_t bitsPos = NAME_INDEX_HEADER_SIZE;
+        uint64_t ranksPos = bitsPos + totalBits / 8;
+        uint64_t idsPos = ranksPos + rankCount * sizeof(uint64_t);
+        uint64_t fallbackPos = (idsPos + placed * sizeof(uint32_t) + 7) / 8 * 8;
+        uint64_t fileSize = fallbackPos + rest.size() * sizeof(NameIndexFallback);
+        if (!image.allocate(fileSize, error)) return false;
+
+        NameIndexHeader* h = (NameIndexHeader*)image.data();
+        memcpy(h->magic, NAME_INDEX_MAGIC, sizeof(NAME_INDEX_MAGIC));
+        h->version = NAME_INDEX_VERSION;
+        h->levels = (uint32_t)level;
+        h->keys = total;
+        h->tableChecksum = tableChecksum;
+        h->bitsPos = bitsPos;
+        h->ranksPos = ranksPos;
+        h->idsPos = idsPos;
+        h->fallbackPos = fallbackPos;
+        h->fallbackCount = rest.size();
+        h->fileSize = fileSize;
+        for (size_t l = 0; l < levelStart.size(); l++) h->levelStart[l] = levelStart[l];
+
+        uint64_t* outBits = (uint64_t*)(image.data() + bitsPos);
+        memcpy(outBits, buildBits.data(), totalBits / 8);
+        std::vector<uint64_t>().swap(buildBits);
+        uint64_t* outRanks = (uint64_t*)(image.data() + ranksPos);
+        uint64_t running = 0;
+        for (uint64_t b = 0; b < rankCount; b++) {
+            outRanks[b] = running;
+            for (uint64_t w = b * (BLOCK_BITS / 64); w < (b + 1) * (BLOCK_BITS / 64) && w < totalBits / 64; w++) {
+                running += __builtin_popcountll(outBits[w]);
+            }
+        }
+        NameIndexFallback* outFallback = (NameIndexFallback*)(image.data() + fallbackPos);
+        for (size_t i = 0; i < rest.size(); i++) {
+            outFallback[i].hash = rest[i].hash;
+            outFallback[i].id = rest[i].id;
+            outFallback[i].reserved = 0;
+        }
+        h->headerChecksum = imageChecksum(h, offsetof(NameIndexHeader, headerChecksum));
+        bind();
+
+        // 最后一遍: 按落位下标写入 ID
+        uint32_t* outIds = (uint32_t*)(image.data() + idsPos);
+        runBlocks(parts, [&](int part) {
+            table.scan(part, parts, [&](uint32_t id, const NameRef& name) {
+                uint64_t pos = placement(bits, header->levelStart, header->levels, nameHash(name.data, name.len));
+                if (pos != UINT64_MAX) outIds[rank(pos)] = id;
+            });
+        });
+        return true;
+    }
+
+    // 映射 writeFile 写出的索引文件；keys 与 tableChecksum 须与对应快照一致
+    bool openFile(const std::string& path, uint64_t keys, uint64_t tableChecksum, std::string& error) {
+        if (!image.mapReadOnly(path, NAME_INDEX_HEADER_SIZE, error)) return false;
+        header = (const NameIndexHeader*)image.data();
+        if (!validate(keys, tableChecksum, error)) {
+            image.release();
+            header = NULL;
+            return false;
+        }
+        bind();
+        return true;
+    }
+
+    bool writeFile(const std::string& path, std::string& error) const {
+        return image.writeFile(path, image.size(), error);
+    }
+
+    // 名称对应的 ID。候选 ID 须通过正向表比对 (table 须为构建索引时的表或内容相同的表)；
+    // 名称重复时返回其中最小的 ID
+    bool find(const char* name, size_t len, const NameTable& table, NameScratch& scratch, uint32_t& id) const {
+        uint64_t hash = nameHash(name, len);
+        NameRef ref;
+        uint64_t pos = placement(bits, header->levelStart, header->levels, hash);
+        if (pos != UINT64_MAX) {
+            // rank 目录不在校验和内，损坏时下标可能越过 ID 区段
+            uint64_t r = rank(pos);
+            if (r >= header->keys - header->fallbackCount) return false;
+            id = ids[r];
+            return table.find(id, ref, scratch) && ref.len == len && memcmp(ref.data, name, len) == 0;
+        }
+        const NameIndexFallback* end = fallback + header->fallbackCount;
+        const NameIndexFallback* it = std::lower_bound(fallback, end, hash,
+            [](const NameIndexFallback& entry, uint64_t h) { return entry.hash < h; });
+        for (; it != end && it->hash == hash; ++it) {
+            if (table.find(it->id, ref, scratch) && ref.len == len && memcmp(ref.data, name, len) == 0) {
+                id = it->id;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    size_t memoryBytes() const { return image.size(); }
+
+    // 每条目平均字节数
+    double bytesPerEntry() const {
+        return header && header->keys ? (double)image.size() / header->keys : 0;
+    }
+};
+
+#endif // CONVERTSERVER_NAME_INDEX_H
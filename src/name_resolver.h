@@ -0,0 +1,91 @@
+/**
+ * name_resolver.h - 在本进程内从 lookup 快照解析名称 (服务端与客户端共用)
+ *
+ * 只读映射二进制快照 (convertserver --build-snapshot) 或服务端的共享内存段，名称直接从
+ * page cache 读取，不需要 convertserver，也不解析文本 lookup:
+ *   - 映射只建立页表，查询时按需缺页，开销与实际访问的 ID 数成正比；
+ *     映射设置 MADV_RANDOM，缺页时不预读相邻的页
+ *   - 批量解析先按 ID 高位分组再查询，落在同一页或相邻页的 ID 连续访问，page cache 冷时缺页更少
+ *
+ * 分片快照 (见 shard.h) 只含部分 ID，解析器按全局 ID 查询，分片外的 ID 视为不存在。
+ */
+
+#ifndef CONVERTSERVER_NAME_RESOLVER_H
+#define CONVERTSERVER_NAME_RESOLVER_H
+
+#include <sys/mman.h>
+#include <stdint.h>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "name_table.h"
+#include "shard.h"
+
+// 快照记录的分片，完整快照为 all
+inline ShardSpec snapshotShard(const DenseNameTable& table) {
+    ShardSpec spec;
+    const LookupImageShard* stored = table.shard();
+    if (stored != NULL) {
+        spec.kind = stored->kind;
+        spec.first = stored->first;
+        spec.second = stored->second;
+    }
+    return spec;
+}
+
+class NameResolver {
+private:
+    std::unique_ptr<NameTable> table;  // 分片快照时为包装 image 的 ShardedNameTable
+    DenseNameTable* image;
+    ShardSpec spec;
+
+    NameResolver(const NameResolver&);
+    NameResolver& operator=(const NameResolver&);
+
+public:
+    NameResolver() : image(NULL) {}
+
+    // 映射快照文件或共享内存段；verifyData 时校验数据校验和 (需读取整个文件)
+    bool open(const std::string& path, bool verifyData, std::string& error) {
+        DenseNameTable* dense = new DenseNameTable();
+        std::unique_ptr<NameTable> owned(dense);
+        if (!dense->openSnapshot(path, verifyData, error)) return false;
+        dense->adviseRandom();
+        spec = snapshotShard(*dense);
+        if (spec.partial()) owned.reset(new ShardedNameTable(std::move(owned), spec));
+        table.swap(owned);
+        image = dense;
+        return true;
+    }
+
+    bool isOpen() const { return image != NULL; }
+
+    // 快照中的分片，完整快照为 all
+    const ShardSpec& shard() const { return spec; }
+
+    // 映射的文件路径
+    const std::string& path() const { return image->sharedPath(); }
+
+    size_t size() const { return table->size(); }
+
+    const NameTable& names() const { return *table; }
+
+    // 把 count 个 ID 的名称写入 values，不存在的为 NOT_FOUND。ID 按高位分组后查询 (见 findBatchGrouped)，
+    // 结果按原顺序写回
+    void resolve(const uint32_t* ids, size_t count, std::string* values) const {
+        std::vector<NameRef> refs(count);
+        NameScratch scratch;
+        findBatchGrouped(*table, ids, count, refs.data(), scratch);
+        for (size_t i = 0; i < count; i++) {
+            prefetchName(refs.data(), i, count);
+            if (refs[i].data != NULL) {
+                values[i].assign(refs[i].data, refs[i].len);
+            } else {
+                values[i] = "NOT_FOUND";
+            }
+        }
+    }
+};
+
+#endif // CONVERTSERVER_NAME_RESOLVER_H
@@ -0,0 +1,771 @@
+/**
+ * name_table.h - ID→名称 查询表
+ *
+ * 三种后端:
+ *   - DenseNameTable:      offsets 数组按 ID 直接下标 + 一段紧凑的名称 blob。
+ *                          lookup 文件中的 ID 基本连续 (0..N-1)，查询只需两次数组访问。
+ *                          内存布局与二进制快照相同，见 lookup_image.h。
+ *   - HashNameTable:       unordered_map<uint32_t, std::string>，ID 稀疏时的回退方案。
+ *   - CompressedNameTable: 按 ID 每 16 个一块做前缀压缩 (front coding)，
+ *                          查询解码一个块，内存约为稠密表的一半以下。
+ *
+ * 三者在加载完成后都是只读的，多线程并发查询无需加锁。
+ * 稠密表与压缩表的数据在 LookupImage 中，可按 MemoryPlacement 使用大页、mlock 与 NUMA 策略，
+ * 并可复制出绑定在其他 NUMA 节点上的副本。
+ */
+
+#ifndef CONVERTSERVER_NAME_TABLE_H
+#define CONVERTSERVER_NAME_TABLE_H
+
+#include <stdint.h>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+#include <functional>
+#include <memory>
+#include <thread>
+
+#include "lookup_image.h"
+#include "parallel.h"
+
+// 指向表内名称的只读引用 (不拷贝)
+struct NameRef {
+    const char* data;
+    uint32_t len;
+};
+
+// 解码缓冲: 压缩表把名称解码到这里。按块分配，已写入的名称在 clear() 之前地址不变，
+// 因此一个批量请求可以先收集全部 NameRef 再输出。不需要解码的后端不会使用它
+class NameScratch {
+private:
+    static const size_t CHUNK_SIZE = 64 * 1024;
+    std::vector<std::vector<char> > chunks;
+    size_t current;   // 正在写入的块
+    size_t used;      // 当前块已用字节
+
+public:
+    NameScratch() : current(0), used(0) {}
+
+    // 取得至少 n 字节的可写空间，写入后以 commit 确认实际长度
+    char* reserve(size_t n) {
+        if (current < chunks.size() && chunks[current].size() - used >= n) {
+            return chunks[current].data() + used;
+        }
+        if (current < chunks.size()) {
+            current++;
+            used = 0;
+        }
+        while (current < chunks.size() && chunks[current].size() < n) current++;
+        if (current == chunks.size()) {
+            chunks.push_back(std::vector<char>(std::max(CHUNK_SIZE, n)));
+        }
+        return chunks[current].data();
+    }
+
+    void commit(size_t n) { used += n; }
+
+    // 请求结束: 复用已分配的块
+    void clear() {
+        current = 0;
+        used = 0;
+    }
+};
+
+// 遍历条目的回调: (ID, 名称)，名称只在回调期间有效
+typedef std::function<void(uint32_t, const NameRef&)> NameVisitor;
+
+// 以至多 threads 个线程拷贝一段内存 (每线程至少 64MB)；目标页在首次写入时按其区域的策略分配
+static void copyBlocks(char* dst, const char* src, size_t bytes, int threads) {
+    int parts = (int)std::max<size_t>(1, std::min<size_t>(threads, bytes >> 26));
+    runBlocks(parts, [&](int b) {
+        size_t begin = bytes * b / parts, end = bytes * (b + 1) / parts;
+        memcpy(dst + begin, src + begin, end - begin);
+    });
+}
+
+class NameTable {
+public:
+    virtual ~NameTable() {}
+
+    // 查询单个 ID，找到时返回 true 并填充 out。
+    // 名称通常直接指向表内存；压缩表把名称解码到 scratch，out 在 scratch.clear() 之前有效
+    virtual bool find(uint32_t id, NameRef& out, NameScratch& scratch) const = 0;
+
+    // 批量查询: 不存在的 ID 对应 refs[i].data 为 NULL，返回不存在的个数
+    virtual size_t findBatch(const uint32_t* ids, size_t count, NameRef* refs, NameScratch& scratch) const {
+        size_t notFound = 0;
+        for (size_t i = 0; i < count; i++) {
+            if (!find(ids[i], refs[i], scratch)) {
+                refs[i].data = NULL;
+                refs[i].len = 0;
+                notFound++;
+            }
+        }
+        return notFound;
+    }
+
+    // 遍历第 part 部分 (共 parts 部分) 的全部条目，用于构建反向索引；不同部分可由不同线程同时遍历
+    virtual void scan(int part, int parts, const NameVisitor& visit) const = 0;
+
+    // 有效条目数
+    virtual size_t size() const = 0;
+
+    // 常驻内存估算 (字节)
+    virtual size_t memoryBytes() const = 0;
+
+    // 相同内容以稠密表布局存放所需的字节数；压缩比 = rawBytes / memoryBytes
+    virtual size_t rawBytes() const { return memoryBytes(); }
+
+    // 后端名称，用于日志和 STAT
+    virtual const char* kind() const = 0;
+
+    // 名称数据所在的区域，用于报告实际的内存放置；数据不在 LookupImage 中的后端为 NULL
+    virtual const LookupImage* residentImage() const { return NULL; }
+
+    // 锁定表内存，使其不被换出
+    virtual bool lockMemory(std::string& error) {
+        error = std::string(kind()) + " table does not support mlock";
+        return false;
+    }
+
+    // 按 placement 复制一份 (NUMA 节点副本)，由 threads 个线程并行拷贝
+    virtual bool replicate(const MemoryPlacement& placement, int threads, std::unique_ptr<NameTable>& copy,
+                           std::string& error) const {
+        (void)placement;
+        (void)threads;
+        (void)copy;
+        error = std::string(kind()) + " table cannot be replicated";
+        return false;
+    }
+};
+
+// 按顺序读取 findBatch 结果时，处理第 i 个前预取第 i + NAME_PREFETCH 个名称，使名称缺失与拷贝重叠。
+// 不存在的 ID 为 NULL，预取不会出错
+static const size_t NAME_PREFETCH = 16;
+
+inline void prefetchName(const NameRef* refs, size_t i, size_t count) {
+    if (i + NAME_PREFETCH < count) __builtin_prefetch(refs[i + NAME_PREFETCH].data);
+}
+
+// 稠密表: offsets[id]..offsets[id+1] 为名称在 blob 中的区间，空区间表示不存在。
+// 数据存放在 LookupImage 中，布局见 lookup_image.h，可直接写出为快照或从快照映射。
+class DenseNameTable : public NameTable {
+private:
+    static const size_t BATCH_GROUP = 32;  // 批量查询每组的 ID 数
+    static const uint64_t LENGTH_SET = 1ull << 63;  // 构建中 offsets 的标记位: 该 ID 已记录过长度 (含空名称)
+
+    LookupImage image;
+    LookupImageHeader* header;
+    uint64_t* offsets;
+    char* blob;
+    uint64_t slots;
+    uint64_t blobLimit;  // blob 起点之后已映射的字节数，find 不会越过它 (未校验数据的快照中偏移可能损坏)
+    bool fromSnapshot;
+
+    // 预取 id 的偏移项: 区间的两端通常在同一缓存行，跨行时 offsets[id] 在上一行
+    void prefetchSlot(uint32_t id) const {
+        if (id < slots) {
+            __builtin_prefetch(&offsets[id]);
+            __builtin_prefetch(&offsets[(size_t)id + 1]);
+        }
+    }
+
+    void bind() {
+        header = (LookupImageHeader*)image.data();
+        offsets = (uint64_t*)(image.data() + header->offsetsPos);
+        blob = image.data() + header->blobPos;
+        slots = header->slots;
+        blobLimit = image.size() - header->blobPos;
+    }
+
+public:
+    DenseNameTable() : header(NULL), offsets(NULL), blob(NULL), slots(0), blobLimit(0), fromSnapshot(false) {}
+
+    // 构建第一步: 按 slot 数 (maxId + 1) 与名称总字节数上限分配镜像；
+    // sharedPath 非空时镜像放在该路径的共享内存段中，可供同主机的客户端直接映射。
+    // placement 在写入前生效 (大页、NUMA 策略)，mlock 在构建完成后由 lockMemory 进行
+    bool allocate(uint64_t numSlots, uint64_t maxBlobBytes, std::string& error,
+                  const std::string& sharedPath = std::string(),
+                  const MemoryPlacement& placement = MemoryPlacement()) {
+        uint64_t offsetsPos, blobPos;
+        size_t size = imageLayout(numSlots, maxBlobBytes, offsetsPos, blobPos);
+        bool ok = sharedPath.empty() ? image.allocate(size, error, placement)
+                                     : image.allocateShared(sharedPath, size, error, placement);
+        if (!ok) return false;
+
+        LookupImageHeader* h = (LookupImageHeader*)image.data();
+        memcpy(h->magic, LOOKUP_IMAGE_MAGIC, sizeof(LOOKUP_IMAGE_MAGIC));
+        h->version = LOOKUP_IMAGE_VERSION;
+        h->headerSize = LOOKUP_IMAGE_HEADER_SIZE;
+        h->slots = numSlots;
+        h->offsetsPos = offsetsPos;
+        h->blobPos = blobPos;
+        bind();
+        fromSnapshot = false;
+        return true;
+    }
+
+    // 构建第二步: 记录每个 ID 的名称长度 (重复 ID 以最后一次为准)
+    void setLength(uint32_t id, uint32_t len) {
+        offsets[(size_t)id + 1] = LENGTH_SET | len;
+    }
+
+    // 多个线程同时记录长度时使用: 原子写入，返回该 ID 之前是否已记录过 (重复 ID)。
+    // 重复 ID 在不同线程中时保留哪一条不确定，调用方应按文件顺序用 setLength 重新记录，并串行 setName
+    bool claimLength(uint32_t id, uint32_t len) {
+        return __atomic_exchange_n(&offsets[(size_t)id + 1], LENGTH_SET | len, __ATOMIC_RELAXED) != 0;
+    }
+
+    // 构建第三步: 长度前缀和转为偏移，按块并行 (块内求和 → 块间串行扫描 → 块内前缀和)
+    void finalizeLayout(int threads = 1) {
+        uint64_t n = slots;
+        int blocks = (int)std::max<uint64_t>(1, std::min<uint64_t>(threads, n / 65536));
+        std::vector<uint64_t> blockSum(blocks, 0);
+        std::vector<uint64_t> blockCount(blocks, 0);
+        uint64_t* lengths = offsets + 1;
+
+        runBlocks(blocks, [&](int b) {
+            uint64_t begin = n * b / blocks, end = n * (b + 1) / blocks;
+            uint64_t sum = 0, count = 0;
+            for (uint64_t i = begin; i < end; i++) {
+                uint64_t len = lengths[i] & ~LENGTH_SET;
+                lengths[i] = len;
+                sum += len;
+                count += len != 0;
+            }
+            blockSum[b] = sum;
+            blockCount[b] = count;
+        });
+
+        uint64_t base = 0, count = 0;
+        for (int b = 0; b < blocks; b++) {
+            uint64_t sum = blockSum[b];
+            blockSum[b] = base;
+            base += sum;
+            count += blockCount[b];
+        }
+
+        runBlocks(blocks, [&](int b) {
+            uint64_t begin = n * b / blocks, end = n * (b + 1) / blocks;
+            uint64_t running = blockSum[b];
+            for (uint64_t i = begin; i < end; i++) {
+                running += lengths[i];
+                lengths[i] = running;
+            }
+        });
+
+        header->count = count;
+        header->blobBytes = offsets[slots];
+    }
+
+    // 构建第四步: 拷贝名称到 blob 中对应位置
+    void setName(uint32_t id, const char* name, uint32_t len) {
+        uint64_t begin = offsets[id];
+        if (offsets[(size_t)id + 1] - begin == len) {
+            memcpy(blob + begin, name, len);
+        }
+    }
+
+    // 构建完成: 写入 header 校验和，使其他进程映射时能通过校验
+    void seal() {
+        header->headerChecksum = imageHeaderChecksum(*header);
+    }
+
+    // 将镜像写出为快照文件 (计算校验和)
+    bool writeSnapshot(const std::string& path, std::string& error) {
+        size_t size = (size_t)(header->blobPos + header->blobBytes);
+        header->dataChecksum = imageChecksum(image.data() + header->offsetsPos, size - header->offsetsPos);
+        header->headerChecksum = imageHeaderChecksum(*header);
+        return image.writeFile(path, size, error);
+    }
+
+    // 直接映射快照文件提供服务
+    bool openSnapshot(const std::string& path, bool verifyData, std::string& error) {
+        if (!image.mapFile(path, verifyData, error)) return false;
+        bind();
+        fromSnapshot = true;
+        return true;
+    }
+
+    bool isSnapshot() const { return fromSnapshot; }
+
+    // 映射的快照只做零散的随机查询时调用: 缺页不预读相邻的页
+    void adviseRandom() const { image.advise(MADV_RANDOM); }
+
+    // 记录镜像只含一个分片的 ID (按局部 ID 下标，见 shard.h)，在 seal / writeSnapshot 之前调用
+    void setShard(uint32_t kind, uint64_t first, uint64_t second) {
+        LookupImageShard* shard = (LookupImageShard*)(image.data() + LOOKUP_IMAGE_SHARD_POS);
+        memcpy(shard->magic, LOOKUP_IMAGE_SHARD_MAGIC, sizeof(LOOKUP_IMAGE_SHARD_MAGIC));
+        shard->kind = kind;
+        shard->first = first;
+        shard->second = second;
+        shard->checksum = imageShardChecksum(*shard);
+        header->version = LOOKUP_IMAGE_SHARD_VERSION;
+    }
+
+    // 镜像的分片信息，完整的表为 NULL
+    const LookupImageShard* shard() const {
+        if (header == NULL || header->version != LOOKUP_IMAGE_SHARD_VERSION) return NULL;
+        return (const LookupImageShard*)(image.data() + LOOKUP_IMAGE_SHARD_POS);
+    }
+
+    // 快照的数据校验和 (writeSnapshot 时计算，从文本构建的表为 0)
+    uint64_t dataChecksum() const { return header ? header->dataChecksum : 0; }
+
+    // 可被其他进程映射的文件路径 (快照文件或共享内存段)，匿名内存时为空
+    const std::string& sharedPath() const { return image.path(); }
+
+    uint64_t slotCount() const { return slots; }
+
+    bool find(uint32_t id, NameRef& out) const {
+        if (id >= slots) return false;
+        uint64_t begin = offsets[id];
+        uint64_t end = offsets[(size_t)id + 1];
+        if (begin >= end || end > blobLimit) return false;
+        out.data = blob + begin;
+        out.len = (uint32_t)(end - begin);
+        return true;
+    }
+
+    bool find(uint32_t id, NameRef& out, NameScratch&) const { return find(id, out); }
+
+    // 逐个 find 时每个 ID 的偏移项缺失依次发生。批量查询按 BATCH_GROUP 个 ID 一组，
+    // 处理一组前先预取下一组的偏移项，约两组 ID 的缺失同时在途。
+    // 名称不在这里预取: 大批次查完时早被逐出缓存，由调用方读取结果时用 prefetchName 提前预取
+    size_t findBatch(const uint32_t* ids, size_t n, NameRef* refs, NameScratch&) const {
+        size_t notFound = 0;
+        for (size_t i = 0; i < n && i < BATCH_GROUP; i++) prefetchSlot(ids[i]);
+        for (size_t group = 0; group < n; group += BATCH_GROUP) {
+            size_t end = std::min(n, group + BATCH_GROUP);
+            size_t ahead = std::min(n, end + BATCH_GROUP);
+            for (size_t i = end; i < ahead; i++) prefetchSlot(ids[i]);
+            for (size_t i = group; i < end; i++) {
+                if (!find(ids[i], refs[i])) {
+                    refs[i].data = NULL;
+                    refs[i].len = 0;
+                    notFound++;
+                }
+            }
+        }
+        return notFound;
+    }
+
+    void scan(int part, int parts, const NameVisitor& visit) const {
+        uint64_t begin = slots * part / parts, end = slots * (part + 1) / parts;
+        NameRef name;
+        for (uint64_t id = begin; id < end; id++) {
+            if (find((uint32_t)id, name)) visit((uint32_t)id, name);
+        }
+    }
+
+    size_t size() const { return header ? header->count : 0; }
+
+    size_t memoryBytes() const {
+        return header ? (size_t)(header->blobPos + header->blobBytes) : 0;
+    }
+
+    const char* kind() const { return "dense"; }
+
+    const LookupImage* residentImage() const { return &image; }
+
+    bool lockMemory(std::string& error) { return image.lock(error); }
+
+    // 副本位于按 placement 分配的匿名内存中 (快照也由此复制到大页或指定节点上)
+    bool replicate(const MemoryPlacement& placement, int threads, std::unique_ptr<NameTable>& copy,
+                   std::string& error) const {
+        size_t bytes = memoryBytes();
+        DenseNameTable* replica = new DenseNameTable();
+        std::unique_ptr<NameTable> owned(replica);
+        if (!replica->image.allocate(bytes, error, placement)) return false;
+        copyBlocks(replica->image.data(), image.data(), bytes, threads);
+        replica->bind();
+        copy.swap(owned);
+        return true;
+    }
+};
+
+// 哈希表: 原始实现，适用于 ID 空间远大于条目数的情况。
+// 按 id % shards 拆成多个分片，便于多线程并行构建。
+class HashNameTable : public NameTable {
+private:
+    std::vector<std::unordered_map<uint32_t, std::string> > shards;
+
+public:
+    explicit HashNameTable(int shardCount = 1) : shards(std::max(1, shardCount)) {}
+
+    int shardOf(uint32_t id) const { return (int)(id % shards.size()); }
+
+    void reserveShard(int shard, size_t n) { shards[shard].reserve(n); }
+
+    // 不同分片可由不同线程同时写入
+    void insertIntoShard(int shard, uint32_t id, const char* name, uint32_t len) {
+        shards[shard][id].assign(name, len);
+    }
+
+    void insert(uint32_t id, const char* name, uint32_t len) {
+        insertIntoShard(shardOf(id), id, name, len);
+    }
+
+    bool find(uint32_t id, NameRef& out) const {
+        const std::unordered_map<uint32_t, std::string>& idToName = shards[shardOf(id)];
+        auto it = idToName.find(id);
+        if (it == idToName.end()) return false;
+        out.data = it->second.data();
+        out.len = (uint32_t)it->second.size();
+        return true;
+    }
+
+    bool find(uint32_t id, NameRef& out, NameScratch&) const { return find(id, out); }
+
+    void scan(int part, int parts, const NameVisitor& visit) const {
+        for (size_t s = part; s < shards.size(); s += parts) {
+            for (const auto& pair : shards[s]) {
+                NameRef name = {pair.second.data(), (uint32_t)pair.second.size()};
+                visit(pair.first, name);
+            }
+        }
+    }
+
+    size_t size() const {
+        size_t n = 0;
+        for (const auto& idToName : shards) n += idToName.size();
+        return n;
+    }
+
+    size_t memoryBytes() const {
+        // 节点 (key + string + next 指针 + malloc 头) + 桶数组 + 超出 SSO 的字符串堆内存
+        size_t bytes = 0;
+        for (const auto& idToName : shards) {
+            bytes += idToName.size() * (sizeof(std::pair<const uint32_t, std::string>) + 2 * sizeof(void*));
+            bytes += idToName.bucket_count() * sizeof(void*);
+            for (const auto& pair : idToName) {
+                if (pair.second.capacity() > 15) bytes += pair.second.capacity() + 1;
+            }
+        }
+        return bytes;
+    }
+
+    const char* kind() const { return "hash"; }
+};
+
+// 压缩表: ID 按 BLOCK_SLOTS 个一块，块内每个名称只存与前一个名称不同的后缀 (front coding)。
+// 每项编码为 varint(后缀长度 + 1)、varint(与前一名称的公共前缀长度)、后缀字节；0 表示该 ID 不存在。
+// blockOffsets[b] 为第 b 块在 data 中的起点。查询时先顺序扫描块内各项的长度 (不拷贝)，
+// 再从目标项向前拼出名称，每个字节只拷贝一次；批量查询中落在同一块的 ID 共用一次扫描。
+// lookup 中相邻 ID 的名称通常共享库前缀与 accession 前缀 (UniRef100_A0A…)，每项只剩几个字节
+class CompressedNameTable : public NameTable {
+public:
+    static const uint32_t BLOCK_SLOTS = 16;
+    static const size_t PREFETCH_DISTANCE = 8;  // 批量查询预取的 ID 距离
+
+private:
+    LookupImage image;                  // 编码后的名称
+    std::vector<uint64_t> blockOffsets; // 块数 + 1 项
+    const uint8_t* data;
+    uint64_t slots;
+    uint64_t count;
+    uint64_t nameBytes;
+
+    struct BuildStats {
+        uint64_t count;
+        uint64_t nameBytes;
+    };
+
+    // 一个块已扫描部分的各项位置: suffix 为 NULL 表示该项不存在
+    struct BlockScan {
+        uint64_t block;
+        uint32_t scanned;        // 已扫描的项数
+        const uint8_t* next;     // 第 scanned 项的编码
+        uint32_t prefix[BLOCK_SLOTS];
+        uint32_t suffixLen[BLOCK_SLOTS];
+        const uint8_t* suffix[BLOCK_SLOTS];
+    };
+
+    static size_t varintSize(uint32_t v) {
+        size_t n = 1;
+        while (v >= 0x80) {
+            v >>= 7;
+            n++;
+        }
+        return n;
+    }
+
+    static uint8_t* putVarint(uint8_t* p, uint32_t v) {
+        while (v >= 0x80) {
+            *p++ = (uint8_t)(v | 0x80);
+            v >>= 7;
+        }
+        *p++ = (uint8_t)v;
+        return p;
+    }
+
+    static uint32_t getVarint(const uint8_t*& p) {
+        uint32_t v = *p++;
+        if (v < 0x80) return v;
+        v &= 0x7F;
+        for (int shift = 7;; shift += 7) {
+            uint32_t b = *p++;
+            v |= (b & 0x7F) << shift;
+            if (b < 0x80) return v;
+        }
+    }
+
+    // 编码第 block 块，返回字节数；out 为 NULL 时只计算长度并累计统计
+    template <typename NameAt>
+    size_t encodeBlock(uint64_t block, NameAt& nameAt, uint8_t* out, BuildStats& stats) const {
+        uint64_t begin = block * BLOCK_SLOTS;
+        uint64_t end = std::min(slots, begin + BLOCK_SLOTS);
+        NameRef prev = {NULL, 0};
+        size_t bytes = 0;
+        for (uint64_t id = begin; id < end; id++) {
+            NameRef name;
+            if (!nameAt((uint32_t)id, name)) {
+                if (out != NULL) out[bytes] = 0;
+                bytes++;
+                continue;
+            }
+            uint32_t prefix = 0;
+            uint32_t limit = std::min(prev.len, name.len);
+            while (prefix < limit && prev.data[prefix] == name.data[prefix]) prefix++;
+            uint32_t suffix = name.len - prefix;
+            if (out != NULL) {
+                uint8_t* p = putVarint(putVarint(out + bytes, suffix + 1), prefix);
+                memcpy(p, name.data + prefix, suffix);
+            }
+            bytes += varintSize(suffix + 1) + varintSize(prefix) + suffix;
+            stats.count++;
+            stats.nameBytes += name.len;
+            prev = name;
+        }
+        return bytes;
+    }
+
+    void startScan(uint64_t block, BlockScan& scan) const {
+        scan.block = block;
+        scan.scanned = 0;
+        scan.next = data + blockOffsets[block];
+    }
+
+    // 扫描到第 pos 项 (含)，只读长度、跳过后缀
+    static void scanTo(uint32_t pos, BlockScan& scan) {
+        const uint8_t* p = scan.next;
+        for (uint32_t i = scan.scanned; i <= pos; i++) {
+            uint32_t code = getVarint(p);
+            if (code == 0) {
+                scan.suffix[i] = NULL;
+                continue;
+            }
+            scan.prefix[i] = getVarint(p);
+            scan.suffixLen[i] = code - 1;
+            scan.suffix[i] = p;
+            p += code - 1;
+        }
+        scan.next = p;
+        scan.scanned = pos + 1;
+    }
+
+    // 拼出第 pos 项 (须存在) 的名称: 先拷贝自身后缀，再向前由各项后缀补齐仍缺的前缀。
+    // 块内第一个存在的项前缀为 0，循环一定在此之前结束
+    static uint32_t assemble(const BlockScan& scan, uint32_t pos, char* out) {
+        uint32_t need = scan.prefix[pos];
+        memcpy(out + need, scan.suffix[pos], scan.suffixLen[pos]);
+        for (uint32_t j = pos; need > 0;) {
+            j--;
+            if (scan.suffix[j] != NULL && scan.prefix[j] < need) {
+                memcpy(out + scan.prefix[j], scan.suffix[j], need - scan.prefix[j]);
+                need = scan.prefix[j];
+            }
+        }
+        return scan.prefix[pos] + scan.suffixLen[pos];
+    }
+
+    static uint32_t nameLength(const BlockScan& scan, uint32_t pos) {
+        return scan.prefix[pos] + scan.suffixLen[pos];
+    }
+
+public:
+    CompressedNameTable() : data(NULL), slots(0), count(0), nameBytes(0) {}
+
+    // 按 slot 数 (maxId + 1) 构建。nameAt(id, NameRef&) 返回该 ID 的名称 (不存在时返回 false)，
+    // 会被多个线程并发调用，名称须在构建期间保持有效。
+    // 第一遍各线程计算所负责块的编码长度，前缀和得到块偏移后一次分配，第二遍直接编码到位。
+    // placement 作用于编码后的数据 (块偏移数组在堆上，约为其 1/10)
+    template <typename NameAt>
+    bool build(uint64_t numSlots, NameAt nameAt, int threads, std::string& error,
+               const MemoryPlacement& placement = MemoryPlacement()) {
+        slots = numSlots;
+        uint64_t blocks = (slots + BLOCK_SLOTS - 1) / BLOCK_SLOTS;
+        int parts = (int)std::max<uint64_t>(1, std::min<uint64_t>(threads, blocks / 4096));
+        std::vector<BuildStats> partStats(parts, BuildStats{0, 0});
+        blockOffsets.assign(blocks + 1, 0);
+
+        runBlocks(parts, [&](int t) {
+            uint64_t begin = blocks * t / parts, end = blocks * (t + 1) / parts;
+            for (uint64_t b = begin; b < end; b++) {
+                blockOffsets[b + 1] = encodeBlock(b, nameAt, NULL, partStats[t]);
+            }
+        });
+        count = 0;
+        nameBytes = 0;
+        for (const BuildStats& stats : partStats) {
+            count += stats.count;
+            nameBytes += stats.nameBytes;
+        }
+        for (uint64_t b = 0; b < blocks; b++) {
+            blockOffsets[b + 1] += blockOffsets[b];
+        }
+
+        if (!image.allocate(std::max<size_t>(1, (size_t)blockOffsets[blocks]), error, placement)) return false;
+        uint8_t* out = (uint8_t*)image.data();
+        runBlocks(parts, [&](int t) {
+            uint64_t begin = blocks * t / parts, end = blocks * (t + 1) / parts;
+            BuildStats ignored = {0, 0};
+            for (uint64_t b = begin; b < end; b++) {
+                encodeBlock(b, nameAt, out + blockOffsets[b], ignored);
+            }
+        });
+        data = out;
+        return true;
+    }
+
+    bool find(uint32_t id, NameRef& out, NameScratch& scratch) const {
+        if (id >= slots) return false;
+        BlockScan scan;
+        uint32_t pos = id % BLOCK_SLOTS;
+        startScan(id / BLOCK_SLOTS, scan);
+        scanTo(pos, scan);
+        if (scan.suffix[pos] == NULL) return false;
+        char* buf = scratch.reserve(nameLength(scan, pos));
+        out.len = assemble(scan, pos, buf);
+        out.data = buf;
+        scratch.commit(out.len);
+        return true;
+    }
+
+    // 与上一个 ID 同块时沿用已扫描的部分，只需继续扫描或直接拼出名称
+    size_t findBatch(const uint32_t* ids, size_t n, NameRef* refs, NameScratch& scratch) const {
+        BlockScan scan;
+        scan.block = UINT64_MAX;
+        scan.scanned = 0;
+        scan.next = NULL;
+        size_t notFound = 0;
+        for (size_t i = 0; i < n; i++) {
+            // 解码一项的指令较多，乱序执行覆盖不到后续 ID 的缓存缺失: 提前两倍距离预取块偏移，
+            // 一倍距离预取块数据的前两个缓存行
+            if (i + 2 * PREFETCH_DISTANCE < n && ids[i + 2 * PREFETCH_DISTANCE] < slots) {
+                __builtin_prefetch(&blockOffsets[ids[i + 2 * PREFETCH_DISTANCE] / BLOCK_SLOTS]);
+            }
+            if (i + PREFETCH_DISTANCE < n && ids[i + PREFETCH_DISTANCE] < slots) {
+                const uint8_t* block = data + blockOffsets[ids[i + PREFETCH_DISTANCE] / BLOCK_SLOTS];
+                __builtin_prefetch(block);
+                __builtin_prefetch(block + 64);
+            }
+            uint32_t id = ids[i];
+            uint32_t pos = id % BLOCK_SLOTS;
+            if (id < slots) {
+                if (id / BLOCK_SLOTS != scan.block) startScan(id / BLOCK_SLOTS, scan);
+                if (pos >= scan.scanned) scanTo(pos, scan);
+            }
+            if (id >= slots || scan.suffix[pos] == NULL) {
+                refs[i].data = NULL;
+                refs[i].len = 0;
+                notFound++;
+                continue;
+            }
+            char* buf = scratch.reserve(nameLength(scan, pos));
+            refs[i].len = assemble(scan, pos, buf);
+            refs[i].data = buf;
+            scratch.commit(refs[i].len);
+        }
+        return notFound;
+    }
+
+    // 按块顺序解码，块内逐项在同一缓冲上覆盖后缀
+    void scan(int part, int parts, const NameVisitor& visit) const {
+        uint64_t blocks = blockOffsets.size() - 1;
+        std::string name;
+        for (uint64_t b = blocks * part / parts; b < blocks * (part + 1) / parts; b++) {
+            const uint8_t* p = data + blockOffsets[b];
+            uint64_t end = std::min(slots, (b + 1) * BLOCK_SLOTS);
+            for (uint64_t id = b * BLOCK_SLOTS; id < end; id++) {
+                uint32_t code = getVarint(p);
+                if (code == 0) continue;
+                uint32_t prefix = getVarint(p);
+                name.resize(prefix + code - 1);
+                memcpy(&name[prefix], p, code - 1);
+                p += code - 1;
+                NameRef ref = {name.data(), (uint32_t)name.size()};
+                visit((uint32_t)id, ref);
+            }
+        }
+    }
+
+    size_t size() const { return count; }
+
+    size_t memoryBytes() const { return image.size() + blockOffsets.size() * sizeof(uint64_t); }
+
+    // 稠密表的 offsets 数组 + 名称 blob
+    size_t rawBytes() const { return (size_t)((slots + 1) * sizeof(uint64_t) + nameBytes); }
+
+    const char* kind() const { return "compressed"; }
+
+    const LookupImage* residentImage() const { return &image; }
+
+    bool lockMemory(std::string& error) {
+        if (!image.lock(error)) return false;
+        if (mlock(blockOffsets.data(), blockOffsets.size() * sizeof(uint64_t)) != 0) {
+            error = std::string("mlock failed: ") + strerror(errno);
+            return false;
+        }
+        return true;
+    }
+
+    // 块偏移数组由调用线程分配，其 NUMA 节点取决于该线程的内存策略 (见 preferNode)
+    bool replicate(const MemoryPlacement& placement, int threads, std::unique_ptr<NameTable>& copy,
+                   std::string& error) const {
+        CompressedNameTable* replica = new CompressedNameTable();
+        std::unique_ptr<NameTable> owned(replica);
+        if (!replica->image.allocate(image.size(), error, placement)) return false;
+        copyBlocks(replica->image.data(), image.data(), image.size(), threads);
+        replica->blockOffsets = blockOffsets;
+        replica->data = (const uint8_t*)replica->image.data();
+        replica->slots = slots;
+        replica->count = count;
+        replica->nameBytes = nameBytes;
+        copy.swap(owned);
+        return true;
+    }
+};
+
+// 先按 ID 的高位分组 (一遍计数排序) 再批量查询，结果按请求顺序写回 refs。
+// 组数随批次大小增长 (至多 65536 组)，分组后的访问按地址大致递增，大表上 TLB 与页缓存的局部性更好，
+// 压缩表中同块的 ID 也相邻；代价是分组与写回各一遍额外的随机访问
+inline size_t findBatchGrouped(const NameTable& table, const uint32_t* ids, size_t count, NameRef* refs,
+                               NameScratch& scratch) {
+    uint32_t maxId = 0;
+    for (size_t i = 0; i < count; i++) maxId = std::max(maxId, ids[i]);
+    int idBits = 32 - __builtin_clz(maxId | 1);
+    int groupBits = 1;
+    while (groupBits < 16 && ((size_t)1 << (groupBits + 1)) <= count) groupBits++;
+    int shift = std::max(0, idBits - groupBits);
+
+    std::vector<uint32_t> start(((size_t)1 << groupBits) + 1, 0);
+    for (size_t i = 0; i < count; i++) start[(ids[i] >> shift) + 1]++;
+    for (size_t g = 1; g < start.size(); g++) start[g] += start[g - 1];
+    std::vector<uint32_t> order(count);
+    std::vector<uint32_t> grouped(count);
+    for (size_t i = 0; i < count; i++) {
+        uint32_t at = start[ids[i] >> shift]++;
+        order[at] = (uint32_t)i;
+        grouped[at] = ids[i];
+    }
+
+    std::vector<NameRef> groupedRefs(count);
+    size_t notFound = table.findBatch(grouped.data(), count, groupedRefs.data(), scratch);
+    for (size_t k = 0; k < count; k++) refs[order[k]] = groupedRefs[k];
+    return notFound;
+}
+
+#endif // CONVERTSERVER_NAME_TABLE_H
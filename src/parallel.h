@@ -0,0 +1,42 @@
+/**
+ * parallel.h - 加载与构建共用的并行辅助函数
+ *
+ *   - runBlocks:    把 blocks 个分块交给同样数量的线程，返回前全部 join
+ *   - splitAtLines: 在换行处把文本切成 n 段，供各线程按行解析
+ */
+
+#ifndef CONVERTSERVER_PARALLEL_H
+#define CONVERTSERVER_PARALLEL_H
+
+#include <stddef.h>
+#include <algorithm>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+// 把 blocks 个分块交给同样数量的线程 (当前线程处理第 0 块)，全部完成后返回
+template <typename Fn>
+static void runBlocks(int blocks, Fn fn) {
+    std::vector<std::thread> workers;
+    for (int b = 1; b < blocks; b++) {
+        workers.push_back(std::thread(fn, b));
+    }
+    fn(0);
+    for (auto& worker : workers) {
+        worker.join();
+    }
+}
+
+// 在换行处把 [0, size) 切成 n 段，返回 n + 1 个边界
+static inline std::vector<size_t> splitAtLines(const char* data, size_t size, int n) {
+    std::vector<size_t> bounds(1, 0);
+    for (int i = 1; i < n; i++) {
+        size_t pos = std::max(bounds.back(), (size_t)((double)size * i / n));
+        const char* nl = pos < size ? (const char*)memchr(data + pos, '\n', size - pos) : NULL;
+        bounds.push_back(nl ? (size_t)(nl - data) + 1 : size);
+    }
+    bounds.push_back(size);
+    return bounds;
+}
+
+#endif // CONVERTSERVER_PARALLEL_H
@@ -0,0 +1,170 @@
+/**
+ * protocol.h - convertserver 二进制协议定义 (服务端与客户端共用)
+ *
+ * 文本协议 (GET/BATCH/PING/STAT/STATS/HEADER/SEQ/NAMEID) 保留给 nc 与调试使用；大批量查询使用二进制 BATCH:
+ *
+ *   协商: 客户端连接后发送 "HELLO BIN1\n"，支持的服务端回复 "OK BIN1\n"，
+ *         旧版本服务端回复 "ERROR:Unknown command\n"，客户端回退到文本协议。
+ *
+ *   请求: [BIN_MAGIC][uint32 count][count × uint32 id]
+ *   响应: [BIN_MAGIC][uint32 count][count × uint32 len][名称依次拼接]
+ *         len == BIN_NOT_FOUND 表示该 ID 不存在，不占用名称字节。
+ *
+ *   列请求: [BIN_COLUMNS_MAGIC][uint32 count][uint32 columns][count × uint32 id]
+ *         columns 为 TargetColumn 位的组合 (服务端以 "COLUMNS" 命令报告可用的列)。
+ *         响应与 BATCH 相同 (BIN_MAGIC 帧)，共 count × 列数 个值，按 ID 依次排列，
+ *         每个 ID 内按列位从低到高；长度与 taxid 以十进制文本返回。
+ *
+ *   名称查询 (名称 → ID，需要服务端为该表建立反向索引):
+ *         [BIN_NAMEID_MAGIC][uint32 count][uint32 bytes][count × uint32 len][名称依次拼接，共 bytes 字节]
+ *   响应: [BIN_NAMEID_MAGIC][uint32 count][count × uint32 id]，BIN_NOT_FOUND 表示名称不在表中。
+ *         表没有反向索引时响应 "ERROR:Name index not available\n"。
+ *
+ *   流式转换: 文本请求 "CONVERT [@table] <bytes> [passthrough]\n" 之后紧跟 bytes 字节的 M8 行
+ *         (queryName \t targetId \t ...)。服务端每收到完整的行即换上 target 名称并格式化为默认 12 列，
+ *         以帧返回: [BIN_CONVERT_MAGIC][uint32 len][len 字节转换后的行]，长度为 0 的帧表示结束，
+ *         其后一行 "OK CONVERTED <rows> <notFound>\n"。表不可用时只返回一行 "ERROR:...\n"，
+ *         随后的 bytes 字节仍被读取并丢弃。
+ *   文件转换: "CONVERTFILE [@table] <input> <output> [passthrough]\n"，服务端直接读写这两个路径
+ *         (需以 --convert-files 启动)，响应 "OK CONVERTED <rows> <notFound>\n"。
+ *
+ * 所有整数均为小端。BIN_MAGIC 不是可打印字符，不会与文本命令混淆。
+ *
+ * 服务端地址为 unix socket 路径或 host:port (服务端 --tcp)，见 connectAddress。
+ */
+
+#ifndef CONVERTSERVER_PROTOCOL_H
+#define CONVERTSERVER_PROTOCOL_H
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <netdb.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdint.h>
+#include <cstring>
+#include <string>
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__
+#error "convertserver binary protocol assumes a little-endian host"
+#endif
+
+static const char* const BIN_HELLO = "HELLO BIN1\n";
+static const char* const BIN_HELLO_OK = "OK BIN1\n";
+static const unsigned char BIN_MAGIC = 0xB1;
+static const size_t BIN_HEADER_SIZE = 1 + sizeof(uint32_t);
+static const uint32_t BIN_NOT_FOUND = 0xFFFFFFFFu;
+static const uint32_t BIN_MAX_COUNT = 1u << 26;  // 单帧最多 6700 万个 ID (256 MB)
+static const unsigned char BIN_COLUMNS_MAGIC = 0xB2;
+static const size_t BIN_COLUMNS_HEADER_SIZE = 1 + 2 * sizeof(uint32_t);
+static const unsigned char BIN_NAMEID_MAGIC = 0xB3;
+static const size_t BIN_NAMEID_HEADER_SIZE = 1 + 2 * sizeof(uint32_t);
+static const uint32_t BIN_MAX_NAME_BYTES = 1u << 28;  // 单帧名称最多 256 MB
+static const unsigned char BIN_CONVERT_MAGIC = 0xB4;
+static const size_t BIN_CONVERT_HEADER_SIZE = 1 + sizeof(uint32_t);
+
+// 列请求可取的 target 列
+enum TargetColumn {
+    COLUMN_NAME = 1u << 0,      // lookup 中的名称
+    COLUMN_HEADER = 1u << 1,    // targetDB_h 中的表头
+    COLUMN_SEQUENCE = 1u << 2,  // targetDB 中的序列
+    COLUMN_LENGTH = 1u << 3,    // 序列长度
+    COLUMN_TAXID = 1u << 4      // targetDB_mapping 中的 taxid
+};
+static const uint32_t COLUMN_ALL = (1u << 5) - 1;
+static const char* const TARGET_COLUMN_NAMES[] = {"name", "header", "sequence", "length", "taxid"};
+
+inline int columnCount(uint32_t columns) {
+    int n = 0;
+    for (; columns != 0; columns &= columns - 1) n++;
+    return n;
+}
+
+inline void putU32(char* p, uint32_t v) { memcpy(p, &v, sizeof(v)); }
+
+inline uint32_t getU32(const char* p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+// 完整发送 len 字节
+inline bool sendAll(int sock, const char* data, size_t len) {
+    size_t sent = 0;
+    while (sent < len) {
+        ssize_t n = send(sock, data + sent, len - sent, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        sent += n;
+    }
+    return true;
+}
+
+// 完整接收 len 字节
+inline bool recvAll(int sock, char* data, size_t len) {
+    size_t got = 0;
+    while (got < len) {
+        ssize_t n = recv(sock, data + got, len - got, 0);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        got += n;
+    }
+    return true;
+}
+
+// host:port 形式 (不含 '/'，最后一个 ':' 之后全为数字) 的地址走 TCP，其余为 unix socket 路径
+inline bool isTcpAddress(const std::string& address) {
+    size_t colon = address.rfind(':');
+    if (address.find('/') != std::string::npos || colon == std::string::npos || colon + 1 == address.size()) {
+        return false;
+    }
+    return address.find_first_not_of("0123456789", colon + 1) == std::string::npos;
+}
+
+// 连接到服务端地址，TCP 连接关闭 Nagle 算法。失败时返回 -1
+inline int connectAddress(const std::string& address, std::string& error) {
+    if (!isTcpAddress(address)) {
+        int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        struct sockaddr_un addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        strncpy(addr.sun_path, address.c_str(), sizeof(addr.sun_path) - 1);
+        if (fd >= 0 && connect(fd, (struct sockaddr*)&addr, sizeof(addr)) == 0) return fd;
+        error = address + ": " + strerror(errno);
+        if (fd >= 0) close(fd);
+        return -1;
+    }
+    size_t colon = address.rfind(':');
+    std::string host = address.substr(0, colon);
+    if (host.size() >= 2 && host[0] == '[' && host[host.size() - 1] == ']') host = host.substr(1, host.size() - 2);
+    struct addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    struct addrinfo* result = NULL;
+    int rc = getaddrinfo(host.empty() ? "127.0.0.1" : host.c_str(), address.c_str() + colon + 1, &hints, &result);
+    if (rc != 0) {
+        error = address + ": " + gai_strerror(rc);
+        return -1;
+    }
+    int fd = -1;
+    for (struct addrinfo* ai = result; ai != NULL; ai = ai->ai_next) {
+        fd = socket(ai->ai_family, ai->ai_socktype | SOCK_CLOEXEC, ai->ai_protocol);
+        if (fd < 0) continue;
+        if (connect(fd, ai->ai_addr, ai->ai_addrlen) == 0) {
+            int one = 1;
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+            break;
+        }
+        error = address + ": " + strerror(errno);
+        close(fd);
+        fd = -1;
+    }
+    freeaddrinfo(result);
+    return fd;
+}
+
+#endif // CONVERTSERVER_PROTOCOL_H
@@ -0,0 +1,530 @@
+/**
+ * reactor.h - 基于 epoll 的事件循环与固定工作线程池
+ *
+ * - 主线程 (Reactor::run) 以边沿触发方式在各监听 socket (unix 与 TCP) 上 accept，新连接轮询分配给工作线程；
+ *   描述符耗尽时用预留的描述符接受并关闭新连接，监听不会停滞；
+ *   TCP 连接关闭 Nagle 算法，小响应不被延迟
+ * - 每个工作线程拥有独立的 epoll 实例，负责其名下连接的读取、处理与发送，
+ *   连接状态只在所属线程中访问，无需加锁
+ * - 工作线程数量固定，可绑定到 CPU 核心，避免每个连接一个线程带来的创建风暴
+ * - 响应写入按块组织的 OutputQueue，以 iovec 分散/聚集发送，不拼接成一个大字符串
+ * - 耗时长且不依赖新数据的请求 (CONVERTFILE) 由处理器分步完成: 连接设置 resume 后事件循环每轮调用一步，
+ *   同一线程上的其他连接不会被整段阻塞
+ * - 关闭时停止 accept，各工作线程处理完已收到的请求、发送完响应后再关闭连接
+ * - 连接数与收发字节数记入所在工作线程的 ThreadMetrics (metrics.h)
+ */
+
+#ifndef CONVERTSERVER_REACTOR_H
+#define CONVERTSERVER_REACTOR_H
+
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "metrics.h"
+#include "memory_placement.h"
+
+// 待发送数据队列: 固定大小的块链表，追加时不会搬移已有数据
+class OutputQueue {
+private:
+    static const size_t CHUNK_SIZE = 64 * 1024;
+
+    std::deque<std::string> chunks;
+    size_t headPos;  // 第一个块中已发送的字节数
+    size_t bytes;    // 未发送的总字节数
+
+public:
+    OutputQueue() : headPos(0), bytes(0) {}
+
+    size_t size() const { return bytes; }
+    bool empty() const { return bytes == 0; }
+
+    void append(const char* data, size_t len) {
+        bytes += len;
+        while (len > 0) {
+            if (chunks.empty() || chunks.back().size() == CHUNK_SIZE) {
+                chunks.push_back(std::string());
+                chunks.back().reserve(CHUNK_SIZE);
+            }
+            std::string& tail = chunks.back();
+            size_t n = std::min(len, CHUNK_SIZE - tail.size());
+            tail.append(data, n);
+            data += n;
+            len -= n;
+        }
+    }
+
+    void append(const std::string& data) { append(data.data(), data.size()); }
+
+    void append(char c) { append(&c, 1); }
+
+    // 预留 len 字节的连续空间 (不超过一个块) 并返回写入位置
+    char* reserve(size_t len) {
+        if (chunks.empty() || chunks.back().size() + len > CHUNK_SIZE) {
+            chunks.push_back(std::string());
+            chunks.back().reserve(std::max(CHUNK_SIZE, len));
+        }
+        std::string& tail = chunks.back();
+        size_t old = tail.size();
+        tail.resize(old + len);
+        bytes += len;
+        return &tail[old];
+    }
+
+    // 填充最多 max 个 iovec，返回实际个数
+    int fill(struct iovec* iov, int max) const {
+        int n = 0;
+        for (size_t i = 0; i < chunks.size() && n < max; i++) {
+            size_t skip = (i == 0) ? headPos : 0;
+            if (chunks[i].size() == skip) continue;
+            iov[n].iov_base = (void*)(chunks[i].data() + skip);
+            iov[n].iov_len = chunks[i].size() - skip;
+            n++;
+        }
+        return n;
+    }
+
+    // 丢弃已发送的 n 字节
+    void consume(size_t n) {
+        bytes -= n;
+        while (n > 0) {
+            size_t avail = chunks.front().size() - headPos;
+            if (n < avail) {
+                headPos += n;
+                return;
+            }
+            n -= avail;
+            chunks.pop_front();
+            headPos = 0;
+        }
+        if (bytes == 0) {
+            chunks.clear();
+            headPos = 0;
+        }
+    }
+};
+
+// 协议层挂在连接上的解析状态
+struct ConnectionContext {
+    virtual ~ConnectionContext() {}
+};
+
+// 单个客户端连接的状态
+struct Connection {
+    int fd;
+    std::string in;     // 已接收、尚未处理的数据
+    OutputQueue out;    // 待发送的响应
+    std::unique_ptr<ConnectionContext> context;
+    bool peerClosed;    // 对端已关闭写方向
+    bool readBlocked;   // 因待发送数据过多暂停读取，内核中可能仍有数据
+    bool remote;        // 经 TCP 监听接入 (而非 unix socket)
+    bool resume;        // 处理器还有不依赖新数据的工作 (如 CONVERTFILE 的下一片)，事件循环下一轮再次调用；
+                        // 期间暂停读取，后续请求按顺序等待
+
+    Connection(int fd, bool remote)
+        : fd(fd), peerClosed(false), readBlocked(false), remote(remote), resume(false) {}
+
+    size_t pendingOutput() const { return out.size(); }
+};
+
+// 消费 conn.in 中的完整请求，把响应追加到 conn.out
+typedef std::function<void(Connection&)> RequestProcessor;
+
+static inline bool setNonBlocking(int fd) {
+    int flags = fcntl(fd, F_GETFL, 0);
+    return flags >= 0 && fcntl(fd, F_SETFL, flags | O_NONBLOCK) == 0;
+}
+
+class Worker {
+private:
+    static const size_t READ_CHUNK = 65536;
+    static const size_t MAX_PENDING_OUTPUT = 64 << 20;  // 超过后暂停读取 (背压)
+    static const int DRAIN_TIMEOUT_MS = 5000;
+
+    int epollFd;
+    int wakeFd;
+    int cpu;
+    RequestProcessor processor;
+    std::unordered_map<int, std::unique_ptr<Connection> > connections;
+    bool resumePending;  // 有连接设置了 resume
+
+    std::mutex incomingMutex;
+    std::vector<std::pair<int, bool> > incoming;  // 主线程交给本线程的新连接: (fd, 是否经 TCP 接入)
+    std::atomic<bool> stopping;
+    std::thread thread;
+
+    void wake() {
+        uint64_t one = 1;
+        ssize_t n = ::write(wakeFd, &one, sizeof(one));
+        (void)n;
+    }
+
+    void adoptIncoming() {
+        std::vector<std::pair<int, bool> > fds;
+        {
+            std::lock_guard<std::mutex> lock(incomingMutex);
+            fds.swap(incoming);
+        }
+        for (const auto& accepted : fds) {
+            int fd = accepted.first;
+            Connection* conn = new Connection(fd, accepted.second);
+            struct epoll_event ev;
+            ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+            ev.data.ptr = conn;
+            if (epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &ev) != 0) {
+                ::close(fd);
+                delete conn;
+                continue;
+            }
+            connections[fd].reset(conn);
+            bumpCounter(ServerMetrics::local().connectionsOpened);
+        }
+    }
+
+    void closeConnection(Connection* conn) {
+        epoll_ctl(epollFd, EPOLL_CTL_DEL, conn->fd, NULL);
+        ::close(conn->fd);
+        connections.erase(conn->fd);
+        bumpCounter(ServerMetrics::local().connectionsClosed);
+    }
+
+    void process(Connection& conn) {
+        conn.resume = false;
+        processor(conn);
+        if (conn.resume) resumePending = true;
+    }
+
+    // 读到 EAGAIN (或待发送数据达到上限、处理器要求稍后继续) 为止，每读一块就处理一次；返回 false 表示连接出错
+    bool readAndProcess(Connection& conn) {
+        char buffer[READ_CHUNK];
+        conn.readBlocked = false;
+        if (!conn.in.empty() || conn.resume) {
+            process(conn);
+        }
+        while (!conn.peerClosed) {
+            if (conn.pendingOutput() >= MAX_PENDING_OUTPUT || conn.resume) {
+                conn.readBlocked = true;
+                break;
+            }
+            ssize_t n = recv(conn.fd, buffer, sizeof(buffer), 0);
+            if (n > 0) {
+                bumpCounter(ServerMetrics::local().bytesIn, n);
+                conn.in.append(buffer, n);
+                process(conn);
+            } else if (n == 0) {
+                conn.peerClosed = true;
+            } else if (errno == EINTR) {
+                continue;
+            } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                break;
+            } else {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // 以分散/聚集方式 (sendmsg + iovec) 尽量发送 out，返回 false 表示连接出错
+    bool flush(Connection& conn) {
+        struct iovec iov[64];
+        while (!conn.out.empty()) {
+            int count = conn.out.fill(iov, 64);
+            struct msghdr msg;
+            memset(&msg, 0, sizeof(msg));
+            msg.msg_iov = iov;
+            msg.msg_iovlen = count;
+            ssize_t n = sendmsg(conn.fd, &msg, MSG_NOSIGNAL);
+            if (n > 0) {
+                bumpCounter(ServerMetrics::local().bytesOut, n);
+                conn.out.consume(n);
+            } else if (n < 0 && errno == EINTR) {
+                continue;
+            } else if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                break;
+            } else {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    void handleEvent(Connection* conn, uint32_t events) {
+        bool ok = (events & EPOLLERR) == 0;
+        if (ok && (events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP))) {
+            ok = readAndProcess(*conn);
+        }
+        if (ok) {
+            ok = flush(*conn);
+        }
+        finishEvent(conn, ok);
+    }
+
+    void finishEvent(Connection* conn, bool ok) {
+        // 背压解除后继续读取内核中积压的数据
+        while (ok && conn->readBlocked && conn->pendingOutput() == 0 && !conn->resume) {
+            ok = readAndProcess(*conn) && flush(*conn);
+        }
+        if (!ok || (conn->peerClosed && conn->pendingOutput() == 0 && !conn->resume)) {
+            closeConnection(conn);
+        }
+    }
+
+    // 再次调用设置了 resume 的连接的处理器: 每个连接每轮处理一步，与其他连接的事件交替进行
+    void resumeConnections() {
+        resumePending = false;
+        std::vector<Connection*> ready;
+        for (auto& pair : connections) {
+            if (pair.second->resume) ready.push_back(pair.second.get());
+        }
+        for (Connection* conn : ready) {
+            process(*conn);
+            finishEvent(conn, flush(*conn));
+        }
+    }
+
+    // 关闭前: 处理已到达的请求，并在超时前尽量发送完所有响应
+    void drain() {
+        std::vector<Connection*> live;
+        for (auto& pair : connections) {
+            live.push_back(pair.second.get());
+        }
+        for (Connection* conn : live) {
+            if (!readAndProcess(*conn) || !flush(*conn)) {
+                closeConnection(conn);
+            }
+        }
+
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(DRAIN_TIMEOUT_MS);
+        struct epoll_event events[256];
+        while (std::chrono::steady_clock::now() < deadline) {
+            bool pending = false;
+            for (auto& pair : connections) {
+                if (pair.second->pendingOutput() > 0 || pair.second->resume) pending = true;
+            }
+            if (!pending) break;
+            if (resumePending) resumeConnections();
+            int n = epoll_wait(epollFd, events, 256, resumePending ? 0 : 100);
+            for (int i = 0; i < n; i++) {
+                Connection* conn = (Connection*)events[i].data.ptr;
+                if (conn == NULL) {
+                    uint64_t value;
+                    ssize_t r = ::read(wakeFd, &value, sizeof(value));
+                    (void)r;
+                } else if (!flush(*conn)) {
+                    closeConnection(conn);
+                }
+            }
+        }
+
+        while (!connections.empty()) {
+            closeConnection(connections.begin()->second.get());
+        }
+    }
+
+    void loop() {
+        // 信号只由主线程处理
+        sigset_t mask;
+        sigemptyset(&mask);
+        sigaddset(&mask, SIGINT);
+        sigaddset(&mask, SIGTERM);
+        sigaddset(&mask, SIGHUP);
+        pthread_sigmask(SIG_BLOCK, &mask, NULL);
+
+        if (cpu >= 0) {
+            cpu_set_t set;
+            CPU_ZERO(&set);
+            CPU_SET(cpu, &set);
+            pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+        }
+
+        struct epoll_event events[256];
+        while (!stopping) {
+            int n = epoll_wait(epollFd, events, 256, resumePending ? 0 : -1);
+            if (n < 0 && errno != EINTR) break;
+            for (int i = 0; i < n; i++) {
+                Connection* conn = (Connection*)events[i].data.ptr;
+                if (conn == NULL) {
+                    uint64_t value;
+                    ssize_t r = ::read(wakeFd, &value, sizeof(value));
+                    (void)r;
+                    adoptIncoming();
+                } else {
+                    handleEvent(conn, events[i].events);
+                }
+            }
+            if (resumePending) resumeConnections();
+        }
+
+        adoptIncoming();
+        drain();
+    }
+
+public:
+    Worker(int cpu, const RequestProcessor& processor)
+        : epollFd(-1), wakeFd(-1), cpu(cpu), processor(processor), resumePending(false), stopping(false) {}
+
+    ~Worker() {
+        if (wakeFd >= 0) ::close(wakeFd);
+        if (epollFd >= 0) ::close(epollFd);
+    }
+
+    bool start() {
+        epollFd = epoll_create1(0);
+        wakeFd = eventfd(0, EFD_NONBLOCK);
+        if (epollFd < 0 || wakeFd < 0) return false;
+        struct epoll_event ev;
+        ev.events = EPOLLIN;
+        ev.data.ptr = NULL;
+        if (epoll_ctl(epollFd, EPOLL_CTL_ADD, wakeFd, &ev) != 0) return false;
+        thread = std::thread(&Worker::loop, this);
+        return true;
+    }
+
+    // 由主线程调用，把新连接交给本线程
+    void addConnection(int fd, bool remote) {
+        {
+            std::lock_guard<std::mutex> lock(incomingMutex);
+            incoming.push_back(std::make_pair(fd, remote));
+        }
+        wake();
+    }
+
+    void stop() {
+        stopping = true;
+        wake();
+    }
+
+    void join() {
+        if (thread.joinable()) thread.join();
+    }
+};
+
+class Reactor {
+private:
+    std::vector<std::unique_ptr<Worker> > workers;
+
+public:
+    // pinCpus 为 true 时工作线程依次绑定到当前进程允许的 CPU 上；
+    // spreadNodes 为 true 时相邻的工作线程轮流落在不同 NUMA 节点上 (每个节点的副本都有线程读取)
+    Reactor(int numWorkers, bool pinCpus, const RequestProcessor& processor, bool spreadNodes = false) {
+        std::vector<int> cpus;
+        cpu_set_t allowed;
+        if (pinCpus && sched_getaffinity(0, sizeof(allowed), &allowed) == 0) {
+            for (int c = 0; c < CPU_SETSIZE; c++) {
+                if (CPU_ISSET(c, &allowed)) cpus.push_back(c);
+            }
+        }
+        if (spreadNodes) spreadAcrossNodes(cpus);
+        for (int i = 0; i < numWorkers; i++) {
+            int cpu = cpus.empty() ? -1 : cpus[i % cpus.size()];
+            workers.push_back(std::unique_ptr<Worker>(new Worker(cpu, processor)));
+        }
+    }
+
+    // 在 listenFds 上接受连接直到 running 变为 false，然后等待所有工作线程排空退出
+    bool run(const std::vector<int>& listenFds, const std::atomic<bool>& running) {
+        for (auto& worker : workers) {
+            if (!worker->start()) return false;
+        }
+
+        int epollFd = epoll_create1(0);
+        std::vector<bool> tcp;
+        for (size_t i = 0; i < listenFds.size(); i++) {
+            setNonBlocking(listenFds[i]);
+            struct sockaddr_storage addr;
+            socklen_t len = sizeof(addr);
+            tcp.push_back(getsockname(listenFds[i], (struct sockaddr*)&addr, &len) == 0 && addr.ss_family != AF_UNIX);
+            struct epoll_event ev;
+            ev.events = EPOLLIN | EPOLLET;
+            ev.data.u32 = (uint32_t)i;
+            epoll_ctl(epollFd, EPOLL_CTL_ADD, listenFds[i], &ev);
+        }
+
+        // 预留一个描述符: 描述符耗尽 (EMFILE/ENFILE) 时释放它来接受并立即关闭待处理的连接，
+        // 否则连接留在 backlog 中，边沿触发不会再次通知，监听会一直停滞
+        int spareFd = ::open("/dev/null", O_RDONLY | O_CLOEXEC);
+        bool exhausted = false;
+        std::vector<bool> retry(listenFds.size(), false);  // 预留描述符也无法释放时，下一轮再尝试 accept
+        size_t next = 0;
+        auto acceptAll = [&](size_t k) {
+            // 边沿触发: 一次取完所有待接受的连接
+            retry[k] = false;
+            while (true) {
+                int clientSocket = accept4(listenFds[k], NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+                if (clientSocket < 0) {
+                    if (errno == EINTR || errno == ECONNABORTED) continue;
+                    if (errno != EMFILE && errno != ENFILE) break;
+                    if (!exhausted) {
+                        std::cerr << "[WARN] Out of file descriptors, rejecting new connections" << std::endl;
+                        exhausted = true;
+                    }
+                    if (spareFd < 0) {
+                        retry[k] = true;
+                        break;
+                    }
+                    ::close(spareFd);
+                    int rejected = accept4(listenFds[k], NULL, NULL, SOCK_CLOEXEC);
+                    if (rejected >= 0) ::close(rejected);
+                    spareFd = ::open("/dev/null", O_RDONLY | O_CLOEXEC);
+                    if (rejected < 0 && errno != EINTR && errno != ECONNABORTED) {
+                        retry[k] = errno == EMFILE || errno == ENFILE;
+                        break;
+                    }
+                    continue;
+                }
+                exhausted = false;
+                if (tcp[k]) {
+                    int one = 1;
+                    setsockopt(clientSocket, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+                }
+                workers[next++ % workers.size()]->addConnection(clientSocket, tcp[k]);
+            }
+        };
+
+        std::vector<struct epoll_event> events(std::max<size_t>(1, listenFds.size()));
+        while (running) {
+            bool retrying = std::find(retry.begin(), retry.end(), true) != retry.end();
+            int n = epoll_wait(epollFd, events.data(), (int)events.size(), retrying ? 100 : 1000);  // 超时用于检查 running
+            for (int e = 0; e < n; e++) {
+                acceptAll(events[e].data.u32);
+            }
+            for (size_t k = 0; retrying && k < retry.size(); k++) {
+                if (retry[k]) acceptAll(k);
+            }
+        }
+
+        if (spareFd >= 0) ::close(spareFd);
+        ::close(epollFd);
+        for (auto& worker : workers) {
+            worker->stop();
+        }
+        for (auto& worker : workers) {
+            worker->join();
+        }
+        return true;
+    }
+};
+
+#endif // CONVERTSERVER_REACTOR_H
@@ -0,0 +1,339 @@
+/**
+ * shard.h - 按 ID 把查询表分到多个 convertserver 实例 (服务端与客户端共用)
+ *
+ * 分片描述 (--shard / 分片表中的一项):
+ *   range:<begin>-<end>   ID 在 [begin, end) 中，end 省略时到 ID 上限
+ *   hash:<k>/<n>          ID % n == k，相邻 ID 分散到各分片，热点区间也能均摊
+ *   all                   完整的表
+ *
+ * 服务端只加载分片内的条目，表中按局部 ID 下标 (range 为 id - begin，hash 为 id / n)，
+ * 稠密表因此仍然紧凑；ShardedNameTable 在查询时把全局 ID 转换为局部 ID，
+ * 请求与响应中始终是全局 ID。分片写入快照时记录在镜像 header 中 (见 lookup_image.h)。
+ *
+ * 客户端的分片表 (convertalis-fast --shard-map) 每行 "<address> <shard>"，# 开头为注释;
+ * address 为 unix socket 路径或 host:port。批次按分片拆开并行查询，结果按原顺序合并。
+ */
+
+#ifndef CONVERTSERVER_SHARD_H
+#define CONVERTSERVER_SHARD_H
+
+#include <stdint.h>
+#include <cstdlib>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+#include "name_table.h"
+
+enum ShardKind { SHARD_ALL = 0, SHARD_RANGE = 1, SHARD_HASH = 2 };
+
+static const uint64_t SHARD_ID_LIMIT = 1ull << 32;
+
+// 一个分片包含的 ID 集合
+struct ShardSpec {
+    uint32_t kind;
+    uint64_t first;   // range: 起始 ID；hash: 余数 k
+    uint64_t second;  // range: 结束 ID (不含)；hash: 分片数 n
+
+    ShardSpec() : kind(SHARD_ALL), first(0), second(0) {}
+
+    // 是否只含部分 ID
+    bool partial() const { return kind != SHARD_ALL; }
+
+    bool contains(uint32_t id) const {
+        switch (kind) {
+        case SHARD_RANGE:
+            return id >= first && id < second;
+        case SHARD_HASH:
+            return id % second == first;
+        default:
+            return true;
+        }
+    }
+
+    // 全局 ID → 表中的局部 ID (调用方先确认 contains)
+    uint32_t toLocal(uint32_t id) const {
+        switch (kind) {
+        case SHARD_RANGE:
+            return (uint32_t)(id - first);
+        case SHARD_HASH:
+            return (uint32_t)(id / second);
+        default:
+            return id;
+        }
+    }
+
+    uint32_t toGlobal(uint32_t local) const {
+        switch (kind) {
+        case SHARD_RANGE:
+            return (uint32_t)(local + first);
+        case SHARD_HASH:
+            return (uint32_t)(local * second + first);
+        default:
+            return local;
+        }
+    }
+
+    // 全局 ID 在 [0, globalSlots) 中的表按分片取出后的局部 slot 数
+    uint64_t localSlots(uint64_t globalSlots) const {
+        switch (kind) {
+        case SHARD_RANGE:
+            return globalSlots > first ? std::min(globalSlots, second) - first : 0;
+        case SHARD_HASH:
+            return globalSlots > first ? (globalSlots - 1 - first) / second + 1 : 0;
+        default:
+            return globalSlots;
+        }
+    }
+
+    bool operator==(const ShardSpec& other) const {
+        return kind == other.kind && first == other.first && second == other.second;
+    }
+
+    bool operator!=(const ShardSpec& other) const { return !(*this == other); }
+
+    std::string describe() const {
+        switch (kind) {
+        case SHARD_RANGE:
+            return "range:" + std::to_string(first) + "-" + std::to_string(second);
+        case SHARD_HASH:
+            return "hash:" + std::to_string(first) + "/" + std::to_string(second);
+        default:
+            return "all";
+        }
+    }
+
+    // 解析 range:<begin>-<end> / hash:<k>/<n> / all
+    bool parse(const std::string& text, std::string& error) {
+        ShardSpec spec;
+        const char* p = text.c_str();
+        char* end = NULL;
+        if (text == "all") {
+            *this = spec;
+            return true;
+        }
+        if (text.compare(0, 6, "range:") == 0) {
+            spec.kind = SHARD_RANGE;
+            spec.first = strtoull(p + 6, &end, 10);
+            if (end == p + 6 || *end != '-') {
+                error = "expected range:<begin>-<end>: " + text;
+                return false;
+            }
+            const char* last = end + 1;
+            spec.second = *last == '\0' ? SHARD_ID_LIMIT : strtoull(last, &end, 10);
+            if ((*last != '\0' && (end == last || *end != '\0')) || spec.first >= spec.second ||
+                spec.second > SHARD_ID_LIMIT) {
+                error = "invalid ID range: " + text;
+                return false;
+            }
+            if (spec.first == 0 && spec.second == SHARD_ID_LIMIT) spec = ShardSpec();
+        } else if (text.compare(0, 5, "hash:") == 0) {
+            spec.kind = SHARD_HASH;
+            spec.first = strtoull(p + 5, &end, 10);
+            if (end == p + 5 || *end != '/') {
+                error = "expected hash:<k>/<n>: " + text;
+                return false;
+            }
+            const char* count = end + 1;
+            spec.second = strtoull(count, &end, 10);
+            if (end == count || *end != '\0' || spec.second == 0 || spec.first >= spec.second ||
+                spec.second >= SHARD_ID_LIMIT) {
+                error = "invalid hash shard: " + text;
+                return false;
+            }
+            if (spec.second == 1) spec = ShardSpec();
+        } else {
+            error = "unknown shard (expected range:<begin>-<end> or hash:<k>/<n>): " + text;
+            return false;
+        }
+        *this = spec;
+        return true;
+    }
+};
+
+// 分片表: 内部表按局部 ID 下标，对外以全局 ID 查询与遍历 (反向索引因此返回全局 ID)
+class ShardedNameTable : public NameTable {
+private:
+    std::unique_ptr<NameTable> inner;
+    ShardSpec shard;
+
+public:
+    ShardedNameTable(std::unique_ptr<NameTable> table, const ShardSpec& spec) : inner(std::move(table)), shard(spec) {}
+
+    const ShardSpec& spec() const { return shard; }
+
+    const NameTable& table() const { return *inner; }
+
+    bool find(uint32_t id, NameRef& out, NameScratch& scratch) const {
+        return shard.contains(id) && inner->find(shard.toLocal(id), out, scratch);
+    }
+
+    // 整批转换为局部 ID 后交给内部表 (保留其批量查询的预取)；不在分片内的 ID 转换为不存在的局部 ID
+    size_t findBatch(const uint32_t* ids, size_t count, NameRef* refs, NameScratch& scratch) const {
+        static thread_local std::vector<uint32_t> local;
+        local.resize(count);
+        for (size_t i = 0; i < count; i++) {
+            local[i] = shard.contains(ids[i]) ? shard.toLocal(ids[i]) : UINT32_MAX;
+        }
+        return inner->findBatch(local.data(), count, refs, scratch);
+    }
+
+    void scan(int part, int parts, const NameVisitor& visit) const {
+        const ShardSpec& spec = shard;
+        inner->scan(part, parts, [&](uint32_t local, const NameRef& name) { visit(spec.toGlobal(local), name); });
+    }
+
+    size_t size() const { return inner->size(); }
+
+    size_t memoryBytes() const { return inner->memoryBytes(); }
+
+    size_t rawBytes() const { return inner->rawBytes(); }
+
+    const char* kind() const { return inner->kind(); }
+
+    const LookupImage* residentImage() const { return inner->residentImage(); }
+
+    bool lockMemory(std::string& error) { return inner->lockMemory(error); }
+
+    bool replicate(const MemoryPlacement& placement, int threads, std::unique_ptr<NameTable>& copy,
+                   std::string& error) const {
+        std::unique_ptr<NameTable> innerCopy;
+        if (!inner->replicate(placement, threads, innerCopy, error)) return false;
+        copy.reset(new ShardedNameTable(std::move(innerCopy), shard));
+        return true;
+    }
+};
+
+// 分片表中的一项: 服务该分片的 convertserver 地址
+struct ShardRoute {
+    std::string address;
+    ShardSpec spec;
+};
+
+// 客户端的分片表。各项须为同一种划分 (全部 range 或全部 hash 且 n 相同)，互不重叠；
+// 未覆盖的 ID 不属于任何分片
+class ShardMap {
+private:
+    std::vector<ShardRoute> routes;
+    std::vector<uint64_t> rangeBegins;  // range: 按起点排序后的各项起点
+    std::vector<int> rangeOrder;        // range: 排序后第 i 项对应的 routes 下标
+    std::vector<int> byResidue;         // hash: id % n → routes 下标，未覆盖为 -1
+
+    bool index(std::string& error) {
+        rangeBegins.clear();
+        rangeOrder.clear();
+        byResidue.clear();
+        if (routes.empty()) {
+            error = "empty shard map";
+            return false;
+        }
+        uint32_t kind = routes[0].spec.kind;
+        for (const ShardRoute& route : routes) {
+            if (route.spec.kind != kind || (kind == SHARD_ALL && routes.size() > 1) ||
+                (kind == SHARD_HASH && route.spec.second != routes[0].spec.second)) {
+                error = "shards must all be ranges or all hash:<k>/<n> with the same n";
+                return false;
+            }
+        }
+        if (kind == SHARD_RANGE) {
+            for (size_t i = 0; i < routes.size(); i++) rangeOrder.push_back((int)i);
+            std::sort(rangeOrder.begin(), rangeOrder.end(),
+                      [&](int a, int b) { return routes[a].spec.first < routes[b].spec.first; });
+            for (size_t i = 0; i < rangeOrder.size(); i++) {
+                const ShardSpec& spec = routes[rangeOrder[i]].spec;
+                if (i > 0 && spec.first < routes[rangeOrder[i - 1]].spec.second) {
+                    error = "overlapping shards " + routes[rangeOrder[i - 1]].spec.describe() + " and " + spec.describe();
+                    return false;
+                }
+                rangeBegins.push_back(spec.first);
+            }
+        } else if (kind == SHARD_HASH) {
+            byResidue.assign(routes[0].spec.second, -1);
+            for (size_t i = 0; i < routes.size(); i++) {
+                int& slot = byResidue[routes[i].spec.first];
+                if (slot >= 0) {
+                    error = "duplicate shard " + routes[i].spec.describe();
+                    return false;
+                }
+                slot = (int)i;
+            }
+        }
+        return true;
+    }
+
+public:
+    // 单个服务端 (不分片)
+    void single(const std::string& address) {
+        routes.assign(1, ShardRoute());
+        routes[0].address = address;
+        std::string error;
+        index(error);
+    }
+
+    bool load(const std::string& path, std::string& error) {
+        std::ifstream in(path.c_str());
+        if (!in) {
+            error = "cannot open " + path;
+            return false;
+        }
+        routes.clear();
+        std::string line;
+        for (int number = 1; std::getline(in, line); number++) {
+            size_t start = line.find_first_not_of(" \t\r");
+            if (start == std::string::npos || line[start] == '#') continue;
+            size_t space = line.find_first_of(" \t", start);
+            size_t specStart = space == std::string::npos ? space : line.find_first_not_of(" \t", space);
+            if (specStart == std::string::npos) {
+                error = path + ":" + std::to_string(number) + ": expected <address> <shard>";
+                return false;
+            }
+            size_t specEnd = line.find_first_of(" \t\r", specStart);
+            ShardRoute route;
+            route.address = line.substr(start, space - start);
+            if (!route.spec.parse(line.substr(specStart, specEnd - specStart), error)) {
+                error = path + ":" + std::to_string(number) + ": " + error;
+                return false;
+            }
+            routes.push_back(route);
+        }
+        return index(error);
+    }
+
+    size_t size() const { return routes.size(); }
+
+    const ShardRoute& operator[](size_t i) const { return routes[i]; }
+
+    // ID 所在分片在表中的下标，不属于任何分片时为 -1
+    int shardOf(uint32_t id) const {
+        if (!byResidue.empty()) return byResidue[id % byResidue.size()];
+        if (rangeBegins.empty()) return 0;
+        size_t k = std::upper_bound(rangeBegins.begin(), rangeBegins.end(), (uint64_t)id) - rangeBegins.begin();
+        if (k == 0) return -1;
+        int route = rangeOrder[k - 1];
+        return routes[route].spec.contains(id) ? route : -1;
+    }
+
+    // 未被任何分片覆盖的 ID 的描述 (range 只计最后一个分片之前的空隙)，全部覆盖时为空
+    std::string gaps() const {
+        std::string text;
+        if (!byResidue.empty()) {
+            for (size_t k = 0; k < byResidue.size(); k++) {
+                if (byResidue[k] < 0) text += (text.empty() ? "hash:" : ",") + std::to_string(k);
+            }
+            return text.empty() ? text : text + "/" + std::to_string(byResidue.size());
+        }
+        uint64_t covered = 0;
+        for (int route : rangeOrder) {
+            const ShardSpec& spec = routes[route].spec;
+            if (spec.first > covered) {
+                text += (text.empty() ? "" : ",") + std::to_string(covered) + "-" + std::to_string(spec.first);
+            }
+            covered = spec.second;
+        }
+        return text;
+    }
+};
+
+#endif // CONVERTSERVER_SHARD_H
@@ -0,0 +1,187 @@
+/**
+ * m8_format_test - 验证 m8_format.h 的输出与原 iostream 格式逐字节一致
+ *
+ * 用法: ./m8_format_test [iterations]
+ *
+ * 对照基准即 convertalis-fast 原来的写法:
+ *   std::fixed << setprecision(3) / std::scientific << setprecision(2) / std::fixed << setprecision(1)
+ */
+
+#include <iostream>
+#include <sstream>
+#include <iomanip>
+#include <random>
+#include <limits>
+#include <cmath>
+#include <string>
+#include <vector>
+#include <cstring>
+#include <cstdlib>
+
+#include "../src/m8_reader.h"
+#include "../src/m8_format.h"
+
+static int failures = 0;
+
+static void expectEqual(const std::string& what, const std::string& expected, const std::string& actual) {
+    if (expected != actual && failures++ < 20) {
+        std::cerr << "[FAIL] " << what << ": expected '" << expected << "', got '" << actual << "'" << std::endl;
+    }
+}
+
+static std::string viaStream(double v, bool scientific, int precision) {
+    std::ostringstream out;
+    if (scientific) {
+        out << std::scientific << std::setprecision(precision) << v;
+    } else {
+        out << std::fixed << std::setprecision(precision) << v;
+    }
+    return out.str();
+}
+
+static std::string viaFormatter(double v, bool scientific, int precision) {
+    char buffer[m8::MAX_NUMBER_TEXT];
+    char* end = scientific ? m8::formatExp2(buffer, v) : m8::formatFixed(buffer, v, precision);
+    return std::string(buffer, end - buffer);
+}
+
+static void checkDouble(double v) {
+    expectEqual("fixed3", viaStream(v, false, 3), viaFormatter(v, false, 3));
+    expectEqual("fixed1", viaStream(v, false, 1), viaFormatter(v, false, 1));
+    expectEqual("exp2", viaStream(v, true, 2), viaFormatter(v, true, 2));
+}
+
+// 原写法输出一行
+static std::string legacyRow(const std::string& query, const std::string& target, const AlignmentColumns& rows, size_t i) {
+    std::ostringstream out;
+    out << query << "\t"
+        << target << "\t"
+        << std::fixed << std::setprecision(3) << rows.fident[i] << "\t"
+        << rows.alnlen[i] << "\t"
+        << rows.mismatch[i] << "\t"
+        << rows.gapopen[i] << "\t"
+        << rows.qstart[i] << "\t"
+        << rows.qend[i] << "\t"
+        << rows.tstart[i] << "\t"
+        << rows.tend[i] << "\t"
+        << std::scientific << std::setprecision(2) << rows.evalue[i] << "\t"
+        << std::fixed << std::setprecision(1) << rows.bits[i]
+        << "\n";
+    return out.str();
+}
+
+int main(int argc, char* argv[]) {
+    size_t iterations = argc > 1 ? strtoull(argv[1], NULL, 10) : 200000;
+    std::mt19937_64 rng(20240601);
+
+    // 1. 特殊值与舍入边界
+    const double specials[] = {
+        0.0, -0.0, 0.0005, 0.0015, 0.0625, 0.125, 0.25, 0.5, 1.5, 2.5, 0.05, 0.15, 0.95, 0.9995, 0.99949999,
+        9.995, 99.95, 999.5, 1e9, 1e15, 1e300, -1e300, 1.7976931348623157e308, 4.9e-324, 2.2250738585072014e-308,
+        1e-5, 1e-100, 9.995e-100, 9.999e-100, 1.005e-7, 123.456, -0.0004, -0.00051, 999999999.5
+    };
+    for (double v : specials) {
+        checkDouble(v);
+        checkDouble(-v);
+    }
+    checkDouble(std::numeric_limits<double>::infinity());
+    checkDouble(-std::numeric_limits<double>::infinity());
+    checkDouble(std::numeric_limits<double>::quiet_NaN());
+
+    // 2. 随机值: 常见区间、k/2^n 形式的精确二进制中点、任意位模式
+    std::uniform_real_distribution<double> unit(0.0, 1.0);
+    std::uniform_int_distribution<int> exponent(-320, 310);
+    for (size_t i = 0; i < iterations; i++) {
+        checkDouble(unit(rng));
+        checkDouble(unit(rng) * 5000.0);
+        checkDouble(unit(rng) * std::pow(10.0, exponent(rng)));
+        checkDouble((double)(rng() % 4000000) / 2048.0);
+        double bits;
+        uint64_t pattern = rng();
+        memcpy(&bits, &pattern, sizeof(bits));
+        checkDouble(bits);
+
+        int32_t n = (int32_t)rng();
+        char buffer[16];
+        expectEqual("int", std::to_string(n), std::string(buffer, m8::formatInt(buffer, n) - buffer));
+    }
+
+    // 3. 整行: 随机 M8 行分别经原写法、格式化器、透传模式输出
+    const char* fieldSamples[] = {
+        "0", "-1", "+5", " 7", "12.5", "abc", "", "2147483648", "-2147483648", "0.581", "1.000", "0.0005",
+        "2.52e-06", "1.00e+00", "0.00e+00", "-0.00e+00", "9.99e-100", "1e-400", "4.2E-05", "206.8", "-0.0",
+        "777.0", "007", "1.0e+05", "inf", "nan", "0x1A", "3.14159265358979", "1e+05", "-0.000"
+    };
+    const size_t sampleCount = sizeof(fieldSamples) / sizeof(fieldSamples[0]);
+    std::string input;
+    size_t lineCount = iterations / 10 + 1000;
+    for (size_t i = 0; i < lineCount; i++) {
+        input += "Q" + std::to_string(i) + "\t" + std::to_string(rng() % 1000000);
+        size_t fields = rng() % 12;
+        for (size_t f = 0; f < fields; f++) {
+            input += "\t";
+            switch (rng() % 4) {
+            case 0: input += fieldSamples[rng() % sampleCount]; break;
+            case 1: input += std::to_string((int)(rng() % 100000)); break;
+            case 2: input += viaStream(unit(rng) * std::pow(10.0, (int)(rng() % 40) - 30), true, 2); break;
+            default: input += viaStream(unit(rng) * 1000, false, (int)(rng() % 4)); break;
+            }
+        }
+        input += "\n";
+    }
+
+    AlignmentColumns rows;
+    parseM8(input.data(), 0, input.size(), rows);
+    OutputBuffer formatted;
+    OutputBuffer passthrough;
+    std::string legacy;
+    for (size_t i = 0; i < rows.size(); i++) {
+        std::string query(input.data() + rows.lineOffset[i], rows.queryLen[i]);
+        std::string target = "T" + std::to_string(rows.targetId[i]);
+        legacy += legacyRow(query, target, rows, i);
+        appendAlignmentRow(formatted, input.data(), rows, i, target.data(), target.size(), false);
+        appendAlignmentRow(passthrough, input.data(), rows, i, target.data(), target.size(), true);
+    }
+    expectEqual("rows", legacy, std::string(formatted.data(), formatted.size()));
+    expectEqual("passthrough rows", legacy, std::string(passthrough.data(), passthrough.size()));
+
+    // 4. 编译期特化的行写出器与逐列解释的通用写出器一致
+    std::vector<OutputColumn> defaultColumns;
+    std::vector<OutputColumn> shortColumns;
+    std::string error;
+    parseOutputFormat(DEFAULT_FORMAT_OUTPUT, defaultColumns, error);
+    parseOutputFormat("query,theader,evalue,bits,tlen,tcov,taxid", shortColumns, error);
+    OutputBuffer specialized;
+    OutputBuffer generic;
+    OutputBuffer specializedShort;
+    OutputBuffer genericShort;
+    for (size_t i = 0; i < rows.size(); i++) {
+        std::string target = "T" + std::to_string(rows.targetId[i]);
+        std::string header = target + " protein n=1";
+        std::string length = std::to_string(rows.targetId[i] % 500 + 1);
+        TargetFields fields;
+        fields.name = target.data();
+        fields.nameLen = target.size();
+        fields.header = header.data();
+        fields.headerLen = header.size();
+        fields.length = length.data();
+        fields.lengthLen = i % 7 == 0 ? 0 : length.size();
+        RowWriter<OUT_QUERY, OUT_TARGET, OUT_FIDENT, OUT_ALNLEN, OUT_MISMATCH, OUT_GAPOPEN, OUT_QSTART, OUT_QEND,
+                  OUT_TSTART, OUT_TEND, OUT_EVALUE, OUT_BITS>::append(specialized, input.data(), rows, i, fields);
+        appendFormattedRow(generic, input.data(), rows, i, defaultColumns, fields);
+        RowWriter<OUT_QUERY, OUT_THEADER, OUT_EVALUE, OUT_BITS, OUT_TLEN, OUT_TCOV, OUT_TAXID>::append(
+            specializedShort, input.data(), rows, i, fields);
+        appendFormattedRow(genericShort, input.data(), rows, i, shortColumns, fields);
+    }
+    expectEqual("specialized rows", legacy, std::string(specialized.data(), specialized.size()));
+    expectEqual("generic rows", legacy, std::string(generic.data(), generic.size()));
+    expectEqual("specialized target columns", std::string(genericShort.data(), genericShort.size()),
+                std::string(specializedShort.data(), specializedShort.size()));
+
+    if (failures > 0) {
+        std::cerr << "[ERROR] m8_format_test: " << failures << " mismatches" << std::endl;
+        return 1;
+    }
+    std::cerr << "[INFO] m8_format_test: " << iterations << " iterations, " << rows.size() << " rows, all identical" << std::endl;
+    return 0;
+}
@@ -0,0 +1,202 @@
+/**
+ * name_table_test - 验证查询表的各后端与 std::map 给出相同的查询结果
+ *
+ * 用法: ./name_table_test [slots]
+ *
+ * 随机生成名称 (含长公共前缀、完全相同的相邻名称、超过 127 字节的前缀与后缀、缺失的 ID)，分别经
+ *   dense       allocate / setLength / finalizeLayout / setName 构建，writeSnapshot 后 openSnapshot 映射
+ *   compressed  CompressedNameTable::build 前缀编码 (encodeBlock)，查询时 scanTo / assemble 解码
+ * 比较 find、findBatch (随机顺序、同块连续、越界 ID)、findBatchGrouped 与 scan 的结果。
+ */
+
+#include <iostream>
+#include <random>
+#include <map>
+#include <string>
+#include <vector>
+#include <cstdlib>
+#include <unistd.h>
+
+#include "../src/name_table.h"
+
+static int failures = 0;
+
+static void expect(bool ok, const std::string& what) {
+    if (!ok && failures++ < 20) {
+        std::cerr << "[FAIL] " << what << std::endl;
+    }
+}
+
+// 对照的结果: 不存在时为 "<missing>"
+static std::string expected(const std::map<uint32_t, std::string>& names, uint32_t id) {
+    std::map<uint32_t, std::string>::const_iterator it = names.find(id);
+    return it == names.end() ? std::string("<missing>") : it->second;
+}
+
+static std::string actual(bool found, const NameRef& ref) {
+    return found && ref.data != NULL ? std::string(ref.data, ref.len) : std::string("<missing>");
+}
+
+static void expectName(const std::string& what, const std::map<uint32_t, std::string>& names, uint32_t id,
+                       const std::string& got) {
+    std::string want = expected(names, id);
+    expect(want == got, what + " id " + std::to_string(id) + ": expected '" + want + "', got '" + got + "'");
+}
+
+// 随机名称: 多数共享少数几种前缀 (前缀编码的常见情形)，部分与上一个名称相同或只差末尾
+static std::string randomName(std::mt19937_64& rng, const std::string& previous) {
+    static const char* families[] = {"UniRef90_", "sp|P", "tr|A0A0", "MGYP000"};
+    std::string name;
+    switch (rng() % 8) {
+    case 0:
+        if (!previous.empty()) return previous;
+        // fall through
+    case 1:
+        if (!previous.empty()) return previous.substr(0, rng() % previous.size() + 1) + std::to_string(rng() % 100);
+        // fall through
+    case 2:
+        name.assign(130 + rng() % 200, 'A' + (char)(rng() % 26));  // 超过 127 字节，varint 占两字节
+        return name + std::to_string(rng() % 1000);
+    default:
+        name = families[rng() % 4];
+        for (size_t i = rng() % 20 + 1; i > 0; i--) name += (char)('0' + rng() % 43);
+        return name;
+    }
+}
+
+// 逐个 find、批量查询与遍历都与 names 一致
+static void checkTable(const std::string& what, const NameTable& table, uint64_t slots,
+                       const std::map<uint32_t, std::string>& names, std::mt19937_64& rng) {
+    NameScratch scratch;
+    expect(table.size() == names.size(), what + " size " + std::to_string(table.size()) + ", expected " +
+                                             std::to_string(names.size()));
+    for (uint32_t id = 0; id < slots + 40; id++) {
+        NameRef ref = {NULL, 0};
+        bool found = table.find(id, ref, scratch);
+        expectName(what + " find", names, id, actual(found, ref));
+        if (id % 4096 == 0) scratch.clear();
+    }
+
+    // 批量查询: 随机 ID (含越界)、同一块内递增的连续 ID、重复与倒序的 ID
+    for (int round = 0; round < 200; round++) {
+        size_t count = rng() % 3000 + 1;
+        std::vector<uint32_t> ids(count);
+        uint32_t start = (uint32_t)(rng() % (slots + 10));
+        for (size_t i = 0; i < count; i++) {
+            switch (round % 4) {
+            case 0: ids[i] = (uint32_t)(rng() % (slots + 100)); break;
+            case 1: ids[i] = start + (uint32_t)i; break;
+            case 2: ids[i] = start + (uint32_t)(rng() % 32); break;
+            default: ids[i] = i % 5 == 0 ? 0xFFFFFFFFu : (uint32_t)((start + count - i) % (slots + 1)); break;
+            }
+        }
+        std::vector<NameRef> refs(count), grouped(count);
+        scratch.clear();
+        size_t notFound = table.findBatch(ids.data(), count, refs.data(), scratch);
+        size_t groupedNotFound = findBatchGrouped(table, ids.data(), count, grouped.data(), scratch);
+        size_t missing = 0;
+        for (size_t i = 0; i < count; i++) {
+            missing += names.count(ids[i]) == 0;
+            expectName(what + " findBatch", names, ids[i], actual(true, refs[i]));
+            expectName(what + " findBatchGrouped", names, ids[i], actual(true, grouped[i]));
+        }
+        expect(notFound == missing && groupedNotFound == missing,
+               what + " findBatch not-found count " + std::to_string(notFound) + "/" +
+                   std::to_string(groupedNotFound) + ", expected " + std::to_string(missing));
+    }
+
+    for (int parts = 1; parts <= 3; parts++) {
+        std::map<uint32_t, std::string> scanned;
+        for (int part = 0; part < parts; part++) {
+            table.scan(part, parts, [&](uint32_t id, const NameRef& name) {
+                expect(scanned.count(id) == 0, what + " scan visits id " + std::to_string(id) + " twice");
+                scanned[id] = std::string(name.data, name.len);
+            });
+        }
+        expect(scanned == names, what + " scan with " + std::to_string(parts) + " parts differs");
+    }
+}
+
+int main(int argc, char* argv[]) {
+    uint64_t slots = argc > 1 ? strtoull(argv[1], NULL, 10) : 300000;
+    std::mt19937_64 rng(20240715);
+
+    // 1. 随机名称: 约 30% 的 ID 不存在，另有整块缺失的区段与末尾的 ID
+    std::map<uint32_t, std::string> names;
+    std::vector<std::string> byId(slots);
+    std::vector<bool> present(slots, false);
+    std::string previous;
+    uint64_t blobBytes = 0;
+    for (uint64_t id = 0; id < slots; id++) {
+        bool gap = (id / 16) % 97 == 5;
+        if (id + 1 != slots && (gap || rng() % 10 < 3)) continue;
+        previous = randomName(rng, previous);
+        names[(uint32_t)id] = previous;
+        byId[id] = previous;
+        present[id] = true;
+        blobBytes += previous.size();
+    }
+
+    // 2. 稠密表: 构建后写出快照，再映射快照 (校验与不校验数据两种方式) 查询
+    std::string error;
+    DenseNameTable built;
+    if (!built.allocate(slots, blobBytes, error)) {
+        std::cerr << "[ERROR] Cannot allocate dense table: " << error << std::endl;
+        return 1;
+    }
+    for (const auto& entry : names) built.setLength(entry.first, (uint32_t)entry.second.size());
+    built.finalizeLayout(4);
+    for (const auto& entry : names) built.setName(entry.first, entry.second.data(), (uint32_t)entry.second.size());
+    built.seal();
+    checkTable("dense", built, slots, names, rng);
+
+    const char* tmp = getenv("TMPDIR");
+    std::string path = std::string(tmp != NULL && *tmp != '\0' ? tmp : "/tmp") + "/name_table_test.XXXXXX";
+    std::vector<char> pathBuffer(path.begin(), path.end());
+    pathBuffer.push_back('\0');
+    int fd = mkstemp(pathBuffer.data());
+    if (fd < 0) {
+        std::cerr << "[ERROR] Cannot create temporary file " << path << std::endl;
+        return 1;
+    }
+    close(fd);
+    path = pathBuffer.data();
+    if (!built.writeSnapshot(path, error)) {
+        std::cerr << "[ERROR] Cannot write snapshot " << path << ": " << error << std::endl;
+        unlink(path.c_str());
+        return 1;
+    }
+    for (int verify = 0; verify < 2; verify++) {
+        DenseNameTable snapshot;
+        if (!snapshot.openSnapshot(path, verify != 0, error)) {
+            expect(false, "open snapshot: " + error);
+            continue;
+        }
+        checkTable(verify ? "dense snapshot (verified)" : "dense snapshot", snapshot, slots, names, rng);
+    }
+    unlink(path.c_str());
+
+    // 3. 压缩表: 以单线程与多线程构建 (块的编码分给不同线程)
+    for (int threads = 1; threads <= 4; threads += 3) {
+        CompressedNameTable compressed;
+        bool ok = compressed.build(slots, [&](uint32_t id, NameRef& out) {
+            if (!present[id]) return false;
+            out.data = byId[id].data();
+            out.len = (uint32_t)byId[id].size();
+            return true;
+        }, threads, error);
+        if (!ok) {
+            expect(false, "build compressed table: " + error);
+            continue;
+        }
+        checkTable("compressed (" + std::to_string(threads) + " threads)", compressed, slots, names, rng);
+    }
+
+    if (failures > 0) {
+        std::cerr << "[ERROR] name_table_test: " << failures << " mismatches" << std::endl;
+        return 1;
+    }
+    std::cerr << "[INFO] name_table_test: " << slots << " slots, " << names.size() << " names, all identical"
+              << std::endl;
+    return 0;
+}